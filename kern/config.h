@@ -8,20 +8,38 @@
 #define DISK_SIZE		104767488
 #define SEC_OFF			0 // the sector the file system starts at
 #define NR_PROC			64
-#define NR_FILES		64
+#define NR_FILES		128
 #define NR_FILDES		128
 #define NR_FILDES_PER_PROC	32
-#define NR_PIPES		16
+#define NR_VMAS_PER_PROC	16
+// Number of reverse mappings (user mappings of physical pages)
+#define NR_RMAPS		65536
+// Most pipes at a time (their table grows a page at a time), default,
+// smallest and largest sizes of their buffers (powers of two)
+#define NR_PIPES		1024
+#define PIPE_SIZE		65536
+#define PIPE_MIN_SIZE		4096
+#define PIPE_MAX_SIZE		(1024 * 1024)
 #define ATA_CTL			0
 #define ATA_SLAVE		0
 #define NAME_MAX_LEN		255
 #define PATH_MAX_LEN		1024
 // Round buffer size
 #define RBUF_SIZE		4096 
-#define PIPE_ATOMIC_LIMIT	(RBUF_SIZE / 2)
+#define PIPE_ATOMIC_LIMIT	PIPE_MIN_SIZE
 // Number of disk blocks in the cache
 #define NR_BLOCKS		4096
 #define MAX_DIRTY_BLOCKS	2048
+// Number of executable file pages in the page cache (and hash chains)
+#define NR_PCACHE_PAGES		1024
+#define NR_PCACHE_HASH		256
+// Swap area: raw sectors of an ATA drive (the primary slave by default)
+#define SWAP_ATA_CTL		0
+#define SWAP_ATA_SLAVE		1
+#define SWAP_SEC_OFF		0
+#define SWAP_SIZE		(64 * 1024 * 1024)
+// Number of pages the page reclaimer tries to free at once
+#define SWAP_CLUSTER		32
 #define ATA_SEL_PIO
 #define ATA_SEL_DELAY		10
 //#define ATA_CACHE_FLUSH
@@ -30,8 +48,23 @@
 #define PAGING_ZERO
 #define ENABLE_FPU
 #define CLK_FREQ		100
+// Time slices (in clock tics) at the lowest and highest static priority
+#define SCHED_MIN_SLICE		1
+#define SCHED_MAX_SLICE		20
+// Sleep time (in clock tics) giving a process the maximal priority bonus
+#define SCHED_MAX_SLEEP_AVG	CLK_FREQ
+// Time interactive processes may keep expired ones from running
+#define SCHED_STARVATION_LIMIT	(2 * CLK_FREQ)
+// Use the application processors (found in the ACPI or MP tables)
+//#define ENABLE_SMP
+#ifdef ENABLE_SMP
+#define NR_CPUS			4
+#else
+#define NR_CPUS			1
+#endif
 //#define ENABLE_NETWORK
 #define ENABLE_PIPES
+#define ENABLE_SWAP
 // A received packet is not handled if there is no free transmit descriptor
 #define RTL8139_TX_DESC_HACK
 #define IP_BUF_SIZE	0x2000
@@ -39,12 +72,43 @@
 // Max number of seconds a packet is considered valid.
 #define IP_DELAY		9
 #define IP_TTL			40
-#define NR_TCP_SOCKS		16
-#define TCP_BUF_SIZE		1460
-#define TCP_BUF_PER_SOCK	8
-#define TCP_REQ_PER_SOCK	8
+#define NR_TCP_SOCKS		1024
+// Chains of the connection, listening socket and local port hash tables,
+// range of the ports given to the sockets connecting unbound (RFC 6335)
+#define TCP_CONN_HASH_SIZE	256
+#define TCP_LISTEN_HASH_SIZE	32
+#define TCP_PORT_HASH_SIZE	64
+#define TCP_EPHEMERAL_MIN	49152
+#define TCP_EPHEMERAL_MAX	65535
+// Connections in TIME_WAIT kept after their user closed them (in records
+// smaller than a socket)
+#define NR_TCP_TIMEWAIT		4096
+// Send and receive buffers of a socket (powers of two, see SO_SNDBUF and
+// SO_RCVBUF)
+#define TCP_SNDBUF_SIZE		16384
+#define TCP_SNDBUF_MIN		4096
+#define TCP_SNDBUF_MAX		(256 * 1024)
+#define TCP_RCVBUF_SIZE		65536
+#define TCP_RCVBUF_MIN		4096
+#define TCP_RCVBUF_MAX		(256 * 1024)
+// Largest backlog of a listening socket (connections in the handshake or
+// waiting for accept); past its backlog, it answers SYNs with SYN cookies
+#define TCP_BACKLOG_MAX		128
+#define TCP_SYN_COOKIES
+// Holes the receive FIFO of a socket may have (out of order segments)
+#define TCP_OOO_PER_SOCK	8
+// Largest segment received (advertised in the MSS option), segment assumed
+// when the remote host sends no MSS option
 #define TCP_MSS			1460
+#define TCP_DEF_MSS		536
 #define TCP_SSTHRESH		20000
+// Congestion window of a new connection (in segments, RFC 5681), duplicate
+// ACKs triggering a fast retransmit, bounds of the retransmission timeout (in
+// clock tics)
+#define TCP_INIT_CWND		3
+#define TCP_DUPACK_THRESH	3
+#define TCP_RTO_MIN		(CLK_FREQ / 5)
+#define TCP_RTO_MAX		(60 * CLK_FREQ)
 // Number of retries before considering the packet lost in the network.
 #define TCP_NET_RETRY		6
 #define TCP_MAX_TRY_CNT		8
@@ -70,6 +134,9 @@
 #define DEMAND_PAGING
 #define PANIC_ON_EXC
 #define USE_CACHE
+/** Share the read-only segments of executables between processes through the
+    page cache. **/
+#define USE_PAGE_CACHE
 /** Do not write back the current FAT sector to the disk if it was not
     modified. **/
 #define USE_FAT32_LIMITED_WRITE
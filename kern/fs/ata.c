@@ -8,12 +8,19 @@
 #include <config.h>
 #include <kernel/errno.h>
 #include <kernel/io.h>
+#include <kernel/lock.h>
 #ifdef DEBUG
 #include <kernel/printk.h>
 #endif
 
 #include "ata.h"
 
+/** Drive currently selected (2 meaning none) and lock of the controllers (the
+    transfers are done by polling, with interrupts enabled). **/
+
+ui8_t ata_sel_ctl = 2, ata_sel_slave = 2;
+struct mutex ata_mutex = MUTEX_INIT;
+
 /**
  * ata_init
  */
@@ -38,6 +45,35 @@ void ata_init(ui8_t ctl)
 	inb(devctl_reg);
 }
 
+/**
+ * ata_probe
+ */
+
+bool_t ata_probe(ui8_t ctl, ui8_t slave)
+{
+	ui16_t base = (ctl == 0) ? 0x1f0 : 0x170;
+	ui8_t altstatus_reg = (ctl == 0) ? 0x3f6 : 0x376;
+	ui8_t status;
+
+	/** Select the drive and wait for the selection to complete. **/
+
+	outb(base + 6, 0xe0 | slave << 4);
+
+	inb(altstatus_reg);
+	inb(altstatus_reg);
+	inb(altstatus_reg);
+	inb(altstatus_reg);
+
+	ata_sel_ctl = ctl;
+	ata_sel_slave = slave;
+
+	/** A missing drive reads as 0 (or 0xff if the bus is floating). **/
+
+	status = inb(base + 7);
+
+	return status != 0x00 && status != 0xff;
+}
+
 /**
  * ata_read_write
  */
@@ -48,7 +84,25 @@ ret_t ata_read_write(ui8_t ctl,
                      ui32_t lba,
                      bool_t write)
 {
-	static ui8_t prev_ctl = 2, prev_slave = 2;
+	ret_t ret;
+
+	mutex_lock(&ata_mutex);
+	ret = ata_transfer(ctl, slave, buf, lba, write);
+	mutex_unlock(&ata_mutex);
+
+	return ret;
+}
+
+/**
+ * ata_transfer
+ */
+
+ret_t ata_transfer(ui8_t ctl,
+                   ui8_t slave,
+                   void *buf,
+                   ui32_t lba,
+                   bool_t write)
+{
 	ui16_t base = (ctl == 0) ? 0x1f0 : 0x170;
 	#ifdef ATA_CACHE_FLUSH
 	ui8_t altstatus_reg = (ctl == 0) ? 0x3f6 : 0x376;
@@ -61,7 +115,7 @@ ret_t ata_read_write(ui8_t ctl,
 	printk("ata i/o operation\n");
 	#endif
 
-	if(prev_ctl != ctl || prev_slave != slave)
+	if(ata_sel_ctl != ctl || ata_sel_slave != slave)
 	{
 		/** Select the drive and give the 4 highest bits of the LBA. **/
 
@@ -78,8 +132,8 @@ ret_t ata_read_write(ui8_t ctl,
 		delay(ATA_SEL_DELAY);
 		#endif
 
-		prev_ctl = ctl;
-		prev_slave = slave;
+		ata_sel_ctl = ctl;
+		ata_sel_slave = slave;
 	}
 
 	/** Number of sectors to read/write: 1. **/
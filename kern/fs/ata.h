@@ -24,10 +24,18 @@
 
 void ata_init(ui8_t ctl);
 /****************************************************************/
+bool_t ata_probe(ui8_t ctl, ui8_t slave);
+/****************************************************************/
 ret_t ata_read_write(ui8_t ctl,
                      ui8_t slave,
                      void *buf,
                      ui32_t lba,
                      bool_t write);
+/****************************************************************/
+ret_t ata_transfer(ui8_t ctl,
+                   ui8_t slave,
+                   void *buf,
+                   ui32_t lba,
+                   bool_t write);
 
 #endif
@@ -9,6 +9,7 @@
 #include <fs/ata.h>
 #include <kernel/errno.h>
 #include <kernel/libc.h>
+#include <kernel/lock.h>
 #include <kernel/panic.h>
 #include <kernel/printk.h> // debug
 #include <mm/paging.h>
@@ -18,6 +19,7 @@
 struct block *block_tab = (void*)CACHE_MEMORY_BASE;
 struct block *first_dirty = 0;
 count_t dirty = 0;
+struct mutex cache_mutex = MUTEX_INIT;
 
 /**
  * cache_init
@@ -62,6 +64,8 @@ ret_t cache_read(ui32_t n, void *buf)
 	ui32_t hash = n % NR_BLOCKS;
 	struct block *block = &block_tab[hash];
 
+	mutex_lock(&cache_mutex);
+
 	/** Add the block to the cache if it is not already in the cache. **/
 
 	#ifdef DEBUG
@@ -81,6 +85,7 @@ ret_t cache_read(ui32_t n, void *buf)
 
 			if(cache_sync_block(block) != OK)
 			{
+				mutex_unlock(&cache_mutex);
 				return -EIO;
 			}
 		}
@@ -92,6 +97,7 @@ ret_t cache_read(ui32_t n, void *buf)
 
 		if(ata_read_write(ATA_CTL, ATA_SLAVE, block->buf, n, 0) != OK)
 		{
+			mutex_unlock(&cache_mutex);
 			return -EIO;
 		}
 
@@ -109,6 +115,8 @@ ret_t cache_read(ui32_t n, void *buf)
 
 	memcpy(buf, block->buf, 512);
 
+	mutex_unlock(&cache_mutex);
+
 	return OK;
 }
 
@@ -124,6 +132,7 @@ ret_t cache_write(ui32_t n, void *buf)
 	    syncing). **/
 	struct block *last_dirty;
 
+	mutex_lock(&cache_mutex);
 
 	/** Add the block to the cache if it is not already in the cache. **/
 
@@ -144,6 +153,7 @@ ret_t cache_write(ui32_t n, void *buf)
 
 			if(cache_sync_block(block) != OK)
 			{
+				mutex_unlock(&cache_mutex);
 				return -EIO;
 			}
 		}
@@ -197,16 +207,20 @@ ret_t cache_write(ui32_t n, void *buf)
 		#ifdef CACHE_SYNC_WHEN_FULL
 		if(cache_sync() != OK)
 		{
+			mutex_unlock(&cache_mutex);
 			return -EIO;
 		}
 		#else
 		if(cache_sync_block(first_dirty) != OK)
 		{
+			mutex_unlock(&cache_mutex);
 			return -EIO;
 		}
 		#endif
 	}
 
+	mutex_unlock(&cache_mutex);
+
 	return OK;
 }
 
@@ -283,6 +297,8 @@ ret_t cache_sync()
 	struct block *block;
 	ui32_t i;
 
+	mutex_lock(&cache_mutex);
+
 	/** Synchronize each block. **/
 
 	for(i = 0; i < NR_BLOCKS; i++)
@@ -293,10 +309,13 @@ ret_t cache_sync()
 		{
 			if(cache_sync_block(block) != OK)
 			{
+				mutex_unlock(&cache_mutex);
 				return -EIO;
 			}
 		}
 	}
 
+	mutex_unlock(&cache_mutex);
+
 	return OK;
 }
@@ -11,6 +11,9 @@
 #include <kernel/errno.h>
 #include <kernel/libc.h>
 #include <kernel/panic.h>
+#ifdef USE_PAGE_CACHE
+#include <mm/pcache.h>
+#endif
 
 #include <fs/ext2.h>
 
@@ -661,6 +664,15 @@ ssize_t ext2_read_write(ui32_t inum,
 	struct ext2_block_info binfo;
 	ui32_t file_size;
 
+	/** Cached pages of the file become stale when it is written. **/
+
+	#ifdef USE_PAGE_CACHE
+	if(write)
+	{
+		pcache_invalidate(inum);
+	}
+	#endif
+
 	/** Fetch the inode structure. **/
 
 	if(ext2_read_inode(inum, &inode) != OK)
@@ -1001,6 +1013,10 @@ ret_t ext2_truncate(struct ext2_file *file, off_t len)
 		return -EINVAL;
 	}
 
+	#ifdef USE_PAGE_CACHE
+	pcache_invalidate(file->inum);
+	#endif
+
 	file_size = file->inode.i_size_low;
 
 	while(file_size > len)
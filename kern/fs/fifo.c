@@ -6,68 +6,43 @@
  ****************************************************************/
 
 #include <kernel/errno.h>
-#include <kernel/int.h>
 #include <kernel/libc.h>
+#include <kernel/lock.h>
 #include <kernel/panic.h>
+#include <kernel/wait.h>
+#include <mm/paging.h>
 
 #include "fifo.h"
 
-/** WARNING: Interrupts must be disabled when calling these functions. **/
-
 /**
- * fifo_read_byte
+ * fifo_init
  */
 
-ret_t fifo_read_byte(struct fifo *fifo, ui8_t *byte, bool_t block)
+void fifo_init(struct fifo *fifo, ui8_t *rbuf, size_t size)
 {
-	if(!fifo->to_read)
+	if(size & (size - 1))
 	{
-		if(block)
-		{
-			/** If we can block, wait until the buffer contains at
-			    least one byte. **/
-
-			while(1)
-			{
-				sti;
-				yield;
-				//delay(FIFO_DELAY);
-				cli;
-
-				if(fifo->to_read)
-				{
-					break;
-				}
-			}
-		}
-		else
-		{
-			/** Else return an error to indicate that no byte could
-			    be read. **/
-
-			return -1; // FIXME: Use a constant defined in errno.h.
-		}
+		panic("fifo size %x is not a power of two", size);
 	}
 
-	/** Read first byte. **/
-
-	*byte = fifo->rbuf[fifo->read];
-
-	/** Update the read cursor and the number of bytes to read. **/
+	fifo->head = fifo->tail = 0;
+	fifo->size = size;
+	fifo->rbuf = rbuf;
+	memset(&fifo->wq, 0, sizeof(struct wait_queue));
+	spin_init(&fifo->lock);
+}
 
-	fifo->read++;
+/**
+ * fifo_read_byte
+ */
 
-	if(fifo->read == RBUF_SIZE)
-	{
-		fifo->read = 0;
-	}
-	else if(fifo->read > RBUF_SIZE)
+ret_t fifo_read_byte(struct fifo *fifo, ui8_t *byte, bool_t block)
+{
+	if(fifo_read(fifo, byte, 1, block) != 1)
 	{
-		panic("fifo read cursor is %x", fifo->read);
+		return -1; // FIXME: Use a constant defined in errno.h.
 	}
 
-	fifo->to_read--;
-
 	return OK;
 }
 
@@ -79,17 +54,49 @@ ret_t fifo_read_byte(struct fifo *fifo, ui8_t *byte, bool_t block)
 
 size_t fifo_read(struct fifo *fifo, void *buf, size_t size, bool_t block)
 {
-	size_t i;
+	size_t read = 0, n;
+	void *data;
+	ui32_t flags;
+
+	/** If we can block, wait until the buffer contains at least one
+	    byte. **/
 
-	for(i = 0; i < size; i++)
+	if(block && !fifo_count(fifo))
 	{
-		if(fifo_read_byte(fifo, buf + i, block && !i) != OK)
+		flags = spin_lock_irqsave(&fifo->lock);
+
+		while(!fifo_count(fifo))
 		{
-			break;
+			wait_sleep_lock(&fifo->wq, &fifo->lock);
 		}
+
+		spin_unlock_irqrestore(&fifo->lock, flags);
 	}
 
-	return i;
+	/** Copy the end of the ring, then its beginning if the data wraps
+	    around. **/
+
+	while(read < size && (n = fifo_peek(fifo, &data)))
+	{
+		if(n > size - read)
+		{
+			n = size - read;
+		}
+
+		/** If faulting a user buffer in slept, look the bytes up
+		    again. **/
+
+		if(paging_fault_in(buf + read, n, 1))
+		{
+			continue;
+		}
+
+		memcpy(buf + read, data, n);
+		fifo_consume(fifo, n);
+		read += n;
+	}
+
+	return read;
 }
 
 /**
@@ -98,109 +105,286 @@ size_t fifo_read(struct fifo *fifo, void *buf, size_t size, bool_t block)
 
 ret_t fifo_write_byte(struct fifo *fifo, ui8_t byte, bool_t block)
 {
-	if(fifo->to_read == RBUF_SIZE)
+	if(fifo_write(fifo, &byte, 1, block) != 1)
 	{
-		if(block)
+		return -EWOULDBLOCK;
+	}
+
+	return OK;
+}
+
+/**
+ * fifo_write
+ *
+ *   Returns the number of bytes written: all of them if the writer can block,
+ *   else as many as there is room for.
+ */
+
+size_t fifo_write(struct fifo *fifo, void *buf, size_t size, bool_t block)
+{
+	size_t written = 0, n;
+	void *data;
+	ui32_t flags;
+
+	while(1)
+	{
+		/** Copy the bytes to the end of the ring, then to its
+		    beginning. **/
+
+		while(written < size && (n = fifo_reserve(fifo, &data)))
 		{
-			/** If we can block, wait until we can write to the
-			    buffer without overriding its content. **/
+			if(n > size - written)
+			{
+				n = size - written;
+			}
 
-			while(1)
+			/** If faulting a user buffer in slept, look the room
+			    up again. **/
+
+			if(paging_fault_in(buf + written, n, 0))
 			{
-				sti;
-				yield;
-				//delay(FIFO_DELAY);
-				cli;
-
-				if(fifo->to_read < RBUF_SIZE)
-				{
-					break;
-				}
+				continue;
 			}
+
+			memcpy(data, buf + written, n);
+			fifo_commit(fifo, n);
+			written += n;
 		}
-		else
+
+		if(written == size || !block)
 		{
-			/** Else return an error code to indicate that the byte
-			    could not be written. **/
+			break;
+		}
 
-			return -EWOULDBLOCK;
+		/** Wait until a reader makes room. **/
+
+		flags = spin_lock_irqsave(&fifo->lock);
+
+		while(fifo_count(fifo) == fifo->size)
+		{
+			wait_sleep_lock(&fifo->wq, &fifo->lock);
 		}
+
+		spin_unlock_irqrestore(&fifo->lock, flags);
+	}
+
+	return written;
+}
+
+/**
+ * fifo_peek
+ *
+ *   Returns the number of bytes that can be read in a row and where they are.
+ *   The reader takes them with fifo_consume.
+ */
+
+size_t fifo_peek(struct fifo *fifo, void **data)
+{
+	ui32_t head, tail, off;
+	size_t count;
+
+	/** The bytes below head are written before head is moved. **/
+
+	head = fifo->head;
+	barrier();
+	tail = fifo->tail;
+
+	count = head - tail;
+
+	if(count > fifo->size)
+	{
+		panic("fifo holds %x bytes", count);
 	}
 
-	/** Write the byte. **/
+	off = tail & (fifo->size - 1);
+	*data = &fifo->rbuf[off];
+
+	return (count < fifo->size - off) ? count : fifo->size - off;
+}
+
+/**
+ * fifo_consume
+ */
+
+void fifo_consume(struct fifo *fifo, size_t size)
+{
+	/** Give the room back once the bytes are copied, then wake up the
+	    writers waiting for it. **/
 
-	fifo->rbuf[fifo->write] = byte;
+	barrier();
+	fifo->tail += size;
+
+	wait_wake(&fifo->wq);
+}
 
-	/** Update the write cursor and the number of bytes to read. **/
+/**
+ * fifo_reserve
+ *
+ *   Returns the room that can be written in a row and where it is. The writer
+ *   publishes the bytes with fifo_commit.
+ */
+
+size_t fifo_reserve(struct fifo *fifo, void **data)
+{
+	ui32_t head, tail, off;
+	size_t room;
 
-	fifo->write++;
+	tail = fifo->tail;
+	barrier();
+	head = fifo->head;
 
-	if(fifo->write == RBUF_SIZE)
+	room = fifo->size - (head - tail);
+	off = head & (fifo->size - 1);
+	*data = &fifo->rbuf[off];
+
+	return (room < fifo->size - off) ? room : fifo->size - off;
+}
+
+/**
+ * fifo_commit
+ */
+
+void fifo_commit(struct fifo *fifo, size_t size)
+{
+	/** Publish the bytes once they are copied, then wake up the readers
+	    waiting for them. **/
+
+	barrier();
+	fifo->head += size;
+
+	wait_wake(&fifo->wq);
+}
+
+/**
+ * fifo_read_at
+ *
+ *   Copies bytes off bytes past the beginning of the data, without consuming
+ *   them. Returns the number of bytes copied, which the data limits.
+ */
+
+size_t fifo_read_at(struct fifo *fifo, size_t off, void *buf, size_t size)
+{
+	size_t count = fifo_count(fifo), done = 0, n;
+	ui32_t pos;
+
+	if(off >= count)
 	{
-		fifo->write = 0;
+		return 0;
 	}
-	else if(fifo->write > RBUF_SIZE)
+
+	if(size > count - off)
 	{
-		panic("fifo write cursor is %x", fifo->write);
+		size = count - off;
 	}
 
-	fifo->to_read++;
+	while(done < size)
+	{
+		pos = (fifo->tail + off + done) & (fifo->size - 1);
+		n = min(size - done, fifo->size - pos);
+		memcpy(buf + done, &fifo->rbuf[pos], n);
+		done += n;
+	}
 
-	return OK;
+	return size;
 }
 
 /**
- * fifo_write
+ * fifo_peek_at
+ *
+ *   Returns the number of bytes that can be read in a row off bytes past the
+ *   beginning of the data, and where they are, without consuming them.
  */
 
-ret_t fifo_write(struct fifo *fifo, void *buf, size_t size, bool_t block)
+size_t fifo_peek_at(struct fifo *fifo, size_t off, void **data)
 {
-	size_t i;
-	ret_t ret;
+	size_t count = fifo_count(fifo);
+	ui32_t pos;
 
-	for(i = 0; i < size; i++)
+	if(off >= count)
 	{
-		ret = fifo_write_byte(fifo, *(ui8_t*)(buf + i), block);
+		return 0;
+	}
 
-		if(ret != OK)
-		{
-			break;
-		}
+	pos = (fifo->tail + off) & (fifo->size - 1);
+	*data = &fifo->rbuf[pos];
+
+	return min(count - off, fifo->size - pos);
+}
+
+/**
+ * fifo_write_at
+ *
+ *   Copies bytes off bytes past the end of the data, without publishing them:
+ *   the writer commits them once the bytes before are written too. Returns the
+ *   number of bytes copied, which the room left limits.
+ */
+
+size_t fifo_write_at(struct fifo *fifo, size_t off, void *buf, size_t size)
+{
+	size_t room = fifo_left(fifo), done = 0, n;
+	ui32_t pos;
+
+	if(off >= room)
+	{
+		return 0;
 	}
 
-	return ret;
+	if(size > room - off)
+	{
+		size = room - off;
+	}
+
+	while(done < size)
+	{
+		pos = (fifo->head + off + done) & (fifo->size - 1);
+		n = min(size - done, fifo->size - pos);
+		memcpy(&fifo->rbuf[pos], buf + done, n);
+		done += n;
+	}
+
+	return size;
+}
+
+/**
+ * fifo_last
+ *
+ *   Returns the last byte written (the fifo must not be empty).
+ */
+
+ui8_t fifo_last(struct fifo *fifo)
+{
+	return fifo->rbuf[(fifo->head - 1) & (fifo->size - 1)];
 }
 
 /**
  * fifo_pop_last
+ *
+ *   Takes back the last byte written. The writer calls it, with the reader
+ *   kept away (see tty_lock).
  */
 
 void fifo_pop_last(struct fifo *fifo)
 {
-	if(fifo->to_read)
+	if(fifo_count(fifo))
 	{
-		/*if(fifo->write)
-		{
-			fifo->write--;
-		}
-		else
-		{
-			fifo->write = RBUF_SIZE - 1;
-		}*/
-
-		fifo->write = (fifo->write + RBUF_SIZE - 1) % RBUF_SIZE;
-		fifo->to_read--;
+		fifo->head--;
+		wait_wake(&fifo->wq);
 	}
 }
 
 /**
  * fifo_flush
+ *
+ *   Neither end may be using the fifo.
  */
 
 void fifo_flush(struct fifo *fifo)
 {
-	fifo->read = fifo->write = 0;
-	fifo->to_read = 0;
+	ui32_t flags = spin_lock_irqsave(&fifo->lock);
+
+	fifo->head = fifo->tail = 0;
+	wait_wake(&fifo->wq);
+	spin_unlock_irqrestore(&fifo->lock, flags);
 }
 
 /**
@@ -209,5 +393,5 @@ void fifo_flush(struct fifo *fifo)
 
 count_t fifo_left(struct fifo *fifo)
 {
-	return RBUF_SIZE - fifo->to_read;
+	return fifo->size - fifo_count(fifo);
 }
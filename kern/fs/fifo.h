@@ -2,35 +2,62 @@
 #define _FIFO_H_
 
 #include <config.h>
+#include <kernel/lock.h>
 #include <kernel/types.h>
+#include <kernel/wait.h>
 
-/** FIFO and pipe structures. **/
+/** FIFO: a ring of size bytes (a power of two) at rbuf. head and tail count
+    the bytes written and read since the last flush: the writer only moves
+    head and the reader only moves tail, so that one writer and one reader
+    need no lock. The lock is only taken to sleep until the other end
+    moves. A process never sleeps between fifo_reserve and fifo_commit, or
+    between fifo_peek and fifo_consume: fifo_read and fifo_write fault user
+    buffers in before copying. Processes sharing a fifo and pipe_resize
+    rely on it. **/
+
+#if RBUF_SIZE & (RBUF_SIZE - 1)
+#error "RBUF_SIZE must be a power of two"
+#endif
 
 struct fifo
 {
-	off_t read;
-	off_t write;
-	ui8_t rbuf[RBUF_SIZE];
-	count_t to_read;
+	volatile ui32_t head;
+	volatile ui32_t tail;
+	ui32_t size;
+	ui8_t *rbuf;
+	struct wait_queue wq; // readers and writers waiting for the fifo
+	struct spinlock lock;
 };
 
-struct pipe
-{
-	bool_t used;
-	count_t readers;
-	count_t writers;
-	struct fifo fifo;
-};
+#define fifo_count(fifo)	((fifo)->head - (fifo)->tail)
 
 /** Functions. **/
 
+void fifo_init(struct fifo *fifo, ui8_t *rbuf, size_t size);
+/****************************************************************/
 ret_t fifo_read_byte(struct fifo *fifo, ui8_t *byte, bool_t block);
 /****************************************************************/
 size_t fifo_read(struct fifo *fifo, void *buf, size_t size, bool_t block);
 /****************************************************************/
 ret_t fifo_write_byte(struct fifo *fifo, ui8_t byte, bool_t block);
 /****************************************************************/
-ret_t fifo_write(struct fifo *fifo, void *buf, size_t size, bool_t block);
+size_t fifo_write(struct fifo *fifo, void *buf, size_t size, bool_t block);
+/****************************************************************/
+size_t fifo_peek(struct fifo *fifo, void **data);
+/****************************************************************/
+void fifo_consume(struct fifo *fifo, size_t size);
+/****************************************************************/
+size_t fifo_reserve(struct fifo *fifo, void **data);
+/****************************************************************/
+void fifo_commit(struct fifo *fifo, size_t size);
+/****************************************************************/
+size_t fifo_read_at(struct fifo *fifo, size_t off, void *buf, size_t size);
+/****************************************************************/
+size_t fifo_peek_at(struct fifo *fifo, size_t off, void **data);
+/****************************************************************/
+size_t fifo_write_at(struct fifo *fifo, size_t off, void *buf, size_t size);
+/****************************************************************/
+ui8_t fifo_last(struct fifo *fifo);
 /****************************************************************/
 void fifo_pop_last(struct fifo *fifo);
 /****************************************************************/
@@ -29,6 +29,8 @@ ino_t file_alloc()
 	ino_t inum;
 	struct file *file;
 
+	mutex_lock(&file_mutex);
+
 	for(inum = 1; inum <= NR_FILES; inum++)
 	{
 		file = &file_tab[inum - 1];
@@ -47,11 +49,14 @@ ino_t file_alloc()
 
 			file->fs = FS_NOFS;
 			file->used = 1;
+			mutex_unlock(&file_mutex);
 
 			return inum;
 		}
 	}
 
+	mutex_unlock(&file_mutex);
+
 	return 0;
 }
 
@@ -75,7 +80,9 @@ void file_ref(ino_t inum)
 	       inum, file_tab[inum - 1].ref_cnt);
 	#endif
 
+	mutex_lock(&file_mutex);
 	file_tab[inum - 1].ref_cnt++;
+	mutex_unlock(&file_mutex);
 }
 
 /**
@@ -95,6 +102,7 @@ void file_unref(ino_t inum)
 		panic("trying to unreference a free file (inum: %x)", inum);
 	}
 
+	mutex_lock(&file_mutex);
 	file->ref_cnt--;
 
 	if(!file->ref_cnt)
@@ -102,23 +110,28 @@ void file_unref(ino_t inum)
 		#ifdef ENABLE_PIPES
 		if(file->fs == FS_PIPEFS)
 		{
-			pipe_tab[file->data.pipe_id].used = 0;
+			pipe_free(file->data.pipe_id);
 		}
 		#endif
 		#ifdef ENABLE_NETWORK
 		if(file->fs == FS_TCPSOCKFS)
 		{
 			struct tcp_socket *tcp_sock
-			= &tcp_sock_tab[file->data.tcp_sock_id];
+			= tcp_sock_get(file->data.tcp_sock_id);
+			ui32_t flags = spin_lock_irqsave(&tcp_lock);
 
 			tcp_sock->close_req = 1;
+			tcp_output(tcp_sock);
 			tcp_socket_free(file->data.tcp_sock_id);
+			spin_unlock_irqrestore(&tcp_lock, flags);
 		}
 		#endif
 
 		file->used = 0;
 	}
 
+	mutex_unlock(&file_mutex);
+
 	#ifdef DEBUG
 	printk("unref file %x (old ref count: %x)\n", inum, file->ref_cnt + 1);
 
@@ -231,6 +244,8 @@ si32_t fildes_alloc(si32_t min_fildes)
 
 	if(fildes < NR_FILDES_PER_PROC)
 	{
+		mutex_lock(&file_mutex);
+
 		for(abs_fildes = 0; abs_fildes < NR_FILDES; abs_fildes++)
 		{
 			fd = &fildes_tab[abs_fildes];
@@ -242,10 +257,13 @@ si32_t fildes_alloc(si32_t min_fildes)
 				fd->off = 0;
 				fd->inum = 0;
 				current->pfildes_tab[fildes] = fd;
+				mutex_unlock(&file_mutex);
 
 				return fildes;
 			}
 		}
+
+		mutex_unlock(&file_mutex);
 	}
 
 	return -1;
@@ -276,10 +294,12 @@ void fildes_ref(si32_t fildes)
 		panic("referencing file descriptor bound to no file");
 	}
 
+	mutex_lock(&file_mutex);
+
 	#ifdef ENABLE_PIPES
 	if(file->fs == FS_PIPEFS)
 	{
-		struct pipe *pipe = &pipe_tab[file->data.pipe_id];
+		struct pipe *pipe = pipe_get(file->data.pipe_id);
 
 		if(current->fildes_flags[fildes] & O_WRONLY)
 		{
@@ -307,6 +327,7 @@ void fildes_ref(si32_t fildes)
 
 	file_ref(fd->inum);
 	fd->ref_cnt++;
+	mutex_unlock(&file_mutex);
 }
 
 /**
@@ -329,12 +350,14 @@ void fildes_unref(si32_t fildes)
 	printk("fildes_unref unreferences inode %x\n", fd->inum);
 	#endif
 
+	mutex_lock(&file_mutex);
+
 	if(file)
 	{
 		#ifdef ENABLE_PIPES
 		if(file->fs == FS_PIPEFS)
 		{
-			struct pipe *pipe = &pipe_tab[file->data.pipe_id];
+			struct pipe *pipe = pipe_get(file->data.pipe_id);
 
 			if(current->fildes_flags[fildes] & O_WRONLY)
 			{
@@ -355,6 +378,10 @@ void fildes_unref(si32_t fildes)
 				pipe->readers--;
 			}
 
+			/** The other end may be waiting for this one. **/
+
+			wait_wake(&pipe->fifo.wq);
+
 			/*printk("(unref) pipe (readers, writers) = (%x, %x)\n",
 			       pipe->readers, pipe->writers);*/
 		}
@@ -376,6 +403,8 @@ void fildes_unref(si32_t fildes)
 	{
 		fd->used = 0;
 	}
+
+	mutex_unlock(&file_mutex);
 }
 
 /**
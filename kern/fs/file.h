@@ -4,6 +4,8 @@
 #include <config.h>
 #include <fs/ext2.h>
 #include <fs/fifo.h>
+#include <fs/pipe.h>
+#include <kernel/lock.h>
 #include <kernel/types.h>
 #include <net/tcp.h>
 
@@ -155,6 +157,12 @@ struct sockaddr_in
 #define F_GETFL	3
 #define F_SETFL	4
 #define F_SETLK	8
+#define F_SETPIPE_SZ	1031 // as defined in Linux
+#define F_GETPIPE_SZ	1032
+
+/** splice flags (as defined in Linux). **/
+
+#define SPLICE_F_NONBLOCK	0x02
 
 /** Flag for command SETFD. **/
 
@@ -174,7 +182,7 @@ struct sockaddr_in
 
 #define PF_INET	AF_INET
 
-/** Global file table. **/
+/** Global file and file descriptor tables, and their lock. **/
 
 #ifdef _FILE_C_
 struct file file_tab[NR_FILES] = {
@@ -205,11 +213,12 @@ struct fildes fildes_tab[NR_FILDES] = {
 		.used = 0
 	}
 };
+struct mutex file_mutex = MUTEX_INIT;
 #else
 extern struct file file_tab[];
 extern struct fildes fildes_tab[];
+extern struct mutex file_mutex;
 #endif
-extern struct pipe pipe_tab[];
 
 /** Functions. **/
 
@@ -0,0 +1,169 @@
+/****************************************************************
+ * pipe.c                                                       *
+ *                                                              *
+ *    Pipe table and buffers.                                   *
+ *                                                              *
+ ****************************************************************/
+
+#define _PIPE_C_
+#include <config.h>
+#include <kernel/errno.h>
+#include <kernel/libc.h>
+#include <kernel/panic.h>
+#include <mm/paging.h>
+
+#include "pipe.h"
+
+/**
+ * pipe_alloc
+ *
+ *   Returns the number of a new pipe, with a buffer of PIPE_SIZE bytes and
+ *   neither readers nor writers, or an error.
+ */
+
+si32_t pipe_alloc()
+{
+	struct pheap_page page;
+	struct pipe *pipe;
+	si32_t pipe_id;
+	ui32_t vpage;
+
+	mutex_lock(&pipe_mutex);
+
+	for(pipe_id = 0; pipe_id < nr_pipes; pipe_id++)
+	{
+		if(!pipe_get(pipe_id)->used)
+		{
+			break;
+		}
+	}
+
+	/** All the pipes are used: add a page to the table. **/
+
+	if(pipe_id == nr_pipes)
+	{
+		if(nr_pipes >= NR_PIPES)
+		{
+			mutex_unlock(&pipe_mutex);
+			return -ENFILE;
+		}
+
+		page = paging_valloc(1);
+
+		if(!page.vpage)
+		{
+			mutex_unlock(&pipe_mutex);
+			return -ENOMEM;
+		}
+
+		memset((void*)(page.vpage << 12), 0, 4096);
+		pipe_page_tab[nr_pipes / PIPES_PER_PAGE]
+		 = (void*)(page.vpage << 12);
+		nr_pipes += PIPES_PER_PAGE;
+	}
+
+	/** Allocate its buffer. **/
+
+	vpage = paging_valloc_range(PIPE_SIZE >> 12);
+
+	if(!vpage)
+	{
+		mutex_unlock(&pipe_mutex);
+		return -ENOMEM;
+	}
+
+	pipe = pipe_get(pipe_id);
+	pipe->used = 1;
+	pipe->readers = pipe->writers = 0;
+	fifo_init(&pipe->fifo, (void*)(vpage << 12), PIPE_SIZE);
+	mutex_unlock(&pipe_mutex);
+
+	return pipe_id;
+}
+
+/**
+ * pipe_free
+ */
+
+void pipe_free(si32_t pipe_id)
+{
+	struct pipe *pipe = pipe_get(pipe_id);
+
+	mutex_lock(&pipe_mutex);
+
+	if(!pipe->used)
+	{
+		panic("pipe %x already freed", pipe_id);
+	}
+
+	paging_vfree_range((ui32_t)pipe->fifo.rbuf >> 12,
+	                   pipe->fifo.size >> 12);
+	pipe->used = 0;
+	mutex_unlock(&pipe_mutex);
+}
+
+/**
+ * pipe_resize
+ *
+ *   Moves the bytes of the pipe to a buffer of at least size bytes (rounded
+ *   up to a power of two). Processes sleeping on the pipe keep sleeping on it.
+ */
+
+ret_t pipe_resize(struct pipe *pipe, size_t size)
+{
+	struct fifo *fifo = &pipe->fifo;
+	size_t new_size = PIPE_MIN_SIZE, count;
+	ui8_t *rbuf;
+	ui32_t vpage;
+
+	if(size > PIPE_MAX_SIZE)
+	{
+		return -EINVAL;
+	}
+
+	while(new_size < size)
+	{
+		new_size <<= 1;
+	}
+
+	if(new_size == fifo->size)
+	{
+		return OK;
+	}
+
+	count = fifo_count(fifo);
+
+	if(count > new_size)
+	{
+		return -EBUSY;
+	}
+
+	vpage = paging_valloc_range(new_size >> 12);
+
+	if(!vpage)
+	{
+		return -ENOMEM;
+	}
+
+	/** Nobody uses the buffer while it is moved: pipes are only used by
+	    processes, which do not sleep in the middle of a copy. **/
+
+	rbuf = (void*)(vpage << 12);
+
+	if(fifo_read(fifo, rbuf, count, 0) != count)
+	{
+		panic("pipe corrupted");
+	}
+
+	paging_vfree_range((ui32_t)fifo->rbuf >> 12, fifo->size >> 12);
+
+	fifo->rbuf = rbuf;
+	fifo->size = new_size;
+	fifo->tail = 0;
+	barrier();
+	fifo->head = count;
+
+	wait_wake(&fifo->wq);
+
+	return OK;
+}
@@ -0,0 +1,50 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+#include <config.h>
+#include <fs/fifo.h>
+#include <kernel/lock.h>
+#include <kernel/types.h>
+
+/** Pipe: its buffer is a fifo of pages of the page heap. **/
+
+struct pipe
+{
+	bool_t used;
+	count_t readers;
+	count_t writers;
+	struct fifo fifo;
+};
+
+/** The pipe table is made of pages of pipes, allocated when all the pipes
+    are used. **/
+
+#define PIPES_PER_PAGE		(4096 / sizeof(struct pipe))
+#define NR_PIPE_PAGES		((NR_PIPES + PIPES_PER_PAGE - 1) \
+                                 / PIPES_PER_PAGE)
+
+#define pipe_get(pipe_id)	(&pipe_page_tab[(pipe_id) / PIPES_PER_PAGE] \
+                                               [(pipe_id) % PIPES_PER_PAGE])
+
+/** Global variables (pages of the pipe table, number of pipes they hold,
+    lock of the table). **/
+
+#ifdef _PIPE_C_
+struct pipe *pipe_page_tab[NR_PIPE_PAGES] = { 0 };
+count_t nr_pipes = 0;
+struct mutex pipe_mutex = MUTEX_INIT;
+#else
+extern struct pipe *pipe_page_tab[];
+extern count_t nr_pipes;
+extern struct mutex pipe_mutex;
+#endif
+
+/** Functions **/
+
+si32_t pipe_alloc();
+/****************************************************************/
+void pipe_free(si32_t pipe_id);
+/****************************************************************/
+ret_t pipe_resize(struct pipe *pipe, size_t size);
+
+#endif
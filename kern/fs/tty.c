@@ -13,8 +13,10 @@
 #include <kernel/libc.h>
 #include <kernel/panic.h>
 #include <kernel/process.h>
+#include <kernel/schedule.h>
 #include <kernel/screen.h>
 #include <kernel/signal.h>
+#include <kernel/wait.h>
 
 #include "tty.h"
 
@@ -27,36 +29,29 @@ ssize_t tty_read(uchar_t *buf, size_t size)
 	uchar_t c;
 	size_t i = 0;
 	ssize_t read_bytes = 0;
+	bool_t waited = 0;
+	ui32_t flags;
 
 	/** Get the terminal. **/
 
-	while(1)
-	{
-		sti;
-		yield;
-		//delay(TTY_DELAY);
-		cli;
+	flags = spin_lock_irqsave(&tty_lock);
 
-		if(!reader_pid)
-		{
-			reader_pid = current_pid;
-			break;
-		}
+	while(reader_pid)
+	{
+		wait_sleep_lock(&tty_ififo2.wq, &tty_lock);
 	}
 
+	reader_pid = current_pid;
+
 	/** Try to read from it. **/
 
 	while(1)
 	{
-		/** Wait until we can read data. **/
+		/** Wait until we can read data (the keyboard IRQ fills the
+		    secondary FIFO). **/
 
 		while(1)
 		{
-			sti;
-			yield;
-			//delay(TTY_DELAY);
-			cli;
-
 			if(termios.c_lflag & ICANON)
 			{
 				if(eol_count)
@@ -66,11 +61,23 @@ ssize_t tty_read(uchar_t *buf, size_t size)
 			}
 			else
 			{
-				if(tty_ififo2.to_read)
+				if(fifo_count(&tty_ififo2))
 				{
 					break;
 				}
 			}
+
+			wait_sleep_lock(&tty_ififo2.wq, &tty_lock);
+			waited = 1;
+		}
+
+		/** A process woken up by terminal input is interactive: give
+		    it the highest priority its nice value allows. **/
+
+		if(waited)
+		{
+			schedule_boost();
+			waited = 0;
 		}
 
 		/** Tranfer the data from the secondary FIFO to the buffer. **/
@@ -106,15 +113,37 @@ ssize_t tty_read(uchar_t *buf, size_t size)
 	/** Free the terminal. **/
 
 	reader_pid = 0;
+	wait_wake(&tty_ififo2.wq);
+	spin_unlock_irqrestore(&tty_lock, flags);
 
 	return read_bytes;
 }
 
 /**
  * tty_write
+ *
+ *   Called by the keyboard IRQ.
  */
 
 ret_t tty_write(uchar_t *buf, size_t size)
+{
+	ui32_t flags = spin_lock_irqsave(&tty_lock);
+	ret_t ret;
+
+	ret = tty_input(buf, size);
+	spin_unlock_irqrestore(&tty_lock, flags);
+
+	return ret;
+}
+
+/**
+ * tty_input
+ *
+ *   Same as tty_write, with tty_lock held (vt100.c answers the queries of
+ *   the applications through it).
+ */
+
+ret_t tty_input(uchar_t *buf, size_t size)
 {
 	size_t i;
 	ret_t ret = OK;
@@ -145,6 +174,7 @@ ssize_t tty_puts(uchar_t *buf, size_t size)
 {
 	size_t i;
 	uchar_t c;
+	ui32_t flags = spin_lock_irqsave(&tty_lock);
 
 	for(i = 0; i < size; i++)
 	{
@@ -169,6 +199,8 @@ ssize_t tty_puts(uchar_t *buf, size_t size)
 		vt100_put_char(c);
 	}
 
+	spin_unlock_irqrestore(&tty_lock, flags);
+
 	return (ssize_t)size;
 }
 
@@ -201,9 +233,14 @@ ret_t tty_process()
 
 			if(c == termios.c_cc[VERASE])
 			{
-				c2 = tty_ififo2.rbuf[tty_ififo2.write - 1];
+				if(!fifo_count(&tty_ififo2))
+				{
+					continue;
+				}
+
+				c2 = fifo_last(&tty_ififo2);
 
-				if(!tty_ififo2.to_read || is_eol(c2))
+				if(is_eol(c2))
 				{
 					continue;
 				}
@@ -226,10 +263,14 @@ ret_t tty_process()
 			{
 				while(1)
 				{
-					c2 = tty_ififo2
-					    .rbuf[tty_ififo2.write - 1];
+					if(!fifo_count(&tty_ififo2))
+					{
+						break;
+					}
+
+					c2 = fifo_last(&tty_ififo2);
 
-					if(!tty_ififo2.to_read || is_eol(c2))
+					if(is_eol(c2))
 					{
 						break;
 					}
@@ -1,6 +1,7 @@
 #ifndef _TTY_H_
 #define _TTY_H_
 
+#include <kernel/lock.h>
 #include <kernel/types.h>
 
 typedef ui32_t tcflag_t;
@@ -94,7 +95,8 @@ struct termios
                 || c == termios.c_cc[VEOL2] \
                 || c == termios.c_cc[VEOF])
 
-/** Global variables. **/
+/** Global variables (the lock is taken by the keyboard IRQ and, with
+    interrupts disabled, by the processes using the terminal). **/
 
 #ifdef _TTY_C_
 struct termios termios __attribute__((section("DATA"))) = {
@@ -120,19 +122,24 @@ struct termios termios __attribute__((section("DATA"))) = {
 	          22,
 	          255 }
 };
+ui8_t tty_ibuf[RBUF_SIZE];
+ui8_t tty_ibuf2[RBUF_SIZE];
 struct fifo tty_ififo = {
-	.read = 0,
-	.write = 0,
-	.to_read = 0
+	.head = 0,
+	.tail = 0,
+	.size = RBUF_SIZE,
+	.rbuf = tty_ibuf
 };
 struct fifo tty_ififo2 = {
-	.read = 0,
-	.write = 0,
-	.to_read = 0
+	.head = 0,
+	.tail = 0,
+	.size = RBUF_SIZE,
+	.rbuf = tty_ibuf2
 };
 pid_t reader_pid = 0;
 pid_t pgrp = 2;
 count_t eol_count = 0;
+struct spinlock tty_lock = SPINLOCK_INIT;
 #else
 extern struct termios termios;
 extern struct fifo tty_ififo;
@@ -140,6 +147,7 @@ extern struct fifo tty_ififo2;
 extern pid_t reader_pid;
 extern pid_t pgrp;
 extern count_t eol_count;
+extern struct spinlock tty_lock;
 #endif
 
 /** Functions **/
@@ -148,6 +156,8 @@ ssize_t tty_read(uchar_t *buf, size_t size);
 /****************************************************************/
 ret_t tty_write(uchar_t *buf, size_t size);
 /****************************************************************/
+ret_t tty_input(uchar_t *buf, size_t size);
+/****************************************************************/
 ssize_t tty_puts(uchar_t *buf, size_t size);
 /****************************************************************/
 ret_t tty_process();
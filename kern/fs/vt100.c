@@ -238,7 +238,7 @@ void vt100_put_char(uchar_t c)
 		switch(c)
 		{
 			case 'c': // report device status
-				tty_write("\033[?1;2c", 7);
+				tty_input("\033[?1;2c", 7);
 				break;
 
 			case 'g': // TODO
@@ -304,7 +304,7 @@ void vt100_put_char(uchar_t c)
 			case 'n': // query
 				if(param[0] == 5) // device status
 				{
-					tty_write("\033[0n", 4);
+					tty_input("\033[0n", 4);
 				}
 				else if(param[0] == 6) // cursor position
 				{
@@ -318,7 +318,7 @@ void vt100_put_char(uchar_t c)
 					         '0' + (X + 1) / 10,
 					         '0' + ((X + 1) % 10));
 					state = VT100_NORMAL;
-					tty_write(s, 8);
+					tty_input(s, 8);
 				}
 				break;
 				
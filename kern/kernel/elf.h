@@ -37,4 +37,11 @@ struct elf32_phdr
 	ui32_t p_align;
 } __attribute__ ((packed));
 
+/** Segment types and flags. **/
+
+#define PT_LOAD		1
+#define PF_X		0x1
+#define PF_W		0x2
+#define PF_R		0x4
+
 #endif
@@ -6,6 +6,7 @@
 #define OK		0
 #define EPERM		1
 #define ENOENT		2
+#define ESRCH		3
 #define EINTR		4
 #define EIO		5
 #define ENXIO		6
@@ -14,9 +15,11 @@
 #define EAGAIN		11
 #define EWOULDBLOCK	EAGAIN
 #define ENOMEM		12
+#define EACCES		13
 #define EFAULT		14
 #define EBUSY		16
 #define EEXIST		17
+#define ENODEV		19
 #define ENOTDIR		20
 #define EISDIR		21
 #define EINVAL		22
@@ -30,6 +33,7 @@
 #define ECONNRESET	104
 #define ENOBUFS		105
 #define ENOTSOCK	108
+#define ENOPROTOOPT	109
 #define EADDRINUSE	112
 #define ETIMEDOUT	116
 #define EINPROGRESS	119
@@ -11,9 +11,9 @@
 
 #include "gdt.h"
 
-struct gdt_descriptor gdt_desc[8];
+struct gdt_descriptor gdt_desc[GDT_NR_ENTRIES];
 struct gdt_description gdt_descript = {
-	.limit = 8 * sizeof(struct gdt_descriptor),
+	.limit = GDT_NR_ENTRIES * sizeof(struct gdt_descriptor),
 	/* NOTE: DO NOT ADD -1 to limit (contrary to the case of the IDT). It
 	         made my real machine crash (while neither qemu nor Bochs did)
 	         and it took me a long time to work out the origin of the
@@ -98,25 +98,13 @@ void gdt_init()
 
 	/*** TSS ***/
 
-	default_tss.debug_flag = 0;
-	default_tss.iopb_offset = 0;
-	default_tss.esp0 = 0x6ffc;
-	default_tss.ss0 = 0x18;
-
-	gdt_init_descriptor(&gdt_desc[7],
-	                    (ui32_t)&default_tss,
-	                    sizeof(struct tss) - 1,
-	                    GDT_ACCESS_PR
-	                  | GDT_ACCESS_RING3
-	                  | GDT_ACCESS_EX
-	                  | GDT_ACCESS_AC,
-	                    0);
+	gdt_set_tss(GDT_TSS_ENTRY, &default_tss);
 
 	/** Load GDT **/
 
 	memcpy((void*)GDT_BASE,
 	       &gdt_desc,
-	       8 * sizeof(struct gdt_descriptor));
+	       GDT_NR_ENTRIES * sizeof(struct gdt_descriptor));
 
 	asm volatile("lgdt (gdt_descript) \n\
 	              movw $0x10, %%ax \n\
@@ -146,3 +134,31 @@ void gdt_init_descriptor(struct gdt_descriptor *desc,
 	desc->access = access;
 	desc->flags = flags;
 }
+
+/**
+ * gdt_set_tss
+ *
+ *   Initializes a TSS and its descriptor. It may be called once the GDT is
+ *   loaded (to add the TSS of another processor).
+ */
+
+void gdt_set_tss(ui32_t entry, struct tss *tss)
+{
+	tss->debug_flag = 0;
+	tss->iopb_offset = 0;
+	tss->esp0 = 0x6ffc;
+	tss->ss0 = 0x18;
+
+	gdt_init_descriptor(&gdt_desc[entry],
+	                    (ui32_t)tss,
+	                    sizeof(struct tss) - 1,
+	                    GDT_ACCESS_PR
+	                  | GDT_ACCESS_RING3
+	                  | GDT_ACCESS_EX
+	                  | GDT_ACCESS_AC,
+	                    0);
+
+	memcpy((void*)GDT_BASE + entry * sizeof(struct gdt_descriptor),
+	       &gdt_desc[entry],
+	       sizeof(struct gdt_descriptor));
+}
@@ -1,6 +1,7 @@
 #ifndef _GDT_H_
 #define _GDT_H_
 
+#include <config.h>
 #include <kernel/types.h>
 
 /** GDT descriptor **/
@@ -87,6 +88,12 @@ struct tss
 #define GDT_FLAGS_SIZE_16	0x0
 #define GDT_FLAGS_SIZE_32	0x4
 
+/** Entry of the default TSS. Under SMP, processor i uses entry
+    GDT_TSS_ENTRY + i. **/
+
+#define GDT_TSS_ENTRY		7
+#define GDT_NR_ENTRIES		(GDT_TSS_ENTRY + NR_CPUS)
+
 /** Default TSS **/
 
 #ifdef _GDT_C_
@@ -104,5 +111,7 @@ void gdt_init_descriptor(struct gdt_descriptor *desc,
                          ui32_t limit,
                          ui8_t access,
                          ui8_t flags);
+/****************************************************************/
+void gdt_set_tss(ui32_t entry, struct tss *tss);
 
 #endif
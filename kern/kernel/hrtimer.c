@@ -0,0 +1,262 @@
+/****************************************************************
+ * hrtimer.c                                                    *
+ *                                                              *
+ *    One-shot PIT clock and high-resolution timers.            *
+ *                                                              *
+ ****************************************************************/
+
+#define _HRTIMER_C_
+#include <config.h>
+#include <kernel/io.h>
+#include <kernel/lock.h>
+#include <kernel/panic.h>
+
+#include "hrtimer.h"
+
+/** WARNING: Interrupts must be disabled when calling these functions, except
+    hrtimer_now. **/
+
+/**
+ * hrtimer_init
+ */
+
+void hrtimer_init()
+{
+	/** The PIT is always used in one-shot mode: it is programmed for the
+	    next clock tic or the next timer, whichever comes first. **/
+
+	hrtimer_base = 0;
+	hrtimer_next_tick = HRTIMER_TICK;
+	hrtimer_program(HRTIMER_TICK);
+}
+
+/**
+ * hrtimer_program
+ */
+
+void hrtimer_program(ui32_t count)
+{
+	if(!count)
+	{
+		count = 1;
+	}
+	else if(count > HRTIMER_MAX_COUNT)
+	{
+		count = HRTIMER_MAX_COUNT;
+	}
+
+	hrtimer_count = count;
+
+	outb(PIT_CMD, PIT_CMD_ONESHOT);
+	outb(PIT_CH0, (ui8_t)count);
+	outb(PIT_CH0, (ui8_t)(count >> 8));
+}
+
+/**
+ * hrtimer_elapsed
+ *
+ *   Returns the number of PIT cycles since the PIT was last programmed.
+ */
+
+ui32_t hrtimer_elapsed()
+{
+	ui8_t status;
+	ui16_t count;
+
+	outb(PIT_CMD, PIT_CMD_READBACK);
+	status = inb(PIT_CH0);
+	count = inb(PIT_CH0);
+	count |= inb(PIT_CH0) << 8;
+
+	/** The count is not loaded yet right after programming. Once it
+	    reaches 0, OUT goes high and the counter goes on from 0xffff. **/
+
+	if(status & PIT_STATUS_NULL_COUNT)
+	{
+		return 0;
+	}
+	else if(status & PIT_STATUS_OUT)
+	{
+		return hrtimer_count + (ui16_t)(0x10000 - count);
+	}
+	else
+	{
+		return hrtimer_count - count;
+	}
+}
+
+/**
+ * hrtimer_now
+ *
+ *   The clock ISR must not reprogram the PIT between the read of the base and
+ *   that of the counter.
+ */
+
+ui64_t hrtimer_now()
+{
+	ui32_t flags = irq_save();
+	ui64_t now = hrtimer_base + hrtimer_elapsed();
+
+	irq_restore(flags);
+
+	return now;
+}
+
+/**
+ * hrtimer_update
+ *
+ *   Called from the IRQ handlers. Returns the number of clock tics elapsed
+ *   since the previous call (possibly many after an idle period).
+ */
+
+count_t hrtimer_update()
+{
+	ui64_t now = hrtimer_now();
+	count_t elapsed_tics = 0;
+
+	while(hrtimer_next_tick <= now)
+	{
+		hrtimer_next_tick += HRTIMER_TICK;
+		elapsed_tics++;
+	}
+
+	return elapsed_tics;
+}
+
+/**
+ * hrtimer_run
+ */
+
+void hrtimer_run()
+{
+	struct hrtimer *timer;
+	ui64_t now = hrtimer_now();
+
+	/** The function of a timer may start it again. **/
+
+	while(hrtimer_list && hrtimer_list->expires <= now)
+	{
+		timer = hrtimer_list;
+		hrtimer_list = timer->next;
+		timer->pending = 0;
+		timer->function(timer->data);
+	}
+}
+
+/**
+ * hrtimer_reprogram
+ *
+ *   Programs the PIT for the next event. When the processor is about to be
+ *   idle, clock tics are skipped (they are accounted for when it wakes up).
+ */
+
+void hrtimer_reprogram(bool_t idle)
+{
+	ui64_t now, deadline;
+
+	now = hrtimer_now();
+	deadline = idle ? now + HRTIMER_MAX_COUNT : hrtimer_next_tick;
+
+	if(hrtimer_list && hrtimer_list->expires < deadline)
+	{
+		deadline = hrtimer_list->expires;
+	}
+
+	/** Do not touch the PIT if it is already set for this deadline. **/
+
+	if(deadline == hrtimer_base + hrtimer_count && deadline > now)
+	{
+		return;
+	}
+
+	/** The few cycles between reading the counter and programming it
+	    again are lost: the clock slightly lags behind. **/
+
+	hrtimer_base = now;
+	hrtimer_program(deadline > now ? (ui32_t)(deadline - now) : 1);
+}
+
+/**
+ * hrtimer_start
+ */
+
+void hrtimer_start(struct hrtimer *timer,
+                   ui64_t expires,
+                   void (*function)(ui32_t data),
+                   ui32_t data)
+{
+	struct hrtimer **ptimer;
+
+	hrtimer_cancel(timer);
+
+	timer->expires = expires;
+	timer->function = function;
+	timer->data = data;
+	timer->pending = 1;
+
+	/** Insert the timer in the sorted list. **/
+
+	for(ptimer = &hrtimer_list;
+	    *ptimer && (*ptimer)->expires <= expires;
+	    ptimer = &(*ptimer)->next);
+
+	timer->next = *ptimer;
+	*ptimer = timer;
+
+	/** A new first timer may expire before the PIT fires. **/
+
+	if(hrtimer_list == timer)
+	{
+		hrtimer_reprogram(0);
+	}
+}
+
+/**
+ * hrtimer_cancel
+ */
+
+void hrtimer_cancel(struct hrtimer *timer)
+{
+	struct hrtimer **ptimer;
+
+	if(!timer->pending)
+	{
+		return;
+	}
+
+	for(ptimer = &hrtimer_list; *ptimer; ptimer = &(*ptimer)->next)
+	{
+		if(*ptimer == timer)
+		{
+			*ptimer = timer->next;
+			timer->pending = 0;
+
+			return;
+		}
+	}
+
+	panic("pending timer %x not found", timer);
+}
+
+/**
+ * hrtimer_cycles
+ *
+ *   Converts a duration to PIT cycles (rounded up), without 64-bit division.
+ */
+
+ui64_t hrtimer_cycles(time_t sec, ui32_t nsec)
+{
+	ui32_t usec = nsec / 1000;
+
+	if(!sec && !nsec)
+	{
+		return 0;
+	}
+
+	/** HRTIMER_FREQ / 1000000 = 1.193182 **/
+
+	return (ui64_t)sec * HRTIMER_FREQ
+	     + usec * 1193 / 1000
+	     + usec * 182 / 1000000
+	     + 1;
+}
@@ -0,0 +1,82 @@
+#ifndef _HRTIMER_H_
+#define _HRTIMER_H_
+
+#include <config.h>
+#include <kernel/types.h>
+
+/** Constants **/
+
+// Frequency of the PIT input clock (high-resolution times are in its cycles)
+#define HRTIMER_FREQ		1193182
+// PIT cycles per clock tic
+#define HRTIMER_TICK		(HRTIMER_FREQ / CLK_FREQ)
+// Longest period the PIT can be programmed with (16-bit counter)
+#define HRTIMER_MAX_COUNT	0xffff
+
+/** PIT ports and commands **/
+
+#define PIT_CH0			0x40
+#define PIT_CMD			0x43
+// Channel 0, low byte then high byte, mode 0 (interrupt on terminal count)
+#define PIT_CMD_ONESHOT		0x30
+// Read-back: latch the count and the status of channel 0
+#define PIT_CMD_READBACK	0xc2
+#define PIT_STATUS_OUT		0x80
+#define PIT_STATUS_NULL_COUNT	0x40
+
+/** High-resolution timer: function is called from the clock ISR with data as
+    its parameter once the time reaches expires. **/
+
+struct hrtimer
+{
+	ui64_t expires;
+	void (*function)(ui32_t data);
+	ui32_t data;
+	bool_t pending;
+	struct hrtimer *next;
+};
+
+/** Global variables (time of the last programming of the PIT and count it
+    was programmed with, time of the next clock tic, pending timers sorted by
+    expiry date, number of clock interrupts). **/
+
+#ifdef _HRTIMER_C_
+ui64_t hrtimer_base = 0;
+ui32_t hrtimer_count = 0;
+ui64_t hrtimer_next_tick = HRTIMER_TICK;
+struct hrtimer *hrtimer_list = 0;
+count_t nr_clock_irqs = 0;
+#else
+extern ui64_t hrtimer_base;
+extern ui32_t hrtimer_count;
+extern ui64_t hrtimer_next_tick;
+extern struct hrtimer *hrtimer_list;
+extern count_t nr_clock_irqs;
+#endif
+
+/** Functions **/
+
+void hrtimer_init();
+/****************************************************************/
+void hrtimer_program(ui32_t count);
+/****************************************************************/
+ui32_t hrtimer_elapsed();
+/****************************************************************/
+ui64_t hrtimer_now();
+/****************************************************************/
+count_t hrtimer_update();
+/****************************************************************/
+void hrtimer_run();
+/****************************************************************/
+void hrtimer_reprogram(bool_t idle);
+/****************************************************************/
+void hrtimer_start(struct hrtimer *timer,
+                   ui64_t expires,
+                   void (*function)(ui32_t data),
+                   ui32_t data);
+/****************************************************************/
+void hrtimer_cancel(struct hrtimer *timer);
+/****************************************************************/
+ui64_t hrtimer_cycles(time_t sec, ui32_t nsec);
+
+#endif
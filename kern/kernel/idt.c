@@ -5,8 +5,12 @@
  *                                                              *
  ****************************************************************/
 
+#include <config.h>
 #include <kernel/libc.h>
 #include <mm/mem_map.h>
+#ifdef ENABLE_SMP
+#include <kernel/smp.h>
+#endif
 
 #include "idt.h"
 
@@ -118,6 +122,28 @@ void idt_init()
 	                    IDT_ATTRIBUTE_P | IDT_ATTRIBUTE_RING3,
 	                    0x08);
 
+	/*** Local APIC interrupts and inter-processor interrupts ***/
+
+	#ifdef ENABLE_SMP
+	idt_init_descriptor(&idt_desc[LAPIC_TIMER_VECTOR],
+	                    (ui32_t)isr_lapic_timer,
+	                    IDT_TYPE_32_INT_GATE,
+	                    IDT_ATTRIBUTE_P | IDT_ATTRIBUTE_RING0,
+	                    0x08);
+
+	idt_init_descriptor(&idt_desc[IPI_TLB_VECTOR],
+	                    (ui32_t)isr_tlb_ipi,
+	                    IDT_TYPE_32_INT_GATE,
+	                    IDT_ATTRIBUTE_P | IDT_ATTRIBUTE_RING0,
+	                    0x08);
+
+	idt_init_descriptor(&idt_desc[LAPIC_SPURIOUS_VECTOR],
+	                    (ui32_t)isr_lapic_spurious,
+	                    IDT_TYPE_32_INT_GATE,
+	                    IDT_ATTRIBUTE_P | IDT_ATTRIBUTE_RING0,
+	                    0x08);
+	#endif
+
 	/** Load IDT **/
 
 	memcpy((void*)IDT_BASE,
@@ -1,6 +1,7 @@
 #ifndef _IDT_H_
 #define _IDT_H_
 
+#include <config.h>
 #include <kernel/types.h>
 
 /** IDT descriptor **/
@@ -73,5 +74,13 @@ extern void isr_0x0b_irq();
 extern void isr_syscall();
 /****************************************************************/
 extern void isr_yield();
+#ifdef ENABLE_SMP
+/****************************************************************/
+extern void isr_lapic_timer();
+/****************************************************************/
+extern void isr_tlb_ipi();
+/****************************************************************/
+extern void isr_lapic_spurious();
+#endif
 
 #endif
@@ -11,6 +11,7 @@
 #include <fs/tty.h>
 #include <fs/vt100.h> // debug
 #include <kernel/errno.h>
+#include <kernel/hrtimer.h>
 #include <kernel/io.h>
 #include <kernel/kbdmap.h>
 #include <kernel/libc.h>
@@ -21,8 +22,15 @@
 #include <kernel/screen.h>
 #include <kernel/signal.h>
 #include <kernel/syscall.h>
+#ifdef ENABLE_SMP
+#include <kernel/smp.h>
+#endif
+#include <kernel/timer.h>
+#include <kernel/wait.h>
 #include <mm/mem_map.h>
 #include <mm/paging.h>
+#include <mm/swap.h>
+#include <mm/vma.h>
 #ifdef ENABLE_NETWORK
 #include <net/rtl8139.h>
 #include <net/tcp.h>
@@ -62,13 +70,10 @@ void _isr_pf_exc()
 {
 	ui32_t error_code;
 	void *bad_vaddr, *bad_vpage_base; ui32_t bad_vpage;
+	struct pheap_page copy_vpage;
 	ui32_t ppage;
-	/** This buffer is protected from race conditions because interrupts
-	    are disabled when handling a page fault. **/
-	static ui8_t page_buf[4096];
-	#ifndef PANIC_ON_EXC
+	ret_t ret;
 	ui32_t *ebp;
-	#endif
 
 	//dump_stack();
 	asm volatile("mov %%cr2, %%eax \n\
@@ -78,6 +83,14 @@ void _isr_pf_exc()
 	                             :
 	                             : "eax", "memory");
 
+	/** A process faulting in user mode holds no lock: the page is read
+	    from the swap area or copied with interrupts enabled. **/
+
+	if(error_code & EXC_PF_USER)
+	{
+		sti;
+	}
+
 	#ifdef DEBUG
 	printk("page fault @%x, error_code: %x\n", bad_vaddr, error_code);
 	#endif
@@ -93,26 +106,7 @@ void _isr_pf_exc()
 	#endif
 	)
 	{
-		if(!(error_code & EXC_PF_USER))
-		{
-			/** The page fault occured in kernel mode. **/
-
-			panic("page fault from kernel mode (bad vaddr: %x)",
-			      bad_vaddr);
-		}
-
-		/** The page fault occured in user mode. **/
-
-		#ifdef PANIC_ON_EXC
-		panic("bad page fault (process %x, bad vaddr: %x, error: %x)",
-		      current_pid, bad_vaddr, error_code);
-		#else
-		cli;
-		asm volatile("mov %%ebp, %0" : "=m"(ebp));	
-		schedule_save_regs(&current->regs, ebp, 1);
-		current->sigset |= (1 << (SIGSEGV - 1));
-		schedule_switch(current_pid);
-		#endif
+		goto bad_pf;
 	}
 	else if(error_code > 7)
 	{
@@ -120,8 +114,55 @@ void _isr_pf_exc()
 	}
 
 	bad_vpage = (ui32_t)bad_vaddr >> 12;
+	bad_vpage_base = (void*)(bad_vpage << 12);
+
+	/** Pages swapped out are read back from the swap area. **/
+
+	if(!(error_code & EXC_PF_PRESENT)
+	&& (paging_get_entry(bad_vpage) & PAGING_SWAPPED))
+	{
+		ret = swap_in(bad_vpage);
+
+		if(ret == OK)
+		{
+			current->majflt++;
+			return;
+		}
+		else if(ret == -ENOMEM)
+		{
+			goto oom;
+		}
+
+		panic("cannot read page %x from swap (error %x)",
+		      bad_vpage, ret);
+	}
+
+	/** Faults in the regions created by mmap are resolved according to
+	    the region. The mmap area is not demand-paged outside of them. **/
+
+	ret = vma_fault(bad_vpage, error_code);
+
+	if(ret == OK)
+	{
+		current->minflt++;
+		return;
+	}
+	else if(ret == -EFAULT)
+	{
+		goto bad_pf;
+	}
+	else if(ret == -ENOMEM)
+	{
+		goto oom;
+	}
+	else if(!(error_code & EXC_PF_PRESENT)
+	     && (ui32_t)bad_vaddr >= USER_MMAP_BASE
+	     && (ui32_t)bad_vaddr < USER_MMAP_LIMIT)
+	{
+		goto bad_pf;
+	}
 
-	if((error_code & EXC_PF_PRESENT) && (error_code && EXC_PF_WRITE))
+	if((error_code & EXC_PF_PRESENT) && (error_code & EXC_PF_WRITE))
 	{
 		/** Copy-on-write **/
 
@@ -129,15 +170,55 @@ void _isr_pf_exc()
 		printk("copy on write\n");
 		#endif
 
+		/** If the page is not shared anymore, there is nothing to copy:
+		    just make it writable again. **/
+
+		ppage = paging_get_entry(bad_vpage) >> 12;
+
+		if(ppage_tab[ppage].ref_cnt == 1)
+		{
+			paging_set_flags(bad_vpage, PAGING_RW, 0);
+			current->minflt++;
+			return;
+		}
+
+		/** Allocating the copy may reclaim memory and swap the page
+		    out: in this case, the access will simply fault again. **/
+
 		ppage = paging_palloc();
 
 		if(!ppage)
 		{
-			panic("no physical memory left");
+			goto oom;
 		}
 
-		bad_vpage_base = (void*)(bad_vpage << 12);
-		memcpy(page_buf, bad_vpage_base, 4096);
+		if(!(paging_get_entry(bad_vpage) & PAGING_PRESENT))
+		{
+			paging_pfree(ppage);
+			return;
+		}
+
+		/** Copy the page through a temporary kernel mapping of the new
+		    page. **/
+
+		copy_vpage = paging_valloc(0);
+
+		if(!copy_vpage.vpage)
+		{
+			paging_pfree(ppage);
+			goto oom;
+		}
+
+		if(paging_map(ppage, copy_vpage.vpage) != OK)
+		{
+			paging_vfree(copy_vpage);
+			paging_pfree(ppage);
+			goto oom;
+		}
+
+		memcpy((void*)(copy_vpage.vpage << 12), bad_vpage_base, 4096);
+		paging_unmap(copy_vpage.vpage);
+		paging_vfree(copy_vpage);
 
 		/*** After unmapping, the physical page mapped to bad_vpage is
 		     freed automatically by paging_unmap if its reference
@@ -148,10 +229,9 @@ void _isr_pf_exc()
 
 		if(paging_map(ppage, bad_vpage) != OK)
 		{
-			panic("no physical memory left (could not map page)");
+			paging_pfree(ppage);
+			goto oom;
 		}
-
-		memcpy(bad_vpage_base, page_buf, 4096);
 	}
 	else if(error_code & EXC_PF_PRESENT)
 	{
@@ -168,22 +248,115 @@ void _isr_pf_exc()
 
 		if(!ppage)
 		{
-			panic("no physical memory left");
+			goto oom;
 		}
 
 		if(paging_map(ppage, bad_vpage) != OK)
 		{
-			panic("no physical memory left (could not map page)");
+			paging_pfree(ppage);
+			goto oom;
 		}
 
 		#ifdef PAGING_ZERO
-		memset((void*)(bad_vpage << 12), 0, 4096);
+		memset(bad_vpage_base, 0, 4096);
 		#endif
 
 		#else
 		panic("demand paging not supported");
 		#endif
 	}
+
+	current->minflt++;
+
+	return;
+
+	oom:
+		/** Memory is exhausted even after reclaim: kill the process
+		    instead of the whole system. **/
+
+		if(!(error_code & EXC_PF_USER))
+		{
+			panic("no physical memory left");
+		}
+
+		printk("out of memory: killing process %x\n", current_pid);
+
+		cli;
+		asm volatile("mov %%ebp, %0" : "=m"(ebp));
+		schedule_save_regs(&current->regs, ebp, 1);
+		current->sigset |= (1 << (SIGKILL - 1));
+		schedule_switch(current_pid);
+
+	bad_pf:
+		if(!(error_code & EXC_PF_USER))
+		{
+			/** The page fault occured in kernel mode. **/
+
+			panic("page fault from kernel mode (bad vaddr: %x)",
+			      bad_vaddr);
+		}
+
+		/** The page fault occured in user mode. **/
+
+		#ifdef PANIC_ON_EXC
+		panic("bad page fault (process %x, bad vaddr: %x, error: %x)",
+		      current_pid, bad_vaddr, error_code);
+		#else
+		cli;
+		asm volatile("mov %%ebp, %0" : "=m"(ebp));	
+		schedule_save_regs(&current->regs, ebp, 1);
+		current->sigset |= (1 << (SIGSEGV - 1));
+		schedule_switch(current_pid);
+		#endif
+}
+
+/**
+ * isr_timer_run
+ *
+ *   Runs the timers that expired.
+ */
+
+void isr_timer_run()
+{
+	/** The timers all belong to the network stack. **/
+
+	#ifdef ENABLE_NETWORK
+	spin_lock(&tcp_lock);
+	#endif
+
+	timer_run();
+
+	#ifdef ENABLE_NETWORK
+	spin_unlock(&tcp_lock);
+	#endif
+}
+
+/**
+ * isr_idle_exit
+ *
+ *   Called first by the IRQ handlers other than the clock one. The clock
+ *   tics skipped while the processor was idle are charged to the idle task
+ *   and the timers run before the handler reads tics or wakes a process up:
+ *   the clock ISR would otherwise charge them to that process.
+ */
+
+void isr_idle_exit()
+{
+	count_t elapsed_tics;
+
+	if(current_pid != IDLE_PID)
+	{
+		return;
+	}
+
+	elapsed_tics = hrtimer_update();
+
+	if(elapsed_tics)
+	{
+		tics += elapsed_tics;
+		idle_tics += elapsed_tics;
+		isr_timer_run();
+	}
 }
 
 /**
@@ -192,6 +365,8 @@ void _isr_pf_exc()
 
 void _isr_default_pic1_irq()
 {
+	isr_idle_exit();
+
 	#ifdef DEBUG
 	printk("pic1 irq\n");
 	#endif
@@ -203,6 +378,8 @@ void _isr_default_pic1_irq()
 
 void _isr_default_pic2_irq()
 {
+	isr_idle_exit();
+
 	#ifdef DEBUG
 	printk("pic2 irq\n");
 	#endif
@@ -214,12 +391,28 @@ void _isr_default_pic2_irq()
 
 void _isr_pit_irq()
 {
-	tics++;
+	count_t elapsed_tics;
 
-	#ifdef ENABLE_NETWORK
-	tcp_callback();
-	#endif
+	/** The PIT fires either for a clock tic or for a timer. Tics skipped
+	    while the processor was idle are accounted for now, unless another
+	    IRQ already did (see isr_idle_exit). **/
+
+	nr_clock_irqs++;
+	elapsed_tics = hrtimer_update();
+
+	if(elapsed_tics)
+	{
+		tics += elapsed_tics;
 
+		while(elapsed_tics--)
+		{
+			schedule_tick();
+		}
+
+		isr_timer_run();
+	}
+
+	hrtimer_run();
 	schedule();
 }
 
@@ -236,6 +429,8 @@ void _isr_kbd_irq()
 	              ctrl_enabled = 0,
 	              alt_enabled = 0;
 
+	isr_idle_exit();
+
 	scancode = inb(KEYBOARD_DATA_PORT);
 
 	if(scancode <= 0x80)
@@ -291,6 +486,88 @@ void _isr_kbd_irq()
 			asm volatile("cli \n\
 			              hlt");
 		}
+		else if(scancode == KEYBOARD_F1_SCANCODE + 8)
+		{
+			pid_t pid;
+			count_t private, shared;
+
+			for(pid = 0; pid < NR_PROC; pid++)
+			{
+				if(proc_tab[pid].used
+				&& proc_tab[pid].state != PROC_ZOMBIE)
+				{
+					paging_usage(proc_tab[pid].pd,
+					             &private,
+					             &shared);
+					printk("pid %x: private %x, shared %x\n",
+					       pid, private << 12, shared << 12);
+				}
+			}
+		}
+		else if(scancode == KEYBOARD_F1_SCANCODE + 9)
+		{
+			pid_t pid;
+			struct process *proc;
+
+			printk("switches: %x, cr3 reloads: %x\n",
+			       nr_switches, nr_cr3_loads);
+			printk("tics: idle %x, user %x, system %x, "
+			       "clock irqs: %x\n",
+			       idle_tics, user_tics, system_tics,
+			       nr_clock_irqs);
+			printk("timers: pending %x, added %x, cancelled %x, "
+			       "expired %x, cascaded %x\n",
+			       timer_nr_pending, timer_nr_added,
+			       timer_nr_cancelled, timer_nr_expired,
+			       timer_nr_cascaded);
+			printk("timer latency: %x %x %x %x %x %x %x %x\n",
+			       timer_latency[0], timer_latency[1],
+			       timer_latency[2], timer_latency[3],
+			       timer_latency[4], timer_latency[5],
+			       timer_latency[6], timer_latency[7]);
+
+			#ifdef ENABLE_NETWORK
+			printk("tcp listen: overflows %x, drops %x, "
+			       "cookies sent %x/ok %x, accepted %x\n",
+			       tcp_nr_listen_overflows, tcp_nr_listen_drops,
+			       tcp_nr_cookies_sent, tcp_nr_cookies_ok,
+			       tcp_nr_accepted);
+			printk("accept latency: %x %x %x %x %x %x %x %x\n",
+			       tcp_accept_latency[0], tcp_accept_latency[1],
+			       tcp_accept_latency[2], tcp_accept_latency[3],
+			       tcp_accept_latency[4], tcp_accept_latency[5],
+			       tcp_accept_latency[6], tcp_accept_latency[7]);
+			#endif
+
+			#ifdef ENABLE_SMP
+			printk("cpus: online %x/%x, kernel lock contended %x\n",
+			       smp_nr_online, smp_nr_cpus,
+			       kernel_lock_contended);
+
+			for(pid = 1; pid < (pid_t)smp_nr_cpus; pid++)
+			{
+				printk("cpu %x: pid %x, timer irqs %x\n",
+				       pid, cpu_tab[pid].pid,
+				       cpu_tab[pid].nr_timer_irqs);
+			}
+			#endif
+
+			for(pid = 0; pid < NR_PROC; pid++)
+			{
+				proc = &proc_tab[pid];
+
+				if(proc->used && proc->state != PROC_ZOMBIE)
+				{
+					printk("pid %x: user %x, system %x, "
+					       "csw %x/%x, faults %x/%x, "
+					       "syscalls %x\n",
+					       pid, proc->utime, proc->stime,
+					       proc->nvcsw, proc->nivcsw,
+					       proc->minflt, proc->majflt,
+					       proc->nsyscalls);
+				}
+			}
+		}
 		else if(scancode == KEYBOARD_F1_SCANCODE + 7)
 		{
 			struct process *root = &proc_tab[0];
@@ -368,6 +645,8 @@ void _isr_kbd_irq()
 
 void _isr_0x09_irq()
 {
+	isr_idle_exit();
+
 	#ifdef DEBUG
 	printk("0x09 irq\n");
 	#endif
@@ -384,6 +663,8 @@ void _isr_0x09_irq()
 
 void _isr_0x0a_irq()
 {
+	isr_idle_exit();
+
 	#ifdef DEBUG
 	printk("0x0a irq\n");
 	#endif
@@ -400,6 +681,8 @@ void _isr_0x0a_irq()
 
 void _isr_0x0b_irq()
 {
+	isr_idle_exit();
+
 	#ifdef DEBUG
 	printk("0x0b irq\n");
 	#endif
@@ -418,3 +701,37 @@ void _isr_yield()
 {
 	schedule();
 }
+
+#ifdef ENABLE_SMP
+
+/**
+ * _isr_lapic_timer
+ *
+ *   Clock of the application processors (the bootstrap processor keeps the
+ *   PIT, which also drives tics and timers).
+ */
+
+void _isr_lapic_timer()
+{
+	cpu_tab[smp_cpu_id()].nr_timer_irqs++;
+	schedule_tick();
+	schedule();
+}
+
+/**
+ * _isr_tlb_ipi
+ */
+
+void _isr_tlb_ipi()
+{
+	struct cpu *cpu = &cpu_tab[smp_cpu_id()];
+	ui32_t gen, vpage;
+
+	gen = smp_tlb_gen;
+	vpage = smp_tlb_vpage;
+
+	smp_flush_local(vpage);
+	cpu->tlb_gen = gen;
+}
+
+#endif
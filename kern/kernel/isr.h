@@ -1,6 +1,7 @@
 #ifndef _ISR_H_
 #define _ISR_H_
 
+#include <config.h>
 #include <kernel/types.h>
 
 /** Keyboard **/
@@ -52,6 +53,10 @@ void _isr_pf_exc();
 
 /** IRQs **/
 
+void isr_timer_run();
+/****************************************************************/
+void isr_idle_exit();
+/****************************************************************/
 void _isr_default_pic1_irq();
 /****************************************************************/
 void _isr_default_pic2_irq();
@@ -65,6 +70,12 @@ void _isr_0x09_irq();
 void _isr_0x0a_irq();
 /****************************************************************/
 void _isr_0x0b_irq();
+#ifdef ENABLE_SMP
+/****************************************************************/
+void _isr_lapic_timer();
+/****************************************************************/
+void _isr_tlb_ipi();
+#endif
 
 /** Function pointers **/
 
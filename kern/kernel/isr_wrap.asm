@@ -19,6 +19,11 @@ global isr_0x0a_irq
 global isr_0x0b_irq
 global isr_syscall
 global isr_yield
+%ifdef ENABLE_SMP
+global isr_lapic_timer
+global isr_tlb_ipi
+global isr_lapic_spurious
+%endif
 
 ;; External functions ;;
 
@@ -33,6 +38,13 @@ extern _isr_0x0a_irq
 extern _isr_0x0b_irq
 extern _isr_syscall
 extern _isr_yield
+%ifdef ENABLE_SMP
+extern _isr_lapic_timer
+extern _isr_tlb_ipi
+extern smp_lock_kernel
+extern smp_isr_leave
+extern smp_lapic
+%endif
 
 ;; Macros for saving/restoring registers ;;
 
@@ -64,12 +76,40 @@ extern _isr_yield
 	out 0xa0, al
 %endmacro
 
+;; Big kernel lock macros (see kernel/smp.c). KERNEL_LEAVE takes the offset of
+;; the interrupted CS on the stack. ;;
+
+%ifdef ENABLE_SMP
+%macro KERNEL_ENTER 0
+	call smp_lock_kernel
+%endmacro
+
+%macro KERNEL_LEAVE 1
+	push dword [esp+%1]
+	call smp_isr_leave
+	add esp, 4
+%endmacro
+
+%macro EOI_LAPIC 0
+	mov eax, [smp_lapic]
+	mov dword [eax+0xb0], 0
+%endmacro
+%else
+%macro KERNEL_ENTER 0
+%endmacro
+
+%macro KERNEL_LEAVE 1
+%endmacro
+%endif
+
 ;; Exceptions ;;
 
 isr_default_exc:
 	cli
 	SAVE_REGISTERS
+	KERNEL_ENTER
 	call _isr_default_exc
+	KERNEL_LEAVE 56
 	RESTORE_REGISTERS
 	add esp, 4
 	iret
@@ -77,7 +117,9 @@ isr_default_exc:
 isr_pf_exc:
 	cli
 	SAVE_REGISTERS
+	KERNEL_ENTER
 	call _isr_pf_exc
+	KERNEL_LEAVE 56
 	RESTORE_REGISTERS
 	add esp, 4
 	iret
@@ -86,54 +128,68 @@ isr_pf_exc:
 
 isr_default_pic1_irq:
 	SAVE_REGISTERS
+	KERNEL_ENTER
 	call _isr_default_pic1_irq
 	EOI_MASTER
+	KERNEL_LEAVE 52
 	RESTORE_REGISTERS
 	iret
 
 isr_default_pic2_irq:
 	SAVE_REGISTERS
+	KERNEL_ENTER
 	call _isr_default_pic2_irq
 	EOI_SLAVE
 	EOI_MASTER
+	KERNEL_LEAVE 52
 	RESTORE_REGISTERS
 	iret
 
 isr_pit_irq:
 	SAVE_REGISTERS
+	KERNEL_ENTER
 	call _isr_pit_irq
 	EOI_MASTER
+	KERNEL_LEAVE 52
 	RESTORE_REGISTERS
 	iret
 
 isr_kbd_irq:
 	SAVE_REGISTERS
+	KERNEL_ENTER
 	call _isr_kbd_irq
 	EOI_MASTER
+	KERNEL_LEAVE 52
 	RESTORE_REGISTERS
 	iret
 
 isr_0x09_irq:
 	SAVE_REGISTERS
+	KERNEL_ENTER
 	call _isr_0x09_irq
 	EOI_SLAVE
 	EOI_MASTER
+	KERNEL_LEAVE 52
 	RESTORE_REGISTERS
 	iret
 
 isr_0x0a_irq:
 	SAVE_REGISTERS
+	KERNEL_ENTER
 	call _isr_0x0a_irq
 	EOI_SLAVE
 	EOI_MASTER
+	KERNEL_LEAVE 52
 	RESTORE_REGISTERS
 	iret
 
 isr_0x0b_irq:
 	SAVE_REGISTERS
+	KERNEL_ENTER
 	call _isr_0x0b_irq
 	EOI_SLAVE
 	EOI_MASTER
+	KERNEL_LEAVE 52
 	RESTORE_REGISTERS
 	iret
 
@@ -141,7 +197,9 @@ isr_0x0b_irq:
 
 isr_syscall:
 	SAVE_REGISTERS
+	KERNEL_ENTER
 	call _isr_syscall
+	KERNEL_LEAVE 52
 	RESTORE_REGISTERS
 	iret
 
@@ -150,6 +208,38 @@ isr_syscall:
 isr_yield:
 	cli
 	SAVE_REGISTERS
+	KERNEL_ENTER
 	call _isr_yield
+	KERNEL_LEAVE 52
+	RESTORE_REGISTERS
+	iret
+
+%ifdef ENABLE_SMP
+
+;; Local APIC timer of the application processors ;;
+
+isr_lapic_timer:
+	SAVE_REGISTERS
+	KERNEL_ENTER
+	call _isr_lapic_timer
+	EOI_LAPIC
+	KERNEL_LEAVE 52
 	RESTORE_REGISTERS
 	iret
+
+;; TLB shootdown (the kernel lock is not taken: its owner waits for the
+;; processors to flush their TLB) ;;
+
+isr_tlb_ipi:
+	SAVE_REGISTERS
+	call _isr_tlb_ipi
+	EOI_LAPIC
+	RESTORE_REGISTERS
+	iret
+
+;; Spurious interrupt (no EOI) ;;
+
+isr_lapic_spurious:
+	iret
+
+%endif
@@ -16,6 +16,7 @@
 #include <fs/path.h> // debug
 #include <kernel/errno.h>
 #include <kernel/gdt.h>
+#include <kernel/hrtimer.h>
 #include <kernel/idt.h>
 #include <kernel/int.h>
 #include <kernel/io.h> // debug
@@ -27,8 +28,17 @@
 #include <kernel/process.h>
 #include <kernel/schedule.h>
 #include <kernel/screen.h>
+#ifdef ENABLE_SMP
+#include <kernel/smp.h>
+#endif
 #include <kernel/syscall.h> // debug
 #include <mm/paging.h>
+#ifdef USE_PAGE_CACHE
+#include <mm/pcache.h>
+#endif
+#ifdef ENABLE_SWAP
+#include <mm/swap.h>
+#endif
 #ifdef ENABLE_NETWORK
 #include <net/endian.h> // debug
 #include <net/ether.h> // debug
@@ -57,6 +67,7 @@ void kmain()
 
 	printk("init pic...\t");
 	pic_init();
+	hrtimer_init();
 	printk("ok\r\n");
 
 	printk("init gdt...\t");
@@ -86,6 +97,25 @@ void kmain()
 	printk("ok\r\n");
 	#endif
 
+	#ifdef USE_PAGE_CACHE
+	printk("init pcache..\t");
+	pcache_init();
+	printk("ok\r\n");
+	#endif
+
+	#ifdef ENABLE_SWAP
+	printk("init swap...\t");
+	swap_init();
+	printk(swap_enabled ? "ok\r\n" : "no drive\r\n");
+	#endif
+
+	printk("init sched...\t");
+	if(schedule_init() != OK)
+	{
+		panic("failed creating idle task");
+	}
+	printk("ok\r\n");
+
 	printk("init ext2...\t");
 	ext2_init();
 	printk("ok\r\n");
@@ -102,6 +132,18 @@ void kmain()
 	printk("ok\r\n");
 	#endif
 
+	#ifdef ENABLE_SMP
+	printk("init smp...\t");
+	if(smp_init() != OK)
+	{
+		printk("not found\r\n");
+	}
+	else
+	{
+		printk("%x cpus\r\n", smp_nr_online);
+	}
+	#endif
+
 	printk("kernel started\r\nmemory: 0x%x/0x%x bytes left\r\n",
 	       ppage_left << 12,
 	       RAM_SIZE);
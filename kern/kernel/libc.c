@@ -9,16 +9,19 @@
 
 /**
  * memcpy
+ *
+ *   Copies double words, then the remaining bytes.
  */
 
 void *memcpy(void *dest, void *src, size_t n)
 {
-	size_t i;
+	ui32_t ecx, edi, esi;
 
-	for(i = 0; i < n; i++)
-	{
-		((ui8_t*)dest)[i] = ((ui8_t*)src)[i];
-	}
+	asm volatile("rep movsl \n\
+	              mov %4, %%ecx \n\
+	              rep movsb" : "=&c"(ecx), "=&D"(edi), "=&S"(esi)
+	                         : "0"(n >> 2), "r"(n & 3), "1"(dest), "2"(src)
+	                         : "memory");
 
 	return dest;
 }
@@ -0,0 +1,203 @@
+/****************************************************************
+ * lock.c                                                       *
+ *                                                              *
+ *    Spinlocks and mutexes.                                    *
+ *                                                              *
+ ****************************************************************/
+
+#include <config.h>
+#include <kernel/int.h>
+#include <kernel/libc.h>
+#include <kernel/panic.h>
+#include <kernel/process.h>
+
+#include "lock.h"
+
+/**
+ * irq_save
+ *
+ *   Disables interrupts and returns the previous EFLAGS for irq_restore.
+ */
+
+ui32_t irq_save()
+{
+	ui32_t flags;
+
+	asm volatile("pushf \n\
+	              pop %0 \n\
+	              cli" : "=r"(flags) :: "memory");
+
+	return flags;
+}
+
+/**
+ * irq_restore
+ */
+
+void irq_restore(ui32_t flags)
+{
+	if(flags & EFLAGS_IF)
+	{
+		barrier();
+		sti;
+	}
+}
+
+/**
+ * irq_enabled
+ *
+ *   Interrupt handlers run, and spinlocks are held, with interrupts disabled:
+ *   code that finds them disabled must not sleep.
+ */
+
+bool_t irq_enabled()
+{
+	ui32_t flags;
+
+	asm volatile("pushf \n\
+	              pop %0" : "=r"(flags));
+
+	return (flags & EFLAGS_IF) != 0;
+}
+
+/**
+ * spin_init
+ */
+
+void spin_init(struct spinlock *lock)
+{
+	lock->locked = 0;
+}
+
+/**
+ * spin_lock
+ *
+ *   On a single processor, interrupts being disabled is enough: the lock only
+ *   catches code taking it twice.
+ */
+
+void spin_lock(struct spinlock *lock)
+{
+	#ifdef ENABLE_SMP
+	ui32_t locked;
+
+	while(1)
+	{
+		asm volatile("xchgl %0, %1" : "=r"(locked), "+m"(lock->locked)
+		                            : "0"(1)
+		                            : "memory");
+
+		if(!locked)
+		{
+			break;
+		}
+
+		while(lock->locked)
+		{
+			asm volatile("pause");
+		}
+	}
+	#else
+	if(lock->locked)
+	{
+		panic("spinlock %x already held", (ui32_t)lock);
+	}
+
+	lock->locked = 1;
+	barrier();
+	#endif
+}
+
+/**
+ * spin_unlock
+ */
+
+void spin_unlock(struct spinlock *lock)
+{
+	if(!lock->locked)
+	{
+		panic("spinlock %x not held", (ui32_t)lock);
+	}
+
+	barrier();
+	lock->locked = 0;
+}
+
+/**
+ * spin_lock_irqsave
+ */
+
+ui32_t spin_lock_irqsave(struct spinlock *lock)
+{
+	ui32_t flags = irq_save();
+
+	spin_lock(lock);
+
+	return flags;
+}
+
+/**
+ * spin_unlock_irqrestore
+ */
+
+void spin_unlock_irqrestore(struct spinlock *lock, ui32_t flags)
+{
+	spin_unlock(lock);
+	irq_restore(flags);
+}
+
+/**
+ * mutex_init
+ */
+
+void mutex_init(struct mutex *mutex)
+{
+	mutex->locked = 0;
+	mutex->owner = 0;
+	mutex->depth = 0;
+	memset(&mutex->wq, 0, sizeof(struct wait_queue));
+}
+
+/**
+ * mutex_lock
+ *
+ *   Must not be called from an interrupt handler.
+ */
+
+void mutex_lock(struct mutex *mutex)
+{
+	ui32_t flags = irq_save();
+
+	while(mutex->locked && mutex->owner != current_pid)
+	{
+		wait_sleep(&mutex->wq);
+	}
+
+	mutex->locked = 1;
+	mutex->owner = current_pid;
+	mutex->depth++;
+
+	irq_restore(flags);
+}
+
+/**
+ * mutex_unlock
+ */
+
+void mutex_unlock(struct mutex *mutex)
+{
+	ui32_t flags = irq_save();
+
+	if(!mutex->locked || mutex->owner != current_pid)
+	{
+		panic("mutex %x not held by %x", (ui32_t)mutex, current_pid);
+	}
+
+	if(!--mutex->depth)
+	{
+		mutex->locked = 0;
+		wait_wake(&mutex->wq);
+	}
+
+	irq_restore(flags);
+}
@@ -0,0 +1,67 @@
+#ifndef _LOCK_H_
+#define _LOCK_H_
+
+#include <config.h>
+#include <kernel/types.h>
+#include <kernel/wait.h>
+
+/** Constants **/
+
+#define EFLAGS_IF		0x200
+
+/** Compiler barrier: x86 keeps stores (and loads) in order, so it is enough
+    to order the accesses of lock-free code. **/
+
+#define barrier()		asm volatile("" ::: "memory")
+
+/** Spinlock: protects data shared with interrupt handlers (or with the other
+    processors). It is held with interrupts disabled (see spin_lock_irqsave)
+    and never across a sleep, except through wait_sleep_lock. **/
+
+struct spinlock
+{
+	volatile ui32_t locked;
+};
+
+#define SPINLOCK_INIT		{0}
+
+/** Mutex: protects data only used by processes. Its owner may take it again
+    (for instance when a page fault is handled while it holds it), waiters
+    sleep. It is not held across a sleep, since an interruptible system call
+    may never return. **/
+
+struct mutex
+{
+	volatile bool_t locked;
+	pid_t owner;
+	count_t depth;
+	struct wait_queue wq;
+};
+
+#define MUTEX_INIT		{0, 0, 0, {{0}}}
+
+/** Functions **/
+
+ui32_t irq_save();
+/****************************************************************/
+void irq_restore(ui32_t flags);
+/****************************************************************/
+bool_t irq_enabled();
+/****************************************************************/
+void spin_init(struct spinlock *lock);
+/****************************************************************/
+void spin_lock(struct spinlock *lock);
+/****************************************************************/
+void spin_unlock(struct spinlock *lock);
+/****************************************************************/
+ui32_t spin_lock_irqsave(struct spinlock *lock);
+/****************************************************************/
+void spin_unlock_irqrestore(struct spinlock *lock, ui32_t flags);
+/****************************************************************/
+void mutex_init(struct mutex *mutex);
+/****************************************************************/
+void mutex_lock(struct mutex *mutex);
+/****************************************************************/
+void mutex_unlock(struct mutex *mutex);
+
+#endif
@@ -13,8 +13,6 @@
 
 void pic_init()
 {
-	ui16_t div = 1193182 / CLK_FREQ;
-
 	/** Using ICW4 **/
 
 	outbt(PIC1_BASE, PIC_ICW1_DEFAULT | PIC_ICW1_WITH_ICW4);
@@ -40,9 +38,5 @@ void pic_init()
 	outbt(PIC1_BASE + 1, 0);
 	outbt(PIC2_BASE + 1, 0);
 
-	/** Set the clock frequency. **/
-
-	outb(0x43, 0x36);
-	outb(0x40, (ui8_t)div);
-	outb(0x40, (ui8_t)(div >> 8));
+	/** The PIT is programmed by hrtimer_init. **/
 }
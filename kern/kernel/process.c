@@ -10,6 +10,7 @@
 #include <kernel/errno.h>
 #include <kernel/libc.h>
 #include <kernel/panic.h>
+#include <kernel/schedule.h>
 #include <mm/paging.h>
 
 #include "process.h"
@@ -26,6 +27,7 @@ pid_t process_create(struct process *parent, void *code, size_t code_size)
 	       ustack_ppage, ustack_vpage;
 	struct pheap_page kstack_page;
 	si32_t fildes;
+	ui32_t vma;
 	/*struct fildes def_io = {
 		.used = 1,
 		.flags = O_RDWR | O_APPEND,
@@ -161,6 +163,11 @@ pid_t process_create(struct process *parent, void *code, size_t code_size)
 	                                        & ~3);
 	proc_tab[pid].e_heap = proc_tab[pid].b_heap;
 
+	for(vma = 0; vma < NR_VMAS_PER_PROC; vma++)
+	{
+		proc_tab[pid].vmas[vma].used = 0;
+	}
+
 		/** Process family. **/
 
 	proc_tab[pid].parent = parent;
@@ -195,7 +202,9 @@ pid_t process_create(struct process *parent, void *code, size_t code_size)
 
 		/** State and wait syscall stuff. **/
 
-	proc_tab[pid].state = PROC_READY;
+	proc_tab[pid].timer.pending = 0;
+	proc_tab[pid].sleep_tics = 0;
+	memset(&proc_tab[pid].child_wq, 0, sizeof(struct wait_queue));
 	proc_tab[pid].status = 0;
 	proc_tab[pid].reported = 0;
 
@@ -208,6 +217,14 @@ pid_t process_create(struct process *parent, void *code, size_t code_size)
 
 	proc_tab[pid].perrno = 0;
 
+		/** Accounting. **/
+
+	proc_tab[pid].utime = proc_tab[pid].stime = 0;
+	proc_tab[pid].cutime = proc_tab[pid].cstime = 0;
+	proc_tab[pid].nvcsw = proc_tab[pid].nivcsw = 0;
+	proc_tab[pid].minflt = proc_tab[pid].majflt = 0;
+	proc_tab[pid].nsyscalls = 0;
+
 		/** Debugging. **/
 
 	proc_tab[pid].sysc_num = 0;
@@ -234,6 +251,14 @@ pid_t process_create(struct process *parent, void *code, size_t code_size)
 		}
 	}
 
+	/** Make the process runnable. A son inherits the nice value and the
+	    interactivity of its parent. **/
+
+	proc_tab[pid].nice = parent ? parent->nice : 0;
+	proc_tab[pid].sleep_avg = parent ? parent->sleep_avg : 0;
+	proc_tab[pid].array = 0;
+	schedule_add(&proc_tab[pid]);
+
 	/** Update nproc. **/
 
 	nproc++;
@@ -262,3 +287,15 @@ pid_t process_create(struct process *parent, void *code, size_t code_size)
 	fail2:
 		return -1;
 }
+
+/**
+ * process_rusage
+ */
+
+void process_rusage(clock_t utime, clock_t stime, struct rusage *rusage)
+{
+	rusage->ru_utime.tv_sec = utime / CLK_FREQ;
+	rusage->ru_utime.tv_usec = (utime % CLK_FREQ) * (1000000 / CLK_FREQ);
+	rusage->ru_stime.tv_sec = stime / CLK_FREQ;
+	rusage->ru_stime.tv_usec = (stime % CLK_FREQ) * (1000000 / CLK_FREQ);
+}
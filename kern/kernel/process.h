@@ -3,9 +3,15 @@
 
 #include <config.h>
 #include <fs/file.h>
+#include <kernel/hrtimer.h>
 #include <kernel/signal.h>
+#ifdef ENABLE_SMP
+#include <kernel/smp.h>
+#endif
 #include <kernel/types.h>
+#include <kernel/wait.h>
 #include <mm/paging.h>
+#include <mm/vma.h>
 
 /** Registers structure. **/
 
@@ -41,6 +47,7 @@ struct process
 	ui32_t esp0;
 	void *b_heap;
 	void *e_heap;
+	struct vm_area vmas[NR_VMAS_PER_PROC];
 
 	struct process *parent;
 	struct process *first_son;
@@ -59,8 +66,31 @@ struct process
 		PROC_ZOMBIE,
 		PROC_NOT_RUNNABLE,
 		PROC_READY, // ready or running
-		PROC_SUSPENDED // suspended process
+		PROC_SUSPENDED, // suspended process
+		PROC_SLEEPING // waiting for an event (see kernel/wait.c)
 	} state;
+	struct hrtimer timer; // timeout of the sleep
+	clock_t sleep_tics; // beginning of the last sleep
+
+	/** Scheduling (see kernel/schedule.c). **/
+
+	si32_t nice;
+	ui32_t prio; // dynamic priority
+	count_t time_slice; // clock tics left
+	clock_t sleep_avg; // interactivity credit (in clock tics)
+	struct prio_array *array; // priority array (0 if not runnable)
+	struct process *rq_prev, *rq_next; // processes of the same priority
+	si32_t cpu; // processor running the process (NO_CPU if none)
+
+	/** Accounting. **/
+
+	clock_t utime, stime; // clock tics spent in user mode and in the kernel
+	clock_t cutime, cstime; // same for the waited-for sons
+	count_t nvcsw, nivcsw; // voluntary and involuntary context switches
+	count_t minflt, majflt; // page faults (major ones read from disk)
+	count_t nsyscalls;
+
+	struct wait_queue child_wq; // for wait4
 	int status; // Exit status
 	bool_t reported;
 	pid_t dead_son_pid;
@@ -71,26 +101,52 @@ struct process
 	ui32_t sysc_num;
 };
 
-/** Global variables. **/
+/** Constants. **/
+
+// The idle task of each processor has an entry following the processes in
+// proc_tab.
+#ifdef ENABLE_SMP
+#define IDLE_PID		(NR_PROC + smp_cpu_id())
+#else
+#define IDLE_PID		NR_PROC
+#endif
+
+// getrusage
+#define RUSAGE_SELF		0
+#define RUSAGE_CHILDREN		-1
+
+/** Global variables. Under SMP, the current process is that of the processor
+    running the code. **/
+
+#ifdef ENABLE_SMP
+#define current_pid		(cpu_tab[smp_cpu_id()].pid)
+#define current			(cpu_tab[smp_cpu_id()].proc)
+#endif
 
 #ifdef _PROCESS_C_
 count_t nproc = 0;
-struct process proc_tab[NR_PROC] = {
+struct process proc_tab[NR_PROC + NR_CPUS] = {
 	{
 		.used = 0
 	}
 };
+#ifndef ENABLE_SMP
 pid_t current_pid = 0;
 struct process *current = &proc_tab[0];
+#endif
 #else
 extern count_t nproc;
 extern struct process proc_tab[];
+#ifndef ENABLE_SMP
 extern pid_t current_pid;
 extern struct process *current;
 #endif
+#endif
 
 /** Functions **/
 
 pid_t process_create(struct process *parent, void *code, size_t code_size);
+/****************************************************************/
+void process_rusage(clock_t utime, clock_t stime, struct rusage *rusage);
 
 #endif
@@ -4,18 +4,33 @@
  *    Scheduling functions.                                     *
  *                                                              *
  ****************************************************************/
+#define _SCHEDULE_C_
 #include <config.h>
 #include <kernel/errno.h>
 #include <kernel/gdt.h>
+#include <kernel/hrtimer.h>
+#include <kernel/int.h>
+#include <kernel/io.h>
+#include <kernel/isr.h>
+#include <kernel/libc.h>
+#include <kernel/lock.h>
 #include <kernel/panic.h>
 #include <kernel/printk.h>
 #include <kernel/process.h>
+#include <kernel/timer.h>
+#include <mm/mem_map.h>
+#include <mm/paging.h>
 #ifdef INTERRUPTIBLE_SYSCALLS
 #include <fs/tty.h>
 #endif
 
 #include "schedule.h"
 
+struct prio_array prio_arrays[2];
+struct prio_array *active = &prio_arrays[0];
+struct prio_array *expired = &prio_arrays[1];
+clock_t expired_tics = 0; // since when processes are expired (0 if none)
+
 /**
  * schedule
  *
@@ -27,6 +42,7 @@ void schedule()
 {
 	ui32_t *ebp_isr; // EBP of the C interrupt service routine.
 	pid_t pid;
+	bool_t idle;
 
 	asm volatile("mov (%%ebp), %%eax \n\
 	              mov %%eax, %0" : "=m"(ebp_isr)
@@ -39,14 +55,30 @@ void schedule()
 		printk("no process\n");
 		#endif*/
 
+		hrtimer_reprogram(0);
 		return;
 	}
-	else if(nproc == 1)
+	else if(nproc == 1
+	     && current_pid != IDLE_PID
+	     && current->state == PROC_READY)
 	{
 		#ifdef DEBUG
 		printk("one process\n");
 		#endif
 
+		hrtimer_reprogram(0);
+		return;
+	}
+	else if(ebp_isr[15] == 0x08
+	     && current_pid != IDLE_PID
+	     && current->state != PROC_SLEEPING)
+	{
+		/** Kernel code is not preempted: a process interrupted in a
+		    system call keeps the processor until it sleeps or the
+		    system call returns (see _isr_syscall). **/
+
+		need_resched = 1;
+		hrtimer_reprogram(0);
 		return;
 	}
 	else
@@ -87,31 +119,560 @@ void schedule()
 		}*/
 	}
 
-	/** Choose a new process (round-robin). **/
+	/** Choose a new process and switch to it. Clock tics are not needed
+	    while idle, unless a timer is pending. **/
+
+	pid = schedule_pick();
+	idle = pid == IDLE_PID && !timer_nr_pending;
+
+	/** Under SMP, the PIT only interrupts the bootstrap processor. It
+	    skips clock tics once every processor is idle, and the others
+	    restart them when they leave their idle task. **/
+
+	#ifdef ENABLE_SMP
+	if(!smp_cpu_id())
+	{
+		hrtimer_reprogram(idle && smp_idle());
+	}
+	else if(pid != IDLE_PID)
+	{
+		hrtimer_reprogram(0);
+	}
+	#else
+	hrtimer_reprogram(idle);
+	#endif
+
+	schedule_switch(pid);
+}
+
+/**
+ * schedule_pick
+ *
+ *   Chooses the first process of the highest priority queue of the active
+ *   array, or the idle task if no process is runnable.
+ */
+
+pid_t schedule_pick()
+{
+	struct prio_array *array;
+	ui32_t prio;
+	#ifdef ENABLE_SMP
+	struct process *proc;
+	si32_t me = smp_cpu_id();
+	#endif
+
+	/** When every process of the active array has used its time slice,
+	    the arrays are exchanged. **/
+
+	if(!active->nr_active && expired->nr_active)
+	{
+		array = active;
+		active = expired;
+		expired = array;
+		expired_tics = 0;
+	}
+
+	if(!active->nr_active)
+	{
+		return IDLE_PID;
+	}
+
+	#ifdef ENABLE_SMP
+	/** The run queues are shared: skip the processes running on the other
+	    processors. **/
 
-	for(pid = current_pid + 1;
-	    pid != current_pid;
-	    pid = (pid + 1) % NR_PROC)
+	for(prio = 0; prio < NR_PRIO; prio++)
 	{
-		if(proc_tab[pid].used)
+		if(!(active->bitmap[prio / 32] & (1 << (prio % 32))))
 		{
-			if(proc_tab[pid].state == PROC_SUSPENDED
-			&& proc_tab[pid].sigset)
-			{
-				proc_tab[pid].state = PROC_READY;
-				//printk("desuspending %x\n", pid);
-			}
+			continue;
+		}
 
-			if(proc_tab[pid].state == PROC_READY)
+		proc = active->queue[prio];
+
+		do
+		{
+			if(proc->cpu == NO_CPU || proc->cpu == me)
 			{
-				break;
+				return proc->pid;
 			}
+
+			proc = proc->rq_next;
+		} while(proc != active->queue[prio]);
+	}
+
+	return IDLE_PID;
+	#else
+	prio = schedule_find_first(active);
+
+	return active->queue[prio]->pid;
+	#endif
+}
+
+/**
+ * schedule_find_first
+ */
+
+ui32_t schedule_find_first(struct prio_array *array)
+{
+	ui32_t i, bit;
+
+	for(i = 0; !array->bitmap[i]; i++);
+
+	asm volatile("bsf %1, %0" : "=r"(bit) : "m"(array->bitmap[i]));
+
+	return i * 32 + bit;
+}
+
+/**
+ * schedule_enqueue
+ */
+
+void schedule_enqueue(struct process *proc, struct prio_array *array)
+{
+	struct process **head = &array->queue[proc->prio];
+
+	if(proc->array)
+	{
+		panic("process %x already queued", proc->pid);
+	}
+
+	/** Insert the process at the end of the circular list of its
+	    priority. **/
+
+	if(!*head)
+	{
+		*head = proc->rq_next = proc->rq_prev = proc;
+	}
+	else
+	{
+		proc->rq_next = *head;
+		proc->rq_prev = (*head)->rq_prev;
+		(*head)->rq_prev->rq_next = proc;
+		(*head)->rq_prev = proc;
+	}
+
+	array->bitmap[proc->prio / 32] |= (1 << (proc->prio % 32));
+	array->nr_active++;
+	proc->array = array;
+}
+
+/**
+ * schedule_dequeue
+ */
+
+void schedule_dequeue(struct process *proc)
+{
+	struct prio_array *array = proc->array;
+	struct process **head;
+
+	if(!array)
+	{
+		return;
+	}
+
+	head = &array->queue[proc->prio];
+
+	if(proc->rq_next == proc)
+	{
+		*head = 0;
+		array->bitmap[proc->prio / 32] &= ~(1 << (proc->prio % 32));
+	}
+	else
+	{
+		proc->rq_prev->rq_next = proc->rq_next;
+		proc->rq_next->rq_prev = proc->rq_prev;
+
+		if(*head == proc)
+		{
+			*head = proc->rq_next;
 		}
 	}
 
-	/** Switch to the process. **/
+	array->nr_active--;
+	proc->array = 0;
+}
 
-	schedule_switch(pid);
+/**
+ * schedule_effective_prio
+ *
+ *   Priority of a process: its static priority (given by its nice value)
+ *   minus a bonus for processes which spend most of their time sleeping
+ *   (interactive ones) or plus a penalty for those which never sleep.
+ */
+
+ui32_t schedule_effective_prio(struct process *proc)
+{
+	si32_t bonus, prio;
+
+	bonus = (si32_t)(proc->sleep_avg * SCHED_MAX_BONUS / SCHED_MAX_SLEEP_AVG)
+	      - SCHED_MAX_BONUS / 2;
+	prio = NICE_TO_PRIO(proc->nice) - bonus;
+
+	if(prio < 0)
+	{
+		prio = 0;
+	}
+	else if(prio >= NR_PRIO)
+	{
+		prio = NR_PRIO - 1;
+	}
+
+	return prio;
+}
+
+/**
+ * schedule_time_slice
+ */
+
+count_t schedule_time_slice(struct process *proc)
+{
+	/** The time slice decreases linearly from SCHED_MAX_SLICE at the
+	    highest static priority to SCHED_MIN_SLICE at the lowest. **/
+
+	return SCHED_MIN_SLICE
+	     + (SCHED_MAX_SLICE - SCHED_MIN_SLICE)
+	     * (NR_PRIO - 1 - NICE_TO_PRIO(proc->nice)) / (NR_PRIO - 1);
+}
+
+/**
+ * schedule_add
+ */
+
+void schedule_add(struct process *proc)
+{
+	ui32_t flags = irq_save();
+
+	proc->state = PROC_READY;
+	proc->prio = schedule_effective_prio(proc);
+	proc->time_slice = schedule_time_slice(proc);
+	#ifdef ENABLE_SMP
+	proc->cpu = NO_CPU;
+	#endif
+	schedule_enqueue(proc, active);
+	irq_restore(flags);
+}
+
+/**
+ * schedule_sleep
+ */
+
+void schedule_sleep(struct process *proc)
+{
+	ui32_t flags = irq_save();
+
+	proc->sleep_tics = tics;
+	schedule_dequeue(proc);
+	irq_restore(flags);
+}
+
+/**
+ * schedule_wakeup
+ *
+ *   Only wakes up a sleeping process: a suspended one stays suspended until a
+ *   signal resumes it (see schedule_resume), even if an event it was waiting
+ *   for before being stopped comes.
+ */
+
+void schedule_wakeup(struct process *proc)
+{
+	clock_t slept;
+	ui32_t flags = irq_save();
+
+	if(proc->state != PROC_SLEEPING)
+	{
+		irq_restore(flags);
+		return;
+	}
+
+	/** Credit the time spent sleeping to the interactivity of the
+	    process. **/
+
+	slept = tics - proc->sleep_tics;
+	proc->sleep_avg = (slept >= SCHED_MAX_SLEEP_AVG - proc->sleep_avg)
+	                  ? SCHED_MAX_SLEEP_AVG
+	                  : proc->sleep_avg + slept;
+
+	proc->state = PROC_READY;
+	proc->prio = schedule_effective_prio(proc);
+	schedule_enqueue(proc, active);
+	irq_restore(flags);
+}
+
+/**
+ * schedule_resume
+ *
+ *   Resumes a process suspended by a signal.
+ */
+
+void schedule_resume(struct process *proc)
+{
+	ui32_t flags = irq_save();
+
+	if(proc->state == PROC_SUSPENDED)
+	{
+		proc->state = PROC_SLEEPING;
+		schedule_wakeup(proc);
+	}
+
+	irq_restore(flags);
+}
+
+/**
+ * schedule_boost
+ *
+ *   Gives the maximal interactivity bonus to the current process (e.g. after
+ *   it was woken up by terminal input).
+ */
+
+void schedule_boost()
+{
+	ui32_t flags;
+
+	if(current_pid == IDLE_PID || !current->array)
+	{
+		return;
+	}
+
+	flags = irq_save();
+	current->sleep_avg = SCHED_MAX_SLEEP_AVG;
+	schedule_requeue(current);
+	irq_restore(flags);
+}
+
+/**
+ * schedule_set_nice
+ */
+
+void schedule_set_nice(struct process *proc, si32_t nice)
+{
+	ui32_t flags;
+
+	if(nice < NICE_MIN)
+	{
+		nice = NICE_MIN;
+	}
+	else if(nice > NICE_MAX)
+	{
+		nice = NICE_MAX;
+	}
+
+	flags = irq_save();
+	proc->nice = nice;
+
+	if(proc->array)
+	{
+		schedule_requeue(proc);
+	}
+
+	irq_restore(flags);
+}
+
+/**
+ * schedule_prio_match
+ *
+ *   Tells whether a process is designated by the which and who arguments of
+ *   setpriority and getpriority. There is only one user (0).
+ */
+
+bool_t schedule_prio_match(struct process *proc, ui32_t which, ui32_t who)
+{
+	if(!proc->used || proc->state == PROC_ZOMBIE)
+	{
+		return 0;
+	}
+
+	switch(which)
+	{
+		case PRIO_PROCESS:
+			return proc->pid == (who ? (pid_t)who : current_pid);
+
+		case PRIO_PGRP:
+			return proc->pgid == (who ? (pid_t)who : current->pgid);
+
+		case PRIO_USER:
+			return !who;
+
+		default:
+			return 0;
+	}
+}
+
+/**
+ * schedule_requeue
+ */
+
+void schedule_requeue(struct process *proc)
+{
+	struct prio_array *array = proc->array;
+
+	schedule_dequeue(proc);
+	proc->prio = schedule_effective_prio(proc);
+	schedule_enqueue(proc, array);
+}
+
+/**
+ * schedule_tick
+ *
+ * called from the clock ISR
+ *
+ */
+
+void schedule_tick()
+{
+	ui32_t *ebp_isr; // EBP of the C interrupt service routine.
+
+	asm volatile("mov (%%ebp), %%eax \n\
+	              mov %%eax, %0" : "=m"(ebp_isr)
+	                             :
+	                             : "eax", "memory");
+
+	/** Charge the tick to the idle task, to user mode or to the kernel
+	    depending on what was interrupted. **/
+
+	if(current_pid == IDLE_PID)
+	{
+		idle_tics++;
+		return;
+	}
+	else if(ebp_isr[15] == 0x08)
+	{
+		system_tics++;
+		current->stime++;
+	}
+	else
+	{
+		user_tics++;
+		current->utime++;
+	}
+
+	if(!current->array)
+	{
+		return;
+	}
+
+	/** Running consumes the interactivity credit. **/
+
+	if(current->sleep_avg)
+	{
+		current->sleep_avg--;
+	}
+
+	if(current->time_slice && --current->time_slice)
+	{
+		return;
+	}
+
+	/** The time slice is used up. Interactive processes go back at the end
+	    of their queue in the active array, unless the expired processes
+	    have been waiting for too long. The others wait in the expired array
+	    until every process of the active array has run. **/
+
+	schedule_dequeue(current);
+	current->prio = schedule_effective_prio(current);
+	current->time_slice = schedule_time_slice(current);
+
+	if(current->prio + SCHED_INTERACTIVE_DELTA <= NICE_TO_PRIO(current->nice)
+	&& (!expired_tics || tics - expired_tics < SCHED_STARVATION_LIMIT))
+	{
+		schedule_enqueue(current, active);
+	}
+	else
+	{
+		if(!expired_tics)
+		{
+			expired_tics = tics;
+		}
+
+		schedule_enqueue(current, expired);
+	}
+}
+
+/**
+ * schedule_idle
+ *
+ *   Code of the idle task: halts the processor until an interrupt occurs and
+ *   gives the processor back as soon as a process is runnable.
+ */
+
+void schedule_idle()
+{
+	pid_t pid;
+
+	while(1)
+	{
+		cli;
+
+		/** The idle task does not hold the kernel lock (see
+		    smp_lock_kernel), except to look at the run queues. **/
+
+		#ifdef ENABLE_SMP
+		smp_lock_kernel();
+		pid = schedule_pick();
+		smp_unlock_kernel();
+		#else
+		pid = schedule_pick();
+		#endif
+
+		if(pid != IDLE_PID)
+		{
+			sti;
+			yield;
+		}
+		else
+		{
+			/** sti only takes effect after the next instruction,
+			    so no interrupt can be lost before hlt. **/
+
+			asm volatile("sti \n\
+			              hlt");
+		}
+	}
+}
+
+/**
+ * schedule_init
+ */
+
+ret_t schedule_init()
+{
+	struct process *idle;
+	struct pheap_page kstack_page;
+	pid_t pid;
+
+	/** Each processor has its own idle task. It only runs in kernel mode,
+	    on its own stack, and is not counted in nproc. **/
+
+	for(pid = NR_PROC; pid < NR_PROC + NR_CPUS; pid++)
+	{
+		idle = &proc_tab[pid];
+		kstack_page = paging_valloc(1);
+
+		if(!kstack_page.vpage)
+		{
+			return -ENOMEM;
+		}
+
+		memset(idle, 0, sizeof(struct process));
+
+		idle->regs.gs = idle->regs.fs = idle->regs.es = 0x10;
+		idle->regs.ds = 0x10;
+		idle->regs.eip = (ui32_t)schedule_idle;
+		idle->regs.cs = 0x08;
+		idle->regs.eflags = 0x202;
+		idle->regs.esp = (kstack_page.vpage << 12) + 4092;
+		idle->regs.ss = 0x18;
+		idle->pd = (ui32_t*)KERNEL_PD_BASE;
+
+		idle->used = 1;
+		idle->pid = pid;
+		idle->kstack_page = kstack_page;
+		idle->esp0 = (kstack_page.vpage << 12) + 4092;
+		idle->parent = idle;
+		idle->state = PROC_READY;
+	}
+
+	return OK;
 }
 
 /**
@@ -173,20 +734,67 @@ void schedule_switch(pid_t pid)
 {
 	ui32_t kesp;
 	ui32_t sig;
+	struct process *next;
+	volatile ui32_t *unlock = 0; // kernel lock to release (SMP)
+
+	/** System calls switch from process context: interrupts stay
+	    disabled until the next process resumes. **/
 
-	if(pid >= NR_PROC)
+	cli;
+
+	if(pid >= NR_PROC + NR_CPUS)
 	{
 		panic("invalid pid %x", pid);
 	}
 
+	need_resched = 0;
+
+	/** The idle task keeps the address space of the process it replaces,
+	    so that switching to it and back does not flush the TLB. Page
+	    directories are only destroyed after switching to the kernel one.
+	    Under SMP, the process may go on running on another processor and
+	    exit there, so the idle task keeps the kernel page directory. **/
+
+	#ifndef ENABLE_SMP
+	if(pid == IDLE_PID)
+	{
+		proc_tab[IDLE_PID].pd = paging_get_pd();
+	}
+	#endif
+
+	/** A process leaving the processor while still runnable was
+	    preempted. **/
+
+	if(current != &proc_tab[pid])
+	{
+		if(current->state == PROC_READY && current->array)
+		{
+			current->nivcsw++;
+		}
+		else
+		{
+			current->nvcsw++;
+		}
+	}
+
 	/** Change current_pid **/
 
+	#ifdef ENABLE_SMP
+	current->cpu = NO_CPU;
+	proc_tab[pid].cpu = smp_cpu_id();
+	#endif
+
 	current_pid = pid;
 	current = &proc_tab[pid];
+	next = current;
 
 	/** Update TSS. **/
 
+	#ifdef ENABLE_SMP
+	cpu_tab[smp_cpu_id()].tss->esp0 = current->esp0;
+	#else
 	default_tss.esp0 = current->esp0;
+	#endif
 
 	/** Handle first signal if the process we want to switch to is not the
 	    root process and if it is currently in user mode. **/
@@ -249,6 +857,36 @@ void schedule_switch(pid_t pid)
 		kesp = current->esp0;
 	}
 
+	/** The address space is only reloaded if it changes: reloading cr3
+	    flushes the user part of the TLB. **/
+
+	nr_switches++;
+
+	if(current->pd != paging_get_pd())
+	{
+		nr_cr3_loads++;
+	}
+
+	/** The kernel lock is released when going back to user mode or to the
+	    idle task, once the stack of the previous process is left. **/
+
+	#ifdef ENABLE_SMP
+	if(kernel_lock == smp_cpu_id() + 1
+	&& (current->regs.cs != 0x08 || pid == IDLE_PID))
+	{
+		unlock = &kernel_lock;
+	}
+	#endif
+
+	/** Acknowledge the interrupt being serviced, since the wrapper which
+	    would do it is not returned to. **/
+
+	#ifdef ENABLE_SMP
+	smp_eoi();
+	#else
+	outb(0x20, 0x20);
+	#endif
+
 	/** Do the actual switch. **/
 
 	asm volatile("mov $0x18, %%ax \n\
@@ -275,11 +913,17 @@ void schedule_switch(pid_t pid)
 	              pushl 0x8(%%esi) \n\
 	              pushl 0x4(%%esi) \n\
 	              pushl (%%esi) \n\
-	              cli \n\
-	              mov $0x20, %%al \n\
-	              out %%al, $0x20 \n\
 	              mov 0x40(%%esi), %%eax \n\
+	              mov %%cr3, %%edx \n\
+	              cmp %%eax, %%edx \n\
+	              je same_pd \n\
 	              mov %%eax, %%cr3 \n\
+	              same_pd: \n\
+	              mov %2, %%eax \n\
+	              test %%eax, %%eax \n\
+	              jz no_unlock \n\
+	              movl $0, (%%eax) \n\
+	              no_unlock: \n\
 	              popl %%gs \n\
 	              popl %%fs \n\
 	              popl %%es \n\
@@ -291,5 +935,5 @@ void schedule_switch(pid_t pid)
 	              popl %%edx \n\
 	              popl %%ecx \n\
 	              popl %%eax \n\
-	              iretl" :: "m"(kesp), "m"(current));
+	              iretl" :: "m"(kesp), "m"(next), "m"(unlock) : "memory");
 }
@@ -1,12 +1,97 @@
 #ifndef _SCHEDULE_H_
 #define _SCHEDULE_H_
 
+#include <config.h>
 #include <kernel/types.h>
 
+/** Constants. **/
+
+#define NICE_MIN		-20
+#define NICE_MAX		19
+// Priorities go from 0 (highest) to NR_PRIO - 1 (lowest).
+#define NR_PRIO			(NICE_MAX - NICE_MIN + 1)
+#define NICE_TO_PRIO(nice)	((nice) - NICE_MIN)
+// Range of the dynamic priority bonus
+#define SCHED_MAX_BONUS		10
+// Bonus above which a process is considered interactive
+#define SCHED_INTERACTIVE_DELTA	2
+
+// setpriority and getpriority
+#define PRIO_PROCESS		0
+#define PRIO_PGRP		1
+#define PRIO_USER		2
+
+/** Priority array: a queue of runnable processes per priority and a bitmap
+    of the non-empty queues. **/
+
+struct process;
+struct registers;
+
+struct prio_array
+{
+	count_t nr_active;
+	ui32_t bitmap[(NR_PRIO + 31) / 32];
+	struct process *queue[NR_PRIO];
+};
+
+/** Global variables (number of context switches and of address space
+    reloads, clock ticks spent idle, in user mode and in the kernel, switch
+    deferred until the current system call returns). **/
+
+#ifdef _SCHEDULE_C_
+volatile bool_t need_resched = 0;
+count_t nr_switches = 0;
+count_t nr_cr3_loads = 0;
+clock_t idle_tics = 0;
+clock_t user_tics = 0;
+clock_t system_tics = 0;
+#else
+extern volatile bool_t need_resched;
+extern count_t nr_switches;
+extern count_t nr_cr3_loads;
+extern clock_t idle_tics;
+extern clock_t user_tics;
+extern clock_t system_tics;
+#endif
+
 /** Functions. **/
 
 void schedule();
 /****************************************************************/
+pid_t schedule_pick();
+/****************************************************************/
+ui32_t schedule_find_first(struct prio_array *array);
+/****************************************************************/
+void schedule_enqueue(struct process *proc, struct prio_array *array);
+/****************************************************************/
+void schedule_dequeue(struct process *proc);
+/****************************************************************/
+ui32_t schedule_effective_prio(struct process *proc);
+/****************************************************************/
+count_t schedule_time_slice(struct process *proc);
+/****************************************************************/
+void schedule_add(struct process *proc);
+/****************************************************************/
+void schedule_sleep(struct process *proc);
+/****************************************************************/
+void schedule_wakeup(struct process *proc);
+/****************************************************************/
+void schedule_resume(struct process *proc);
+/****************************************************************/
+void schedule_boost();
+/****************************************************************/
+void schedule_set_nice(struct process *proc, si32_t nice);
+/****************************************************************/
+bool_t schedule_prio_match(struct process *proc, ui32_t which, ui32_t who);
+/****************************************************************/
+void schedule_requeue(struct process *proc);
+/****************************************************************/
+void schedule_tick();
+/****************************************************************/
+void schedule_idle();
+/****************************************************************/
+ret_t schedule_init();
+/****************************************************************/
 void schedule_save_regs(struct registers *regs, ui32_t *ebp_isr, bool_t exc);
 /****************************************************************/
 void schedule_switch(pid_t pid);
@@ -9,6 +9,7 @@
 #ifdef DEBUG
 #include <kernel/libc.h>
 #endif
+#include <kernel/hrtimer.h>
 #include <kernel/panic.h>
 #include <kernel/printk.h>
 #include <kernel/process.h>
@@ -98,8 +99,13 @@ void signal_handle(ui32_t sig)
 		{
 			//printk("freeing the terminal\n");
 			reader_pid = 0;
+			wait_wake(&tty_ififo2.wq);
 		}
 
+		/** The timeout of an interrupted sleep will not be used. **/
+
+		hrtimer_cancel(&current->timer);
+
 		current->interruptible = 0;
 	}
 	#endif
@@ -132,13 +138,17 @@ void signal_handle(ui32_t sig)
 
 				current->parent->sigset
 				 |= (1 << (SIGCHLD - 1));
+				signal_wake(current->parent);
+
 				current->parent->dead_son_pid = current_pid;
 				current->parent->dead_son_status
 				 = (ui8_t)sig << 8 | 0x7f;
 				current->status = (ui8_t)sig << 8 | 0x7f;
 				current->reported = 0;
 				current->state = PROC_SUSPENDED;
-				schedule_switch(0);
+				schedule_sleep(current);
+				wait_wake(&current->parent->child_wq);
+				schedule_switch(schedule_pick());
 				break;
 
 			default:
@@ -217,9 +227,33 @@ count_t signal_send_pgrp(ui32_t sig, pid_t pgid)
 		if(proc_tab[pid].used && proc_tab[pid].pgid == pgid)
 		{
 			proc_tab[pid].sigset |= (1 << (sig - 1));
+			signal_wake(&proc_tab[pid]);
 			killed++;
 		}
 	}
 
 	return killed;
 }
+
+/**
+ * signal_wake
+ *
+ *   Called after posting a signal to a process: a pending signal resumes a
+ *   suspended process and interrupts the sleep of an interruptible one.
+ */
+
+void signal_wake(struct process *proc)
+{
+	if(proc->state == PROC_SUSPENDED)
+	{
+		schedule_resume(proc);
+	}
+	#ifdef INTERRUPTIBLE_SYSCALLS
+	else if(proc->state == PROC_SLEEPING
+	     && proc->interruptible
+	     && (proc->sigset & ~proc->sigmask))
+	{
+		schedule_wakeup(proc);
+	}
+	#endif
+}
@@ -57,10 +57,14 @@ struct sigaction
 
 /** Functions **/
 
+struct process;
+
 ui32_t signal_dequeue(sigset_t sigset, sigset_t sigmask);
 /****************************************************************/
 void signal_handle(ui32_t sig);
 /****************************************************************/
 count_t signal_send_pgrp(ui32_t sig, pid_t pgid);
+/****************************************************************/
+void signal_wake(struct process *proc);
 
 #endif
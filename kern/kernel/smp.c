@@ -0,0 +1,791 @@
+/****************************************************************
+ * smp.c                                                        *
+ *                                                              *
+ *    Multiprocessor support: local APICs, startup of the       *
+ *    application processors, big kernel lock.                  *
+ *                                                              *
+ ****************************************************************/
+
+#define _SMP_C_
+#include <config.h>
+#include <kernel/errno.h>
+#include <kernel/int.h>
+#include <kernel/io.h>
+#include <kernel/libc.h>
+#include <kernel/printk.h>
+#include <kernel/process.h>
+#include <kernel/schedule.h>
+#include <mm/paging.h>
+
+#include "smp.h"
+
+struct cpu cpu_tab[NR_CPUS] = {
+	{
+		.online = 1,
+		.pid = 0,
+		.proc = &proc_tab[0],
+		.tss = &default_tss
+	}
+};
+struct tss smp_tss[NR_CPUS]; // TSS of the application processors
+ui8_t smp_table[SMP_TABLE_SIZE]; // copy of the ACPI or MP table being read
+
+/**
+ * smp_cpu_id
+ *
+ *   Each processor has its own TSS, so the task register tells which one is
+ *   running. It is not loaded yet when the kernel starts, on the bootstrap
+ *   processor.
+ */
+
+ui32_t smp_cpu_id()
+{
+	ui32_t tr = 0;
+
+	asm volatile("str %%ax" : "=a"(tr));
+
+	tr &= 0xffff;
+
+	return tr > (GDT_TSS_ENTRY << 3) ? (tr >> 3) - GDT_TSS_ENTRY : 0;
+}
+
+/**
+ * smp_read_phys
+ *
+ *   Copies physical memory which may lie outside the identity-mapped area
+ *   (e.g. ACPI tables at the end of the RAM).
+ */
+
+void smp_read_phys(void *buf, ui32_t paddr, size_t size)
+{
+	ui32_t *pte = &page_table(page_table_id(smp_window))[page_id(smp_window)];
+	size_t chunk;
+
+	while(size)
+	{
+		chunk = 4096 - (paddr & 0xfff);
+
+		if(chunk > size)
+		{
+			chunk = size;
+		}
+
+		*pte = (paddr & 0xfffff000) | PAGING_PRESENT;
+		smp_flush_local(smp_window);
+		memcpy(buf, (void*)((smp_window << 12) | (paddr & 0xfff)), chunk);
+
+		buf += chunk;
+		paddr += chunk;
+		size -= chunk;
+	}
+
+	*pte = 0;
+	smp_flush_local(smp_window);
+}
+
+/**
+ * smp_checksum
+ */
+
+ui8_t smp_checksum(ui8_t *data, size_t size)
+{
+	ui8_t sum = 0;
+
+	while(size--)
+	{
+		sum += *data++;
+	}
+
+	return sum;
+}
+
+/**
+ * smp_scan
+ *
+ *   Looks for a structure (16-byte aligned, with a null checksum) in the
+ *   first megabyte of memory, which is identity-mapped.
+ */
+
+ui32_t smp_scan(ui32_t base, size_t size, uchar_t *signature, size_t length)
+{
+	ui32_t addr;
+
+	for(addr = base; addr + length <= base + size; addr += 16)
+	{
+		if(!memcmp((void*)addr, signature, strlen(signature))
+		&& !smp_checksum((ui8_t*)addr, length))
+		{
+			return addr;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * smp_add_cpu
+ */
+
+void smp_add_cpu(ui8_t apic_id)
+{
+	struct cpu *cpu;
+	ui32_t id;
+
+	/** The bootstrap processor is always the first one. **/
+
+	if(apic_id == cpu_tab[0].apic_id || smp_nr_cpus == NR_CPUS)
+	{
+		return;
+	}
+
+	id = smp_nr_cpus++;
+	cpu = &cpu_tab[id];
+
+	cpu->apic_id = apic_id;
+	cpu->online = 0;
+	cpu->pid = NR_PROC + id;
+	cpu->proc = &proc_tab[NR_PROC + id];
+	cpu->tss = &smp_tss[id];
+	cpu->tlb_gen = smp_tlb_gen;
+}
+
+/**
+ * smp_parse_madt
+ *
+ *   Finds the processors in the ACPI MADT.
+ */
+
+ret_t smp_parse_madt()
+{
+	struct acpi_rsdp *rsdp;
+	struct acpi_header rsdt;
+	struct acpi_madt *madt = (struct acpi_madt*)smp_table;
+	ui32_t addr, table = 0, i;
+	size_t size;
+	ui8_t *entry;
+
+	addr = smp_scan(*(ui16_t*)0x40e << 4,
+	                1024,
+	                "RSD PTR ",
+	                sizeof(struct acpi_rsdp));
+
+	if(!addr)
+	{
+		addr = smp_scan(0xe0000,
+		                0x20000,
+		                "RSD PTR ",
+		                sizeof(struct acpi_rsdp));
+	}
+
+	if(!addr)
+	{
+		return -ENOENT;
+	}
+
+	rsdp = (struct acpi_rsdp*)addr;
+	smp_read_phys(&rsdt, rsdp->rsdt, sizeof(struct acpi_header));
+
+	for(i = 0; i < (rsdt.length - sizeof(struct acpi_header)) / 4; i++)
+	{
+		smp_read_phys(&table,
+		              rsdp->rsdt + sizeof(struct acpi_header) + 4 * i,
+		              4);
+		smp_read_phys(madt, table, sizeof(struct acpi_header));
+
+		if(!memcmp(madt->header.signature, "APIC", 4))
+		{
+			break;
+		}
+
+		table = 0;
+	}
+
+	if(!table)
+	{
+		return -ENOENT;
+	}
+
+	size = madt->header.length < SMP_TABLE_SIZE
+	       ? madt->header.length
+	       : SMP_TABLE_SIZE;
+	smp_read_phys(smp_table, table, size);
+
+	/** Entries are variable-sized: type, length, contents. **/
+
+	for(entry = smp_table + sizeof(struct acpi_madt);
+	    entry + 8 <= smp_table + size && entry[1] >= 2;
+	    entry += entry[1])
+	{
+		if(entry[0] == MADT_LAPIC
+		&& (*(ui32_t*)(entry + 4) & MADT_LAPIC_ENABLED))
+		{
+			smp_add_cpu(entry[3]);
+		}
+	}
+
+	return OK;
+}
+
+/**
+ * smp_parse_mp
+ *
+ *   Finds the processors in the MP configuration table (older machines).
+ */
+
+ret_t smp_parse_mp()
+{
+	struct mp_floating *mpf;
+	struct mp_config *config = (struct mp_config*)smp_table;
+	struct mp_processor *proc;
+	ui32_t addr, i;
+	size_t size;
+	ui8_t *entry;
+
+	addr = smp_scan(*(ui16_t*)0x40e << 4,
+	                1024,
+	                "_MP_",
+	                sizeof(struct mp_floating));
+
+	if(!addr)
+	{
+		addr = smp_scan((*(ui16_t*)0x413 << 10) - 1024,
+		                1024,
+		                "_MP_",
+		                sizeof(struct mp_floating));
+	}
+
+	if(!addr)
+	{
+		addr = smp_scan(0xf0000,
+		                0x10000,
+		                "_MP_",
+		                sizeof(struct mp_floating));
+	}
+
+	if(!addr)
+	{
+		return -ENOENT;
+	}
+
+	mpf = (struct mp_floating*)addr;
+
+	/** Default configurations have no table and two processors. **/
+
+	if(!mpf->config)
+	{
+		smp_add_cpu(0);
+		smp_add_cpu(1);
+
+		return OK;
+	}
+
+	smp_read_phys(config, mpf->config, sizeof(struct mp_config));
+
+	if(memcmp(config->signature, "PCMP", 4))
+	{
+		return -EINVAL;
+	}
+
+	size = config->length < SMP_TABLE_SIZE
+	       ? config->length
+	       : SMP_TABLE_SIZE;
+	smp_read_phys(smp_table, mpf->config, size);
+
+	/** Processor entries take 20 bytes, the other ones 8. **/
+
+	entry = smp_table + sizeof(struct mp_config);
+
+	for(i = 0;
+	    i < config->entry_count && entry + 8 <= smp_table + size;
+	    i++)
+	{
+		if(entry[0] == MP_PROCESSOR)
+		{
+			proc = (struct mp_processor*)entry;
+
+			if(proc->flags & MP_PROCESSOR_ENABLED)
+			{
+				smp_add_cpu(proc->apic_id);
+			}
+
+			entry += sizeof(struct mp_processor);
+		}
+		else
+		{
+			entry += 8;
+		}
+	}
+
+	return OK;
+}
+
+/**
+ * smp_lapic_init
+ */
+
+void smp_lapic_init(bool_t bsp)
+{
+	lapic_write(LAPIC_TPR, 0);
+	lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+	lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+
+	/** The PIC is wired to the bootstrap processor (virtual wire mode),
+	    which keeps the PIT as its clock. The other processors get their
+	    clock tics from their local APIC timer. **/
+
+	if(bsp)
+	{
+		lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_EXTINT);
+		lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+		lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+	}
+	else
+	{
+		lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+		lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+		lapic_write(LAPIC_TIMER_DIV, LAPIC_DIV_16);
+		lapic_write(LAPIC_LVT_TIMER,
+		            LAPIC_LVT_PERIODIC | LAPIC_TIMER_VECTOR);
+		lapic_write(LAPIC_TIMER_INIT, smp_lapic_tic);
+	}
+}
+
+/**
+ * smp_lapic_calibrate
+ *
+ *   Counts the local APIC timer decrements during a clock tic, measured with
+ *   the PIT.
+ */
+
+void smp_lapic_calibrate()
+{
+	ui64_t start;
+
+	hrtimer_reprogram(0);
+	start = hrtimer_now();
+
+	lapic_write(LAPIC_TIMER_DIV, LAPIC_DIV_16);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+	lapic_write(LAPIC_TIMER_INIT, 0xffffffff);
+
+	while(hrtimer_now() - start < HRTIMER_TICK);
+
+	smp_lapic_tic = 0xffffffff - lapic_read(LAPIC_TIMER_CUR);
+	smp_lapic_rate = smp_lapic_tic / (1000000 / CLK_FREQ);
+
+	if(!smp_lapic_rate)
+	{
+		smp_lapic_rate = 1;
+	}
+
+	lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+/**
+ * smp_delay
+ *
+ *   Busy-waits with the local APIC timer of the bootstrap processor.
+ */
+
+void smp_delay(ui32_t usec)
+{
+	lapic_write(LAPIC_TIMER_INIT, usec * smp_lapic_rate);
+
+	while(lapic_read(LAPIC_TIMER_CUR))
+	{
+		asm volatile("pause");
+	}
+}
+
+/**
+ * smp_ipi
+ */
+
+void smp_ipi(ui8_t apic_id, ui32_t icr)
+{
+	lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+	lapic_write(LAPIC_ICR_LOW, icr);
+
+	while(lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING)
+	{
+		asm volatile("pause");
+	}
+}
+
+/**
+ * smp_boot_ap
+ */
+
+ret_t smp_boot_ap(ui32_t id)
+{
+	struct cpu *cpu = &cpu_tab[id];
+	struct pheap_page stack;
+	count_t i;
+
+	stack = paging_valloc(1);
+
+	if(!stack.vpage)
+	{
+		return -ENOMEM;
+	}
+
+	gdt_set_tss(GDT_TSS_ENTRY + id, cpu->tss);
+
+	smp_booting = id;
+	smp_ap_stack = (stack.vpage << 12) + 4092;
+
+	/** INIT, then two STARTUP IPIs as the MP specification says. **/
+
+	smp_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+	smp_delay(10000);
+
+	for(i = 0; i < 2 && !cpu->online; i++)
+	{
+		smp_ipi(cpu->apic_id,
+		        LAPIC_ICR_STARTUP
+		      | LAPIC_ICR_ASSERT
+		      | (SMP_TRAMPOLINE_BASE >> 12));
+		smp_delay(200);
+	}
+
+	for(i = 0; i < 100 && !cpu->online; i++)
+	{
+		smp_delay(1000);
+	}
+
+	/** The stack is not freed on failure: the processor may still start
+	    later. **/
+
+	return cpu->online ? OK : -EIO;
+}
+
+/**
+ * smp_init
+ *
+ *   Called on the bootstrap processor once the idle tasks exist. It keeps the
+ *   kernel lock until it switches to the first process.
+ */
+
+ret_t smp_init()
+{
+	struct pheap_page lapic_page, window_page;
+	ui32_t features, base_lo, base_hi, id;
+
+	smp_lock_kernel();
+
+	asm volatile("mov $1, %%eax \n\
+	              cpuid" : "=d"(features) :: "eax", "ebx", "ecx");
+
+	if(!(features & CPUID_APIC))
+	{
+		return -ENODEV;
+	}
+
+	/** Map the local APIC registers (uncached) and a window for the
+	    tables. **/
+
+	lapic_page = paging_valloc(0);
+	window_page = paging_valloc(0);
+
+	if(!lapic_page.vpage || !window_page.vpage)
+	{
+		return -ENOMEM;
+	}
+
+	asm volatile("rdmsr" : "=a"(base_lo), "=d"(base_hi)
+	                     : "c"(IA32_APIC_BASE_MSR));
+
+	page_table(page_table_id(lapic_page.vpage))[page_id(lapic_page.vpage)]
+		= (base_lo & 0xfffff000)
+		| PAGING_PRESENT
+		| PAGING_RW
+		| PAGING_PWT
+		| PAGING_PCD
+		| PAGING_GLOBAL;
+
+	smp_lapic = lapic_page.vpage << 12;
+	smp_window = window_page.vpage;
+
+	cpu_tab[0].apic_id = lapic_read(LAPIC_ID) >> 24;
+	smp_lapic_init(1);
+
+	if(smp_parse_madt() != OK && smp_parse_mp() != OK)
+	{
+		return -ENOENT;
+	}
+
+	if(smp_nr_cpus == 1)
+	{
+		return OK;
+	}
+
+	smp_lapic_calibrate();
+
+	memcpy((void*)SMP_TRAMPOLINE_BASE,
+	       smp_trampoline,
+	       smp_trampoline_end - smp_trampoline);
+
+	for(id = 1; id < smp_nr_cpus; id++)
+	{
+		if(smp_boot_ap(id) != OK)
+		{
+			printk("cpu %x did not start\n", id);
+		}
+	}
+
+	return OK;
+}
+
+/**
+ * smp_ap_main
+ *
+ *   Entry of the application processors (called by the trampoline with
+ *   paging enabled and the kernel page directory).
+ */
+
+void smp_ap_main()
+{
+	ui32_t id = smp_booting;
+	struct cpu *cpu = &cpu_tab[id];
+
+	asm volatile("lidt (idt_descript) \n\
+	              ltr %%ax" :: "a"((GDT_TSS_ENTRY + id) << 3));
+
+	paging_enable_global();
+
+	#ifdef ENABLE_FPU
+	asm volatile("finit");
+	#endif
+
+	smp_lapic_init(0);
+
+	cpu->tlb_gen = smp_tlb_gen;
+	cpu->online = 1;
+	smp_nr_online++;
+
+	/** Wait for processes in the idle task. **/
+
+	schedule_switch(IDLE_PID);
+}
+
+/**
+ * smp_idle
+ *
+ *   Tells whether every application processor runs its idle task.
+ */
+
+bool_t smp_idle()
+{
+	ui32_t id;
+
+	for(id = 1; id < smp_nr_cpus; id++)
+	{
+		if(cpu_tab[id].online && cpu_tab[id].pid < NR_PROC)
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * smp_lock_kernel
+ *
+ *   Takes the big kernel lock: a processor holds it while it runs kernel code
+ *   (except the idle task). It is taken on interrupts and released when
+ *   going back to user mode or to the idle task (see smp_isr_leave and
+ *   schedule_switch).
+ */
+
+void smp_lock_kernel()
+{
+	struct cpu *cpu;
+	ui32_t id = smp_cpu_id(), eflags, owner;
+	bool_t contended = 0;
+
+	if(kernel_lock == id + 1)
+	{
+		return;
+	}
+
+	cpu = &cpu_tab[id];
+
+	asm volatile("pushf \n\
+	              pop %0" : "=r"(eflags));
+	cli;
+
+	/** A processor spinning with interrupts disabled cannot take TLB
+	    shootdown requests: it flushes its TLB once it gets the lock. **/
+
+	cpu->lock_wait = 1;
+
+	while(1)
+	{
+		asm volatile("lock cmpxchgl %2, %1" : "=a"(owner),
+		                                      "+m"(kernel_lock)
+		                                    : "r"(id + 1), "0"(0)
+		                                    : "memory");
+
+		if(!owner)
+		{
+			break;
+		}
+
+		contended = 1;
+
+		while(kernel_lock)
+		{
+			asm volatile("pause");
+		}
+	}
+
+	cpu->lock_wait = 0;
+
+	if(contended)
+	{
+		kernel_lock_contended++;
+	}
+
+	if(cpu->tlb_gen != smp_tlb_gen)
+	{
+		cpu->tlb_gen = smp_tlb_gen;
+		smp_flush_local(SMP_TLB_ALL);
+	}
+
+	if(eflags & 0x200)
+	{
+		sti;
+	}
+}
+
+/**
+ * smp_unlock_kernel
+ */
+
+void smp_unlock_kernel()
+{
+	if(kernel_lock == smp_cpu_id() + 1)
+	{
+		asm volatile("" ::: "memory");
+		kernel_lock = 0;
+	}
+}
+
+/**
+ * smp_isr_leave
+ *
+ *   Called by the interrupt wrappers before iret: the lock is kept if kernel
+ *   code was interrupted. Interrupts stay disabled until iret, so that the
+ *   lock is not taken again on the way out.
+ */
+
+void smp_isr_leave(ui32_t cs)
+{
+	if(cs == 0x08 && current_pid != IDLE_PID)
+	{
+		return;
+	}
+
+	cli;
+	smp_unlock_kernel();
+}
+
+/**
+ * smp_flush_local
+ */
+
+void smp_flush_local(ui32_t vpage)
+{
+	ui32_t cr4;
+
+	if(vpage != SMP_TLB_ALL)
+	{
+		asm volatile("invlpg (%0)" :: "r"(vpage << 12) : "memory");
+		return;
+	}
+
+	/** Toggling PGE also flushes the global entries. **/
+
+	asm volatile("mov %%cr4, %0" : "=r"(cr4));
+
+	if(cr4 & CR4_PGE)
+	{
+		asm volatile("mov %0, %%cr4 \n\
+		              mov %1, %%cr4" :: "r"(cr4 & ~CR4_PGE), "r"(cr4)
+		                             : "memory");
+	}
+	else
+	{
+		asm volatile("mov %%cr3, %%eax \n\
+		              mov %%eax, %%cr3" ::: "eax", "memory");
+	}
+}
+
+/**
+ * smp_tlb_shootdown
+ *
+ *   Makes the other processors invalidate a page (or their whole TLB) after
+ *   a mapping was changed. The kernel lock must be held.
+ */
+
+void smp_tlb_shootdown(ui32_t vpage)
+{
+	ui32_t id, me, eflags;
+
+	if(smp_nr_online < 2)
+	{
+		return;
+	}
+
+	me = smp_cpu_id();
+
+	asm volatile("pushf \n\
+	              pop %0" : "=r"(eflags));
+	cli;
+
+	smp_tlb_vpage = vpage;
+	smp_tlb_gen++;
+	cpu_tab[me].tlb_gen = smp_tlb_gen;
+
+	smp_ipi(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT | IPI_TLB_VECTOR);
+
+	for(id = 0; id < smp_nr_cpus; id++)
+	{
+		if(id == me || !cpu_tab[id].online)
+		{
+			continue;
+		}
+
+		while(cpu_tab[id].tlb_gen != smp_tlb_gen
+		   && !cpu_tab[id].lock_wait)
+		{
+			asm volatile("pause");
+		}
+	}
+
+	if(eflags & 0x200)
+	{
+		sti;
+	}
+}
+
+/**
+ * smp_eoi
+ *
+ *   Acknowledges the interrupt being serviced when its wrapper is not
+ *   returned to (see schedule_switch).
+ */
+
+void smp_eoi()
+{
+	if(!smp_cpu_id())
+	{
+		outb(0x20, 0x20);
+	}
+
+	if(smp_lapic)
+	{
+		lapic_write(LAPIC_EOI, 0);
+	}
+}
@@ -0,0 +1,238 @@
+#ifndef _SMP_H_
+#define _SMP_H_
+
+#include <config.h>
+#include <kernel/gdt.h>
+#include <kernel/types.h>
+
+/** Constants **/
+
+// Physical page the application processors start at (in real mode)
+#define SMP_TRAMPOLINE_BASE	0x8000
+// Largest ACPI or MP configuration table read
+#define SMP_TABLE_SIZE		4096
+// smp_tlb_shootdown: flush every user mapping instead of a single page
+#define SMP_TLB_ALL		0xffffffff
+// No processor runs the process.
+#define NO_CPU			-1
+
+/** Interrupt vectors **/
+
+#define LAPIC_TIMER_VECTOR	0x40
+#define IPI_TLB_VECTOR		0x41
+#define LAPIC_SPURIOUS_VECTOR	0xff
+
+/** Local APIC registers and flags **/
+
+#define IA32_APIC_BASE_MSR	0x1b
+#define CPUID_APIC		0x200
+
+#define LAPIC_ID		0x020
+#define LAPIC_TPR		0x080
+#define LAPIC_EOI		0x0b0
+#define LAPIC_SVR		0x0f0
+#define LAPIC_ICR_LOW		0x300
+#define LAPIC_ICR_HIGH		0x310
+#define LAPIC_LVT_TIMER		0x320
+#define LAPIC_LVT_LINT0		0x350
+#define LAPIC_LVT_LINT1		0x360
+#define LAPIC_LVT_ERROR		0x370
+#define LAPIC_TIMER_INIT	0x380
+#define LAPIC_TIMER_CUR		0x390
+#define LAPIC_TIMER_DIV		0x3e0
+
+#define LAPIC_SVR_ENABLE	0x100
+#define LAPIC_LVT_MASKED	0x10000
+#define LAPIC_LVT_PERIODIC	0x20000
+#define LAPIC_LVT_EXTINT	0x700
+#define LAPIC_LVT_NMI		0x400
+#define LAPIC_DIV_16		0x3
+#define LAPIC_ICR_FIXED		0x000
+#define LAPIC_ICR_INIT		0x500
+#define LAPIC_ICR_STARTUP	0x600
+#define LAPIC_ICR_PENDING	0x1000
+#define LAPIC_ICR_ASSERT	0x4000
+#define LAPIC_ICR_ALL_BUT_SELF	0xc0000
+
+#define lapic_read(reg)		(*(volatile ui32_t*)(smp_lapic + (reg)))
+#define lapic_write(reg, value)	(*(volatile ui32_t*)(smp_lapic + (reg)) \
+                                 = (value))
+
+/** ACPI tables (only what is needed to find the processors) **/
+
+struct acpi_rsdp
+{
+	uchar_t signature[8];
+	ui8_t checksum;
+	uchar_t oem_id[6];
+	ui8_t revision;
+	ui32_t rsdt;
+} __attribute__((packed));
+
+struct acpi_header
+{
+	uchar_t signature[4];
+	ui32_t length;
+	ui8_t revision;
+	ui8_t checksum;
+	uchar_t oem_id[6];
+	uchar_t oem_table_id[8];
+	ui32_t oem_revision;
+	ui32_t creator_id;
+	ui32_t creator_revision;
+} __attribute__((packed));
+
+struct acpi_madt
+{
+	struct acpi_header header;
+	ui32_t lapic;
+	ui32_t flags;
+} __attribute__((packed));
+
+#define MADT_LAPIC		0
+#define MADT_LAPIC_ENABLED	0x1
+
+/** MP specification tables **/
+
+struct mp_floating
+{
+	uchar_t signature[4];
+	ui32_t config;
+	ui8_t length;
+	ui8_t spec_rev;
+	ui8_t checksum;
+	ui8_t features[5];
+} __attribute__((packed));
+
+struct mp_config
+{
+	uchar_t signature[4];
+	ui16_t length;
+	ui8_t spec_rev;
+	ui8_t checksum;
+	uchar_t oem_id[8];
+	uchar_t product_id[12];
+	ui32_t oem_table;
+	ui16_t oem_size;
+	ui16_t entry_count;
+	ui32_t lapic;
+	ui16_t ext_length;
+	ui8_t ext_checksum;
+	ui8_t reserved;
+} __attribute__((packed));
+
+struct mp_processor
+{
+	ui8_t type;
+	ui8_t apic_id;
+	ui8_t apic_version;
+	ui8_t flags;
+	ui32_t signature;
+	ui32_t features;
+	ui32_t reserved[2];
+} __attribute__((packed));
+
+#define MP_PROCESSOR		0
+#define MP_PROCESSOR_ENABLED	0x1
+
+/** Processor: its current process (see current and current_pid in
+    kernel/process.h), its TSS and what the TLB shootdowns need. **/
+
+struct process;
+
+struct cpu
+{
+	ui8_t apic_id;
+	volatile bool_t online;
+	pid_t pid;
+	struct process *proc;
+	struct tss *tss;
+	volatile ui32_t tlb_gen; // last TLB shootdown done
+	volatile bool_t lock_wait; // waiting for the kernel lock
+	count_t nr_timer_irqs;
+};
+
+/** Global variables (processors, address of the local APIC registers and
+    timer counts per clock tic and per microsecond, big kernel lock, TLB
+    shootdown request, processor being started and its stack, page tables
+    are mapped to). **/
+
+#ifdef _SMP_C_
+count_t smp_nr_cpus = 1;
+count_t smp_nr_online = 1;
+ui32_t smp_lapic = 0;
+ui32_t smp_lapic_tic = 0;
+ui32_t smp_lapic_rate = 1;
+volatile ui32_t kernel_lock = 0; // 0 or the number of its owner plus 1
+count_t kernel_lock_contended = 0;
+volatile ui32_t smp_tlb_gen = 0;
+volatile ui32_t smp_tlb_vpage = 0;
+ui32_t smp_booting = 0;
+ui32_t smp_ap_stack = 0;
+ui32_t smp_window = 0;
+#else
+extern struct cpu cpu_tab[];
+extern count_t smp_nr_cpus;
+extern count_t smp_nr_online;
+extern ui32_t smp_lapic;
+extern ui32_t smp_lapic_tic;
+extern ui32_t smp_lapic_rate;
+extern volatile ui32_t kernel_lock;
+extern count_t kernel_lock_contended;
+extern volatile ui32_t smp_tlb_gen;
+extern volatile ui32_t smp_tlb_vpage;
+extern ui32_t smp_booting;
+extern ui32_t smp_ap_stack;
+extern ui32_t smp_window;
+#endif
+
+/** Trampoline of the application processors (see kernel/smp_boot.asm) **/
+
+extern ui8_t smp_trampoline[];
+extern ui8_t smp_trampoline_end[];
+
+/** Functions **/
+
+ui32_t smp_cpu_id();
+/****************************************************************/
+void smp_read_phys(void *buf, ui32_t paddr, size_t size);
+/****************************************************************/
+ui8_t smp_checksum(ui8_t *data, size_t size);
+/****************************************************************/
+ui32_t smp_scan(ui32_t base, size_t size, uchar_t *signature, size_t length);
+/****************************************************************/
+void smp_add_cpu(ui8_t apic_id);
+/****************************************************************/
+ret_t smp_parse_madt();
+/****************************************************************/
+ret_t smp_parse_mp();
+/****************************************************************/
+void smp_lapic_init(bool_t bsp);
+/****************************************************************/
+void smp_lapic_calibrate();
+/****************************************************************/
+void smp_delay(ui32_t usec);
+/****************************************************************/
+void smp_ipi(ui8_t apic_id, ui32_t icr);
+/****************************************************************/
+ret_t smp_boot_ap(ui32_t id);
+/****************************************************************/
+ret_t smp_init();
+/****************************************************************/
+void smp_ap_main();
+/****************************************************************/
+bool_t smp_idle();
+/****************************************************************/
+void smp_lock_kernel();
+/****************************************************************/
+void smp_unlock_kernel();
+/****************************************************************/
+void smp_isr_leave(ui32_t cs);
+/****************************************************************/
+void smp_flush_local(ui32_t vpage);
+/****************************************************************/
+void smp_tlb_shootdown(ui32_t vpage);
+/****************************************************************/
+void smp_eoi();
+
+#endif
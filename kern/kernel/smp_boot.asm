@@ -0,0 +1,73 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;                                                               ;
+;           Startup code of the application processors          ;
+;                                                               ;
+;    Copied to SMP_TRAMPOLINE_BASE by smp_init. The processors  ;
+;    start there in real mode after a STARTUP IPI.              ;
+;                                                               ;
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+
+;; Global symbols ;;
+
+global smp_trampoline
+global smp_trampoline_end
+
+;; External symbols ;;
+
+extern smp_ap_main
+extern smp_ap_stack
+
+;; Constants (see kernel/smp.h and mm/mem_map.h) ;;
+
+%define SMP_TRAMPOLINE_BASE	0x8000
+%define KERNEL_PD_BASE		0x1000
+
+; Address of a symbol once the trampoline is copied
+%define REL(x)	(SMP_TRAMPOLINE_BASE + (x) - smp_trampoline)
+
+;; Real mode: load the kernel GDT and switch to protected mode ;;
+
+[BITS 16]
+
+smp_trampoline:
+	cli
+	xor ax, ax
+	mov ds, ax
+	o32 lgdt [REL(smp_gdt_descript)]
+	mov eax, cr0
+	or eax, 0x1
+	mov cr0, eax
+	jmp dword 0x08:REL(smp_trampoline32)
+
+;; Protected mode: enable paging with the kernel page directory and jump to
+;; the kernel on the stack allocated by smp_boot_ap ;;
+
+[BITS 32]
+
+smp_trampoline32:
+	mov ax, 0x10
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
+	mov ax, 0x18
+	mov ss, ax
+	mov eax, KERNEL_PD_BASE
+	mov cr3, eax
+	mov eax, cr0
+	or eax, 0x80010000
+	mov cr0, eax
+	mov esp, [smp_ap_stack]
+	mov eax, smp_ap_main
+	call eax
+	cli
+	hlt
+
+;; GDT description (the GDT is at address 0) ;;
+
+align 4
+smp_gdt_descript:
+	dw 0x800
+	dd 0
+
+smp_trampoline_end:
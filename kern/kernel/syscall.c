@@ -10,16 +10,20 @@
 #include <fs/cache.h>
 #include <fs/ext2.h>
 #include <fs/file.h>
+#include <kernel/hrtimer.h>
 #include <kernel/libc.h> // debug
+#include <kernel/lock.h>
 #include <kernel/isr.h>
 #include <kernel/panic.h>
 #include <kernel/printk.h> // debug
 #include <kernel/process.h>
 #include <kernel/schedule.h>
+#include <kernel/wait.h>
 #ifdef ENABLE_NETWORK
 #include <net/arp.h>
 #include <net/ether.h>
 #include <net/ip.h>
+#include <net/tcp.h>
 #endif
 
 #include "syscall.h"
@@ -30,6 +34,10 @@ void _isr_syscall()
 	ui32_t *param;
 	ui32_t ret;
 	ui32_t *ebp;
+	#ifdef ENABLE_NETWORK
+	bool_t net;
+	ui32_t flags = 0;
+	#endif
 
 	asm volatile("mov %%eax, %0 \n\
 	              mov %%ebx, %3 \n\
@@ -52,6 +60,8 @@ void _isr_syscall()
 		panic("syscall while interrutible (pid: %x)", current_pid);
 	}
 
+	current->nsyscalls++;
+
 	#ifdef DEBUG_SYSCALLS
 	printk("beginning of syscall %x\n", sysc_num);
 	current->sysc_num = sysc_num;
@@ -78,9 +88,28 @@ void _isr_syscall()
 		panic("syscall from kernel space");
 	}
 
-	/** Test sysc_num and try to perform the system call. **/
+	/** System calls run with interrupts enabled. The socket system calls
+	    hold the lock of the network stack (they release it while they
+	    sleep). **/
 
-	cli;
+	#ifdef ENABLE_NETWORK
+	/** The rings of the sockets released by the interrupt handlers are
+	    freed here, in process context (see tcp_socket_release). **/
+
+	if(tcp_reap_socks)
+	{
+		flags = spin_lock_irqsave(&tcp_lock);
+		tcp_reap();
+		spin_unlock_irqrestore(&tcp_lock, flags);
+	}
+
+	net = sysc_num >= SYSCALL_SOCKET && sysc_num <= SYSCALL_GETSOCKNAME;
+
+	if(net)
+	{
+		flags = spin_lock_irqsave(&tcp_lock);
+	}
+	#endif
 
 	switch(sysc_num)
 	{
@@ -221,6 +250,56 @@ void _isr_syscall()
 			                        (struct rusage*)param[3]);
 			break;
 
+		case SYSCALL_MMAP:
+			ret = (ui32_t)sys_mmap((void*)param[0],
+			                       (size_t)param[1],
+			                       param[2],
+			                       param[3],
+			                       (si32_t)param[4],
+			                       (off_t)param[5]);
+			break;
+
+		case SYSCALL_MUNMAP:
+			ret = (ui32_t)sys_munmap((void*)param[0],
+			                         (size_t)param[1]);
+			break;
+
+		case SYSCALL_MPROTECT:
+			ret = (ui32_t)sys_mprotect((void*)param[0],
+			                           (size_t)param[1],
+			                           param[2]);
+			break;
+
+		case SYSCALL_NICE:
+			ret = (ui32_t)sys_nice((si32_t)*param);
+			break;
+
+		case SYSCALL_SETPRIORITY:
+			ret = (ui32_t)sys_setpriority(param[0],
+			                              param[1],
+			                              (si32_t)param[2]);
+			break;
+
+		case SYSCALL_GETPRIORITY:
+			ret = (ui32_t)sys_getpriority(param[0], param[1]);
+			break;
+
+		case SYSCALL_GETRUSAGE:
+			ret = (ui32_t)sys_getrusage((si32_t)param[0],
+			                            (struct rusage*)param[1]);
+			break;
+
+		case SYSCALL_TIMES:
+			ret = (ui32_t)sys_times((struct tms*)param);
+			break;
+
+		case SYSCALL_NANOSLEEP:
+			current->interruptible = 1;
+			ret = (ui32_t)sys_nanosleep((struct timespec*)param[0],
+			                            (struct timespec*)param[1]);
+			current->interruptible = 0;
+			break;
+
 		case SYSCALL_OPEN:
 			ret = (ui32_t)sys_open((uchar_t*)param[0], param[1]);
 			break;
@@ -325,6 +404,13 @@ void _isr_syscall()
 		case SYSCALL_PIPE2:
 			ret = (ui32_t)sys_pipe2((si32_t*)param[0], param[1]);
 			break;
+
+		case SYSCALL_SPLICE:
+			ret = (ui32_t)sys_splice((si32_t)param[0],
+			                         (si32_t)param[1],
+			                         (size_t)param[2],
+			                         param[3]);
+			break;
 		#endif
 
 		case SYSCALL_FTRUNCATE:
@@ -443,16 +529,19 @@ void _isr_syscall()
 
 				do
 				{
-					sti;
-					yield;
-					cli;
-
 					if(tics - old_tics > CLK_FREQ / 2)
 					{
 						old_tics = tics;
+						flags = spin_lock_irqsave(
+						        &tcp_lock);
 						arp_request(gw_ip);
+						spin_unlock_irqrestore(&tcp_lock,
+						                       flags);
 						try_cnt++;
 					}
+
+					wait_schedule(hrtimer_now()
+					              + HRTIMER_FREQ / 2);
 				} while(!gw_hwaddr_set && try_cnt < 10);
 
 				if(gw_hwaddr_set)
@@ -475,6 +564,13 @@ void _isr_syscall()
 			break;
 	}
 
+	#ifdef ENABLE_NETWORK
+	if(net)
+	{
+		spin_unlock_irqrestore(&tcp_lock, flags);
+	}
+	#endif
+
 	sti;
 
 	#ifdef DEBUG_SYSCALLS
@@ -486,6 +582,16 @@ void _isr_syscall()
 
 	ebp[13] = ret;
 
+	/** Switch now if a clock interrupt could not preempt the process
+	    during the system call (see schedule). **/
+
+	if(need_resched)
+	{
+		cli;
+		schedule();
+		sti;
+	}
+
 	#ifdef EXTENDED_SIGNAL_HANDLING
 
 	/** Handle signals if the current process is not the root process and
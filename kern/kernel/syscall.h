@@ -28,6 +28,15 @@
 #define SYSCALL_SIGSUSPEND	0x2f
 #define SYSCALL_SBRK		0x30
 #define SYSCALL_WAIT4		0x31
+#define SYSCALL_MMAP		0x32
+#define SYSCALL_MUNMAP		0x33
+#define SYSCALL_MPROTECT	0x34
+#define SYSCALL_NICE		0x35
+#define SYSCALL_SETPRIORITY	0x36
+#define SYSCALL_GETPRIORITY	0x37
+#define SYSCALL_GETRUSAGE	0x38
+#define SYSCALL_TIMES		0x39
+#define SYSCALL_NANOSLEEP	0x3a
 
 #define SYSCALL_OPEN		0x40
 #define SYSCALL_CLOSE		0x41
@@ -50,6 +59,7 @@
 #define SYSCALL_PIPE2		0x52
 #define SYSCALL_FTRUNCATE	0x53
 #define SYSCALL_FSTATFS		0x54
+#define SYSCALL_SPLICE		0x55
 
 #define SYSCALL_TCGETATTR	0x60
 #define SYSCALL_TCSETATTR	0x61
@@ -151,6 +161,29 @@ uchar_t *sys_getcwd(uchar_t *buf, size_t size);
 /****************************************************************/
 pid_t sys_wait4(pid_t pid, int *status, int options, struct rusage *rusage);
 /****************************************************************/
+void *sys_mmap(void *addr,
+               size_t len,
+               ui32_t prot,
+               ui32_t flags,
+               si32_t fildes,
+               off_t off);
+/****************************************************************/
+int sys_munmap(void *addr, size_t len);
+/****************************************************************/
+int sys_mprotect(void *addr, size_t len, ui32_t prot);
+/****************************************************************/
+int sys_nice(si32_t inc);
+/****************************************************************/
+int sys_setpriority(ui32_t which, ui32_t who, si32_t prio);
+/****************************************************************/
+int sys_getpriority(ui32_t which, ui32_t who);
+/****************************************************************/
+int sys_getrusage(si32_t who, struct rusage *rusage);
+/****************************************************************/
+clock_t sys_times(struct tms *buf);
+/****************************************************************/
+int sys_nanosleep(struct timespec *req, struct timespec *rem);
+/****************************************************************/
 int sys_tcflush(si32_t fildes, ui32_t queue_selector);
 /****************************************************************/
 int sys_mkdir(uchar_t *path, mode_t mode);
@@ -171,6 +204,8 @@ si32_t sys_select(ui32_t nfds,
 /****************************************************************/
 int sys_pipe2(si32_t pipefd[2], ui32_t flags);
 /****************************************************************/
+ssize_t sys_splice(si32_t fd_in, si32_t fd_out, size_t size, ui32_t flags);
+/****************************************************************/
 int sys_ftruncate(si32_t fildes, off_t length);
 /****************************************************************/
 int sys_fstatfs(si32_t fildes, struct statfs *st);
@@ -8,7 +8,6 @@
 #include <config.h>
 #include <fs/file.h>
 #include <kernel/errno.h>
-#include <kernel/int.h>
 #include <kernel/isr.h>
 #include <kernel/libc.h>
 #include <kernel/panic.h>
@@ -16,6 +15,7 @@
 #include <kernel/process.h>
 #include <kernel/syscall.h>
 #include <kernel/types.h>
+#include <kernel/wait.h>
 #include <kernel/syscalls/utils.h>
 #include <net/endian.h>
 #include <net/tcp.h>
@@ -26,11 +26,11 @@
 
 si32_t sys_accept(si32_t fildes, struct sockaddr *addr, socklen_t *addr_len)
 {
-	struct tcp_request *req;
 	struct fildes *fd;
 	struct file *file;
 	struct tcp_socket *tcp_sock, *tcp_sock2;
-	si32_t tcp_sock_id;
+	si32_t new_fildes;
+	ino_t inum;
 	ret_t err;
 
 	if(addr_len && *addr_len < sizeof(struct sockaddr))
@@ -45,63 +45,83 @@ si32_t sys_accept(si32_t fildes, struct sockaddr *addr, socklen_t *addr_len)
 		return -1;
 	}
 
-	tcp_sock = &tcp_sock_tab[file->data.tcp_sock_id];
+	tcp_sock = tcp_sock_get(file->data.tcp_sock_id);
 
-	/** Try to dequeue an incoming connection. **/
+	/** Take the first established connection of the accept queue, or wait
+	    for one. **/
 
-	do
+	while(1)
 	{
-		sti;
-		yield;
-		cli;
-
 		if(tcp_sock->state != TCP_LISTEN)
 		{
 			*current->perrno = EINVAL;
 			return -1;
 		}
 
-		req = tcp_request_pop(tcp_sock);
-	} while(!req && !(current->fildes_flags[fildes] & O_NONBLOCK));
+		tcp_sock2 = tcp_child_pop(tcp_sock);
 
-	if(!req)
+		if(tcp_sock2 || (current->fildes_flags[fildes] & O_NONBLOCK))
+		{
+			break;
+		}
+
+		wait_sleep_lock(&tcp_sock->wq, &tcp_lock);
+	}
+
+	if(!tcp_sock2)
 	{
 		*current->perrno = EWOULDBLOCK;
 		return -1;
 	}
 
-	/** Create a new socket to handle the connection. Pretend we have sent
-	    a SYN-ACK which has timed out. **/
+	/** The connection gets the rings of its buffers now that a process
+	    takes it, and opens its window. Put another socket aside for the
+	    next one. **/
 
-	tcp_sock_id = tcp_socket_alloc();
+	tcp_socket_reserve();
 
-	if(tcp_sock_id == -1)
+	if(tcp_buffers_attach(tcp_sock2) != OK)
 	{
-		if(tcp_request_push(tcp_sock,
-		                    tcp_sock->source_ip,
-		                    tcp_sock->dest_ip,
-		                    tcp_sock->source_port,
-		                    tcp_sock->dest_port,
-		                    tcp_sock->irs) != OK)
+		tcp_send(tcp_sock2, tcp_sock2->snd_nxt, 0, 0, 0, TCP_RST);
+		tcp_set_socket_state(tcp_sock2, TCP_CLOSED, 0);
+
+		*current->perrno = ENOMEM;
+		return -1;
+	}
+
+	tcp_send_ack(tcp_sock2);
+
+	/** Give the user a file descriptor for it. Without one, the
+	    connection is reset. **/
+
+	inum = file_alloc();
+	new_fildes = inum ? fildes_alloc(0) : -1;
+
+	if(new_fildes == -1)
+	{
+		if(inum)
 		{
-			panic("incoming connections queue possibly corrupted");
+			file_tab[inum - 1].used = 0;
 		}
 
-		*current->perrno = ENFILE; // FIXME
+		tcp_send(tcp_sock2, tcp_sock2->snd_nxt, 0, 0, 0, TCP_RST);
+		tcp_set_socket_state(tcp_sock2, TCP_CLOSED, 0);
+
+		*current->perrno = inum ? EMFILE : ENFILE;
 		return -1;
 	}
 
-	tcp_sock2 = &tcp_sock_tab[tcp_sock_id];
+	tcp_sock2->used = 1;
+
+	file_tab[inum - 1].fs = FS_TCPSOCKFS;
+	file_tab[inum - 1].data.tcp_sock_id = tcp_sock2->id;
+
+	fd = current->pfildes_tab[new_fildes];
+	current->fildes_flags[new_fildes] = O_RDWR;
+	fd->off = 0;
+	fd->inum = inum;
 
-	*tcp_sock2 = *tcp_sock;
-	tcp_sock2->source_ip = req->dest_ip;
-	tcp_sock2->dest_ip = req->source_ip;
-	tcp_sock2->dest_port = req->source_port;
-	tcp_sock2->snd_una = tcp_sock2->iss;
-	tcp_sock2->snd_nxt = tcp_sock2->iss + 1;
-	tcp_sock2->irs = req->irs;
-	tcp_sock2->rcv_nxt = req->irs + 1;
-	tcp_set_socket_state(tcp_sock2, TCP_SYN_RECEIVED, 0);
+	file_ref(inum);
 
 	/** Provide the information about the new connection. **/
 
@@ -116,11 +136,11 @@ si32_t sys_accept(si32_t fildes, struct sockaddr *addr, socklen_t *addr_len)
 		}
 
 		addr_in->sin_family = AF_INET;
-		addr_in->sin_port = htons(req->source_port);
-		addr_in->sin_addr.s_addr = req->source_ip;
+		addr_in->sin_port = htons(tcp_sock2->dest_port);
+		addr_in->sin_addr.s_addr = tcp_sock2->dest_ip;
 		memset(&addr_in->sin_zero, 0, 8);
 		*addr_len = sizeof(struct sockaddr_in);
 	}
 
-	return 0;
+	return new_fildes;
 }
@@ -35,7 +35,7 @@ int sys_bind(si32_t fildes, struct sockaddr *addr, socklen_t addr_len)
 
 	addr_in = (struct sockaddr_in*)addr;
 
-	tcp_sock = &tcp_sock_tab[file->data.tcp_sock_id];
+	tcp_sock = tcp_sock_get(file->data.tcp_sock_id);
 
 	if(tcp_port_is_used(ntohs(addr_in->sin_port)))
 	{
@@ -44,7 +44,7 @@ int sys_bind(si32_t fildes, struct sockaddr *addr, socklen_t addr_len)
 	}
 
 	tcp_sock->source_ip = addr_in->sin_addr.s_addr;
-	tcp_sock->source_port = ntohs(addr_in->sin_port);
+	tcp_port_bind(tcp_sock, ntohs(addr_in->sin_port));
 
 	return 0;
 }
@@ -8,13 +8,13 @@
 #include <config.h>
 #include <fs/file.h>
 #include <kernel/errno.h>
-#include <kernel/int.h>
 #include <kernel/isr.h>
 #include <kernel/libc.h>
 #include <kernel/panic.h>
 #include <kernel/printk.h>
 #include <kernel/process.h>
 #include <kernel/types.h>
+#include <kernel/wait.h>
 #include <kernel/syscalls/utils.h>
 #include <net/endian.h>
 #include <net/ip.h>
@@ -44,7 +44,7 @@ int sys_connect(si32_t fildes, struct sockaddr *addr, socklen_t addr_len)
 		return -1;
 	}
 
-	tcp_sock = &tcp_sock_tab[file->data.tcp_sock_id];
+	tcp_sock = tcp_sock_get(file->data.tcp_sock_id);
 
 	/** Check whether we are allowed to connect. **/
 
@@ -74,7 +74,7 @@ int sys_connect(si32_t fildes, struct sockaddr *addr, socklen_t addr_len)
 	if(!tcp_sock->source_port)
 	{
 		tcp_sock->source_ip = local_ip;
-		tcp_sock->source_port = tcp_port_alloc();
+		tcp_port_bind(tcp_sock, tcp_port_alloc());
 
 		if(!tcp_sock->source_port)
 		{
@@ -82,6 +82,14 @@ int sys_connect(si32_t fildes, struct sockaddr *addr, socklen_t addr_len)
 		}
 	}
 
+	/** Give the buffers their rings. **/
+
+	if((err = tcp_buffers_attach(tcp_sock)) != OK)
+	{
+		*current->perrno = (ui32_t)(-err);
+		return -1;
+	}
+
 	/** Try to establish a connection. **/
 
 	tcp_sock->dest_ip = addr_in->sin_addr.s_addr;
@@ -97,9 +105,7 @@ int sys_connect(si32_t fildes, struct sockaddr *addr, socklen_t addr_len)
 		while(tcp_sock->state != TCP_ESTABLISHED
 		   && tcp_sock->state != TCP_CLOSED)
 		{
-			sti;
-			yield;
-			cli;
+			wait_sleep_lock(&tcp_sock->wq, &tcp_lock);
 		}
 	}
 
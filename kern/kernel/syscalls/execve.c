@@ -18,6 +18,10 @@
 #include <kernel/schedule.h>
 #include <kernel/syscall.h>
 #include <kernel/types.h>
+#include <mm/vma.h>
+#ifdef USE_PAGE_CACHE
+#include <mm/pcache.h>
+#endif
 
 /**
  * sys_execve
@@ -115,8 +119,10 @@ int sys_execve(uchar_t *bin, uchar_t *argv[], uchar_t *envp[])
 		esp = (ui32_t)USER_STACK_BASE - 16;
 	}
 
-	/** Load the ELF file. **/
+	/** Load the ELF file. The regions mapped by the former image are
+	    released first. **/
 
+	vma_clear();
 	current->b_heap = 0;
 
 	for(ph = 0; ph < ehdr.e_phnum; ph++)
@@ -130,7 +136,7 @@ int sys_execve(uchar_t *bin, uchar_t *argv[], uchar_t *envp[])
 			sys_exit(-1);
 		}
 
-		if(phdr.p_type == 1)
+		if(phdr.p_type == PT_LOAD)
 		{
 			if(phdr.p_vaddr >= USER_BASE
 			&& phdr.p_vaddr < USER_STACK_BASE)
@@ -142,14 +148,51 @@ int sys_execve(uchar_t *bin, uchar_t *argv[], uchar_t *envp[])
 				printk("\tp_memsz: %x\n", phdr.p_memsz);
 				#endif
 
-				memset((void*)phdr.p_vaddr, 0, phdr.p_memsz);
-
-				if(ext2_read(ext2_inum,
-				             (void*)phdr.p_vaddr,
-				             phdr.p_filesz,
-				             phdr.p_offset) < 0)
+				#ifdef USE_PAGE_CACHE
+				/** Read-only segments are shared with the
+				    other processes running the same file.
+				    They are registered as file regions so
+				    that their pages can be reclaimed and
+				    read again when accessed (writing to them
+				    still triggers a copy-on-write). **/
+
+				if(!(phdr.p_flags & PF_W)
+				&& phdr.p_filesz == phdr.p_memsz
+				&& (phdr.p_vaddr & 0xfff)
+				    == (phdr.p_offset & 0xfff))
+				{
+					if(vma_add(phdr.p_vaddr & ~0xfff,
+					           (phdr.p_vaddr
+					          + phdr.p_filesz
+					          + 0xfff) & ~0xfff,
+					           PROT_READ
+					         | PROT_WRITE
+					         | PROT_EXEC,
+					           0,
+					           ext2_inum,
+					           phdr.p_offset & ~0xfff) != OK
+					|| pcache_map(ext2_inum,
+					              phdr.p_offset,
+					              (void*)phdr.p_vaddr,
+					              phdr.p_filesz) != OK)
+					{
+						sys_exit(-1);
+					}
+				}
+				else
+				#endif
 				{
-					sys_exit(-1);
+					memset((void*)phdr.p_vaddr,
+					       0,
+					       phdr.p_memsz);
+
+					if(ext2_read(ext2_inum,
+					             (void*)phdr.p_vaddr,
+					             phdr.p_filesz,
+					             phdr.p_offset) < 0)
+					{
+						sys_exit(-1);
+					}
 				}
 
 				if((void*)phdr.p_vaddr + phdr.p_memsz
@@ -7,6 +7,7 @@
 
 #include <config.h>
 #include <fs/tty.h>
+#include <kernel/hrtimer.h>
 #include <kernel/panic.h>
 #include <kernel/printk.h> // debugging
 #include <kernel/process.h>
@@ -14,6 +15,7 @@
 #include <kernel/signal.h>
 #include <mm/mem_map.h>
 #include <mm/paging.h>
+#include <mm/vma.h>
 #ifdef ENABLE_NETWORK
 #include <kernel/errno.h>
 #include <kernel/int.h>
@@ -84,12 +86,26 @@ void sys_exit(int status)
 		}
 	}
 
+	/** Release the memory regions (and the files they map). **/
+
+	vma_clear();
+
+	/** From now on, interrupts are disabled: the kernel stack of the
+	    process is about to be freed. **/
+
+	cli;
+
 	/** Signal the death of the process to the parent. **/
 
 	current->parent->dead_son_pid = current_pid;
 	current->parent->dead_son_status = status;
 	current->parent->sigset |= (1 << (SIGCHLD - 1));
+	signal_wake(current->parent);
+
+	wait_wake(&current->parent->child_wq);
 	current->state = PROC_ZOMBIE;
+	schedule_dequeue(current);
+	hrtimer_cancel(&current->timer);
 	current->status = status;
 	current->reported = 0;
 
@@ -103,6 +119,7 @@ void sys_exit(int status)
 	if(reader_pid == current_pid)
 	{
 		reader_pid = 0;
+		wait_wake(&tty_ififo2.wq);
 	}
 
 	/** As the kernel stack we are currently using is going to be freed and
@@ -124,7 +141,7 @@ void sys_exit(int status)
 
 	paging_destroy_pd(current->pd);
 
-	/** Switch to the first process. **/
+	/** Switch to the next runnable process. **/
 
-	schedule_switch(0);
+	schedule_switch(schedule_pick());
 }
@@ -7,6 +7,7 @@
 
 #include <config.h> // debugging
 #include <fs/file.h>
+#include <fs/pipe.h>
 #include <kernel/errno.h>
 #include <kernel/printk.h>
 #include <kernel/process.h>
@@ -23,10 +24,11 @@
 si32_t sys_fcntl(si32_t fildes, ui32_t cmd, va_list ap)
 {
 	struct fildes *fd;
+	struct file *file;
 	si32_t ret;
 	ret_t err;
 
-	if((err = fildes_check(fildes, &fd, 0, 1, FS_NOFS)) != OK)
+	if((err = fildes_check(fildes, &fd, &file, 1, FS_NOFS)) != OK)
 	{
 		*current->perrno = (ui32_t)(-err);
 		return -1;
@@ -98,6 +100,29 @@ si32_t sys_fcntl(si32_t fildes, ui32_t cmd, va_list ap)
 			// FIXME
 			break;
 
+		#ifdef ENABLE_PIPES
+		case F_SETPIPE_SZ:
+		case F_GETPIPE_SZ:
+			if(!file || file->fs != FS_PIPEFS)
+			{
+				*current->perrno = EBADF;
+				ret = -1;
+				break;
+			}
+
+			if(cmd == F_SETPIPE_SZ
+			&& (err = pipe_resize(pipe_get(file->data.pipe_id),
+			                      va_arg(ap, size_t))) != OK)
+			{
+				*current->perrno = (ui32_t)(-err);
+				ret = -1;
+				break;
+			}
+
+			ret = pipe_get(file->data.pipe_id)->fifo.size;
+			break;
+		#endif
+
 		default:
 			#ifdef DEBUG
 			printk("unimplemented command %x\n", cmd);
@@ -9,6 +9,7 @@
 #include <kernel/panic.h>
 #include <kernel/process.h>
 #include <kernel/types.h>
+#include <mm/vma.h>
 
 /**
  * sys_fork
@@ -84,6 +85,7 @@ pid_t sys_fork()
 
 	son->b_heap = current->b_heap;
 	son->e_heap = current->e_heap;
+	vma_fork(son->vmas);
 
 		/** File descriptors and current working directory. **/
 
@@ -120,6 +122,17 @@ pid_t sys_fork()
 	son->sigmask = current->sigmask;
 	/*memcpy(son->sigact, current->sigact, sizeof(struct sigaction) * 31);*/
 
+		/** Scheduling: the son gets half of the remaining time slice of
+		    its father, so that forking does not give more time. **/
+
+	son->time_slice = (current->time_slice + 1) / 2;
+	current->time_slice -= son->time_slice;
+
+	if(!current->time_slice)
+	{
+		current->time_slice = 1;
+	}
+
 		/** Pointer to errno. FIXME: Really useful? **/
 
 	son->perrno = current->perrno;
@@ -0,0 +1,49 @@
+/****************************************************************
+ * getprio.c                                                    *
+ *                                                              *
+ *    getpriority syscall.                                      *
+ *                                                              *
+ ****************************************************************/
+
+#include <kernel/errno.h>
+#include <kernel/process.h>
+#include <kernel/schedule.h>
+#include <kernel/types.h>
+
+/**
+ * sys_getpriority
+ */
+
+int sys_getpriority(ui32_t which, ui32_t who)
+{
+	pid_t pid;
+	si32_t nice = NICE_MAX + 1;
+
+	if(which != PRIO_PROCESS && which != PRIO_PGRP && which != PRIO_USER)
+	{
+		*current->perrno = EINVAL;
+		return -1;
+	}
+
+	/** Return the highest priority (lowest nice value) of the designated
+	    processes. **/
+
+	for(pid = 0; pid < NR_PROC; pid++)
+	{
+		if(schedule_prio_match(&proc_tab[pid], which, who)
+		&& proc_tab[pid].nice < nice)
+		{
+			nice = proc_tab[pid].nice;
+		}
+	}
+
+	if(nice > NICE_MAX)
+	{
+		*current->perrno = ESRCH;
+		return -1;
+	}
+
+	*current->perrno = 0;
+
+	return nice;
+}
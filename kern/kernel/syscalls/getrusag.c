@@ -0,0 +1,41 @@
+/****************************************************************
+ * getrusag.c                                                   *
+ *                                                              *
+ *    getrusage syscall.                                        *
+ *                                                              *
+ ****************************************************************/
+
+#include <kernel/errno.h>
+#include <kernel/process.h>
+#include <kernel/types.h>
+
+/**
+ * sys_getrusage
+ */
+
+int sys_getrusage(si32_t who, struct rusage *rusage)
+{
+	if(!in_user_range(rusage, rusage + 1))
+	{
+		*current->perrno = EFAULT;
+		return -1;
+	}
+
+	if(who == RUSAGE_SELF)
+	{
+		process_rusage(current->utime, current->stime, rusage);
+	}
+	else if(who == RUSAGE_CHILDREN)
+	{
+		process_rusage(current->cutime, current->cstime, rusage);
+	}
+	else
+	{
+		*current->perrno = EINVAL;
+		return -1;
+	}
+
+	*current->perrno = 0;
+
+	return 0;
+}
@@ -37,7 +37,7 @@ int sys_getsockname(si32_t fildes, struct sockaddr *addr, socklen_t *len)
 		return -1;
 	}
 
-	tcp_sock = &tcp_sock_tab[file->data.tcp_sock_id];
+	tcp_sock = tcp_sock_get(file->data.tcp_sock_id);
 
 	addr_in->sin_family = AF_INET;
 	addr_in->sin_port = htons(tcp_sock->source_port);
@@ -7,11 +7,17 @@
 
 #include <config.h>
 #include <fs/file.h>
+#include <kernel/errno.h>
 #include <kernel/printk.h>
+#include <kernel/process.h>
 #include <kernel/types.h>
+#include <kernel/syscalls/utils.h>
+#include <net/tcp.h>
 
 /**
  * sys_getsockopt
+ *
+ *   See sys_setsockopt.
  */
 
 int sys_getsockopt(si32_t fildes,
@@ -20,10 +26,67 @@ int sys_getsockopt(si32_t fildes,
                    void *opt_val,
                    socklen_t *opt_len)
 {
+	struct file *file;
+	struct tcp_socket *tcp_sock;
+	si32_t val;
+	ret_t err;
+
 	#ifdef DEBUG
 	printk("sys_getsockopt(%x, %x, %x, %x, %x)\n",
 	       fildes, level, opt_name, opt_val, opt_len);
 	#endif
 
-	return -1;
+	if(!in_user_range(opt_len, opt_len + 1)
+	|| !in_user_range(opt_val, (si32_t*)opt_val + 1))
+	{
+		*current->perrno = EFAULT;
+		return -1;
+	}
+
+	/** tcp_lock is held: the option and its length are only touched once
+	    they are present. **/
+
+	while(tcp_fault_in(opt_len, sizeof(socklen_t), 1)
+	   || tcp_fault_in(opt_val, sizeof(si32_t), 1));
+
+	if((err = fildes_check(fildes, 0, &file, 1, FS_TCPSOCKFS)) != OK)
+	{
+		*current->perrno = (ui32_t)(-err);
+		return -1;
+	}
+
+	if(*opt_len < sizeof(si32_t))
+	{
+		*current->perrno = EINVAL;
+		return -1;
+	}
+
+	tcp_sock = tcp_sock_get(file->data.tcp_sock_id);
+
+	if(level == SOL_SOCKET && opt_name == SO_REUSEADDR)
+	{
+		val = tcp_sock->reuse_addr;
+	}
+	else if(level == SOL_SOCKET && opt_name == SO_SNDBUF)
+	{
+		val = tcp_sock->tx_fifo.size;
+	}
+	else if(level == SOL_SOCKET && opt_name == SO_RCVBUF)
+	{
+		val = tcp_sock->rx_fifo.size;
+	}
+	else if(level == IPPROTO_TCP && opt_name == TCP_NODELAY)
+	{
+		val = tcp_sock->nodelay;
+	}
+	else
+	{
+		*current->perrno = ENOPROTOOPT;
+		return -1;
+	}
+
+	*(si32_t*)opt_val = val;
+	*opt_len = sizeof(si32_t);
+
+	return 0;
 }
@@ -43,6 +43,7 @@ int sys_kill(pid_t pid, ui32_t sig)
 	/** Modify the signal set. **/
 
 	proc_tab[pid].sigset |= (1 << (sig - 1));
+	signal_wake(&proc_tab[pid]);
 
 	return 0;
 }
@@ -9,6 +9,7 @@
 #include <fs/file.h>
 #include <kernel/errno.h>
 #include <kernel/isr.h>
+#include <kernel/libc.h>
 #include <kernel/printk.h>
 #include <kernel/process.h>
 #include <kernel/types.h>
@@ -17,6 +18,9 @@
 
 /**
  * sys_listen
+ *
+ *   backlog bounds the connections in the handshake or waiting for accept
+ *   (at least 1, at most TCP_BACKLOG_MAX).
  */
 
 int sys_listen(si32_t fildes, ui32_t backlog)
@@ -31,8 +35,27 @@ int sys_listen(si32_t fildes, ui32_t backlog)
 		return -1;
 	}
 
-	tcp_sock = &tcp_sock_tab[file->data.tcp_sock_id];
+	tcp_sock = tcp_sock_get(file->data.tcp_sock_id);
+
+	if(tcp_sock->state != TCP_CLOSED && tcp_sock->state != TCP_LISTEN)
+	{
+		*current->perrno = EINVAL;
+		return -1;
+	}
+
+	/** The backlog may change while the socket listens: the connections
+	    past a smaller one stay. The free sockets follow it, since the
+	    network interrupt takes its connections from them. **/
+
+	if(tcp_sock->state == TCP_LISTEN)
+	{
+		nr_tcp_backlogs -= tcp_sock->backlog;
+	}
+
+	tcp_sock->backlog = backlog ? min(backlog, TCP_BACKLOG_MAX) : 1;
+	nr_tcp_backlogs += tcp_sock->backlog;
 	tcp_set_socket_state(tcp_sock, TCP_LISTEN, 0);
+	tcp_socket_reserve();
 
 	return 0;
 }
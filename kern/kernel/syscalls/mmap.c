@@ -0,0 +1,136 @@
+/****************************************************************
+ * mmap.c                                                       *
+ *                                                              *
+ *    mmap syscall.                                             *
+ *                                                              *
+ ****************************************************************/
+
+#include <config.h>
+#include <fs/ext2.h>
+#include <fs/file.h>
+#include <kernel/errno.h>
+#include <kernel/printk.h> // debugging
+#include <kernel/process.h>
+#include <kernel/types.h>
+#include <mm/mem_map.h>
+#include <mm/vma.h>
+
+/**
+ * sys_mmap
+ */
+
+/** FIXME Only private mappings are supported (a read-only shared mapping of
+          a file behaves like a private one). **/
+
+void *sys_mmap(void *addr,
+               size_t len,
+               ui32_t prot,
+               ui32_t flags,
+               si32_t fildes,
+               off_t off)
+{
+	struct fildes *fd;
+	struct file *file;
+	ino_t file_id = 0;
+	ui32_t inum = 0;
+	ui32_t start, end;
+	ret_t err;
+
+	#ifdef DEBUG
+	printk("mmap(%x, %x, %x, %x, %x, %x)\n",
+	       addr, len, prot, flags, fildes, off);
+	#endif
+
+	/** Check the arguments. **/
+
+	if(!len || len > USER_STACK_BASE - USER_BASE || (off & 0xfff)
+	|| !(flags & (MAP_SHARED | MAP_PRIVATE)))
+	{
+		*current->perrno = EINVAL;
+		return MAP_FAILED;
+	}
+
+	if((flags & MAP_SHARED)
+	&& ((flags & MAP_ANONYMOUS) || (prot & PROT_WRITE)))
+	{
+		*current->perrno = EINVAL;
+		return MAP_FAILED;
+	}
+
+	len = (len + 0xfff) & ~0xfff;
+
+	/** File mappings are backed by regular ext2 files opened for
+	    reading. **/
+
+	if(!(flags & MAP_ANONYMOUS))
+	{
+		if((err = fildes_check(fildes, &fd, &file, 1, FS_EXT2)) != OK)
+		{
+			*current->perrno = (ui32_t)(-err);
+			return MAP_FAILED;
+		}
+
+		if(!(file->data.ext2_file.inode.i_type_perm & EXT2_REG_FILE))
+		{
+			*current->perrno = ENODEV;
+			return MAP_FAILED;
+		}
+
+		if(current->fildes_flags[fildes] & O_WRONLY)
+		{
+			*current->perrno = EACCES;
+			return MAP_FAILED;
+		}
+
+		file_id = fd->inum;
+		inum = file->data.ext2_file.inum;
+	}
+
+	/** Choose the address of the mapping. A fixed mapping replaces
+	    whatever was mapped at its address. **/
+
+	if(flags & MAP_FIXED)
+	{
+		start = (ui32_t)addr;
+		end = start + len;
+
+		if((start & 0xfff) || start < USER_BASE
+		|| end > USER_STACK_BASE || end < start)
+		{
+			*current->perrno = EINVAL;
+			return MAP_FAILED;
+		}
+
+		if(vma_unmap(start, end) != OK)
+		{
+			*current->perrno = ENOMEM;
+			return MAP_FAILED;
+		}
+
+		vma_release_pages(start, end);
+	}
+	else
+	{
+		start = vma_find_gap(len);
+
+		if(!start)
+		{
+			*current->perrno = ENOMEM;
+			return MAP_FAILED;
+		}
+
+		end = start + len;
+	}
+
+	/** Pages are mapped lazily by the page fault handler. **/
+
+	if(vma_add(start, end, prot, file_id, inum, off) != OK)
+	{
+		*current->perrno = ENOMEM;
+		return MAP_FAILED;
+	}
+
+	*current->perrno = 0;
+
+	return (void*)start;
+}
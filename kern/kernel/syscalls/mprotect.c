@@ -0,0 +1,43 @@
+/****************************************************************
+ * mprotect.c                                                   *
+ *                                                              *
+ *    mprotect syscall.                                         *
+ *                                                              *
+ ****************************************************************/
+
+#include <kernel/errno.h>
+#include <kernel/process.h>
+#include <kernel/types.h>
+#include <mm/mem_map.h>
+#include <mm/vma.h>
+
+/**
+ * sys_mprotect
+ */
+
+/** FIXME Only the regions created by mmap can be protected. **/
+
+int sys_mprotect(void *addr, size_t len, ui32_t prot)
+{
+	ui32_t start = (ui32_t)addr, end;
+	ret_t err;
+
+	end = start + ((len + 0xfff) & ~0xfff);
+
+	if((start & 0xfff) || start < USER_BASE
+	|| end > USER_STACK_BASE || end < start)
+	{
+		*current->perrno = EINVAL;
+		return -1;
+	}
+
+	if((err = vma_protect(start, end, prot)) != OK)
+	{
+		*current->perrno = (ui32_t)(-err);
+		return -1;
+	}
+
+	*current->perrno = 0;
+
+	return 0;
+}
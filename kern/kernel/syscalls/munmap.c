@@ -0,0 +1,40 @@
+/****************************************************************
+ * munmap.c                                                     *
+ *                                                              *
+ *    munmap syscall.                                           *
+ *                                                              *
+ ****************************************************************/
+
+#include <kernel/errno.h>
+#include <kernel/process.h>
+#include <kernel/types.h>
+#include <mm/mem_map.h>
+#include <mm/vma.h>
+
+/**
+ * sys_munmap
+ */
+
+int sys_munmap(void *addr, size_t len)
+{
+	ui32_t start = (ui32_t)addr, end;
+
+	end = start + ((len + 0xfff) & ~0xfff);
+
+	if(!len || (start & 0xfff) || start < USER_BASE
+	|| end > USER_STACK_BASE || end <= start)
+	{
+		*current->perrno = EINVAL;
+		return -1;
+	}
+
+	if(vma_unmap(start, end) != OK)
+	{
+		*current->perrno = ENOMEM;
+		return -1;
+	}
+
+	*current->perrno = 0;
+
+	return 0;
+}
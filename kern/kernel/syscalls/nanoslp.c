@@ -0,0 +1,54 @@
+/****************************************************************
+ * nanoslp.c                                                    *
+ *                                                              *
+ *    nanosleep syscall.                                        *
+ *                                                              *
+ ****************************************************************/
+
+#include <kernel/errno.h>
+#include <kernel/hrtimer.h>
+#include <kernel/process.h>
+#include <kernel/types.h>
+#include <kernel/wait.h>
+
+/**
+ * sys_nanosleep
+ */
+
+int sys_nanosleep(struct timespec *req, struct timespec *rem)
+{
+	ui64_t end;
+
+	if(!in_user_range(req, req + 1)
+	|| (rem && !in_user_range(rem, rem + 1)))
+	{
+		*current->perrno = EFAULT;
+		return -1;
+	}
+
+	if(req->tv_nsec < 0 || req->tv_nsec >= 1000000000)
+	{
+		*current->perrno = EINVAL;
+		return -1;
+	}
+
+	/** The sleep has the resolution of the PIT (about 838 ns). If a signal
+	    interrupts it, the syscall returns EINTR without setting rem. **/
+
+	end = hrtimer_now() + hrtimer_cycles(req->tv_sec, req->tv_nsec);
+
+	while(hrtimer_now() < end)
+	{
+		wait_schedule(end);
+	}
+
+	if(rem)
+	{
+		rem->tv_sec = 0;
+		rem->tv_nsec = 0;
+	}
+
+	*current->perrno = 0;
+
+	return 0;
+}
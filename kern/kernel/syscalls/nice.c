@@ -0,0 +1,26 @@
+/****************************************************************
+ * nice.c                                                       *
+ *                                                              *
+ *    nice syscall.                                             *
+ *                                                              *
+ ****************************************************************/
+
+#include <kernel/errno.h>
+#include <kernel/process.h>
+#include <kernel/schedule.h>
+#include <kernel/types.h>
+
+/**
+ * sys_nice
+ */
+
+int sys_nice(si32_t inc)
+{
+	/** The nice value is clamped to [NICE_MIN, NICE_MAX]. **/
+
+	schedule_set_nice(current, current->nice + inc);
+
+	*current->perrno = 0;
+
+	return current->nice;
+}
@@ -5,20 +5,12 @@
  *                                                              *
  ****************************************************************/
 
-#include <fs/fifo.h>
 #include <fs/file.h>
+#include <fs/pipe.h>
 #include <kernel/errno.h>
 #include <kernel/process.h>
 #include <kernel/types.h>
 
-/** Pipe table. **/
-
-struct pipe pipe_tab[NR_PIPES] = {
-	{
-		.used = 0
-	}
-};
-
 /**
  * sys_pipe2
  */
@@ -31,6 +23,14 @@ int sys_pipe2(si32_t pipefd[2], ui32_t flags)
 	si32_t pipe_id;
 	struct pipe *pipe;
 
+	/** Check pipefd address. **/
+
+	if(!in_user_range(pipefd, pipefd + 2))
+	{
+		*current->perrno = EFAULT;
+		return -1;
+	}
+
 	/** Allocate a file structure. **/
 
 	inum = file_alloc();
@@ -40,24 +40,24 @@ int sys_pipe2(si32_t pipefd[2], ui32_t flags)
 		goto fail1;
 	}
 
-	/** Allocate a pipe structure. **/
+	/** Allocate a pipe structure. The file owns it from now on: it is
+	    released with the file on failure. **/
 
-	for(pipe_id = 0; pipe_id < NR_PIPES; pipe_id++)
-	{
-		pipe = &pipe_tab[pipe_id];
-
-		if(!pipe->used)
-		{
-			break;
-		}
-	}
+	pipe_id = pipe_alloc();
 
-	if(pipe_id == NR_PIPES)
+	if(pipe_id < 0)
 	{
-		*current->perrno = ENFILE;
+		*current->perrno = (ui32_t)(-pipe_id);
 		goto fail2;
 	}
 
+	pipe = pipe_get(pipe_id);
+
+	/** Initialize the file. **/
+
+	file_tab[inum - 1].fs = FS_PIPEFS;
+	file_tab[inum - 1].data.pipe_id = pipe_id;
+
 	/** Allocate the reading file descriptor. **/
 
 	fildes_read = fildes_alloc(0);
@@ -78,11 +78,6 @@ int sys_pipe2(si32_t pipefd[2], ui32_t flags)
 		goto fail3;
 	}
 
-	/** Initialize the file. **/
-
-	file_tab[inum - 1].fs = FS_PIPEFS;
-	file_tab[inum - 1].data.pipe_id = pipe_id;
-
 	/** Initialize file descriptors. **/
 
 	fd_read = current->pfildes_tab[fildes_read];
@@ -99,9 +94,7 @@ int sys_pipe2(si32_t pipefd[2], ui32_t flags)
 
 	/** Initialize the pipe. **/
 
-	pipe->used = 1;
 	pipe->readers = pipe->writers = 1;
-	fifo_flush(&pipe->fifo);
 
 	/** Reference the file (twice). **/
 
@@ -18,6 +18,7 @@
 #include <kernel/process.h>
 #include <kernel/syscall.h>
 #include <kernel/types.h>
+#include <kernel/wait.h>
 
 /**
  * sys_read
@@ -114,17 +115,20 @@ ssize_t sys_read(si32_t fildes, void *buf, size_t size)
 	#ifdef ENABLE_NETWORK
 	else if(file->fs == FS_TCPSOCKFS)
 	{
+		ui32_t flags = spin_lock_irqsave(&tcp_lock);
+
 		ret = sys_recv(fildes, buf, size, 0);
+		spin_unlock_irqrestore(&tcp_lock, flags);
 	}
 	#endif
 	#ifdef ENABLE_PIPES
 	else if(file->fs == FS_PIPEFS)
 	{
-		struct pipe *pipe = &pipe_tab[file->data.pipe_id];
+		struct pipe *pipe = pipe_get(file->data.pipe_id);
 
 		ret = 0;
 
-		while(pipe->writers || pipe->fifo.to_read)
+		while(pipe->writers || fifo_count(&pipe->fifo))
 		{
 			ret = (ssize_t)fifo_read(&pipe->fifo, buf, size, 0);
 
@@ -133,9 +137,7 @@ ssize_t sys_read(si32_t fildes, void *buf, size_t size)
 				break;
 			}
 
-			sti;
-			yield;
-			cli;
+			wait_sleep(&pipe->fifo.wq);
 		}
 
 		/*printk("read bytes \"%s\"(%x) to %x from pipe (pid: %x)\n",
@@ -9,12 +9,12 @@
 #include <fs/fifo.h>
 #include <fs/file.h>
 #include <kernel/errno.h>
-#include <kernel/int.h>
 #include <kernel/libc.h>
 #include <kernel/panic.h>
 #include <kernel/printk.h>
 #include <kernel/process.h>
 #include <kernel/types.h>
+#include <kernel/wait.h>
 #include <kernel/syscalls/utils.h>
 #include <net/tcp.h>
 
@@ -27,6 +27,7 @@ ssize_t sys_recv(si32_t fildes, void *buf, size_t len, ui32_t flags)
 	struct fildes *fd;
 	struct file *file;
 	struct tcp_socket *tcp_sock;
+	size_t n;
 	ssize_t ret;
 	ret_t err;
 
@@ -41,7 +42,14 @@ ssize_t sys_recv(si32_t fildes, void *buf, size_t len, ui32_t flags)
 		goto end;
 	}
 
-	tcp_sock = &tcp_sock_tab[file->data.tcp_sock_id];
+	if(len && !in_user_range(buf, buf + len))
+	{
+		*current->perrno = EFAULT;
+		ret = -1;
+		goto end;
+	}
+
+	tcp_sock = tcp_sock_get(file->data.tcp_sock_id);
 
 	if(tcp_sock->state == TCP_CLOSED
 	|| tcp_sock->state == TCP_SYN_SENT
@@ -55,7 +63,7 @@ ssize_t sys_recv(si32_t fildes, void *buf, size_t len, ui32_t flags)
 	      || tcp_sock->state == TCP_CLOSING
 	      || tcp_sock->state == TCP_TIME_WAIT
 	      || tcp_sock->state == TCP_LAST_ACK)
-	     && !tcp_sock->rx_fifo.to_read)
+	     && !fifo_count(&tcp_sock->rx_fifo))
 	{
 		*current->perrno = 0;
 		ret = 0;
@@ -63,7 +71,7 @@ ssize_t sys_recv(si32_t fildes, void *buf, size_t len, ui32_t flags)
 	}
 
 	/*if((tcp_sock->state == TCP_CLOSED || tcp_sock->state > TCP_ESTABLISHED)
-	&& !tcp_sock->rx_fifo.to_read)
+	&& !fifo_count(&tcp_sock->rx_fifo))
 	{
 		ret = 0;
 		goto end;
@@ -79,20 +87,33 @@ ssize_t sys_recv(si32_t fildes, void *buf, size_t len, ui32_t flags)
 	printk("socket state: %x\n", tcp_sock->state);
 	#endif
 
-	do
+	while(1)
 	{
-		sti;
-		yield;
-		cli;
 		#ifdef DEBUG_SOCKETS
 		printk("reading...: %x available\n",
-		       tcp_sock->rx_fifo.to_read);
+		       fifo_count(&tcp_sock->rx_fifo));
 		#endif
-		ret = tcp_data_push(tcp_sock, buf, len);
+
+		/** Only copy the bytes received once the buffer holding them
+		    is present (more may come while it is faulted in). **/
+
+		do
+		{
+			n = min(len, fifo_count(&tcp_sock->rx_fifo));
+		} while(tcp_fault_in(buf, n, 1));
+
+		ret = tcp_data_push(tcp_sock, buf, n);
 		#ifdef DEBUG_SOCKETS
 		printk("read bytes: %x\n", ret);
 		#endif
-	} while(!(current->fildes_flags[fildes] & O_NONBLOCK) && !ret);
+
+		if((current->fildes_flags[fildes] & O_NONBLOCK) || ret)
+		{
+			break;
+		}
+
+		wait_sleep_lock(&tcp_sock->wq, &tcp_lock);
+	}
 
 	#ifdef DEBUG_SOCKETS
 	printk("out of receive loop\n");
@@ -9,13 +9,14 @@
 #include <fs/file.h>
 #include <fs/tty.h>
 #include <kernel/errno.h>
-#include <kernel/int.h>
+#include <kernel/hrtimer.h>
 #include <kernel/isr.h>
 #include <kernel/libc.h>
 #include <kernel/panic.h>
 #include <kernel/printk.h>
 #include <kernel/process.h>
 #include <kernel/types.h>
+#include <kernel/wait.h>
 
 /**
  * sys_select
@@ -32,17 +33,22 @@ si32_t sys_select(ui32_t nfds,
 	struct file *file;
 	struct tcp_socket *tcp_sock;
 	si32_t ret = 0;
-	clock_t timeout_set_tics = tics;
-	clock_t timeout_tics
-	 = timeout ? (tics
-	            + timeout->tv_sec * CLK_FREQ
-	            + timeout->tv_usec * CLK_FREQ / 1000000 + 1) // FIXME
+	ui64_t timeout_end
+	 = timeout ? hrtimer_now()
+	             + hrtimer_cycles(timeout->tv_sec, timeout->tv_usec * 1000)
 	           : 0;
 	ret_t err;
+	ui32_t flags;
 
 	// WARNING: stack overflow risk if NR_FILDES_PER_PROC is too big
 	fd_set readfds_in, writefds_in, exceptfds_in;
 
+	/** The descriptors are tested with the lock of the network stack held
+	    (and interrupts disabled), so that no wakeup is lost before the
+	    sleep. **/
+
+	flags = spin_lock_irqsave(&tcp_lock);
+
 	/** Check for nfds validity. **/
 
 	if(nfds > NR_FILDES_PER_PROC)
@@ -101,8 +107,8 @@ si32_t sys_select(ui32_t nfds,
 					/** Handle the special case of the
 					    tty. **/
 
-					if(tty_ififo.to_read
-					|| tty_ififo2.to_read)
+					if(fifo_count(&tty_ififo)
+					|| fifo_count(&tty_ififo2))
 					{
 						ret++;
 						FD_SET(fildes, readfds);
@@ -111,12 +117,14 @@ si32_t sys_select(ui32_t nfds,
 					else
 					{
 						FD_CLR(fildes, readfds);
+						wait_add(&tty_ififo.wq);
+						wait_add(&tty_ififo2.wq);
 					}
 				}
 				else if(file->fs == FS_TCPSOCKFS)
 				{
-					tcp_sock = &tcp_sock_tab
-					             [file->data.tcp_sock_id];
+					tcp_sock = tcp_sock_get(
+					           file->data.tcp_sock_id);
 					#ifdef DEBUG_SOCKETS
 					debug = 1;
 					printk("select: sock fildes (r)\n");
@@ -126,7 +134,8 @@ si32_t sys_select(ui32_t nfds,
 					|| tcp_sock->state == TCP_CLOSING
 					|| tcp_sock->state == TCP_TIME_WAIT
 					|| tcp_sock->state == TCP_LAST_ACK
-					|| tcp_sock->rx_fifo.to_read)
+					|| fifo_count(&tcp_sock->rx_fifo)
+					|| tcp_sock->accept_head)
 					{
 						ret++;
 						FD_SET(fildes, readfds);
@@ -135,6 +144,7 @@ si32_t sys_select(ui32_t nfds,
 					else	
 					{
 						FD_CLR(fildes, readfds);
+						wait_add(&tcp_sock->wq);
 					}
 				}
 				else
@@ -181,12 +191,12 @@ si32_t sys_select(ui32_t nfds,
 					debug = 1;
 					printk("select: sock fildes (w)\n");
 					#endif
-					tcp_sock = &tcp_sock_tab
-					            [file->data.tcp_sock_id];
+					tcp_sock = tcp_sock_get(
+					           file->data.tcp_sock_id);
 
 					if((tcp_sock->state == TCP_ESTABLISHED
 					 || tcp_sock->state == TCP_CLOSE_WAIT)
-					&& tcp_sock->free_buf)
+					&& fifo_left(&tcp_sock->tx_fifo))
 					{
 						ret++;
 						FD_SET(fildes, writefds);
@@ -195,6 +205,7 @@ si32_t sys_select(ui32_t nfds,
 					else
 					{
 						FD_CLR(fildes, writefds);
+						wait_add(&tcp_sock->wq);
 						*current->perrno = EALREADY;
 					}
 				}
@@ -210,12 +221,12 @@ si32_t sys_select(ui32_t nfds,
 
 	/** TODO exceptfds **/
 
-	if((!timeout || byte_in_win(tics, timeout_set_tics, timeout_tics))
-	&& !ret)
+	/** Sleep until one of the descriptors which were not ready changes
+	    state or the timeout expires. **/
+
+	if((!timeout || hrtimer_now() < timeout_end) && !ret)
 	{
-		sti;
-		yield;
-		cli;
+		wait_schedule_lock(timeout_end, &tcp_lock);
 		goto retry;
 	}
 
@@ -232,5 +243,6 @@ si32_t sys_select(ui32_t nfds,
 	}
 
 	end:
+		spin_unlock_irqrestore(&tcp_lock, flags);
 		return ret;
 }
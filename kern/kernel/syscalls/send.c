@@ -8,17 +8,21 @@
 #include <config.h>
 #include <fs/file.h>
 #include <kernel/errno.h>
-#include <kernel/int.h>
 #include <kernel/libc.h>
 #include <kernel/panic.h>
 #include <kernel/printk.h>
 #include <kernel/process.h>
 #include <kernel/types.h>
+#include <kernel/wait.h>
 #include <kernel/syscalls/utils.h>
 #include <net/tcp.h>
 
 /**
  * sys_send
+ *
+ *   Queues the bytes in the send buffer of the socket. A blocking socket waits
+ *   for room until all of them are queued, a non-blocking one queues what
+ *   fits.
  */
 
 ssize_t sys_send(si32_t fildes, void *buf, size_t len, ui32_t flags)
@@ -26,42 +30,66 @@ ssize_t sys_send(si32_t fildes, void *buf, size_t len, ui32_t flags)
 	struct fildes *fd;
 	struct file *file;
 	struct tcp_socket *tcp_sock;
-	ret_t ret;
+	size_t done = 0, n;
+	ssize_t ret;
+	ret_t err;
 
 	#ifdef DEBUG_SOCKETS
 	printk("sys_send(%x, %x, %x, %x)\n", fildes, buf, len, flags);
 	#endif
 
-	if((ret = fildes_check(fildes, &fd, &file, 1, FS_TCPSOCKFS)) != OK)
+	if((err = fildes_check(fildes, &fd, &file, 1, FS_TCPSOCKFS)) != OK)
 	{
-		*current->perrno = (ui32_t)(-ret);
+		*current->perrno = (ui32_t)(-err);
 		return -1;
 	}
 
-	tcp_sock = &tcp_sock_tab[file->data.tcp_sock_id];
-
-	if(tcp_sock->state != TCP_ESTABLISHED
-	&& tcp_sock->state != TCP_CLOSE_WAIT)
+	if(len && !in_user_range(buf, buf + len))
 	{
-		*current->perrno = EPIPE;
+		*current->perrno = EFAULT;
 		return -1;
 	}
 
-	do
+	tcp_sock = tcp_sock_get(file->data.tcp_sock_id);
+
+	while(1)
 	{
-		sti;
-		yield;
-		cli;
-		ret = tcp_data_out(tcp_sock, buf, len);
-	} while(!(current->fildes_flags[fildes] & O_NONBLOCK)
-	        && ret == -ENOBUFS);
-
-	if(ret == ENOBUFS)
+		/** Only copy the bytes there is room for once they are
+		    present: the room may grow while they are faulted in. **/
+
+		do
+		{
+			n = min(len - done, fifo_left(&tcp_sock->tx_fifo));
+		} while(tcp_fault_in(buf + done, n, 0));
+
+		ret = tcp_data_out(tcp_sock, buf + done, n);
+
+		if(ret < 0)
+		{
+			if(done)
+			{
+				break;
+			}
+
+			*current->perrno = EPIPE;
+			return -1;
+		}
+
+		done += ret;
+
+		if(done == len || (current->fildes_flags[fildes] & O_NONBLOCK))
+		{
+			break;
+		}
+
+		wait_sleep_lock(&tcp_sock->wq, &tcp_lock);
+	}
+
+	if(!done && len)
 	{
 		*current->perrno = EWOULDBLOCK;
 		return -1;
 	}
 
-	*current->perrno = (ui32_t)(-ret);
-	return len;
+	return done;
 }
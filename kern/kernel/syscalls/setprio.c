@@ -0,0 +1,46 @@
+/****************************************************************
+ * setprio.c                                                    *
+ *                                                              *
+ *    setpriority syscall.                                      *
+ *                                                              *
+ ****************************************************************/
+
+#include <kernel/errno.h>
+#include <kernel/process.h>
+#include <kernel/schedule.h>
+#include <kernel/types.h>
+
+/**
+ * sys_setpriority
+ */
+
+int sys_setpriority(ui32_t which, ui32_t who, si32_t prio)
+{
+	pid_t pid;
+	count_t found = 0;
+
+	if(which != PRIO_PROCESS && which != PRIO_PGRP && which != PRIO_USER)
+	{
+		*current->perrno = EINVAL;
+		return -1;
+	}
+
+	for(pid = 0; pid < NR_PROC; pid++)
+	{
+		if(schedule_prio_match(&proc_tab[pid], which, who))
+		{
+			schedule_set_nice(&proc_tab[pid], prio);
+			found++;
+		}
+	}
+
+	if(!found)
+	{
+		*current->perrno = ESRCH;
+		return -1;
+	}
+
+	*current->perrno = 0;
+
+	return 0;
+}
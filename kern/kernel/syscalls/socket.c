@@ -79,7 +79,7 @@ int sys_socket(ui32_t domain, ui32_t type, ui32_t proto)
 
 	/** Initialize the socket. **/
 
-	tcp_socket_init(&tcp_sock_tab[sock_id]);
+	tcp_socket_init(tcp_sock_get(sock_id));
 
 	/** Reference the file. **/
 
@@ -0,0 +1,489 @@
+/****************************************************************
+ * splice.c                                                     *
+ *                                                              *
+ *    splice syscall.                                           *
+ *                                                              *
+ ****************************************************************/
+
+#include <config.h>
+#include <fs/ext2.h>
+#include <fs/fifo.h>
+#include <fs/file.h>
+#include <fs/pipe.h>
+#include <kernel/errno.h>
+#include <kernel/lock.h>
+#include <kernel/process.h>
+#include <kernel/signal.h>
+#include <kernel/syscall.h>
+#include <kernel/types.h>
+#include <kernel/wait.h>
+#include <kernel/syscalls/utils.h>
+#include <net/tcp.h>
+
+/** Bounce buffer of the transfers from a file to a socket (the only ones
+    with no pipe to copy through). splice_move does not sleep, so that one
+    buffer is enough. **/
+
+#define SPLICE_BUF_SIZE		4096
+
+ui8_t splice_buf[SPLICE_BUF_SIZE];
+
+/**
+ * splice_avail
+ *
+ *   Returns how many bytes can be read from the file without sleeping, 0 at
+ *   the end of the file, -EAGAIN if the reader has to wait, or an error.
+ */
+
+ssize_t splice_avail(struct file *file, struct fildes *fd)
+{
+	ssize_t ret;
+
+	if(file->fs == FS_PIPEFS)
+	{
+		struct pipe *pipe = pipe_get(file->data.pipe_id);
+
+		if(fifo_count(&pipe->fifo))
+		{
+			ret = fifo_count(&pipe->fifo);
+		}
+		else
+		{
+			ret = pipe->writers ? -EAGAIN : 0;
+		}
+	}
+	else if(file->fs == FS_EXT2)
+	{
+		struct ext2_inode *inode = &file->data.ext2_file.inode;
+
+		ret = (fd->off < inode->i_size_low)
+		    ? inode->i_size_low - fd->off
+		    : 0;
+	}
+	#ifdef ENABLE_NETWORK
+	else if(file->fs == FS_TCPSOCKFS)
+	{
+		struct tcp_socket *tcp_sock
+		 = tcp_sock_get(file->data.tcp_sock_id);
+		ui32_t flags = spin_lock_irqsave(&tcp_lock);
+
+		/** Same rules as recv. **/
+
+		if(fifo_count(&tcp_sock->rx_fifo))
+		{
+			ret = fifo_count(&tcp_sock->rx_fifo);
+		}
+		else if(tcp_sock->state == TCP_CLOSED
+		     || tcp_sock->state == TCP_SYN_SENT
+		     || tcp_sock->state == TCP_SYN_RECEIVED)
+		{
+			ret = -ENOTCONN;
+		}
+		else if(tcp_sock->state == TCP_CLOSE_WAIT
+		     || tcp_sock->state == TCP_CLOSING
+		     || tcp_sock->state == TCP_TIME_WAIT
+		     || tcp_sock->state == TCP_LAST_ACK)
+		{
+			ret = 0;
+		}
+		else
+		{
+			ret = -EAGAIN;
+		}
+
+		spin_unlock_irqrestore(&tcp_lock, flags);
+	}
+	#endif
+	else
+	{
+		ret = -EINVAL;
+	}
+
+	return ret;
+}
+
+/**
+ * splice_room
+ *
+ *   Returns how many bytes can be written to the file without sleeping,
+ *   -EAGAIN if the writer has to wait, or an error.
+ */
+
+ssize_t splice_room(struct file *file)
+{
+	ssize_t ret;
+
+	if(file->fs == FS_PIPEFS)
+	{
+		struct pipe *pipe = pipe_get(file->data.pipe_id);
+
+		if(!pipe->readers)
+		{
+			ret = -EPIPE;
+		}
+		else
+		{
+			ret = fifo_left(&pipe->fifo) ? fifo_left(&pipe->fifo)
+			                             : -EAGAIN;
+		}
+	}
+	else if(file->fs == FS_EXT2)
+	{
+		ret = (file->data.ext2_file.inode.i_type_perm & EXT2_DIR)
+		    ? -EISDIR
+		    : 0x7fffffff;
+	}
+	#ifdef ENABLE_NETWORK
+	else if(file->fs == FS_TCPSOCKFS)
+	{
+		struct tcp_socket *tcp_sock
+		 = tcp_sock_get(file->data.tcp_sock_id);
+		ui32_t flags = spin_lock_irqsave(&tcp_lock);
+
+		if((tcp_sock->state != TCP_ESTABLISHED
+		    && tcp_sock->state != TCP_CLOSE_WAIT)
+		|| tcp_sock->close_req)
+		{
+			ret = -EPIPE;
+		}
+		else
+		{
+			ret = fifo_left(&tcp_sock->tx_fifo)
+			    ? fifo_left(&tcp_sock->tx_fifo)
+			    : -EAGAIN;
+		}
+
+		spin_unlock_irqrestore(&tcp_lock, flags);
+	}
+	#endif
+	else
+	{
+		ret = -EINVAL;
+	}
+
+	return ret;
+}
+
+/**
+ * splice_wait
+ *
+ *   Sleeps until the file may have bytes to read (or room to write), as
+ *   splice_avail (or splice_room) said it had not.
+ */
+
+void splice_wait(struct file *file, bool_t in)
+{
+	if(file->fs == FS_PIPEFS)
+	{
+		/** Pipes are only used by processes: nothing changes them
+		    until we sleep. **/
+
+		wait_sleep(&pipe_get(file->data.pipe_id)->fifo.wq);
+	}
+	#ifdef ENABLE_NETWORK
+	else if(file->fs == FS_TCPSOCKFS)
+	{
+		struct tcp_socket *tcp_sock
+		 = tcp_sock_get(file->data.tcp_sock_id);
+		ui32_t flags = spin_lock_irqsave(&tcp_lock);
+
+		/** The interrupt handlers may have changed the socket since
+		    it was checked. **/
+
+		if(in ? !fifo_count(&tcp_sock->rx_fifo)
+		      : !fifo_left(&tcp_sock->tx_fifo))
+		{
+			wait_sleep_lock(&tcp_sock->wq, &tcp_lock);
+		}
+
+		spin_unlock_irqrestore(&tcp_lock, flags);
+	}
+	#endif
+}
+
+/**
+ * splice_read
+ *
+ *   Reads at most size bytes from a file or a socket, without sleeping.
+ */
+
+ssize_t splice_read(struct file *file,
+                    struct fildes *fd,
+                    void *buf,
+                    size_t size)
+{
+	ssize_t ret;
+
+	if(file->fs == FS_EXT2)
+	{
+		ret = ext2_read(file->data.ext2_file.inum, buf, size, fd->off);
+
+		if(ret == -1)
+		{
+			return -EIO;
+		}
+
+		fd->off += ret;
+	}
+	#ifdef ENABLE_NETWORK
+	else if(file->fs == FS_TCPSOCKFS)
+	{
+		ui32_t flags = spin_lock_irqsave(&tcp_lock);
+
+		ret = tcp_data_push(tcp_sock_get(file->data.tcp_sock_id),
+		                    buf,
+		                    size);
+		spin_unlock_irqrestore(&tcp_lock, flags);
+	}
+	#endif
+	else
+	{
+		ret = -EINVAL;
+	}
+
+	return ret;
+}
+
+/**
+ * splice_write
+ *
+ *   Writes at most size bytes to a file, a socket or a pipe, without
+ *   sleeping.
+ */
+
+ssize_t splice_write(struct file *file,
+                     struct fildes *fd,
+                     void *buf,
+                     size_t size)
+{
+	ssize_t ret;
+
+	if(file->fs == FS_PIPEFS)
+	{
+		ret = fifo_write(&pipe_get(file->data.pipe_id)->fifo,
+		                 buf,
+		                 size,
+		                 0);
+	}
+	else if(file->fs == FS_EXT2)
+	{
+		struct ext2_inode *inode = &file->data.ext2_file.inode;
+
+		/** Append bytes to the file if required (see sys_write). **/
+
+		if(fd->off + size > inode->i_size_low
+		&& ext2_append(&file->data.ext2_file,
+		               fd->off + size - inode->i_size_low) != OK)
+		{
+			return -EIO;
+		}
+
+		ret = ext2_write(&file->data.ext2_file, buf, size, fd->off);
+
+		if(ret == -1)
+		{
+			return -EIO;
+		}
+
+		fd->off += ret;
+	}
+	#ifdef ENABLE_NETWORK
+	else if(file->fs == FS_TCPSOCKFS)
+	{
+		ui32_t flags = spin_lock_irqsave(&tcp_lock);
+
+		ret = tcp_data_out(tcp_sock_get(file->data.tcp_sock_id),
+		                   buf,
+		                   size);
+		spin_unlock_irqrestore(&tcp_lock, flags);
+	}
+	#endif
+	else
+	{
+		ret = -EINVAL;
+	}
+
+	return ret;
+}
+
+/**
+ * splice_move
+ *
+ *   Moves at most size bytes, which the input has and the output has room
+ *   for. The bytes are copied once, straight from or to the buffer of the
+ *   pipe when there is one.
+ */
+
+ssize_t splice_move(struct file *in,
+                    struct fildes *fd_in,
+                    struct file *out,
+                    struct fildes *fd_out,
+                    size_t size)
+{
+	struct fifo *fifo;
+	ssize_t ret;
+	size_t n;
+	void *data;
+
+	if(in->fs == FS_PIPEFS)
+	{
+		fifo = &pipe_get(in->data.pipe_id)->fifo;
+		n = fifo_peek(fifo, &data);
+		ret = splice_write(out, fd_out, data, (size < n) ? size : n);
+
+		if(ret > 0)
+		{
+			fifo_consume(fifo, ret);
+		}
+	}
+	else if(out->fs == FS_PIPEFS)
+	{
+		fifo = &pipe_get(out->data.pipe_id)->fifo;
+		n = fifo_reserve(fifo, &data);
+		ret = splice_read(in, fd_in, data, (size < n) ? size : n);
+
+		if(ret > 0)
+		{
+			fifo_commit(fifo, ret);
+		}
+	}
+	else
+	{
+		if(size > SPLICE_BUF_SIZE)
+		{
+			size = SPLICE_BUF_SIZE;
+		}
+
+		ret = splice_read(in, fd_in, splice_buf, size);
+
+		if(ret > 0)
+		{
+			ret = splice_write(out, fd_out, splice_buf, ret);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * sys_splice
+ *
+ *   Moves at most size bytes from fd_in to fd_out, at their offsets. One of
+ *   them must be a pipe, unless a file is sent to a socket. Returns the
+ *   number of bytes moved, which is less than size if it had to wait after
+ *   moving some, 0 at the end of the input.
+ */
+
+ssize_t sys_splice(si32_t fd_in, si32_t fd_out, size_t size, ui32_t flags)
+{
+	struct fildes *fdes_in, *fdes_out;
+	struct file *in, *out;
+	size_t done = 0;
+	ssize_t avail, room, ret;
+	bool_t nonblock;
+	ret_t err;
+
+	/** Check the file descriptors. **/
+
+	if((err = fildes_check(fd_in, &fdes_in, &in, 1, FS_NOFS)) != OK
+	|| (err = fildes_check(fd_out, &fdes_out, &out, 1, FS_NOFS)) != OK)
+	{
+		*current->perrno = (ui32_t)(-err);
+		return -1;
+	}
+
+	if(!in || !out
+	|| (current->fildes_flags[fd_in] & O_WRONLY)
+	|| !(current->fildes_flags[fd_out] & (O_WRONLY | O_RDWR)))
+	{
+		*current->perrno = EBADF;
+		return -1;
+	}
+
+	if(in == out
+	|| (in->fs != FS_PIPEFS
+	    && out->fs != FS_PIPEFS
+	    && (in->fs != FS_EXT2 || out->fs != FS_TCPSOCKFS)))
+	{
+		*current->perrno = EINVAL;
+		return -1;
+	}
+
+	/** The number of bytes moved is returned: it must fit in a
+	    ssize_t. **/
+
+	if(size > 0x7fffffff)
+	{
+		size = 0x7fffffff;
+	}
+
+	err = OK;
+
+	/** Wait until the input has bytes and the output room (the state of
+	    both may change while sleeping), then move as much as possible. **/
+
+	while(done < size)
+	{
+		avail = splice_avail(in, fdes_in);
+
+		if(!avail)
+		{
+			err = OK;
+			break;
+		}
+
+		room = (avail > 0) ? splice_room(out) : 0;
+		err = (avail < 0) ? avail : room;
+
+		if(err < 0)
+		{
+			nonblock = (flags & SPLICE_F_NONBLOCK)
+			        || (current->fildes_flags[(avail < 0) ? fd_in
+			                                             : fd_out]
+			            & O_NONBLOCK);
+
+			if(err != -EAGAIN || nonblock || done)
+			{
+				break;
+			}
+
+			splice_wait((avail < 0) ? in : out, avail < 0);
+			continue;
+		}
+
+		if((size_t)avail > size - done)
+		{
+			avail = size - done;
+		}
+
+		ret = splice_move(in,
+		                  fdes_in,
+		                  out,
+		                  fdes_out,
+		                  (avail < room) ? avail : room);
+
+		if(ret <= 0)
+		{
+			err = ret ? ret : -EIO;
+			break;
+		}
+
+		done += ret;
+		err = OK;
+	}
+
+	/** Report the error only if nothing was moved. **/
+
+	if(!done && err < 0)
+	{
+		if(err == -EPIPE)
+		{
+			current->sigset |= (1 << (SIGPIPE - 1));
+		}
+
+		*current->perrno = (ui32_t)(-err);
+		return -1;
+	}
+
+	return done;
+}
@@ -7,11 +7,19 @@
 
 #include <config.h>
 #include <fs/file.h>
+#include <kernel/errno.h>
 #include <kernel/printk.h>
+#include <kernel/process.h>
 #include <kernel/types.h>
+#include <kernel/syscalls/utils.h>
+#include <net/tcp.h>
 
 /**
  * sys_setsockopt
+ *
+ *   Options take an int: SO_REUSEADDR, SO_SNDBUF and SO_RCVBUF (the sizes of
+ *   the buffers) and TCP_NODELAY. Set SO_RCVBUF before connecting: the window
+ *   scale is chosen then.
  */
 
 int sys_setsockopt(si32_t fildes,
@@ -20,10 +28,77 @@ int sys_setsockopt(si32_t fildes,
                    void *opt_val,
                    socklen_t opt_len)
 {
+	struct file *file;
+	struct tcp_socket *tcp_sock;
+	si32_t val;
+	ret_t err;
+
 	#ifdef DEBUG
 	printk("sys_setsockopt(%x, %x, %x, %x, %x)\n",
 	       fildes, level, opt_name, opt_val, opt_len);
 	#endif
 
-	return -1;
+	if(opt_len < sizeof(si32_t))
+	{
+		*current->perrno = EINVAL;
+		return -1;
+	}
+
+	if(!in_user_range(opt_val, (si32_t*)opt_val + 1))
+	{
+		*current->perrno = EFAULT;
+		return -1;
+	}
+
+	/** tcp_lock is held: the option is only read once it is present. **/
+
+	while(tcp_fault_in(opt_val, sizeof(si32_t), 0));
+	val = *(si32_t*)opt_val;
+
+	if((err = fildes_check(fildes, 0, &file, 1, FS_TCPSOCKFS)) != OK)
+	{
+		*current->perrno = (ui32_t)(-err);
+		return -1;
+	}
+
+	tcp_sock = tcp_sock_get(file->data.tcp_sock_id);
+
+	if(level == SOL_SOCKET && opt_name == SO_REUSEADDR)
+	{
+		tcp_sock->reuse_addr = val ? 1 : 0;
+	}
+	else if(level == SOL_SOCKET
+	     && (opt_name == SO_SNDBUF || opt_name == SO_RCVBUF))
+	{
+		if(val < 0)
+		{
+			*current->perrno = EINVAL;
+			return -1;
+		}
+
+		err = (opt_name == SO_SNDBUF)
+		    ? tcp_sndbuf_resize(tcp_sock, val)
+		    : tcp_rcvbuf_resize(tcp_sock, val);
+
+		if(err != OK)
+		{
+			*current->perrno = (ui32_t)(-err);
+			return -1;
+		}
+	}
+	else if(level == IPPROTO_TCP && opt_name == TCP_NODELAY)
+	{
+		tcp_sock->nodelay = val ? 1 : 0;
+
+		/** Data held back by the Nagle algorithm may go now. **/
+
+		tcp_output(tcp_sock);
+	}
+	else
+	{
+		*current->perrno = ENOPROTOOPT;
+		return -1;
+	}
+
+	return 0;
 }
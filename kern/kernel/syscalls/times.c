@@ -0,0 +1,38 @@
+/****************************************************************
+ * times.c                                                      *
+ *                                                              *
+ *    times syscall.                                            *
+ *                                                              *
+ ****************************************************************/
+
+#include <kernel/errno.h>
+#include <kernel/isr.h>
+#include <kernel/process.h>
+#include <kernel/types.h>
+
+/**
+ * sys_times
+ */
+
+clock_t sys_times(struct tms *buf)
+{
+	/** Times are given in clock tics (CLK_FREQ per second). **/
+
+	if(buf && !in_user_range(buf, buf + 1))
+	{
+		*current->perrno = EFAULT;
+		return (clock_t)-1;
+	}
+
+	if(buf)
+	{
+		buf->tms_utime = current->utime;
+		buf->tms_stime = current->stime;
+		buf->tms_cutime = current->cutime;
+		buf->tms_cstime = current->cstime;
+	}
+
+	*current->perrno = 0;
+
+	return tics;
+}
@@ -1,4 +1,32 @@
 #ifndef _SYSCALLS_UTILS_H_
 #define _SYSCALLS_UTILS_H_
 
+#include <config.h>
+#include <fs/file.h>
+#include <kernel/types.h>
+
+/** Helpers of splice (see splice.c) **/
+
+ssize_t splice_avail(struct file *file, struct fildes *fd);
+/****************************************************************/
+ssize_t splice_room(struct file *file);
+/****************************************************************/
+void splice_wait(struct file *file, bool_t in);
+/****************************************************************/
+ssize_t splice_read(struct file *file,
+                    struct fildes *fd,
+                    void *buf,
+                    size_t size);
+/****************************************************************/
+ssize_t splice_write(struct file *file,
+                     struct fildes *fd,
+                     void *buf,
+                     size_t size);
+/****************************************************************/
+ssize_t splice_move(struct file *in,
+                    struct fildes *fd_in,
+                    struct file *out,
+                    struct fildes *fd_out,
+                    size_t size);
+
 #endif
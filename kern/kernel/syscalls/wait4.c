@@ -6,12 +6,12 @@
  ****************************************************************/
 
 #include <kernel/errno.h>
-#include <kernel/int.h>
 #include <kernel/libc.h>
 #include <kernel/panic.h>
 #include <kernel/process.h>
 #include <kernel/signal.h>
 #include <kernel/types.h>
+#include <kernel/wait.h>
 
 #define WNOHANG		1
 #define WUNTRACED	2
@@ -24,12 +24,27 @@ pid_t sys_wait4(pid_t pid, int *status, int options, struct rusage *rusage)
 {
 	struct process *proc;
 	bool_t matching_id = 0;
+	bool_t first = 1;
+
+	/** Check the rusage address before a son is reaped. **/
+
+	if(rusage && !in_user_range(rusage, rusage + 1))
+	{
+		*current->perrno = EFAULT;
+		return -1;
+	}
 
 	do
 	{
-		sti;
-		yield;
-		cli;
+		/** Sleep until a son changes state (except on the first
+		    pass). **/
+
+		if(!first)
+		{
+			wait_sleep(&current->child_wq);
+		}
+
+		first = 0;
 
 		if(!current->first_son)
 		{
@@ -96,6 +111,12 @@ pid_t sys_wait4(pid_t pid, int *status, int options, struct rusage *rusage)
 				//}
 
 				proc->used = 0;
+
+				/** Its times are added to those of the
+				    waited-for sons of the current process. **/
+
+				current->cutime += proc->utime + proc->cutime;
+				current->cstime += proc->stime + proc->cstime;
 			}
 
 			/** Report the status of the process if possible. **/
@@ -105,12 +126,11 @@ pid_t sys_wait4(pid_t pid, int *status, int options, struct rusage *rusage)
 				*status = proc->status;
 			}
 
-			if(rusage) // FIXME
+			if(rusage)
 			{
-				rusage->ru_utime.tv_sec = 0;
-				rusage->ru_utime.tv_usec = 10;
-				rusage->ru_stime.tv_sec = 0;
-				rusage->ru_stime.tv_usec = 10;
+				process_rusage(proc->utime + proc->cutime,
+				               proc->stime + proc->cstime,
+				               rusage);
 			}
 
 			proc->reported = 1;
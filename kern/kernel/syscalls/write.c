@@ -10,7 +10,6 @@
 #include <fs/file.h>
 #include <fs/tty.h>
 #include <kernel/errno.h>
-#include <kernel/int.h>
 #include <kernel/libc.h>
 #include <kernel/panic.h>
 #include <kernel/printk.h>
@@ -18,6 +17,7 @@
 #include <kernel/screen.h>
 #include <kernel/syscall.h>
 #include <kernel/types.h>
+#include <kernel/wait.h>
 
 /**
  * sys_write
@@ -116,23 +116,23 @@ ssize_t sys_write(si32_t fildes, void *buf, size_t size)
 	#ifdef ENABLE_NETWORK
 	else if(file->fs == FS_TCPSOCKFS)
 	{
-		return sys_send(fildes, buf, size, 0);
+		ui32_t flags = spin_lock_irqsave(&tcp_lock);
+
+		ret = sys_send(fildes, buf, size, 0);
+		spin_unlock_irqrestore(&tcp_lock, flags);
+
+		return ret;
 	}
 	#endif
 	#ifdef ENABLE_PIPES
 	else if(file->fs == FS_PIPEFS)
 	{
-		struct pipe *pipe = &pipe_tab[file->data.pipe_id];
+		struct pipe *pipe = pipe_get(file->data.pipe_id);
 
 		ret = 0;
 
-		do
+		while(1)
 		{
-			sti;
-			yield;
-			//delay(1);
-			cli;
-
 			if(!pipe->readers)
 			{
 				*current->perrno = EPIPE;
@@ -142,12 +142,18 @@ ssize_t sys_write(si32_t fildes, void *buf, size_t size)
 
 			if(size <= PIPE_ATOMIC_LIMIT)
 			{
+				/** Fault the buffer in first: fifo_write
+				    must not sleep once the room is
+				    checked. **/
+
+				paging_fault_in(buf, size, 0);
+
 				if(fifo_left(&pipe->fifo) >= size)
 				{
 					if(fifo_write(&pipe->fifo,
 					              buf,
 					              size,
-					              0) != OK)
+					              0) != size)
 					{
 						panic("pipe corrupted");
 					}
@@ -164,13 +170,10 @@ ssize_t sys_write(si32_t fildes, void *buf, size_t size)
 			}
 			else
 			{
-				while(fifo_write_byte(&pipe->fifo,
-				                      *(ui8_t*)(buf + ret),
-				                      0) == OK
-				   && ret < size)
-				{
-					ret++;
-				}
+				ret += fifo_write(&pipe->fifo,
+				                  buf + ret,
+				                  size - ret,
+				                  0);
 
 				if((current->fildes_flags[fildes] & O_NONBLOCK)
 				&& ret < size)
@@ -180,8 +183,17 @@ ssize_t sys_write(si32_t fildes, void *buf, size_t size)
 			}
 
 			//printk("wrote %x/%x to pipe\n", ret, size);
-		} while(!(current->fildes_flags[fildes] & O_NONBLOCK)
-		        && ret < size);
+
+			if((current->fildes_flags[fildes] & O_NONBLOCK)
+			|| ret >= size)
+			{
+				break;
+			}
+
+			/** Wait for the readers to make room. **/
+
+			wait_sleep(&pipe->fifo.wq);
+		}
 
 		return ret;
 	}
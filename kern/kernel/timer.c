@@ -0,0 +1,209 @@
+/****************************************************************
+ * timer.c                                                      *
+ *                                                              *
+ *    Hierarchical timer wheel driven by clock tics.            *
+ *                                                              *
+ ****************************************************************/
+
+#define _TIMER_C_
+#include <config.h>
+#include <kernel/isr.h>
+
+#include "timer.h"
+
+/** WARNING: Interrupts must be disabled when calling these functions. **/
+
+/**
+ * timer_insert
+ *
+ *   Links a timer in the slot matching its expiry date: the root wheel if it
+ *   expires within TIMER_ROOT_SIZE tics, else the first outer wheel whose
+ *   range covers it. Outer slots are cascaded to the inner wheels as time
+ *   goes on.
+ */
+
+void timer_insert(struct timer *timer)
+{
+	clock_t delay = timer->expires - timer_tics;
+	ui32_t level, shift;
+	struct timer **slot;
+
+	if((si32_t)delay < 0)
+	{
+		/** Already expired: run it with the next processed tic. **/
+
+		slot = &timer_root[timer_tics & TIMER_ROOT_MASK];
+	}
+	else if(delay < TIMER_ROOT_SIZE)
+	{
+		slot = &timer_root[timer->expires & TIMER_ROOT_MASK];
+	}
+	else
+	{
+		if(delay > TIMER_MAX_DELAY)
+		{
+			timer->expires = timer_tics + TIMER_MAX_DELAY;
+			delay = TIMER_MAX_DELAY;
+		}
+
+		for(level = 0, shift = TIMER_ROOT_BITS;
+		    delay >> (shift + TIMER_LEVEL_BITS);
+		    level++, shift += TIMER_LEVEL_BITS);
+
+		slot = &timer_levels[level][(timer->expires >> shift)
+		                            & TIMER_LEVEL_MASK];
+	}
+
+	timer->slot = slot;
+	timer->prev = 0;
+	timer->next = *slot;
+
+	if(*slot)
+	{
+		(*slot)->prev = timer;
+	}
+
+	*slot = timer;
+}
+
+/**
+ * timer_remove
+ */
+
+void timer_remove(struct timer *timer)
+{
+	if(timer->prev)
+	{
+		timer->prev->next = timer->next;
+	}
+	else
+	{
+		*timer->slot = timer->next;
+	}
+
+	if(timer->next)
+	{
+		timer->next->prev = timer->prev;
+	}
+
+	timer->pending = 0;
+	timer_nr_pending--;
+}
+
+/**
+ * timer_add
+ *
+ *   (Re)starts a timer. It may be called from the function of the timer.
+ */
+
+void timer_add(struct timer *timer,
+               clock_t expires,
+               void (*function)(ui32_t data),
+               ui32_t data)
+{
+	if(timer->pending)
+	{
+		timer_remove(timer);
+	}
+
+	timer->expires = expires;
+	timer->function = function;
+	timer->data = data;
+	timer->pending = 1;
+	timer_insert(timer);
+
+	timer_nr_pending++;
+	timer_nr_added++;
+}
+
+/**
+ * timer_cancel
+ */
+
+void timer_cancel(struct timer *timer)
+{
+	if(!timer->pending)
+	{
+		return;
+	}
+
+	timer_remove(timer);
+	timer_nr_cancelled++;
+}
+
+/**
+ * timer_cascade
+ *
+ *   Moves the timers of the current slot of an outer wheel to the inner
+ *   wheels. Returns the index of the slot (0 meaning the next outer wheel
+ *   must be cascaded too).
+ */
+
+ui32_t timer_cascade(ui32_t level)
+{
+	ui32_t index;
+	struct timer *timer, *next;
+
+	index = (timer_tics >> (TIMER_ROOT_BITS + level * TIMER_LEVEL_BITS))
+	      & TIMER_LEVEL_MASK;
+	timer = timer_levels[level][index];
+	timer_levels[level][index] = 0;
+
+	while(timer)
+	{
+		next = timer->next;
+		timer_insert(timer);
+		timer_nr_cascaded++;
+		timer = next;
+	}
+
+	return index;
+}
+
+/**
+ * timer_run
+ *
+ *   Called from the clock ISR. Runs the timers expired up to the current tic,
+ *   processing one by one the tics skipped while the processor was idle.
+ */
+
+void timer_run()
+{
+	struct timer *timer;
+	ui32_t index, level;
+	clock_t latency;
+
+	while((si32_t)(tics - timer_tics) >= 0)
+	{
+		index = timer_tics & TIMER_ROOT_MASK;
+
+		for(level = 0;
+		    !index && level < NR_TIMER_LEVELS;
+		    level++)
+		{
+			index = timer_cascade(level);
+		}
+
+		index = timer_tics & TIMER_ROOT_MASK;
+		timer_tics++;
+
+		/** A timer started again by its function goes to another
+		    slot, since timer_tics moved on. **/
+
+		while((timer = timer_root[index]))
+		{
+			timer_remove(timer);
+
+			latency = tics - timer->expires;
+
+			for(level = 0;
+			    latency && level < TIMER_HIST_SIZE - 1;
+			    level++, latency >>= 1);
+
+			timer_latency[level]++;
+			timer_nr_expired++;
+
+			timer->function(timer->data);
+		}
+	}
+}
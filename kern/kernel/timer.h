@@ -0,0 +1,79 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <config.h>
+#include <kernel/types.h>
+
+/** Constants **/
+
+// The root wheel holds the timers expiring within the next 256 tics...
+#define TIMER_ROOT_BITS		8
+#define TIMER_ROOT_SIZE		(1 << TIMER_ROOT_BITS)
+#define TIMER_ROOT_MASK		(TIMER_ROOT_SIZE - 1)
+// ...and each outer wheel covers 64 slots of its inner wheel.
+#define TIMER_LEVEL_BITS	6
+#define TIMER_LEVEL_SIZE	(1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVEL_MASK	(TIMER_LEVEL_SIZE - 1)
+#define NR_TIMER_LEVELS		3
+// Farthest expiry date (in tics from now) a timer can be set to
+#define TIMER_MAX_DELAY		((1 << (TIMER_ROOT_BITS \
+                                      + NR_TIMER_LEVELS \
+                                      * TIMER_LEVEL_BITS)) - 1)
+// Latency histogram: slot i counts timers run 2^(i-1) to 2^i - 1 tics late
+#define TIMER_HIST_SIZE		8
+
+/** Timer: function is called from the clock ISR with data as its parameter
+    once tics reaches expires. **/
+
+struct timer
+{
+	clock_t expires;
+	void (*function)(ui32_t data);
+	ui32_t data;
+	bool_t pending;
+	struct timer **slot;
+	struct timer *prev, *next;
+};
+
+/** Global variables (next tic to process, wheels, stats). **/
+
+#ifdef _TIMER_C_
+clock_t timer_tics = 0;
+struct timer *timer_root[TIMER_ROOT_SIZE] = { 0 };
+struct timer *timer_levels[NR_TIMER_LEVELS][TIMER_LEVEL_SIZE] = { { 0 } };
+count_t timer_nr_pending = 0;
+count_t timer_nr_added = 0;
+count_t timer_nr_cancelled = 0;
+count_t timer_nr_expired = 0;
+count_t timer_nr_cascaded = 0;
+count_t timer_latency[TIMER_HIST_SIZE] = { 0 };
+#else
+extern clock_t timer_tics;
+extern struct timer *timer_root[TIMER_ROOT_SIZE];
+extern struct timer *timer_levels[NR_TIMER_LEVELS][TIMER_LEVEL_SIZE];
+extern count_t timer_nr_pending;
+extern count_t timer_nr_added;
+extern count_t timer_nr_cancelled;
+extern count_t timer_nr_expired;
+extern count_t timer_nr_cascaded;
+extern count_t timer_latency[TIMER_HIST_SIZE];
+#endif
+
+/** Functions **/
+
+void timer_insert(struct timer *timer);
+/****************************************************************/
+void timer_remove(struct timer *timer);
+/****************************************************************/
+void timer_add(struct timer *timer,
+               clock_t expires,
+               void (*function)(ui32_t data),
+               ui32_t data);
+/****************************************************************/
+void timer_cancel(struct timer *timer);
+/****************************************************************/
+ui32_t timer_cascade(ui32_t level);
+/****************************************************************/
+void timer_run();
+
+#endif
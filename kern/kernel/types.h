@@ -28,12 +28,26 @@ struct timeval
 	si32_t tv_usec;
 };
 
+struct timespec
+{
+	time_t tv_sec;
+	si32_t tv_nsec;
+};
+
 struct rusage
 {
 	struct timeval ru_utime;
 	struct timeval ru_stime;
 };
 
+struct tms
+{
+	clock_t tms_utime;
+	clock_t tms_stime;
+	clock_t tms_cutime;
+	clock_t tms_cstime;
+};
+
 typedef ui32_t count_t;
 typedef int ret_t;
 typedef int bool_t;
@@ -0,0 +1,172 @@
+/****************************************************************
+ * wait.c                                                       *
+ *                                                              *
+ *    Wait queues (sleep until an event occurs).                *
+ *                                                              *
+ ****************************************************************/
+
+#include <config.h>
+#include <kernel/hrtimer.h>
+#include <kernel/int.h>
+#include <kernel/isr.h>
+#include <kernel/lock.h>
+#include <kernel/process.h>
+#include <kernel/schedule.h>
+
+#include "wait.h"
+
+/** A process sleeping until an interrupt handler makes a condition true must
+    test it with interrupts disabled (or with the spinlock the handler takes
+    held, see wait_sleep_lock): else the wakeup may happen between the test
+    and the sleep and be lost. **/
+
+/**
+ * wait_add
+ */
+
+void wait_add(struct wait_queue *wq)
+{
+	ui32_t flags = irq_save();
+
+	wq->pids[current_pid / 32] |= (1 << (current_pid % 32));
+	irq_restore(flags);
+}
+
+/**
+ * wait_remove
+ */
+
+void wait_remove(struct wait_queue *wq)
+{
+	ui32_t flags = irq_save();
+
+	wq->pids[current_pid / 32] &= ~(1 << (current_pid % 32));
+	irq_restore(flags);
+}
+
+/**
+ * wait_schedule
+ *
+ *   Puts the current process to sleep until it is woken up through a queue it
+ *   was added to, until hrtimer_now() reaches timeout (if not 0) or, during an
+ *   interruptible syscall, until it receives a signal.
+ */
+
+void wait_schedule(ui64_t timeout)
+{
+	wait_schedule_lock(timeout, 0);
+}
+
+/**
+ * wait_schedule_lock
+ *
+ *   Same as wait_schedule, releasing a spinlock (taken with interrupts
+ *   disabled) while the process sleeps.
+ */
+
+void wait_schedule_lock(ui64_t timeout, struct spinlock *lock)
+{
+	ui32_t flags = irq_save();
+
+	current->state = PROC_SLEEPING;
+	schedule_sleep(current);
+
+	if(timeout)
+	{
+		hrtimer_start(&current->timer, timeout, wait_timeout, current_pid);
+	}
+
+	if(lock)
+	{
+		spin_unlock(lock);
+	}
+
+	sti;
+	yield;
+	cli;
+
+	hrtimer_cancel(&current->timer);
+
+	if(lock)
+	{
+		spin_lock(lock);
+	}
+
+	irq_restore(flags);
+}
+
+/**
+ * wait_sleep
+ */
+
+void wait_sleep(struct wait_queue *wq)
+{
+	wait_sleep_lock(wq, 0);
+}
+
+/**
+ * wait_sleep_lock
+ */
+
+void wait_sleep_lock(struct wait_queue *wq, struct spinlock *lock)
+{
+	ui32_t flags = irq_save();
+
+	wait_add(wq);
+	wait_schedule_lock(0, lock);
+	wait_remove(wq);
+	irq_restore(flags);
+}
+
+/**
+ * wait_sleep_timeout
+ */
+
+void wait_sleep_timeout(struct wait_queue *wq, ui64_t timeout)
+{
+	ui32_t flags = irq_save();
+
+	wait_add(wq);
+	wait_schedule(timeout);
+	wait_remove(wq);
+	irq_restore(flags);
+}
+
+/**
+ * wait_wake
+ */
+
+void wait_wake(struct wait_queue *wq)
+{
+	struct process *proc;
+	ui32_t i, bit, flags;
+
+	flags = irq_save();
+
+	for(i = 0; i < (NR_PROC + 31) / 32; i++)
+	{
+		while(wq->pids[i])
+		{
+			for(bit = 0; !(wq->pids[i] & (1 << bit)); bit++);
+
+			wq->pids[i] &= ~(1 << bit);
+			proc = &proc_tab[i * 32 + bit];
+
+			if(proc->used)
+			{
+				schedule_wakeup(proc);
+			}
+		}
+	}
+
+	irq_restore(flags);
+}
+
+/**
+ * wait_timeout
+ */
+
+void wait_timeout(ui32_t pid)
+{
+	schedule_wakeup(&proc_tab[pid]);
+}
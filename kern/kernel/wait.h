@@ -0,0 +1,39 @@
+#ifndef _WAIT_H_
+#define _WAIT_H_
+
+#include <config.h>
+#include <kernel/types.h>
+
+/** Wait queue: the set of processes sleeping until an event occurs. A process
+    may remain in a queue after being woken up through another one: this
+    only causes a spurious wakeup, after which the process checks again the
+    condition it is waiting for. **/
+
+struct wait_queue
+{
+	ui32_t pids[(NR_PROC + 31) / 32];
+};
+
+struct spinlock;
+
+/** Functions. **/
+
+void wait_add(struct wait_queue *wq);
+/****************************************************************/
+void wait_remove(struct wait_queue *wq);
+/****************************************************************/
+void wait_schedule(ui64_t timeout);
+/****************************************************************/
+void wait_schedule_lock(ui64_t timeout, struct spinlock *lock);
+/****************************************************************/
+void wait_sleep(struct wait_queue *wq);
+/****************************************************************/
+void wait_sleep_lock(struct wait_queue *wq, struct spinlock *lock);
+/****************************************************************/
+void wait_sleep_timeout(struct wait_queue *wq, ui64_t timeout);
+/****************************************************************/
+void wait_wake(struct wait_queue *wq);
+/****************************************************************/
+void wait_timeout(ui32_t pid);
+
+#endif
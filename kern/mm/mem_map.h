@@ -10,6 +10,8 @@
 #define CACHE_MEMORY_BASE	0x00400000
 #define PAGE_HEAP_BASE		0x20000000
 #define USER_BASE		0x40000000
+#define USER_MMAP_BASE		0xa0000000
+#define USER_MMAP_LIMIT		0xe0000000
 #define USER_STACK_BASE		0xf0000000
 #define RESERVED_BASE		0xffc00000
 
@@ -10,6 +10,10 @@
 #include <kernel/errno.h>
 #include <kernel/panic.h>
 #include <kernel/printk.h>
+#ifdef ENABLE_SMP
+#include <kernel/smp.h>
+#endif
+#include <mm/swap.h>
 
 #include "paging.h"
 
@@ -62,40 +66,67 @@ void paging_init()
 
 	for(page = 0; page < (KERNEL_PT_BASE >> 12); page++)
 	{
-		pt0[page] = page << 12 | PAGING_PRESENT | PAGING_RW;
+		pt0[page] = page << 12
+		          | PAGING_PRESENT
+		          | PAGING_RW
+		          | PAGING_GLOBAL;
 	}
 
-	/** Initialize the array giving the reference count of each physical
-	    page (i.e how many times it is mapped in virtual memory).
-	    page_count is the number of pages required to store the array. **/
+	/** Initialize the array of physical page descriptors (giving in
+	    particular how many times each page is mapped in virtual memory)
+	    and the pool of reverse mappings. page_count is the number of pages
+	    required to store them. **/
 
 		/** First reserve the number of physical pages required to
-		    store the array and identity-map these pages. **/
+		    store them and identity-map these pages. **/
 
-	page_count = (NR_PPAGES + 4095) >> 12;
+	page_count = (NR_PPAGES * sizeof(struct page)
+	            + NR_RMAPS * sizeof(struct rmap)
+	            + 4095) >> 12;
+
+	if(PAGE_DESC_BASE + (page_count << 12) > CACHE_MEMORY_BASE)
+	{
+		panic("page descriptors overlap cache memory");
+	}
 
 	for(page = (PAGE_DESC_BASE >> 12);
 	    page < (PAGE_DESC_BASE >> 12) + page_count;
 	    page++)
 	{
 		paging_bitmap_set_used(phys_bmp, page);
-		pt0[page] = page << 12 | PAGING_PRESENT | PAGING_RW;
+		pt0[page] = page << 12
+		          | PAGING_PRESENT
+		          | PAGING_RW
+		          | PAGING_GLOBAL;
 	}
 
-		/** Then, initialize the array. **/
+		/** Then, initialize the descriptors. **/
 
 	for(page = 0; page < NR_PPAGES; page++)
 	{
-		ppage_ref_cnt[page] = 0;
+		ppage_tab[page].ref_cnt = 0;
+		ppage_tab[page].flags = 0;
+		ppage_tab[page].rmap = 0;
 	}
 
 	for(page = 0;
 	    page < ((PAGE_DESC_BASE >> 12) + page_count);
 	    page++)
 	{
-		ppage_ref_cnt[page] = 1;
+		ppage_tab[page].ref_cnt = 1;
+		ppage_tab[page].flags = PAGE_RESERVED;
 	}
 
+		/** Finally, chain the reverse mappings in the free list (the
+		    first one is never used, 0 meaning "none"). **/
+
+	for(page = 1; page < NR_RMAPS; page++)
+	{
+		rmap_tab[page].next = (page + 1 < NR_RMAPS) ? page + 1 : 0;
+	}
+
+	rmap_free = 1;
+
 	/** Update ppage_left. **/
 
 	ppage_left -= ((PAGE_DESC_BASE >> 12) + page_count);
@@ -129,6 +160,31 @@ void paging_init()
 	              or $0x80000000, %%eax \n\
 	              or $0x00010000, %%eax\n\
 	              mov %%eax, %%cr0" :: "i"(KERNEL_PD_BASE));
+
+	paging_enable_global();
+}
+
+/**
+ * paging_enable_global
+ *
+ *   Kernel mappings are the same in every address space: if the processor
+ *   supports it, make them global so that they survive the cr3 reloads of
+ *   context switches. Each processor has to do it.
+ */
+
+void paging_enable_global()
+{
+	ui32_t features;
+
+	asm volatile("mov $1, %%eax \n\
+	              cpuid" : "=d"(features) :: "eax", "ebx", "ecx");
+
+	if(features & CPUID_PGE)
+	{
+		asm volatile("mov %%cr4, %%eax \n\
+		              or %0, %%eax \n\
+		              mov %%eax, %%cr4" :: "i"(CR4_PGE) : "eax");
+	}
 }
 
 /**
@@ -138,7 +194,7 @@ void paging_init()
 ui32_t paging_bitmap_alloc(ui8_t *bitmap, size_t bitmap_size)
 {
 	size_t i, j;
-	ui32_t page;
+	ui32_t page, flags = spin_lock_irqsave(&paging_lock);
 
 	for(i = 0; i < bitmap_size; i++)
 	{
@@ -150,17 +206,67 @@ ui32_t paging_bitmap_alloc(ui8_t *bitmap, size_t bitmap_size)
 				{
 					page = i * 8 + j;
 					paging_bitmap_set_used(bitmap, page);
+					spin_unlock_irqrestore(&paging_lock,
+					                       flags);
 					return page;
 				}
 			}
 		}
 	}
 
+	spin_unlock_irqrestore(&paging_lock, flags);
+
+	return 0;
+}
+
+/**
+ * paging_bitmap_alloc_range
+ *
+ *   Allocates count consecutive entries and returns the first one (0 if
+ *   none).
+ */
+
+ui32_t paging_bitmap_alloc_range(ui8_t *bitmap,
+                                 size_t bitmap_size,
+                                 count_t count)
+{
+	ui32_t page, first = 0, flags = spin_lock_irqsave(&paging_lock);
+	count_t found = 0;
+
+	for(page = 0; page < bitmap_size * 8; page++)
+	{
+		if(bitmap[page / 8] & (1 << (page % 8)))
+		{
+			found = 0;
+			continue;
+		}
+
+		if(!found++)
+		{
+			first = page;
+		}
+
+		if(found == count)
+		{
+			for(page = first; page < first + count; page++)
+			{
+				paging_bitmap_set_used(bitmap, page);
+			}
+
+			spin_unlock_irqrestore(&paging_lock, flags);
+			return first;
+		}
+	}
+
+	spin_unlock_irqrestore(&paging_lock, flags);
+
 	return 0;
 }
 
 /**
  * paging_bitmap_set_used
+ *
+ *   paging_lock must be held, except at initialization.
  */
 
 void paging_bitmap_set_used(ui8_t *bitmap, ui32_t page)
@@ -174,7 +280,10 @@ void paging_bitmap_set_used(ui8_t *bitmap, ui32_t page)
 
 void paging_bitmap_free(ui8_t *bitmap, ui32_t page)
 {
+	ui32_t flags = spin_lock_irqsave(&paging_lock);
+
 	bitmap[page / 8] &= ~(1 << (page % 8));
+	spin_unlock_irqrestore(&paging_lock, flags);
 }
 
 /**
@@ -183,13 +292,24 @@ void paging_bitmap_free(ui8_t *bitmap, ui32_t page)
 
 ui32_t paging_palloc()
 {
-	ui32_t ppage;
+	ui32_t ppage, flags;
 
 	ppage = paging_bitmap_alloc(phys_bmp, NR_PPAGES / 8);
 
+	/** If memory is exhausted, reclaim some pages and retry. Reclaiming
+	    writes pages to the disk and sleeps: in an interrupt handler or
+	    with a spinlock held, the allocation fails instead. **/
+
+	if(!ppage && irq_enabled() && swap_reclaim())
+	{
+		ppage = paging_bitmap_alloc(phys_bmp, NR_PPAGES / 8);
+	}
+
 	if(ppage)
 	{
+		flags = spin_lock_irqsave(&paging_lock);
 		ppage_left--;
+		spin_unlock_irqrestore(&paging_lock, flags);
 	}
 
 	return ppage;
@@ -201,8 +321,13 @@ ui32_t paging_palloc()
 
 void paging_pfree(ui32_t ppage)
 {
+	ui32_t flags;
+
 	paging_bitmap_free(phys_bmp, ppage);
+
+	flags = spin_lock_irqsave(&paging_lock);
 	ppage_left++;
+	spin_unlock_irqrestore(&paging_lock, flags);
 }
 
 /**
@@ -274,16 +399,101 @@ void paging_vfree(struct pheap_page page)
 	}
 }
 
+/**
+ * paging_valloc_range
+ *
+ *   Maps count consecutive pages of the page heap to fresh physical pages and
+ *   returns the first virtual page (0 if out of memory).
+ */
+
+ui32_t paging_valloc_range(count_t count)
+{
+	ui32_t vpage_offset, vpage, ppage;
+	count_t i;
+
+	vpage_offset = paging_bitmap_alloc_range(pheap_bmp,
+	                                         NR_PHEAP_PAGES / 8,
+	                                         count);
+
+	if(!vpage_offset)
+	{
+		return 0;
+	}
+
+	vpage = (PAGE_HEAP_BASE >> 12) + vpage_offset;
+
+	for(i = 0; i < count; i++)
+	{
+		ppage = paging_palloc();
+
+		if(!ppage)
+		{
+			goto fail;
+		}
+
+		if(paging_map(ppage, vpage + i) != OK)
+		{
+			paging_pfree(ppage);
+			goto fail;
+		}
+	}
+
+	return vpage;
+
+	fail:
+		while(i--)
+		{
+			ppage = paging_get_entry(vpage + i) >> 12;
+			paging_unmap(vpage + i);
+			paging_pfree(ppage);
+		}
+
+		for(i = 0; i < count; i++)
+		{
+			paging_bitmap_free(pheap_bmp, vpage_offset + i);
+		}
+
+		return 0;
+}
+
+/**
+ * paging_vfree_range
+ */
+
+void paging_vfree_range(ui32_t vpage, count_t count)
+{
+	ui32_t ppage;
+	count_t i;
+
+	for(i = 0; i < count; i++)
+	{
+		ppage = paging_get_entry(vpage + i) >> 12;
+		paging_unmap(vpage + i);
+		paging_pfree(ppage);
+		paging_bitmap_free(pheap_bmp,
+		                   vpage + i - (PAGE_HEAP_BASE >> 12));
+	}
+}
+
 /**
  * paging_map
  */
 
 ret_t paging_map(ui32_t ppage, ui32_t vpage)
+{
+	return paging_map_flags(ppage, vpage, PAGING_RW);
+}
+
+/**
+ * paging_map_flags
+ */
+
+ret_t paging_map_flags(ui32_t ppage, ui32_t vpage, ui32_t flags)
 {
 	ui32_t pg_tab_id = page_table_id(vpage),
 	       pg_id = page_id(vpage);
 	ui32_t pt_page;
-	ui32_t page;
+	ui32_t page, irq_flags;
 	ui32_t *page_dir, *page_tab;
 
 	page_dir = page_directory();
@@ -291,7 +501,7 @@ ret_t paging_map(ui32_t ppage, ui32_t vpage)
 
 	/** Check whether the physical page is mapped too many times. **/
 
-	if(ppage_ref_cnt[ppage] == 255)
+	if(ppage_tab[ppage].ref_cnt == PAGE_MAX_REF_CNT)
 	{
 		return -EOVERFLOW;
 		//panic("physical page %x mapped too many times", ppage);
@@ -328,14 +538,25 @@ ret_t paging_map(ui32_t ppage, ui32_t vpage)
 		}
 	}
 
-	/** Register the page in page table. **/
+	/** Register the page in page table. User mappings are recorded in the
+	    reverse mappings of the physical page. **/
 
 	if(page_tab[pg_id] & PAGING_PRESENT)
 	{
 		panic("page present (vpage %x, ppage %x)", vpage, ppage);
 	}
+	else if(page_tab[pg_id] & PAGING_SWAPPED)
+	{
+		panic("page swapped out (vpage %x)", vpage);
+	}
+
+	if(vpage >= (USER_BASE >> 12)
+	&& paging_rmap_add(ppage, paging_get_pd(), vpage) != OK)
+	{
+		return -ENOMEM;
+	}
 
-	page_tab[pg_id] = ppage << 12 | PAGING_PRESENT | PAGING_RW;
+	page_tab[pg_id] = ppage << 12 | PAGING_PRESENT | (flags & PAGING_RW);
 
 	/** If the virtual page belongs to user space, add user flag to page
 	    table and page descriptors. **/
@@ -345,11 +566,17 @@ ret_t paging_map(ui32_t ppage, ui32_t vpage)
 		page_dir[pg_tab_id] |= PAGING_USER;
 		page_tab[pg_id] |= PAGING_USER;
 	}
+	else
+	{
+		page_tab[pg_id] |= PAGING_GLOBAL;
+	}
 
 	/** Do not forget to increase the reference counter of the physical
 	    page. **/
 
-	ppage_ref_cnt[ppage]++;
+	irq_flags = spin_lock_irqsave(&paging_lock);
+	ppage_tab[ppage].ref_cnt++;
+	spin_unlock_irqrestore(&paging_lock, irq_flags);
 
 	return OK;
 }
@@ -360,13 +587,11 @@ ret_t paging_map(ui32_t ppage, ui32_t vpage)
 
 void paging_unmap(ui32_t vpage)
 {
-	ui32_t ppage;
+	ui32_t ppage, flags;
 	ui32_t pg_tab_id = page_table_id(vpage),
 	       pg_id = page_id(vpage);
 	ui32_t *page_dir, *page_tab;
-	#ifndef QEMU
-	void *vpage_base;
-	#endif
+	bool_t unused;
 
 	page_dir = page_directory();
 
@@ -398,30 +623,31 @@ void paging_unmap(ui32_t vpage)
 
 	/** Invalidate the virtual page. **/
 
-	#ifdef QEMU
-	asm volatile("mov %cr3, %eax \n\
-	              mov %eax, %cr3");
-	#else
-	vpage_base = (void*)(vpage << 12);
-
-	asm volatile("invlpg %0" :: "m"(vpage_base));
-	#endif
+	paging_invlpg(vpage);
 
 	/** Decrease the reference counter of the physical page **/
 
-	if(ppage_ref_cnt[ppage] == 0)
+	if(vpage >= (USER_BASE >> 12))
+	{
+		paging_rmap_remove(ppage, paging_get_pd(), vpage);
+	}
+
+	flags = spin_lock_irqsave(&paging_lock);
+
+	if(ppage_tab[ppage].ref_cnt == 0)
 	{
 		panic("null reference counter for mapped page");
 	}
 
-	ppage_ref_cnt[ppage]--;
+	unused = !--ppage_tab[ppage].ref_cnt;
+	spin_unlock_irqrestore(&paging_lock, flags);
 
 	/** If the unmapped page was mapped in user space and is not referred
 	    to anywhere, free it. If the page is in kernel space, we don't
 	    (see paging_create_pd to understand why: we would destroy the pd of
 	    a user process as soon as created!). **/
 
-	if(!ppage_ref_cnt[ppage] && vpage >= (USER_BASE >> 12))
+	if(unused && vpage >= (USER_BASE >> 12))
 	{
 		#ifdef DEBUG
 		printk("paging_unmap frees physical page %x\n", ppage);
@@ -430,6 +656,280 @@ void paging_unmap(ui32_t vpage)
 	}
 }
 
+/**
+ * paging_invlpg
+ */
+
+void paging_invlpg(ui32_t vpage)
+{
+	void *vpage_base = (void*)(vpage << 12);
+
+	/** Invalidate the TLB entry of a single page (global or not). **/
+
+	asm volatile("invlpg (%0)" :: "r"(vpage_base) : "memory");
+
+	#ifdef ENABLE_SMP
+	smp_tlb_shootdown(vpage);
+	#endif
+}
+
+/**
+ * paging_flush_tlb
+ */
+
+void paging_flush_tlb()
+{
+	/** Reloading cr3 flushes every non-global TLB entry, that is every
+	    user mapping. **/
+
+	asm volatile("mov %%cr3, %%eax \n\
+	              mov %%eax, %%cr3" ::: "eax", "memory");
+
+	#ifdef ENABLE_SMP
+	smp_tlb_shootdown(SMP_TLB_ALL);
+	#endif
+}
+
+/**
+ * paging_get_entry
+ */
+
+ui32_t paging_get_entry(ui32_t vpage)
+{
+	ui32_t pg_tab_id = page_table_id(vpage);
+
+	/** Return the page table entry of the virtual page in the current
+	    address space, or 0 if its page table is not present. **/
+
+	if(!(page_directory()[pg_tab_id] & PAGING_PRESENT))
+	{
+		return 0;
+	}
+
+	return page_table(pg_tab_id)[page_id(vpage)];
+}
+
+/**
+ * paging_present
+ *
+ *   Tells whether the pages holding the bytes are present (and writable if
+ *   write is set), without faulting them in.
+ */
+
+bool_t paging_present(void *start, size_t size, bool_t write)
+{
+	ui32_t vpage, entry;
+
+	if(!size || (ui32_t)start < USER_BASE)
+	{
+		return 1;
+	}
+
+	for(vpage = (ui32_t)start >> 12;
+	    vpage <= ((ui32_t)start + size - 1) >> 12;
+	    vpage++)
+	{
+		entry = paging_get_entry(vpage);
+
+		if(!(entry & PAGING_PRESENT) || (write && !(entry & PAGING_RW)))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * paging_fault_in
+ *
+ *   Touches the user pages holding the bytes until they are all present (and
+ *   writable if write is set) at once, so that a copy to or from them does
+ *   not fault. Returns the number of pages faulted in: if it is not 0, the
+ *   process may have slept. Kernel buffers are always present.
+ */
+
+count_t paging_fault_in(void *start, size_t size, bool_t write)
+{
+	ui32_t vpage, first, last, entry;
+	void *addr;
+	count_t faulted = 0;
+	bool_t present = 0;
+
+	if(!size || (ui32_t)start < USER_BASE)
+	{
+		return 0;
+	}
+
+	first = (ui32_t)start >> 12;
+	last = ((ui32_t)start + size - 1) >> 12;
+
+	/** A page swapped in may be reclaimed while the next one is read:
+	    check them all again until none faults. **/
+
+	while(!present)
+	{
+		present = 1;
+
+		for(vpage = first; vpage <= last; vpage++)
+		{
+			entry = paging_get_entry(vpage);
+
+			if((entry & PAGING_PRESENT)
+			&& (!write || (entry & PAGING_RW)))
+			{
+				continue;
+			}
+
+			addr = (vpage == first) ? start : (void*)(vpage << 12);
+
+			if(write)
+			{
+				asm volatile("orb $0, %0" : "+m"(*(ui8_t*)addr));
+			}
+			else
+			{
+				(void)*(volatile ui8_t*)addr;
+			}
+
+			present = 0;
+			faulted++;
+		}
+	}
+
+	return faulted;
+}
+
+/**
+ * paging_set_flags
+ */
+
+void paging_set_flags(ui32_t vpage, ui32_t set, ui32_t clear)
+{
+	ui32_t *page_tab;
+
+	/** The entry of a page swapped out keeps the flags the page gets back
+	    when swapped in. **/
+
+	if(!(paging_get_entry(vpage) & (PAGING_PRESENT | PAGING_SWAPPED)))
+	{
+		panic("changing the flags of a non-present page");
+	}
+
+	page_tab = page_table(page_table_id(vpage));
+	page_tab[page_id(vpage)] = (page_tab[page_id(vpage)] & ~clear) | set;
+
+	paging_invlpg(vpage);
+}
+
+/**
+ * paging_get_pd
+ */
+
+ui32_t *paging_get_pd()
+{
+	ui32_t *pd;
+
+	asm volatile("mov %%cr3, %%eax \n\
+	              mov %%eax, %0" : "=m"(pd) :: "eax");
+
+	return pd;
+}
+
+/**
+ * paging_switch_pd
+ */
+
+ui32_t *paging_switch_pd(ui32_t *pd)
+{
+	ui32_t *old_pd;
+
+	old_pd = paging_get_pd();
+
+	asm volatile("mov %0, %%eax \n\
+	              mov %%eax, %%cr3" :: "m"(pd) : "eax", "memory");
+
+	return old_pd;
+}
+
+/**
+ * paging_discard
+ */
+
+void paging_discard(ui32_t vpage)
+{
+	ui32_t entry;
+
+	/** Drop whatever lies at the user virtual page: a mapped page or a
+	    page swapped out. **/
+
+	entry = paging_get_entry(vpage);
+
+	if(entry & PAGING_PRESENT)
+	{
+		paging_unmap(vpage);
+	}
+	else if(entry & PAGING_SWAPPED)
+	{
+		page_table(page_table_id(vpage))[page_id(vpage)] = 0;
+		swap_free(entry >> 12);
+	}
+}
+
+/**
+ * paging_rmap_add
+ */
+
+ret_t paging_rmap_add(ui32_t ppage, ui32_t *pd, ui32_t vpage)
+{
+	ui32_t rmap, flags = spin_lock_irqsave(&paging_lock);
+
+	rmap = rmap_free;
+
+	if(!rmap)
+	{
+		spin_unlock_irqrestore(&paging_lock, flags);
+		return -ENOMEM;
+	}
+
+	rmap_free = rmap_tab[rmap].next;
+
+	rmap_tab[rmap].pd = pd;
+	rmap_tab[rmap].vpage = vpage;
+	rmap_tab[rmap].next = ppage_tab[ppage].rmap;
+	ppage_tab[ppage].rmap = rmap;
+	spin_unlock_irqrestore(&paging_lock, flags);
+
+	return OK;
+}
+
+/**
+ * paging_rmap_remove
+ */
+
+void paging_rmap_remove(ui32_t ppage, ui32_t *pd, ui32_t vpage)
+{
+	ui32_t *link;
+	ui32_t rmap, flags = spin_lock_irqsave(&paging_lock);
+
+	for(link = &ppage_tab[ppage].rmap; *link; link = &rmap_tab[*link].next)
+	{
+		rmap = *link;
+
+		if(rmap_tab[rmap].pd == pd && rmap_tab[rmap].vpage == vpage)
+		{
+			*link = rmap_tab[rmap].next;
+			rmap_tab[rmap].next = rmap_free;
+			rmap_free = rmap;
+			spin_unlock_irqrestore(&paging_lock, flags);
+
+			return;
+		}
+	}
+
+	panic("no reverse mapping for page %x at %x", ppage, vpage);
+}
+
 /**
  * paging_create_pd
  */
@@ -542,27 +1042,34 @@ void paging_destroy_pd(ui32_t *pd) // WARNING: pd must be a physical address
 					       pg_id, pg_tab_id);
 					#endif
 
-					if(!ppage_ref_cnt[ppage])
+					if(!ppage_tab[ppage].ref_cnt)
 					{
 						panic("null reference count");
 					}
 
-					ppage_ref_cnt[ppage]--;
+					paging_rmap_remove(ppage,
+					                   pd,
+					                   pg_tab_id << 10 | pg_id);
+					ppage_tab[ppage].ref_cnt--;
 
-					if(!ppage_ref_cnt[ppage])
+					if(!ppage_tab[ppage].ref_cnt)
 					{
 						paging_pfree(ppage);
 					}
 				}
+				else if(page_tab[pg_id] & PAGING_SWAPPED)
+				{
+					swap_free(page_tab[pg_id] >> 12);
+				}
 			}
 
 			ppage = page_dir[pg_tab_id] >> 12;
 
-			if(ppage_ref_cnt[ppage] == 1)
+			if(ppage_tab[ppage].ref_cnt == 1)
 			{
 				panic("page table seems to be mapped");
 			}
-			else if(ppage_ref_cnt[ppage] > 1)
+			else if(ppage_tab[ppage].ref_cnt > 1)
 			{
 				panic("pt seems to be mapped and shared");
 			}
@@ -593,6 +1100,7 @@ ui32_t *paging_cow_init()
 	ui32_t *page_dir, *page_tab, *son_page_dir, *son_page_tab;
 	ui32_t *son_page_dir_paddr;
 	ui32_t pg_tab_id, pg_id;
+	count_t nr_ro = 0;
 
 	/** Allocate a page directory for the son. **/
 
@@ -695,7 +1203,12 @@ ui32_t *paging_cow_init()
 					       pg_id, pg_tab_id, ppage);
 					#endif
 
-					if(ppage_ref_cnt[ppage] == 255)
+					if(ppage_tab[ppage].ref_cnt
+					   == PAGE_MAX_REF_CNT
+					|| paging_rmap_add(ppage,
+					                   son_page_dir_paddr,
+					                   pg_tab_id << 10 | pg_id)
+					   != OK)
 					{
 						#ifdef DEBUG
 						printk("ppage %x\n", ppage);
@@ -709,7 +1222,22 @@ ui32_t *paging_cow_init()
 						goto fail1;
 					}
 
-					ppage_ref_cnt[ppage]++;
+					ppage_tab[ppage].ref_cnt++;
+				}
+				else if(page_tab[pg_id] & PAGING_SWAPPED)
+				{
+					/** Pages swapped out share their
+					    slot. **/
+
+					if(swap_dup(page_tab[pg_id] >> 12)
+					   != OK)
+					{
+						paging_unmap
+						      (son_pt_vpage.vpage);
+						goto fail1;
+					}
+
+					son_page_tab[pg_id] = page_tab[pg_id];
 				}
 				else
 				{
@@ -725,7 +1253,10 @@ ui32_t *paging_cow_init()
 		}
 	}
 
-	/** Finally remove flag PAGING_RW in the parent's page tables. **/
+	/** Finally remove flag PAGING_RW in the parent's page tables. The
+	    pages which were writable are invalidated one by one, unless there
+	    are so many that flushing the (user part of the) TLB is
+	    cheaper. **/
 
 	for(pg_tab_id = 256; pg_tab_id < 1023; pg_tab_id++)
 	{
@@ -735,23 +1266,30 @@ ui32_t *paging_cow_init()
 
 			for(pg_id = 0; pg_id < 1024; pg_id++)
 			{
-				if(page_tab[pg_id] & PAGING_PRESENT)
+				if((page_tab[pg_id] & PAGING_PRESENT)
+				&& (page_tab[pg_id] & PAGING_RW))
 				{
 					page_tab[pg_id] &= ~PAGING_RW;
+
+					if(++nr_ro <= PAGING_INVLPG_MAX)
+					{
+						paging_invlpg(pg_tab_id << 10
+						            | pg_id);
+					}
 				}
 			}
 		}
 	}
 
+	if(nr_ro > PAGING_INVLPG_MAX)
+	{
+		paging_flush_tlb();
+	}
+
 	paging_vfree(son_pt_vpage);
 	paging_unmap(son_pd_vpage.vpage);
 	paging_vfree(son_pd_vpage);
 
-	/** Flush TLB cache. **/
-
-	asm volatile("mov %%cr3, %%eax \n\
-	              mov %%eax, %%cr3" ::: "eax");
-
 	return son_page_dir_paddr;
 
 	fail1:
@@ -765,3 +1303,56 @@ ui32_t *paging_cow_init()
 	fail5:
 		return 0;
 }
+
+/**
+ * paging_usage
+ */
+
+void paging_usage(ui32_t *pd, count_t *private, count_t *shared)
+{
+	ui32_t pg_tab_id, pg_id;
+	ui32_t *page_dir, *page_tab;
+	ui32_t old_cr3;
+
+	/** Count the user pages of the address space, according to whether
+	    they are mapped only there or also elsewhere (or cached). **/
+
+	*private = *shared = 0;
+
+	old_cr3 = (ui32_t)paging_get_pd();
+
+	asm volatile("mov %0, %%eax \n\
+	              mov %%eax, %%cr3" :: "m"(pd) : "eax", "memory");
+
+	page_dir = page_directory();
+
+	for(pg_tab_id = 256; pg_tab_id < 1023; pg_tab_id++)
+	{
+		if(!(page_dir[pg_tab_id] & PAGING_PRESENT))
+		{
+			continue;
+		}
+
+		page_tab = page_table(pg_tab_id);
+
+		for(pg_id = 0; pg_id < 1024; pg_id++)
+		{
+			if(!(page_tab[pg_id] & PAGING_PRESENT))
+			{
+				continue;
+			}
+
+			if(ppage_tab[page_tab[pg_id] >> 12].ref_cnt == 1)
+			{
+				(*private)++;
+			}
+			else
+			{
+				(*shared)++;
+			}
+		}
+	}
+
+	asm volatile("mov %0, %%eax \n\
+	              mov %%eax, %%cr3" :: "m"(old_cr3) : "eax", "memory");
+}
@@ -2,6 +2,7 @@
 #define _PAGING_H_
 
 #include <config.h>
+#include <kernel/lock.h>
 #include <kernel/types.h>
 #include <mm/mem_map.h>
 
@@ -13,6 +14,24 @@ struct pheap_page
 	ui32_t vpage;
 };
 
+/** Physical page descriptor **/
+
+struct page
+{
+	ui16_t ref_cnt; // how many times the page is mapped (or held)
+	ui16_t flags;
+	ui32_t rmap; // first reverse mapping (0 if none)
+};
+
+/** Reverse mapping (user mapping of a physical page) **/
+
+struct rmap
+{
+	ui32_t *pd; // physical address of the page directory
+	ui32_t vpage;
+	ui32_t next;
+};
+
 /** Constants **/
 
 // WARNING: If NR_PPAGES is not a multiple of 8, not all pages will be
@@ -26,6 +45,29 @@ struct pheap_page
 #define PAGING_PRESENT		0x001
 #define PAGING_RW		0x002
 #define PAGING_USER		0x004
+#define PAGING_PWT		0x008 // write-through
+#define PAGING_PCD		0x010 // cache disabled (device registers)
+#define PAGING_ACCESSED		0x020
+#define PAGING_GLOBAL		0x100 // kernel mappings (same everywhere)
+// Non-present entry of a page swapped out: the slot is in bits 12-31.
+#define PAGING_SWAPPED		0x200
+
+/** Past this number of pages, changing the mappings of a whole address space
+    flushes the TLB instead of invalidating each page. **/
+
+#define PAGING_INVLPG_MAX	64
+
+/** CR4 and CPUID flags **/
+
+#define CR4_PGE			0x080
+#define CPUID_PGE		0x2000
+
+/** Flags for page descriptors **/
+
+#define PAGE_RESERVED		0x0001 // kernel code, data and tables
+#define PAGE_CACHED		0x0002 // held by the page cache
+
+#define PAGE_MAX_REF_CNT	0xffff
 
 /** Convenient macros **/
 
@@ -34,23 +76,40 @@ struct pheap_page
 #define page_table_id(page)	(page >> 10)
 #define page_id(page)		(page & 0x3ff)
 
-/** Global variables (number of physical pages left, physical page reference
-    counter) **/
+/** Global variables (number of physical pages left, physical page
+    descriptors, reverse mappings). The interrupt handlers allocate and free
+    page heap pages too: paging_lock protects the bitmaps, ppage_left, the
+    reverse mappings and the reference counts changed by paging_map_flags and
+    paging_unmap. The other descriptor changes only concern user pages, which
+    only processes touch. **/
 
 #ifdef _PAGING_C_
 size_t ppage_left = NR_PPAGES;
-ui8_t *ppage_ref_cnt = (void*)PAGE_DESC_BASE;
+struct page *ppage_tab = (void*)PAGE_DESC_BASE;
+struct rmap *rmap_tab = (void*)PAGE_DESC_BASE
+                      + NR_PPAGES * sizeof(struct page);
+ui32_t rmap_free = 0;
+struct spinlock paging_lock = SPINLOCK_INIT;
 #else
 extern size_t ppage_left;
-extern ui8_t *ppage_ref_cnt;
+extern struct page *ppage_tab;
+extern struct rmap *rmap_tab;
+extern ui32_t rmap_free;
+extern struct spinlock paging_lock;
 #endif
 
 /** Functions **/
 
 void paging_init();
 /****************************************************************/
+void paging_enable_global();
+/****************************************************************/
 ui32_t paging_bitmap_alloc(ui8_t *bitmap, size_t bitmap_size);
 /****************************************************************/
+ui32_t paging_bitmap_alloc_range(ui8_t *bitmap,
+                                 size_t bitmap_size,
+                                 count_t count);
+/****************************************************************/
 void paging_bitmap_set_used(ui8_t *bitmap, ui32_t page);
 /****************************************************************/
 void paging_bitmap_free(ui8_t *bitmap, ui32_t page);
@@ -63,14 +122,44 @@ struct pheap_page paging_valloc(bool_t map);
 /****************************************************************/
 void paging_vfree(struct pheap_page page);
 /****************************************************************/
+ui32_t paging_valloc_range(count_t count);
+/****************************************************************/
+void paging_vfree_range(ui32_t vpage, count_t count);
+/****************************************************************/
 ret_t paging_map(ui32_t ppage, ui32_t vpage);
 /****************************************************************/
+ret_t paging_map_flags(ui32_t ppage, ui32_t vpage, ui32_t flags);
+/****************************************************************/
 void paging_unmap(ui32_t vpage);
 /****************************************************************/
+void paging_invlpg(ui32_t vpage);
+/****************************************************************/
+void paging_flush_tlb();
+/****************************************************************/
+ui32_t paging_get_entry(ui32_t vpage);
+/****************************************************************/
+bool_t paging_present(void *start, size_t size, bool_t write);
+/****************************************************************/
+count_t paging_fault_in(void *start, size_t size, bool_t write);
+/****************************************************************/
+void paging_set_flags(ui32_t vpage, ui32_t set, ui32_t clear);
+/****************************************************************/
+ui32_t *paging_get_pd();
+/****************************************************************/
+ui32_t *paging_switch_pd(ui32_t *pd);
+/****************************************************************/
+void paging_discard(ui32_t vpage);
+/****************************************************************/
+ret_t paging_rmap_add(ui32_t ppage, ui32_t *pd, ui32_t vpage);
+/****************************************************************/
+void paging_rmap_remove(ui32_t ppage, ui32_t *pd, ui32_t vpage);
+/****************************************************************/
 ui32_t *paging_create_pd();
 /****************************************************************/
 void paging_destroy_pd(ui32_t *pd);
 /****************************************************************/
 ui32_t *paging_cow_init();
+/****************************************************************/
+void paging_usage(ui32_t *pd, count_t *private, count_t *shared);
 
 #endif
@@ -0,0 +1,331 @@
+/****************************************************************
+ * pcache.c                                                     *
+ *                                                              *
+ *    Page cache for the read-only segments of executables.     *
+ *                                                              *
+ ****************************************************************/
+
+#include <config.h>
+#include <fs/ext2.h>
+#include <kernel/errno.h>
+#include <kernel/libc.h>
+#include <kernel/panic.h>
+#include <mm/paging.h>
+
+#include "pcache.h"
+
+struct pcache_entry pcache_tab[NR_PCACHE_PAGES];
+si32_t pcache_head[NR_PCACHE_HASH];
+si32_t pcache_ihead[NR_PCACHE_HASH];
+si32_t pcache_free = -1;
+ui32_t pcache_hand = 0;
+
+/**
+ * pcache_init
+ */
+
+void pcache_init()
+{
+	ui32_t i;
+
+	for(i = 0; i < NR_PCACHE_HASH; i++)
+	{
+		pcache_head[i] = -1;
+		pcache_ihead[i] = -1;
+	}
+
+	/** Chain all the entries in the free list. **/
+
+	for(i = 0; i < NR_PCACHE_PAGES; i++)
+	{
+		pcache_tab[i].used = 0;
+		pcache_tab[i].next = (i + 1 < NR_PCACHE_PAGES) ? i + 1 : -1;
+	}
+
+	pcache_free = 0;
+}
+
+/**
+ * pcache_lookup
+ */
+
+si32_t pcache_lookup(ui32_t inum, ui32_t index)
+{
+	si32_t entry;
+
+	for(entry = pcache_head[pcache_hash(inum, index)];
+	    entry != -1;
+	    entry = pcache_tab[entry].next)
+	{
+		if(pcache_tab[entry].inum == inum
+		&& pcache_tab[entry].index == index)
+		{
+			return entry;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * pcache_drop
+ */
+
+void pcache_drop(si32_t entry)
+{
+	struct pcache_entry *pentry = &pcache_tab[entry];
+	si32_t *link;
+	ui32_t ppage;
+
+	/** Unlink the entry from both hash chains. **/
+
+	for(link = &pcache_head[pcache_hash(pentry->inum, pentry->index)];
+	    *link != entry;
+	    link = &pcache_tab[*link].next);
+
+	*link = pentry->next;
+
+	for(link = &pcache_ihead[pcache_ihash(pentry->inum)];
+	    *link != entry;
+	    link = &pcache_tab[*link].inext);
+
+	*link = pentry->inext;
+
+	/** Give back the reference held by the cache. The page is freed only
+	    if no process maps it any more. **/
+
+	ppage = pentry->ppage;
+
+	if(!ppage_tab[ppage].ref_cnt)
+	{
+		panic("null reference counter for cached page");
+	}
+
+	ppage_tab[ppage].flags &= ~PAGE_CACHED;
+	ppage_tab[ppage].ref_cnt--;
+
+	if(!ppage_tab[ppage].ref_cnt)
+	{
+		paging_pfree(ppage);
+	}
+
+	pentry->used = 0;
+	pentry->next = pcache_free;
+	pcache_free = entry;
+}
+
+/**
+ * pcache_alloc_entry
+ */
+
+si32_t pcache_alloc_entry()
+{
+	si32_t entry;
+	ui32_t i;
+
+	/** If the cache is full, evict an entry, preferably one whose page is
+	    not mapped anywhere. **/
+
+	if(pcache_free == -1)
+	{
+		for(i = 0, entry = pcache_hand; i < NR_PCACHE_PAGES; i++)
+		{
+			entry = (pcache_hand + i) % NR_PCACHE_PAGES;
+
+			if(ppage_tab[pcache_tab[entry].ppage].ref_cnt == 1)
+			{
+				break;
+			}
+		}
+
+		if(i == NR_PCACHE_PAGES)
+		{
+			entry = pcache_hand;
+		}
+
+		pcache_hand = (entry + 1) % NR_PCACHE_PAGES;
+		pcache_drop(entry);
+	}
+
+	entry = pcache_free;
+	pcache_free = pcache_tab[entry].next;
+
+	return entry;
+}
+
+/**
+ * pcache_get
+ */
+
+ui32_t pcache_get(ui32_t inum, ui32_t index)
+{
+	si32_t entry;
+	struct pcache_entry *pentry;
+	struct pheap_page vpage;
+	ui32_t ppage;
+	void *buf;
+
+	entry = pcache_lookup(inum, index);
+
+	if(entry != -1)
+	{
+		return pcache_tab[entry].ppage;
+	}
+
+	/** Read the page of the file through a temporary kernel mapping.
+	    Whatever lies beyond the end of the file is zeroed. **/
+
+	ppage = paging_palloc();
+
+	if(!ppage)
+	{
+		goto fail3;
+	}
+
+	vpage = paging_valloc(0);
+
+	if(!vpage.vpage)
+	{
+		goto fail2;
+	}
+
+	if(paging_map(ppage, vpage.vpage) != OK)
+	{
+		goto fail1;
+	}
+
+	buf = (void*)(vpage.vpage << 12);
+	memset(buf, 0, 4096);
+
+	if(ext2_read(inum, buf, 4096, index << 12) < 0)
+	{
+		paging_unmap(vpage.vpage);
+		goto fail1;
+	}
+
+	paging_unmap(vpage.vpage);
+	paging_vfree(vpage);
+
+	/** The cache holds one reference to the page. **/
+
+	ppage_tab[ppage].ref_cnt = 1;
+	ppage_tab[ppage].flags |= PAGE_CACHED;
+
+	entry = pcache_alloc_entry();
+	pentry = &pcache_tab[entry];
+	pentry->used = 1;
+	pentry->inum = inum;
+	pentry->index = index;
+	pentry->ppage = ppage;
+	pentry->next = pcache_head[pcache_hash(inum, index)];
+	pcache_head[pcache_hash(inum, index)] = entry;
+	pentry->inext = pcache_ihead[pcache_ihash(inum)];
+	pcache_ihead[pcache_ihash(inum)] = entry;
+
+	return ppage;
+
+	fail1:
+		paging_vfree(vpage);
+	fail2:
+		paging_pfree(ppage);
+	fail3:
+		return 0;
+}
+
+/**
+ * pcache_map
+ */
+
+ret_t pcache_map(ui32_t inum, off_t off, void *addr, size_t size)
+{
+	ui32_t vpage, last_vpage, index;
+	ui32_t ppage;
+	ret_t ret;
+
+	if(((ui32_t)addr & 0xfff) != (off & 0xfff))
+	{
+		return -EINVAL;
+	}
+
+	if(!size)
+	{
+		return OK;
+	}
+
+	last_vpage = ((ui32_t)addr + size - 1) >> 12;
+
+	for(vpage = (ui32_t)addr >> 12, index = off >> 12;
+	    vpage <= last_vpage;
+	    vpage++, index++)
+	{
+		ppage = pcache_get(inum, index);
+
+		if(!ppage)
+		{
+			return -ENOMEM;
+		}
+
+		/** Drop whatever the address space inherited at this address
+		    (typically the image of the process calling execve). **/
+
+		paging_discard(vpage);
+
+		/** Map the page read-only so that writing to it triggers a
+		    copy-on-write. The temporary reference prevents the page
+		    from being reclaimed if a page table must be allocated. **/
+
+		ppage_tab[ppage].ref_cnt++;
+		ret = paging_map_flags(ppage, vpage, 0);
+		ppage_tab[ppage].ref_cnt--;
+
+		if(ret != OK)
+		{
+			return ret;
+		}
+	}
+
+	return OK;
+}
+
+/**
+ * pcache_invalidate
+ */
+
+void pcache_invalidate(ui32_t inum)
+{
+	si32_t entry, next;
+
+	for(entry = pcache_ihead[pcache_ihash(inum)]; entry != -1; entry = next)
+	{
+		next = pcache_tab[entry].inext;
+
+		if(pcache_tab[entry].inum == inum)
+		{
+			pcache_drop(entry);
+		}
+	}
+}
+
+/**
+ * pcache_shrink
+ */
+
+count_t pcache_shrink()
+{
+	ui32_t entry;
+	count_t freed = 0;
+
+	/** Free the cached pages which are not mapped by any process. **/
+
+	for(entry = 0; entry < NR_PCACHE_PAGES; entry++)
+	{
+		if(pcache_tab[entry].used
+		&& ppage_tab[pcache_tab[entry].ppage].ref_cnt == 1)
+		{
+			pcache_drop(entry);
+			freed++;
+		}
+	}
+
+	return freed;
+}
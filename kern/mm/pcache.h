@@ -0,0 +1,37 @@
+#ifndef _PCACHE_H_
+#define _PCACHE_H_
+
+#include <config.h>
+#include <kernel/types.h>
+
+/** Cached file page **/
+
+struct pcache_entry
+{
+	bool_t used;
+	ui32_t inum;
+	ui32_t index; // page number in the file
+	ui32_t ppage;
+	si32_t next; // next entry with the same (inum, index) hash or free
+	si32_t inext; // next entry with the same inum hash
+};
+
+/** Hash functions **/
+
+#define pcache_hash(inum, index) \
+	(((inum) * 31 + (index)) % NR_PCACHE_HASH)
+#define pcache_ihash(inum)	((inum) % NR_PCACHE_HASH)
+
+/** Functions **/
+
+void pcache_init();
+/****************************************************************/
+ui32_t pcache_get(ui32_t inum, ui32_t index);
+/****************************************************************/
+ret_t pcache_map(ui32_t inum, off_t off, void *addr, size_t size);
+/****************************************************************/
+void pcache_invalidate(ui32_t inum);
+/****************************************************************/
+count_t pcache_shrink();
+
+#endif
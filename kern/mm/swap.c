@@ -0,0 +1,444 @@
+/****************************************************************
+ * swap.c                                                       *
+ *                                                              *
+ *    Page reclaim and swapping of anonymous pages to disk.     *
+ *                                                              *
+ ****************************************************************/
+
+#define _SWAP_C_
+#include <config.h>
+#include <fs/ata.h>
+#include <kernel/errno.h>
+#include <kernel/panic.h>
+#ifdef ENABLE_SMP
+#include <kernel/smp.h>
+#endif
+#include <mm/paging.h>
+#ifdef USE_PAGE_CACHE
+#include <mm/pcache.h>
+#endif
+
+#include "swap.h"
+
+ui8_t swap_map[NR_SWAP_SLOTS] = { 0 }; // references to each slot
+ui32_t swap_next = 1; // where to start looking for a free slot
+ui32_t swap_hand = 0; // clock hand of the reclaimer
+bool_t swap_reclaiming = 0;
+
+/**
+ * swap_init
+ */
+
+void swap_init()
+{
+	/** The swap area is only used if its drive answers. **/
+
+	#if SWAP_ATA_CTL != ATA_CTL
+	ata_init(SWAP_ATA_CTL);
+	#endif
+
+	swap_enabled = ata_probe(SWAP_ATA_CTL, SWAP_ATA_SLAVE);
+}
+
+/**
+ * swap_alloc
+ */
+
+ui32_t swap_alloc()
+{
+	ui32_t slot, i;
+
+	for(i = 1; i < NR_SWAP_SLOTS; i++)
+	{
+		slot = (swap_next + i - 1) % (NR_SWAP_SLOTS - 1) + 1;
+
+		if(!swap_map[slot])
+		{
+			swap_map[slot] = 1;
+			swap_next = slot + 1;
+			swap_used++;
+
+			return slot;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * swap_dup
+ */
+
+ret_t swap_dup(ui32_t slot)
+{
+	if(!swap_map[slot])
+	{
+		panic("duplicating free swap slot %x", slot);
+	}
+	else if(swap_map[slot] == SWAP_MAX_REF)
+	{
+		return -EOVERFLOW;
+	}
+
+	swap_map[slot]++;
+
+	return OK;
+}
+
+/**
+ * swap_free
+ */
+
+void swap_free(ui32_t slot)
+{
+	if(!slot || slot >= NR_SWAP_SLOTS || !swap_map[slot])
+	{
+		panic("freeing free swap slot %x", slot);
+	}
+
+	swap_map[slot]--;
+
+	if(!swap_map[slot])
+	{
+		swap_used--;
+	}
+}
+
+/**
+ * swap_io
+ */
+
+ret_t swap_io(ui32_t slot, void *buf, bool_t write)
+{
+	ui32_t sec;
+
+	for(sec = 0; sec < 8; sec++)
+	{
+		if(ata_read_write(SWAP_ATA_CTL,
+		                  SWAP_ATA_SLAVE,
+		                  buf + (sec << 9),
+		                  SWAP_SEC_OFF + (slot << 3) + sec,
+		                  write) != OK)
+		{
+			return -EIO;
+		}
+	}
+
+	return OK;
+}
+
+/**
+ * swap_out
+ */
+
+ret_t swap_out(ui32_t ppage)
+{
+	struct page *page = &ppage_tab[ppage];
+	struct pheap_page vpage;
+	ui32_t slot, rmap, user_vpage;
+	ui32_t *pd, *old_pd, *pte;
+	count_t nmaps = 0;
+	ret_t ret;
+
+	slot = swap_alloc();
+
+	if(!slot)
+	{
+		return -ENOSPC;
+	}
+
+	/** Write the page to the slot through a temporary kernel mapping. **/
+
+	vpage = paging_valloc(0);
+
+	if(!vpage.vpage)
+	{
+		ret = -ENOMEM;
+		goto fail2;
+	}
+
+	if((ret = paging_map(ppage, vpage.vpage)) != OK)
+	{
+		goto fail1;
+	}
+
+	ret = swap_io(slot, (void*)(vpage.vpage << 12), 1);
+	paging_unmap(vpage.vpage);
+
+	if(ret != OK)
+	{
+		goto fail1;
+	}
+
+	paging_vfree(vpage);
+
+	/** Replace every mapping of the page by a reference to the slot. The
+	    entry keeps the protection the page must get back when swapped
+	    in. Switching to the page directories also flushes the TLB of this
+	    processor. **/
+
+	while((rmap = page->rmap))
+	{
+		pd = rmap_tab[rmap].pd;
+		user_vpage = rmap_tab[rmap].vpage;
+
+		old_pd = paging_switch_pd(pd);
+		pte = &page_table(page_table_id(user_vpage))[page_id(user_vpage)];
+		*pte = slot << 12
+		     | PAGING_SWAPPED
+		     | (*pte & (PAGING_RW | PAGING_USER));
+		paging_switch_pd(old_pd);
+
+		paging_rmap_remove(ppage, pd, user_vpage);
+		page->ref_cnt--;
+		nmaps++;
+	}
+
+	if(page->ref_cnt)
+	{
+		panic("swapped out page %x still referenced", ppage);
+	}
+
+	/** The other processors may still reach the page through their TLB
+	    until it is flushed: it must not be reused before. **/
+
+	#ifdef ENABLE_SMP
+	smp_tlb_shootdown(nmaps == 1 ? user_vpage : SMP_TLB_ALL);
+	#endif
+
+	swap_map[slot] = nmaps;
+	paging_pfree(ppage);
+
+	return OK;
+
+	fail1:
+		paging_vfree(vpage);
+	fail2:
+		swap_free(slot);
+		return ret;
+}
+
+/**
+ * swap_in
+ */
+
+ret_t swap_in(ui32_t vpage)
+{
+	ui32_t entry, slot, ppage;
+	ui32_t *pte;
+	ret_t ret;
+
+	entry = paging_get_entry(vpage);
+	slot = entry >> 12;
+
+	if(!(entry & PAGING_SWAPPED) || !slot || slot >= NR_SWAP_SLOTS)
+	{
+		panic("bad swap entry %x at %x", entry, vpage);
+	}
+
+	/** Allocating the page may swap other pages out but leaves this entry
+	    untouched. **/
+
+	ppage = paging_palloc();
+
+	if(!ppage)
+	{
+		return -ENOMEM;
+	}
+
+	/** Read the page through its user mapping. **/
+
+	pte = &page_table(page_table_id(vpage))[page_id(vpage)];
+	*pte = 0;
+
+	if((ret = paging_map(ppage, vpage)) != OK)
+	{
+		*pte = entry;
+		paging_pfree(ppage);
+
+		return ret;
+	}
+
+	if((ret = swap_io(slot, (void*)(vpage << 12), 0)) != OK)
+	{
+		paging_unmap(vpage);
+		*pte = entry;
+
+		return ret;
+	}
+
+	/** Restore the protection of the page. If the slot is still referred
+	    to by other processes, the page becomes private to this one and is
+	    given back read-only (as after a fork), so that the copy-on-write
+	    path decides whether it may be written. **/
+
+	if(swap_map[slot] > 1 || !(entry & PAGING_RW))
+	{
+		paging_set_flags(vpage, 0, PAGING_RW);
+	}
+
+	if(!(entry & PAGING_USER))
+	{
+		paging_set_flags(vpage, 0, PAGING_USER);
+	}
+
+	swap_free(slot);
+
+	return OK;
+}
+
+/**
+ * swap_referenced
+ */
+
+bool_t swap_referenced(ui32_t ppage)
+{
+	ui32_t rmap, vpage;
+	ui32_t *old_pd, *pte;
+	bool_t referenced = 0;
+
+	/** Test and clear the accessed bit of every mapping of the page. **/
+
+	for(rmap = ppage_tab[ppage].rmap; rmap; rmap = rmap_tab[rmap].next)
+	{
+		vpage = rmap_tab[rmap].vpage;
+
+		old_pd = paging_switch_pd(rmap_tab[rmap].pd);
+		pte = &page_table(page_table_id(vpage))[page_id(vpage)];
+
+		if(*pte & PAGING_ACCESSED)
+		{
+			*pte &= ~PAGING_ACCESSED;
+			referenced = 1;
+		}
+
+		paging_switch_pd(old_pd);
+	}
+
+	return referenced;
+}
+
+/**
+ * swap_unmap_cached
+ */
+
+void swap_unmap_cached(ui32_t ppage)
+{
+	struct page *page = &ppage_tab[ppage];
+	ui32_t rmap, vpage;
+	ui32_t *pd, *old_pd;
+	count_t nmaps = 0;
+
+	/** Cached pages are only mapped in file regions: they are read again
+	    from the page cache or the file when accessed. **/
+
+	while((rmap = page->rmap))
+	{
+		pd = rmap_tab[rmap].pd;
+		vpage = rmap_tab[rmap].vpage;
+
+		old_pd = paging_switch_pd(pd);
+		page_table(page_table_id(vpage))[page_id(vpage)] = 0;
+		paging_switch_pd(old_pd);
+
+		paging_rmap_remove(ppage, pd, vpage);
+		page->ref_cnt--;
+		nmaps++;
+	}
+
+	/** As in swap_out, before the page cache frees the page. **/
+
+	#ifdef ENABLE_SMP
+	if(nmaps)
+	{
+		smp_tlb_shootdown(nmaps == 1 ? vpage : SMP_TLB_ALL);
+	}
+	#endif
+}
+
+/**
+ * swap_reclaim
+ */
+
+count_t swap_reclaim()
+{
+	struct page *page;
+	ui32_t ppage, rmap;
+	count_t freed = 0, unmapped = 0, nmaps, scanned;
+
+	if(swap_reclaiming)
+	{
+		return 0;
+	}
+
+	swap_reclaiming = 1;
+
+	/** First give back the cached pages which are mapped nowhere. **/
+
+	#ifdef USE_PAGE_CACHE
+	freed = pcache_shrink();
+	#endif
+
+	/** Then run the clock over the physical pages. A page which was
+	    accessed through any of its mappings since the last pass gets a
+	    second chance. Otherwise, a clean cached page is unmapped (and
+	    freed by the page cache) and an anonymous page is swapped out. **/
+
+	for(scanned = 0;
+	    freed + unmapped < SWAP_CLUSTER && scanned < 2 * NR_PPAGES;
+	    scanned++)
+	{
+		ppage = swap_hand;
+		swap_hand = (swap_hand + 1) % NR_PPAGES;
+		page = &ppage_tab[ppage];
+
+		if(!page->rmap || (page->flags & PAGE_RESERVED))
+		{
+			continue;
+		}
+
+		/** Leave alone the pages held by something else than their
+		    user mappings (e.g. a temporary kernel mapping). **/
+
+		for(nmaps = 0, rmap = page->rmap;
+		    rmap;
+		    rmap = rmap_tab[rmap].next)
+		{
+			nmaps++;
+		}
+
+		if(page->ref_cnt
+		   != nmaps + ((page->flags & PAGE_CACHED) ? 1 : 0))
+		{
+			continue;
+		}
+
+		if(swap_referenced(ppage))
+		{
+			continue;
+		}
+
+		if(page->flags & PAGE_CACHED)
+		{
+			swap_unmap_cached(ppage);
+			unmapped++;
+		}
+		else if(swap_enabled
+		     && nmaps <= SWAP_MAX_REF
+		     && swap_out(ppage) == OK)
+		{
+			freed++;
+		}
+	}
+
+	#ifdef USE_PAGE_CACHE
+	if(unmapped)
+	{
+		freed += pcache_shrink();
+	}
+	#endif
+
+	swap_reclaiming = 0;
+
+	return freed;
+}
@@ -0,0 +1,47 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+#include <config.h>
+#include <kernel/types.h>
+
+/** Constants **/
+
+// Slot 0 is never used (0 meaning "no slot").
+#define NR_SWAP_SLOTS		(SWAP_SIZE / 4096)
+// Maximum number of page table entries referring to a slot
+#define SWAP_MAX_REF		0xff
+
+/** Global variables (whether a swap area is available, number of slots in
+    use) **/
+
+#ifdef _SWAP_C_
+bool_t swap_enabled = 0;
+count_t swap_used = 0;
+#else
+extern bool_t swap_enabled;
+extern count_t swap_used;
+#endif
+
+/** Functions **/
+
+void swap_init();
+/****************************************************************/
+ui32_t swap_alloc();
+/****************************************************************/
+ret_t swap_dup(ui32_t slot);
+/****************************************************************/
+void swap_free(ui32_t slot);
+/****************************************************************/
+ret_t swap_io(ui32_t slot, void *buf, bool_t write);
+/****************************************************************/
+ret_t swap_out(ui32_t ppage);
+/****************************************************************/
+ret_t swap_in(ui32_t vpage);
+/****************************************************************/
+bool_t swap_referenced(ui32_t ppage);
+/****************************************************************/
+void swap_unmap_cached(ui32_t ppage);
+/****************************************************************/
+count_t swap_reclaim();
+
+#endif
@@ -0,0 +1,431 @@
+/****************************************************************
+ * vma.c                                                        *
+ *                                                              *
+ *    Memory regions of processes (mmap).                       *
+ *                                                              *
+ ****************************************************************/
+
+#include <config.h>
+#include <fs/ext2.h>
+#include <fs/file.h>
+#include <kernel/errno.h>
+#include <kernel/isr.h>
+#include <kernel/libc.h>
+#include <kernel/process.h>
+#include <mm/mem_map.h>
+#include <mm/paging.h>
+#ifdef USE_PAGE_CACHE
+#include <mm/pcache.h>
+#endif
+
+#include "vma.h"
+
+/**
+ * vma_find
+ */
+
+struct vm_area *vma_find(ui32_t addr)
+{
+	struct vm_area *vma;
+	ui32_t i;
+
+	for(i = 0; i < NR_VMAS_PER_PROC; i++)
+	{
+		vma = &current->vmas[i];
+
+		if(vma->used && addr >= vma->start && addr < vma->end)
+		{
+			return vma;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * vma_alloc
+ */
+
+struct vm_area *vma_alloc()
+{
+	ui32_t i;
+
+	for(i = 0; i < NR_VMAS_PER_PROC; i++)
+	{
+		if(!current->vmas[i].used)
+		{
+			return &current->vmas[i];
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * vma_split
+ */
+
+ret_t vma_split(ui32_t addr)
+{
+	struct vm_area *vma, *new_vma;
+
+	/** Make sure that no region crosses addr. **/
+
+	vma = vma_find(addr);
+
+	if(!vma || vma->start == addr)
+	{
+		return OK;
+	}
+
+	new_vma = vma_alloc();
+
+	if(!new_vma)
+	{
+		return -ENOMEM;
+	}
+
+	*new_vma = *vma;
+	new_vma->start = addr;
+	new_vma->off += addr - vma->start;
+	vma->end = addr;
+
+	if(new_vma->file)
+	{
+		file_ref(new_vma->file);
+	}
+
+	return OK;
+}
+
+/**
+ * vma_find_gap
+ */
+
+ui32_t vma_find_gap(size_t len)
+{
+	struct vm_area *vma;
+	ui32_t start = USER_MMAP_BASE;
+	bool_t moved;
+	ui32_t i;
+
+	if(len > USER_MMAP_LIMIT - USER_MMAP_BASE)
+	{
+		return 0;
+	}
+
+	/** First fit: skip every region overlapping the candidate range until
+	    it is free. **/
+
+	do
+	{
+		moved = 0;
+
+		for(i = 0; i < NR_VMAS_PER_PROC; i++)
+		{
+			vma = &current->vmas[i];
+
+			if(vma->used && vma->end > start && vma->start < start + len)
+			{
+				start = vma->end;
+				moved = 1;
+			}
+		}
+
+		if(start > USER_MMAP_LIMIT - len)
+		{
+			return 0;
+		}
+	} while(moved);
+
+	return start;
+}
+
+/**
+ * vma_add
+ */
+
+ret_t vma_add(ui32_t start,
+              ui32_t end,
+              ui32_t prot,
+              ino_t file,
+              ui32_t inum,
+              off_t off)
+{
+	struct vm_area *vma;
+
+	vma = vma_alloc();
+
+	if(!vma)
+	{
+		return -ENOMEM;
+	}
+
+	vma->used = 1;
+	vma->start = start;
+	vma->end = end;
+	vma->prot = prot;
+	vma->file = file;
+	vma->inum = inum;
+	vma->off = off;
+
+	if(file)
+	{
+		file_ref(file);
+	}
+
+	return OK;
+}
+
+/**
+ * vma_release_pages
+ */
+
+void vma_release_pages(ui32_t start, ui32_t end)
+{
+	ui32_t vpage;
+
+	for(vpage = start >> 12; vpage < (end >> 12); vpage++)
+	{
+		/** Skip whole page tables when they are not present. **/
+
+		if(!(page_directory()[page_table_id(vpage)] & PAGING_PRESENT))
+		{
+			vpage |= 0x3ff;
+			continue;
+		}
+
+		paging_discard(vpage);
+	}
+}
+
+/**
+ * vma_unmap
+ */
+
+ret_t vma_unmap(ui32_t start, ui32_t end)
+{
+	struct vm_area *vma;
+	ret_t ret;
+	ui32_t i;
+
+	if((ret = vma_split(start)) != OK || (ret = vma_split(end)) != OK)
+	{
+		return ret;
+	}
+
+	for(i = 0; i < NR_VMAS_PER_PROC; i++)
+	{
+		vma = &current->vmas[i];
+
+		if(vma->used && vma->start >= start && vma->end <= end)
+		{
+			vma_release_pages(vma->start, vma->end);
+
+			if(vma->file)
+			{
+				file_unref(vma->file);
+			}
+
+			vma->used = 0;
+		}
+	}
+
+	return OK;
+}
+
+/**
+ * vma_protect
+ */
+
+ret_t vma_protect(ui32_t start, ui32_t end, ui32_t prot)
+{
+	struct vm_area *vma;
+	ui32_t addr, vpage;
+	ui32_t set, clear;
+	ret_t ret;
+	ui32_t i;
+
+	/** The whole range must be mapped. **/
+
+	for(addr = start; addr < end; addr = vma->end)
+	{
+		vma = vma_find(addr);
+
+		if(!vma)
+		{
+			return -ENOMEM;
+		}
+	}
+
+	if((ret = vma_split(start)) != OK || (ret = vma_split(end)) != OK)
+	{
+		return ret;
+	}
+
+	/** Write access is never granted here: pages which become writable
+	    are made so by the copy-on-write path. Inaccessible pages are
+	    emulated by making them supervisor pages. **/
+
+	clear = (prot & PROT_WRITE) ? 0 : PAGING_RW;
+	set = 0;
+
+	if(prot == PROT_NONE)
+	{
+		clear |= PAGING_USER;
+	}
+	else
+	{
+		set |= PAGING_USER;
+	}
+
+	for(i = 0; i < NR_VMAS_PER_PROC; i++)
+	{
+		vma = &current->vmas[i];
+
+		if(!vma->used || vma->start < start || vma->end > end)
+		{
+			continue;
+		}
+
+		vma->prot = prot;
+
+		for(vpage = vma->start >> 12; vpage < (vma->end >> 12); vpage++)
+		{
+			if(paging_get_entry(vpage)
+			   & (PAGING_PRESENT | PAGING_SWAPPED))
+			{
+				paging_set_flags(vpage, set, clear);
+			}
+		}
+	}
+
+	return OK;
+}
+
+/**
+ * vma_clear
+ */
+
+void vma_clear()
+{
+	struct vm_area *vma;
+	ui32_t i;
+
+	for(i = 0; i < NR_VMAS_PER_PROC; i++)
+	{
+		vma = &current->vmas[i];
+
+		if(vma->used)
+		{
+			vma_release_pages(vma->start, vma->end);
+
+			if(vma->file)
+			{
+				file_unref(vma->file);
+			}
+
+			vma->used = 0;
+		}
+	}
+}
+
+/**
+ * vma_fork
+ */
+
+void vma_fork(struct vm_area *son_vmas)
+{
+	ui32_t i;
+
+	/** The pages themselves are shared by paging_cow_init. **/
+
+	for(i = 0; i < NR_VMAS_PER_PROC; i++)
+	{
+		son_vmas[i] = current->vmas[i];
+
+		if(son_vmas[i].used && son_vmas[i].file)
+		{
+			file_ref(son_vmas[i].file);
+		}
+	}
+}
+
+/**
+ * vma_fault
+ *
+ *   Returns OK if the fault was resolved, -EFAULT if the access violates the
+ *   protection of the region and -ENOENT if the address belongs to no region
+ *   or if the fault is a copy-on-write, which is left to the caller.
+ */
+
+ret_t vma_fault(ui32_t vpage, ui32_t error_code)
+{
+	struct vm_area *vma;
+	off_t off;
+	ui32_t ppage;
+	ret_t ret;
+
+	vma = vma_find(vpage << 12);
+
+	if(!vma)
+	{
+		return -ENOENT;
+	}
+
+	if(vma->prot == PROT_NONE
+	|| ((error_code & EXC_PF_WRITE) && !(vma->prot & PROT_WRITE)))
+	{
+		return -EFAULT;
+	}
+
+	if(error_code & EXC_PF_PRESENT)
+	{
+		return -ENOENT;
+	}
+
+	/** File mapping: the page is read from the file (through the page
+	    cache if possible) and mapped read-only, so that a write to a
+	    private mapping triggers a copy-on-write. **/
+
+	if(vma->inum)
+	{
+		off = vma->off + ((vpage << 12) - vma->start);
+
+		#ifdef USE_PAGE_CACHE
+		return pcache_map(vma->inum, off, (void*)(vpage << 12), 4096);
+		#endif
+	}
+
+	/** Otherwise, allocate a zeroed page. **/
+
+	ppage = paging_palloc();
+
+	if(!ppage)
+	{
+		return -ENOMEM;
+	}
+
+	if((ret = paging_map(ppage, vpage)) != OK)
+	{
+		paging_pfree(ppage);
+		return ret;
+	}
+
+	memset((void*)(vpage << 12), 0, 4096);
+
+	#ifndef USE_PAGE_CACHE
+	if(vma->inum
+	&& ext2_read(vma->inum, (void*)(vpage << 12), 4096, off) < 0)
+	{
+		return -EIO;
+	}
+	#endif
+
+	if(vma->inum || !(vma->prot & PROT_WRITE))
+	{
+		paging_set_flags(vpage, 0, PAGING_RW);
+	}
+
+	return OK;
+}
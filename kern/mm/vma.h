@@ -0,0 +1,62 @@
+#ifndef _VMA_H_
+#define _VMA_H_
+
+#include <config.h>
+#include <kernel/types.h>
+
+/** Memory region of a process (created by mmap). **/
+
+struct vm_area
+{
+	bool_t used;
+	ui32_t start, end; // page-aligned, end excluded
+	ui32_t prot;
+	ino_t file; // reference to the file table (mmap), 0 if none
+	ui32_t inum; // ext2 inode of file regions, 0 for anonymous ones
+	off_t off; // offset in the file of the first page
+};
+
+/** Protection flags. **/
+
+#define PROT_NONE	0x0
+#define PROT_READ	0x1
+#define PROT_WRITE	0x2
+#define PROT_EXEC	0x4
+
+/** Mapping flags. **/
+
+#define MAP_SHARED	0x01
+#define MAP_PRIVATE	0x02
+#define MAP_FIXED	0x10
+#define MAP_ANONYMOUS	0x20
+
+#define MAP_FAILED	((void*)-1)
+
+/** Functions **/
+
+struct vm_area *vma_find(ui32_t addr);
+/****************************************************************/
+ret_t vma_split(ui32_t addr);
+/****************************************************************/
+ui32_t vma_find_gap(size_t len);
+/****************************************************************/
+ret_t vma_add(ui32_t start,
+              ui32_t end,
+              ui32_t prot,
+              ino_t file,
+              ui32_t inum,
+              off_t off);
+/****************************************************************/
+void vma_release_pages(ui32_t start, ui32_t end);
+/****************************************************************/
+ret_t vma_unmap(ui32_t start, ui32_t end);
+/****************************************************************/
+ret_t vma_protect(ui32_t start, ui32_t end, ui32_t prot);
+/****************************************************************/
+void vma_clear();
+/****************************************************************/
+void vma_fork(struct vm_area *son_vmas);
+/****************************************************************/
+ret_t vma_fault(ui32_t vpage, ui32_t error_code);
+
+#endif
@@ -11,6 +11,7 @@
 #include <kernel/libc.h>
 #include <kernel/panic.h>
 #include <kernel/printk.h>
+#include <kernel/timer.h>
 #include <net/endian.h>
 #include <net/ether.h>
 #include <net/tcp.h>
@@ -20,8 +21,7 @@
 
 struct ip_buffer buf_tab[NR_IP_BUF] = {
 	{
-		.used = 0,
-		.date = 0
+		.used = 0
 	}
 };
 
@@ -34,7 +34,6 @@ void ip_receive(struct ip_header *frag, size_t size)
 	ui16_t checksum = frag->checksum;
 	ui16_t frag_start, frag_end;
 	ui32_t buf_id;
-	ui32_t packet_delay;
 	struct ip_buffer *buf = 0;
 	struct ip_hole *hole, *prev_hole, *new_hole;
 	ui16_t old_hole_end, next_hole;
@@ -133,24 +132,16 @@ void ip_receive(struct ip_header *frag, size_t size)
 			break;
 		}
 
-		/** TODO: Use appropriate TTL instead of IP_DELAY **/
+		/** Buffers of incomplete packets are freed by their timer
+		    after IP_DELAY seconds. **/
 
-		packet_delay = (tics - buf_tab[buf_id].date) / CLK_FREQ;
-
-		if(!buf && (!buf_tab[buf_id].used || packet_delay > IP_DELAY))
+		if(!buf && !buf_tab[buf_id].used)
 		{
 			buf = &buf_tab[buf_id];
 
 			#ifdef DEBUG
-			if(buf_tab[buf_id].used)
-			{
-				printk("dropping packet %x\n", buf - buf_tab);
-			}
-
 			printk("choosing buffer %x\n", buf - buf_tab);
 			#endif
-
-			buf->used = 0;
 		}
 	}
 
@@ -250,7 +241,7 @@ void ip_receive(struct ip_header *frag, size_t size)
 					       buf - buf_tab);
 					#endif
 
-					buf->used = 0;
+					ip_buffer_free(buf);
 
 					return;
 				}
@@ -283,7 +274,7 @@ void ip_receive(struct ip_header *frag, size_t size)
 					       buf - buf_tab);
 					#endif
 
-					buf->used = 0;
+					ip_buffer_free(buf);
 
 					return;
 				}
@@ -329,7 +320,10 @@ void ip_receive(struct ip_header *frag, size_t size)
 		/** Initialize the buffer. **/
 
 		buf->used = 1;
-		buf->date = tics;
+		timer_add(&buf->timer,
+		          tics + IP_DELAY * CLK_FREQ,
+		          ip_buffer_timeout,
+		          (ui32_t)buf);
 		buf->first_hole = 0;
 		buf->id = frag->id;
 		buf->proto = frag->proto;
@@ -358,7 +352,7 @@ void ip_receive(struct ip_header *frag, size_t size)
 				printk("not enough room for hole\n");
 				#endif
 
-				buf->used = 0;
+				ip_buffer_free(buf);
 
 				return;
 			}
@@ -380,7 +374,7 @@ void ip_receive(struct ip_header *frag, size_t size)
 				printk("pkt %x is too big\n", buf - buf_tab);
 				#endif
 
-				buf->used = 0;
+				ip_buffer_free(buf);
 
 				return;
 			}
@@ -393,7 +387,7 @@ void ip_receive(struct ip_header *frag, size_t size)
 				printk("not enough room for hole\n");
 				#endif
 
-				buf->used = 0;
+				ip_buffer_free(buf);
 
 				return;
 			}
@@ -455,10 +449,37 @@ void ip_receive(struct ip_header *frag, size_t size)
 				break;
 		}
 
-		buf->used = 0;
+		ip_buffer_free(buf);
 	}
 }
 
+/**
+ * ip_buffer_free
+ */
+
+void ip_buffer_free(struct ip_buffer *buf)
+{
+	timer_cancel(&buf->timer);
+	buf->used = 0;
+}
+
+/**
+ * ip_buffer_timeout
+ *
+ *   Drops a packet whose fragments did not all arrive in time.
+ */
+
+void ip_buffer_timeout(ui32_t data)
+{
+	struct ip_buffer *buf = (struct ip_buffer*)data;
+
+	#ifdef DEBUG
+	printk("dropping packet %x\n", buf - buf_tab);
+	#endif
+
+	ip_buffer_free(buf);
+}
+
 /**
  * ip_send
  */
@@ -516,26 +537,155 @@ ret_t ip_send(void *data,
 }
 
 /**
- * ip_checksum
+ * ip_sum
+ *
+ *   Adds the bytes to a partial Internet checksum (RFC 1071). The words are
+ *   summed 32 bits at a time into a 64-bit accumulator, whose carries are
+ *   folded back at the end, since the ones' complement sum does not depend on
+ *   the word size.
  */
 
-ui16_t ip_checksum(ui16_t *data, size_t size)
+ui32_t ip_sum(void *data, size_t size, ui32_t sum)
 {
-	ui32_t accum = 0;
+	ui64_t accum = sum;
+	ui32_t *word = data;
+
+	while(size >= 16)
+	{
+		accum += word[0];
+		accum += word[1];
+		accum += word[2];
+		accum += word[3];
+		word += 4;
+		size -= 16;
+	}
 
-	while(size > 1)
+	while(size >= 4)
 	{
-		accum += *data++;
+		accum += *word++;
+		size -= 4;
+	}
+
+	if(size >= 2)
+	{
+		accum += *(ui16_t*)word;
+		word = (void*)word + 2;
 		size -= 2;
 	}
 
 	if(size)
 	{
-		accum += *(ui8_t*)data;
+		accum += *(ui8_t*)word;
 	}
 
-	accum = (accum >> 16) + (accum & 0xffff);
-	accum = (accum >> 16) + accum;
+	accum = (accum >> 32) + (accum & 0xffffffff);
+	accum = (accum >> 32) + (accum & 0xffffffff);
 
-	return (ui16_t)~accum;
-};
+	return (ui32_t)accum;
+}
+
+/**
+ * ip_copy_sum
+ *
+ *   Copies the bytes and adds them to a partial checksum, in a single pass
+ *   over them.
+ */
+
+ui32_t ip_copy_sum(void *dest, void *src, size_t size, ui32_t sum)
+{
+	ui64_t accum = sum;
+	ui32_t *to = dest, *from = src, w0, w1, w2, w3;
+
+	while(size >= 16)
+	{
+		w0 = from[0];
+		w1 = from[1];
+		w2 = from[2];
+		w3 = from[3];
+		to[0] = w0;
+		to[1] = w1;
+		to[2] = w2;
+		to[3] = w3;
+		accum += w0;
+		accum += w1;
+		accum += w2;
+		accum += w3;
+		from += 4;
+		to += 4;
+		size -= 16;
+	}
+
+	while(size >= 4)
+	{
+		w0 = *from++;
+		*to++ = w0;
+		accum += w0;
+		size -= 4;
+	}
+
+	if(size >= 2)
+	{
+		*(ui16_t*)to = *(ui16_t*)from;
+		accum += *(ui16_t*)from;
+		to = (void*)to + 2;
+		from = (void*)from + 2;
+		size -= 2;
+	}
+
+	if(size)
+	{
+		*(ui8_t*)to = *(ui8_t*)from;
+		accum += *(ui8_t*)from;
+	}
+
+	accum = (accum >> 32) + (accum & 0xffffffff);
+	accum = (accum >> 32) + (accum & 0xffffffff);
+
+	return (ui32_t)accum;
+}
+
+/**
+ * ip_sum_add
+ *
+ *   Adds the partial sum of a block starting off bytes into the data: if off
+ *   is odd, the bytes of the block were summed in the wrong halves of the
+ *   words.
+ */
+
+ui32_t ip_sum_add(ui32_t sum, ui32_t part, size_t off)
+{
+	part = (part >> 16) + (part & 0xffff);
+	part = (part >> 16) + (part & 0xffff);
+
+	if(off & 1)
+	{
+		part = ((part & 0xff) << 8) | (part >> 8);
+	}
+
+	sum += part;
+
+	return sum + (sum < part);
+}
+
+/**
+ * ip_sum_fold
+ *
+ *   Returns the checksum of a partial sum.
+ */
+
+ui16_t ip_sum_fold(ui32_t sum)
+{
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + sum;
+
+	return (ui16_t)~sum;
+}
+
+/**
+ * ip_checksum
+ */
+
+ui16_t ip_checksum(ui16_t *data, size_t size)
+{
+	return ip_sum_fold(ip_sum(data, size, 0));
+}
@@ -1,6 +1,7 @@
 #ifndef _IP_H_
 #define _IP_H_
 
+#include <kernel/timer.h>
 #include <kernel/types.h>
 
 /** IP header structure. **/
@@ -40,14 +41,13 @@ struct ip_hole
 struct ip_buffer
 {
 	bool_t used;
-	ui32_t date;
+	struct timer timer; // drops the packet if it is not complete in time
 	ui32_t id;
 	ui8_t proto;
 	ui32_t source_ip;
 	ui32_t dest_ip;
 	size_t size;
 	struct ip_hole *first_hole;
-	ui8_t checksum[12]; // reserved for calculating TCP checksum
 	ui8_t data[IP_BUF_SIZE];
 };
 
@@ -83,6 +83,10 @@ extern ui32_t net_mask;
 
 void ip_receive(struct ip_header *frag, size_t size);
 /****************************************************************/
+void ip_buffer_free(struct ip_buffer *buf);
+/****************************************************************/
+void ip_buffer_timeout(ui32_t data);
+/****************************************************************/
 ret_t ip_send(void *data,
               size_t size,
               ui8_t proto,
@@ -90,6 +94,14 @@ ret_t ip_send(void *data,
               ui32_t dest_ip,
               ui16_t flags);
 /****************************************************************/
+ui32_t ip_sum(void *data, size_t size, ui32_t sum);
+/****************************************************************/
+ui32_t ip_copy_sum(void *dest, void *src, size_t size, ui32_t sum);
+/****************************************************************/
+ui32_t ip_sum_add(ui32_t sum, ui32_t part, size_t off);
+/****************************************************************/
+ui16_t ip_sum_fold(ui32_t sum);
+/****************************************************************/
 ui16_t ip_checksum(ui16_t *data, size_t size); // size in bytes
 
 #endif
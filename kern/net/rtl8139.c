@@ -13,6 +13,7 @@
 #include <kernel/panic.h>
 #include <net/ether.h>
 #include <net/pci.h>
+#include <net/tcp.h>
 
 #include "rtl8139.h"
 
@@ -183,6 +184,19 @@ void rtl8139_reset()
 	free_tx_desc = 4;
 }
 
+/**
+ * rtl8139_tx_buf
+ *
+ *   Returns the buffer of the next free transmit descriptor (0 if there is
+ *   none): a frame built in it is sent without being copied. It stays free
+ *   until rtl8139_send takes it.
+ */
+
+ui8_t *rtl8139_tx_buf()
+{
+	return free_tx_desc ? tx_desc[cur_tx_desc].buf : 0;
+}
+
 /**
  * rtl8139_send
  */
@@ -210,14 +224,19 @@ ret_t rtl8139_send(ui8_t *packet, size_t packet_len)
 
 	/** Check packet length. **/
 
-	if(packet_len > 1516)
+	if(packet_len > RTL8139_TX_BUF_SIZE)
 	{
 		return -EINVAL;
 	}
 
-	/** Fill the current TX descriptor. **/
+	/** Fill the current TX descriptor, unless the packet was built in it
+	    (see rtl8139_tx_buf). **/
+
+	if(packet != tx_desc[cur_tx_desc].buf)
+	{
+		memcpy(tx_desc[cur_tx_desc].buf, packet, packet_len);
+	}
 
-	memcpy(tx_desc[cur_tx_desc].buf, packet, packet_len);
 	tx_desc[cur_tx_desc].packet_len = (ui16_t)packet_len;
 
 	/** Issue it. **/
@@ -324,6 +343,7 @@ void rtl8139_rx_isr()
 void rtl8139_tx_isr()
 {
 	ui32_t tsd;
+	count_t freed = 0;
 
 	while(( (tsd = inl(io_base + TSD_BASE + (first_tx_desc << 2))) & TSD_TOK)
 	    && (tsd & TSD_OWN)
@@ -334,6 +354,14 @@ void rtl8139_tx_isr()
 		#endif
 		first_tx_desc = (first_tx_desc + 1) % 4;
 		free_tx_desc++;
+		freed++;
+	}
+
+	/** Send what was waiting for a descriptor. **/
+
+	if(freed)
+	{
+		tcp_output_all();
 	}
 
 	/*#ifdef DEBUG_RTL8139
@@ -355,6 +383,8 @@ void rtl8139_isr()
 	printk("\nnetwork card interrupt (isr: %x) at tic %x\n", isr, tics);
 	#endif
 
+	spin_lock(&tcp_lock);
+
 	/** Check transmission state. **/
 
 	if(isr & (IR_TOK | IR_TER))
@@ -411,6 +441,8 @@ void rtl8139_isr()
 		outw(io_base + ISR, IR_ROK | IR_RER | IR_RXOVW | IR_FOVW);
 	}
 
+	spin_unlock(&tcp_lock);
+
 	#ifdef DEBUG_RTL8139
 	printk("\n");
 	#endif
@@ -5,9 +5,11 @@
 
 /** Transmit decriptor structure **/
 
+#define RTL8139_TX_BUF_SIZE	(16 + 1500)
+
 struct rtl8139_tx_desc
 {
-	ui8_t buf[16 + 1500] __attribute__((aligned(4)));
+	ui8_t buf[RTL8139_TX_BUF_SIZE] __attribute__((aligned(4)));
 	ui16_t packet_len;
 };
 
@@ -77,6 +79,8 @@ void rtl8139_init();
 /****************************************************************/
 void rtl8139_reset();
 /****************************************************************/
+ui8_t *rtl8139_tx_buf();
+/****************************************************************/
 ret_t rtl8139_send(ui8_t *packet, size_t packet_len);
 /****************************************************************/
 void rtl8139_rx_isr();
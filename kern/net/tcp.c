@@ -10,12 +10,16 @@
 #include <config.h>
 #include <fs/file.h>
 #include <kernel/errno.h>
+#include <kernel/hrtimer.h>
 #include <kernel/int.h>
 #include <kernel/isr.h>
 #include <kernel/libc.h>
 #include <kernel/panic.h>
 #include <kernel/printk.h>
 #include <kernel/libc.h>
+#include <kernel/timer.h>
+#include <kernel/wait.h>
+#include <mm/paging.h>
 #include <net/endian.h>
 #include <net/ip.h>
 #include <net/rtl8139.h>
@@ -31,12 +35,12 @@ void tcp_socket_init(struct tcp_socket *sock)
 {
 	sock->used = 1;
 	sock->reuse_addr = 0;
+	sock->nodelay = 0;
 
 	/** State/timeouts. **/
 
 	sock->state = TCP_CLOSED;
-	sock->timeout_set_tics = tics;
-	sock->timeout_tics = tics;
+	timer_cancel(&sock->timer);
 	sock->try_cnt = 0;
 
 	/** Connection opening/closing. **/
@@ -47,6 +51,8 @@ void tcp_socket_init(struct tcp_socket *sock)
 
 	/** Local/remote host info. **/
 
+	tcp_unhash(sock);
+	tcp_port_unbind(sock);
 	sock->source_ip = 0;
 	sock->dest_ip = 0;
 	sock->source_port = 0;
@@ -59,6 +65,7 @@ void tcp_socket_init(struct tcp_socket *sock)
 	sock->fss = 0;
 	sock->snd_una = 0;
 	sock->snd_nxt = 0;
+	sock->snd_out = 0;
 	sock->snd_wl1 = 0;
 	sock->snd_wl2 = 0;
 	sock->snd_wnd = 0;
@@ -66,766 +73,2487 @@ void tcp_socket_init(struct tcp_socket *sock)
 	sock->rcv_nxt = 0;
 	sock->rcv_wnd = 0;
 
-	/** Stats. **/
+	/** Options: offer them all, with the window scale that lets the
+	    largest receive buffer be advertised. **/
 
-	sock->rtt = CLK_FREQ / 5;
-	sock->vrtt = CLK_FREQ / 20;
-	sock->buffer_timeout = sock->rtt + 4 * sock->vrtt;
+	sock->mss = TCP_DEF_MSS;
+	sock->wscale_ok = 1;
+	sock->snd_wscale = 0;
+
+	for(sock->rcv_wscale = 0;
+	    (TCP_RCVBUF_MAX >> sock->rcv_wscale) > 0xffff;
+	    sock->rcv_wscale++);
+
+	sock->ts_ok = 1;
+	sock->ts_recent = 0;
+
+	/** Stats (RFC 6298, 2.1). **/
+
+	sock->srtt = 0;
+	sock->rttvar = 0;
+	sock->rtt_timing = 0;
+	sock->rto = CLK_FREQ;
+
+	/** Congestion control. **/
+
+	sock->snd_max = 0;
+	sock->cwnd = TCP_INIT_CWND * sock->mss;
+	sock->ssthresh = TCP_SSTHRESH;
+	sock->dup_acks = 0;
+	sock->recovery = 0;
+	sock->recover = 0;
 
 	/** Buffers. **/
 
 	tcp_buffers_reset(sock);
-	sock->req_head = sock->req_tail = 0;
-	sock->free_req = TCP_REQ_PER_SOCK;
+	tcp_tx_unwait(sock);
+
+	/** Passive opening. **/
+
+	sock->parent = 0;
+	sock->queue_next = 0;
+	sock->accept_ready = 0;
+	sock->syn_date = 0;
+	sock->syn_queue = 0;
+	sock->accept_head = sock->accept_tail = 0;
+	sock->syn_cnt = sock->accept_cnt = 0;
+	sock->backlog = 0;
 }
 
 /**
  * tcp_buffers_reset
+ *
+ *   Drops the data received and the data to send.
  */
 
 void tcp_buffers_reset(struct tcp_socket *sock)
 {
-	ui32_t i;
+	fifo_init(&sock->rx_fifo, sock->rx_fifo.rbuf, sock->rx_fifo.size);
+	sock->rcv_wnd = sock->rx_fifo.rbuf ? sock->rx_fifo.size : 0;
+	sock->ooo_cnt = 0;
+
+	fifo_init(&sock->tx_fifo, sock->tx_fifo.rbuf, sock->tx_fifo.size);
+	timer_cancel(&sock->rto_timer);
+	sock->rto_cnt = 0;
+	sock->rexmit = 0;
+	sock->rexmit_sum_size = 0;
+}
+
+/**
+ * tcp_fifo_resize
+ *
+ *   Moves a socket buffer to a ring of at least size bytes (rounded up to a
+ *   power of two, from min_size to max_size), keeping the bytes it holds. A
+ *   buffer without a ring (see tcp_buffers_attach) only takes the size.
+ */
 
-	fifo_flush(&sock->rx_fifo);
+ret_t tcp_fifo_resize(struct fifo *fifo,
+                      size_t size,
+                      size_t min_size,
+                      size_t max_size)
+{
+	size_t new_size = min_size, count;
+	ui8_t *rbuf;
+	ui32_t vpage;
 
-	for(i = 0; i < TCP_BUF_PER_SOCK; i++)
+	if(size > max_size)
 	{
-		sock->buf_tab[i].state = TCP_FREE;
+		return -EINVAL;
 	}
 
-	sock->buf_head = sock->buf_tail = 0;
-	sock->free_buf = TCP_BUF_PER_SOCK;
-}
+	while(new_size < size)
+	{
+		new_size <<= 1;
+	}
 
-/**
- * tcp_socket_alloc
- */
+	if(new_size == fifo->size)
+	{
+		return OK;
+	}
 
-si32_t tcp_socket_alloc()
-{
-	si32_t sock_id;
+	if(!fifo->rbuf)
+	{
+		fifo->size = new_size;
+		return OK;
+	}
 
-	for(sock_id = 0; sock_id < NR_TCP_SOCKS; sock_id++)
+	count = fifo_count(fifo);
+
+	if(count > new_size)
 	{
-		if(tcp_sock_tab[sock_id].state == TCP_CLOSED
-		&& !tcp_sock_tab[sock_id].used)
-		{
-			tcp_socket_init(&tcp_sock_tab[sock_id]);
+		return -EBUSY;
+	}
 
-			return sock_id;
-		}
+	vpage = paging_valloc_range(new_size >> 12);
+
+	if(!vpage)
+	{
+		return -ENOMEM;
+	}
+
+	/** The network stack is locked: nothing uses the ring while it is
+	    moved. **/
+
+	rbuf = (void*)(vpage << 12);
+
+	if(fifo_read(fifo, rbuf, count, 0) != count)
+	{
+		panic("socket buffer corrupted");
+	}
+
+	if(fifo->rbuf)
+	{
+		paging_vfree_range((ui32_t)fifo->rbuf >> 12, fifo->size >> 12);
 	}
 
-	return -1;
+	fifo->rbuf = rbuf;
+	fifo->size = new_size;
+	fifo->tail = 0;
+	fifo->head = count;
+
+	return OK;
 }
 
 /**
- * tcp_socket_free
+ * tcp_sndbuf_resize
  */
 
-void tcp_socket_free(si32_t sock_id)
+ret_t tcp_sndbuf_resize(struct tcp_socket *sock, size_t size)
 {
-	if(!tcp_sock_tab[sock_id].used)
-	{
-		panic("socket %x already freed or unused", sock_id);
-	}
-
-	tcp_sock_tab[sock_id].used = 0;
+	return tcp_fifo_resize(&sock->tx_fifo,
+	                       size,
+	                       TCP_SNDBUF_MIN,
+	                       TCP_SNDBUF_MAX);
 }
 
 /**
- * tcp_port_is_used
+ * tcp_rcvbuf_resize
+ *
+ *   The out of order data is dropped: the remote host will send it again.
  */
 
-bool_t tcp_port_is_used(ui16_t port)
+ret_t tcp_rcvbuf_resize(struct tcp_socket *sock, size_t size)
 {
-	si32_t sock_id;
-	struct tcp_socket *sock;
+	ret_t ret = tcp_fifo_resize(&sock->rx_fifo,
+	                            size,
+	                            TCP_RCVBUF_MIN,
+	                            TCP_RCVBUF_MAX);
 
-	for(sock_id = 0; sock_id < NR_TCP_SOCKS; sock_id++)
+	if(ret == OK)
 	{
-		sock = &tcp_sock_tab[sock_id];
-
-		if((sock->used || sock->state != TCP_CLOSED)
-		&& (sock->source_ip || !sock->reuse_addr)
-		&& sock->source_port == port)
-		{
-			return 1;
-		}
+		sock->ooo_cnt = 0;
+		sock->rcv_wnd = sock->rx_fifo.rbuf ? fifo_left(&sock->rx_fifo) : 0;
 	}
 
-	return 0;
+	return ret;
 }
 
 /**
- * tcp_port_alloc
+ * tcp_buffers_attach
+ *
+ *   Gives their rings to the buffers of a socket about to connect: until
+ *   then, and once the socket is released, the buffers only have a size.
  */
 
-ui16_t tcp_port_alloc()
+ret_t tcp_buffers_attach(struct tcp_socket *sock)
 {
-	ui16_t port;
+	ui32_t rx_vpage = 0, tx_vpage = 0;
 
-	for(port = 1024; port; port++)
+	if(!sock->rx_fifo.rbuf)
 	{
-		if(!tcp_port_is_used(port))
+		rx_vpage = paging_valloc_range(sock->rx_fifo.size >> 12);
+
+		if(!rx_vpage)
 		{
-			return port;
+			return -ENOMEM;
 		}
 	}
 
-	return 0;
-}
+	if(!sock->tx_fifo.rbuf)
+	{
+		tx_vpage = paging_valloc_range(sock->tx_fifo.size >> 12);
 
-/**
- * tcp_find_socket
- */
+		if(!tx_vpage)
+		{
+			if(rx_vpage)
+			{
+				paging_vfree_range(rx_vpage,
+				                   sock->rx_fifo.size >> 12);
+			}
 
-struct tcp_socket *tcp_find_socket(ui32_t source_ip,
-                                   ui16_t source_port,
-                                   ui16_t dest_port)
-{
-	si32_t sock_id;
-	struct tcp_socket *sock = 0, *tmp_sock;
+			return -ENOMEM;
+		}
+	}
 
-	for(sock_id = 0; sock_id < NR_TCP_SOCKS; sock_id++)
+	if(rx_vpage)
 	{
-		tmp_sock = &tcp_sock_tab[sock_id];
+		sock->rx_fifo.rbuf = (void*)(rx_vpage << 12);
+	}
 
-		if((tmp_sock->source_port == dest_port)
-		&& (tmp_sock->state == TCP_LISTEN
-		    ||  (tmp_sock->dest_ip == source_ip
-		      && tmp_sock->dest_port == source_port))
-		&& (tmp_sock->used || tmp_sock->state != TCP_CLOSED)
-		&& (!sock || !sock->source_ip))
-		{
-			sock = &tcp_sock_tab[sock_id];
-		}
+	if(tx_vpage)
+	{
+		sock->tx_fifo.rbuf = (void*)(tx_vpage << 12);
 	}
 
-	return sock;
+	tcp_buffers_reset(sock);
+
+	return OK;
 }
 
 /**
- * tcp_set_socket_state
+ * tcp_buffers_detach
  */
 
-void tcp_set_socket_state(struct tcp_socket *sock,
-                          sock_state_t state,
-                          clock_t timeout)
+void tcp_buffers_detach(struct tcp_socket *sock)
 {
-	if(state != sock->state)
+	if(sock->rx_fifo.rbuf)
 	{
-		sock->try_cnt = 0;
+		paging_vfree_range((ui32_t)sock->rx_fifo.rbuf >> 12,
+		                   sock->rx_fifo.size >> 12);
+		sock->rx_fifo.rbuf = 0;
 	}
 
-	sock->state = state;
-	sock->timeout_set_tics = tics;
-	sock->timeout_tics = tics + timeout;
-
-	if(state == TCP_SYN_SENT)
+	if(sock->tx_fifo.rbuf)
 	{
-		sock->active_open = 1;
+		paging_vfree_range((ui32_t)sock->tx_fifo.rbuf >> 12,
+		                   sock->tx_fifo.size >> 12);
+		sock->tx_fifo.rbuf = 0;
 	}
+
+	tcp_buffers_reset(sock);
 }
 
 /**
- * tcp_set_buffer_state
+ * tcp_socket_grow
+ *
+ *   Adds a page of sockets to the table and to the free list. Called by
+ *   processes only.
  */
 
-void tcp_set_buffer_state(struct tcp_socket *sock,
-                          struct tcp_buffer *buf,
-                          buf_state_t state)
+ret_t tcp_socket_grow()
 {
-	if(state == TCP_FREE)
+	struct tcp_socket *sock;
+	ui32_t vpage;
+	count_t i;
+
+	if(nr_tcp_socks >= NR_TCP_SOCKS)
 	{
-		if(buf->state == TCP_FREE)
-		{
-			panic("free buffer freed again");
-		}
+		return -ENOMEM;
+	}
+
+	vpage = paging_valloc_range(1);
 
-		sock->free_buf++;
+	if(!vpage)
+	{
+		return -ENOMEM;
 	}
 
-	if(state != TCP_FREE && buf->state == TCP_FREE)
+	memset((void*)(vpage << 12), 0, 4096);
+	tcp_sock_page_tab[nr_tcp_socks / TCP_SOCKS_PER_PAGE]
+	 = (void*)(vpage << 12);
+
+	/** The sockets with the lowest IDs come first. **/
+
+	for(i = TCP_SOCKS_PER_PAGE; i; i--)
 	{
-		sock->free_buf--;
+		sock = tcp_sock_get(nr_tcp_socks + i - 1);
+		sock->id = nr_tcp_socks + i - 1;
+		sock->state = TCP_CLOSED;
+		sock->hash_next = tcp_free_socks;
+		tcp_free_socks = sock;
 	}
 
-	buf->state = state;
-	buf->state_change_date = tics;
+	nr_tcp_socks += TCP_SOCKS_PER_PAGE;
+	nr_tcp_free_socks += TCP_SOCKS_PER_PAGE;
+
+	return OK;
 }
 
 /**
- * tcp_request_push
+ * tcp_socket_reserve
+ *
+ *   Keeps a free socket for each connection the listening sockets may queue,
+ *   and a free TIME_WAIT record for each socket, so that the interrupt
+ *   handlers never allocate pages. Called by processes only.
  */
 
-ret_t tcp_request_push(struct tcp_socket *sock,
-                       ui32_t source_ip,
-                       ui32_t dest_ip,
-                       ui16_t source_port,
-                       ui16_t dest_port,
-                       ui32_t irs)
+void tcp_socket_reserve()
 {
-	struct tcp_request *req = &sock->req_tab[sock->req_tail];
+	while(nr_tcp_free_socks < nr_tcp_backlogs && tcp_socket_grow() == OK);
 
-	#ifdef DEBUG_TCP
-	printk("request from %x:%x for socket %x (free req: %x)\n",
-	       source_ip, source_port, sock - tcp_sock_tab, sock->free_req);
-	#endif
+	tcp_timewait_reserve();
+}
+
+/**
+ * tcp_socket_take
+ *
+ *   Takes a socket from the free list, without adding pages to it (0 if it
+ *   is empty). Its buffers have a size but no ring.
+ */
+
+struct tcp_socket *tcp_socket_take()
+{
+	struct tcp_socket *sock = tcp_free_socks;
 
-	if(!sock->free_req)
+	if(!sock)
 	{
-		return -ENOMEM;
+		return 0;
 	}
 
-	req->source_ip = source_ip;
-	req->dest_ip = dest_ip;
-	req->source_port = source_port;
-	req->dest_port = dest_port;
-	req->irs = irs;
+	tcp_free_socks = sock->hash_next;
+	sock->hash_next = 0;
+	nr_tcp_free_socks--;
+	nr_tcp_used_socks++;
 
-	sock->req_tail = (sock->req_tail + 1) % TCP_REQ_PER_SOCK;
-	sock->free_req--;
+	tcp_socket_init(sock);
+	tcp_sndbuf_resize(sock, TCP_SNDBUF_SIZE);
+	tcp_rcvbuf_resize(sock, TCP_RCVBUF_SIZE);
 
-	return OK;
+	return sock;
 }
 
 /**
- * tcp_request_pop
+ * tcp_socket_alloc
+ *
+ *   Takes a socket from the free list, which a new page of the table fills
+ *   when it is empty. The buffers get their rings when the socket connects.
  */
 
-struct tcp_request *tcp_request_pop(struct tcp_socket *sock)
+si32_t tcp_socket_alloc()
 {
-	struct tcp_request *req = &sock->req_tab[sock->req_head];
+	struct tcp_socket *sock;
 
-	if(sock->free_req == TCP_REQ_PER_SOCK)
+	if(!tcp_free_socks && tcp_socket_grow() != OK)
 	{
-		return 0;
+		return -1;
 	}
 
-	sock->req_head = (sock->req_head + 1) % TCP_REQ_PER_SOCK;
-	sock->free_req++;
+	sock = tcp_socket_take();
+	tcp_socket_reserve();
 
-	return req;
+	return sock->id;
 }
 
 /**
- * tcp_receive
+ * tcp_socket_free
+ *
+ *   The socket is released once it is closed too (see tcp_set_socket_state).
+ *   In TIME_WAIT, a record takes its place.
  */
 
-void tcp_receive(struct tcp_header *packet,
-                 size_t size,
-                 ui32_t source_ip,
-                 ui32_t dest_ip)
+void tcp_socket_free(si32_t sock_id)
 {
-	ui16_t checksum = packet->checksum;
-	ui32_t seq_num = ntohl(packet->seq_num);
-	ui32_t ack_num = ntohl(packet->ack_num);
-	ui16_t source_port = ntohs(packet->source_port);
-	ui16_t dest_port = ntohs(packet->dest_port);
-	size_t data_size = size - 4 * packet->header_size;
-	void *data = (void*)packet + 4 * packet->header_size;
-	struct tcp_socket *sock;
+	struct tcp_socket *sock = tcp_sock_get(sock_id);
 
-	#ifdef DEBUG_TCP
-	printk("\n******************* TCP header dump *******************\n");
-	printk("* source port: %x | dest port: %x\n", source_port, dest_port);
-	printk("* seq num: %x | ack num: %x\n", seq_num, ack_num);
-	printk("* flags: %x | data size: %x\n", packet->flags, data_size);
-	printk("*******************************************************\n\n");
-	#endif
+	if(!sock->used)
+	{
+		panic("socket %x already freed or unused", sock_id);
+	}
+
+	sock->used = 0;
+
+	if(sock->state == TCP_CLOSED)
+	{
+		tcp_socket_release(sock);
+	}
+	else if(sock->state == TCP_TIME_WAIT)
+	{
+		tcp_timewait_enter(sock);
+	}
+}
 
-	/** Verify checksum **/
+/**
+ * tcp_socket_release
+ *
+ *   Releases a socket closed and freed by its user: it leaves the queue of
+ *   its listening socket and the hash tables. It may be released by an
+ *   interrupt handler: a socket with rings goes to the reap list, and only
+ *   gives them back in process context (see tcp_reap).
+ */
 
-	packet->checksum = 0;
-	packet->checksum = tcp_checksum(packet, size, source_ip, dest_ip);
+void tcp_socket_release(struct tcp_socket *sock)
+{
+	tcp_child_unlink(sock);
+	timer_cancel(&sock->timer);
+	tcp_unhash(sock);
+	tcp_port_unbind(sock);
+	tcp_buffers_reset(sock);
+	tcp_tx_unwait(sock);
+	nr_tcp_used_socks--;
 
-	if(packet->checksum != checksum)
+	if(sock->rx_fifo.rbuf || sock->tx_fifo.rbuf)
 	{
-		#ifdef DEBUG_TCP
-		printk("wrong tcp checksum\n");
-		#endif
-		return;
+		sock->hash_next = tcp_reap_socks;
+		tcp_reap_socks = sock;
 	}
+	else
+	{
+		sock->hash_next = tcp_free_socks;
+		tcp_free_socks = sock;
+		nr_tcp_free_socks++;
+	}
+}
 
-	/** Find which socket the segment is targetted to. **/
+/**
+ * tcp_reap
+ *
+ *   Frees the rings of the sockets released and puts them back in the free
+ *   list. Called by processes (see _isr_syscall), tcp_lock held.
+ */
 
-	sock = tcp_find_socket(source_ip, source_port, dest_port);
+void tcp_reap()
+{
+	struct tcp_socket *sock;
 
-	if(!sock)
+	while(tcp_reap_socks)
 	{
-		#ifdef DEBUG_TCP
-		printk("tcp segment dropped: unable to find socket\n");
-		#endif
-		return;
+		sock = tcp_reap_socks;
+		tcp_reap_socks = sock->hash_next;
+		tcp_buffers_detach(sock);
+
+		sock->hash_next = tcp_free_socks;
+		tcp_free_socks = sock;
+		nr_tcp_free_socks++;
 	}
+}
 
-	/** Packet processing here. **/
+/**
+ * tcp_timewait_reserve
+ *
+ *   Keeps a free TIME_WAIT record for each socket in use or reserved for
+ *   the listening sockets, so that records are not allocated when the FIN
+ *   arrives, in an interrupt handler. If the pages run out, a socket in
+ *   TIME_WAIT simply stays.
+ */
 
-	if(sock->state == TCP_CLOSED)
+void tcp_timewait_reserve()
+{
+	struct tcp_timewait *tw;
+	ui32_t vpage;
+	count_t i;
+
+	while(nr_tcp_free_tw < nr_tcp_used_socks + nr_tcp_backlogs
+	   && nr_tcp_tw < NR_TCP_TIMEWAIT)
 	{
-		if(packet->flags & TCP_ACK)
+		vpage = paging_valloc_range(1);
+
+		if(!vpage)
 		{
-			tcp_send(sock, ack_num, 0, 0, 0, TCP_RST);
+			return;
 		}
-		else
+
+		for(i = 0; i < TCP_TW_PER_PAGE; i++)
 		{
-			tcp_send(sock,
-			         0,
-			         seq_num + data_size,
-			         0,
-			         0,
-			         TCP_RST | TCP_ACK);
+			tw = (struct tcp_timewait*)(vpage << 12) + i;
+			tw->next = tcp_free_tw;
+			tcp_free_tw = tw;
 		}
+
+		nr_tcp_tw += TCP_TW_PER_PAGE;
+		nr_tcp_free_tw += TCP_TW_PER_PAGE;
 	}
-	else if(sock->state == TCP_LISTEN)
+}
+
+/**
+ * tcp_timewait_enter
+ *
+ *   Replaces a socket in TIME_WAIT, closed by its user, with a record (see
+ *   tcp_timewait_reserve). The socket stays if there is no record left.
+ */
+
+void tcp_timewait_enter(struct tcp_socket *sock)
+{
+	struct tcp_timewait *tw, **bucket;
+
+	if(!tcp_free_tw)
 	{
-		if(packet->flags & TCP_RST)
-		{
-			/** This is maybe a duplicate of a RST sent to abort
-			    the connection instead of acking our SYN-ACK. **/
-		}
-		else if(packet->flags & TCP_ACK)
-		{
-			tcp_send(sock, ack_num, 0, 0, 0, TCP_RST);
-		}
-		else if(packet->flags & TCP_SYN)
-		{ 
-			if(tcp_request_push(sock,
-			                    source_ip,
-			                    dest_ip,
-			                    source_port,
-			                    dest_port,
-			                    seq_num) != OK)
-			{
-				#ifdef DEBUG_TCP
-				printk("could not push connection request\n");
-				#endif
-			}
-		}
+		return;
 	}
-	else if(sock->state == TCP_SYN_SENT)
+
+	tw = tcp_free_tw;
+	tcp_free_tw = tw->next;
+	nr_tcp_free_tw--;
+
+	tw->source_ip = sock->source_ip;
+	tw->dest_ip = sock->dest_ip;
+	tw->source_port = sock->source_port;
+	tw->dest_port = sock->dest_port;
+	tw->snd_nxt = sock->snd_nxt;
+	tw->rcv_nxt = sock->rcv_nxt;
+	tw->ts_ok = sock->ts_ok;
+	tw->ts_recent = sock->ts_recent;
+	tw->expires = sock->timer.expires;
+
+	bucket = &tcp_tw_hash[tcp_conn_hashfn(tw->dest_ip,
+	                                      tw->dest_port,
+	                                      tw->source_port)];
+	tw->hash_next = *bucket;
+	*bucket = tw;
+	tcp_timewait_queue(tw);
+
+	tcp_set_socket_state(sock, TCP_CLOSED, 0);
+}
+
+/**
+ * tcp_timewait_queue
+ *
+ *   Inserts a record in the expiry list, from its end since the records
+ *   mostly come in expiry order.
+ */
+
+void tcp_timewait_queue(struct tcp_timewait *tw)
+{
+	struct tcp_timewait *prev = tcp_tw_tail;
+
+	while(prev && prev->expires > tw->expires)
 	{
-		if(packet->flags & TCP_ACK)
-		{
-			/** The packet has an acknowledgement number. **/
+		prev = prev->prev;
+	}
 
-			if(ack_num == sock->iss + 1)
-			{
-				/** Our SYN is acknowledged. **/
+	tw->prev = prev;
+	tw->next = prev ? prev->next : tcp_tw_head;
 
-				if(packet->flags & TCP_RST)
-				{
-					tcp_set_socket_state(sock,
-					               TCP_CLOSED,
-					                        0);
-					sock->reset = 1;
-					tcp_buffers_reset(sock);
-				}
-				else if(packet->flags & TCP_SYN)
-				{
-					sock->irs = seq_num;
+	if(tw->next)
+	{
+		tw->next->prev = tw;
+	}
+	else
+	{
+		tcp_tw_tail = tw;
+	}
+
+	if(prev)
+	{
+		prev->next = tw;
+	}
+	else
+	{
+		tcp_tw_head = tw;
+		timer_add(&tcp_tw_timer, tw->expires, tcp_timewait_timeout, 0);
+	}
+}
+
+/**
+ * tcp_timewait_unqueue
+ */
+
+void tcp_timewait_unqueue(struct tcp_timewait *tw)
+{
+	if(tw->prev)
+	{
+		tw->prev->next = tw->next;
+	}
+	else
+	{
+		tcp_tw_head = tw->next;
+	}
+
+	if(tw->next)
+	{
+		tw->next->prev = tw->prev;
+	}
+	else
+	{
+		tcp_tw_tail = tw->prev;
+	}
+}
+
+/**
+ * tcp_timewait_free
+ */
+
+void tcp_timewait_free(struct tcp_timewait *tw)
+{
+	struct tcp_timewait **prev;
+
+	prev = &tcp_tw_hash[tcp_conn_hashfn(tw->dest_ip,
+	                                    tw->dest_port,
+	                                    tw->source_port)];
+
+	for(; *prev != tw; prev = &(*prev)->hash_next)
+	{
+		if(!*prev)
+		{
+			panic("time wait record %x not in its hash chain",
+			      (ui32_t)tw);
+		}
+	}
+
+	*prev = tw->hash_next;
+	tcp_timewait_unqueue(tw);
+
+	tw->next = tcp_free_tw;
+	tcp_free_tw = tw;
+	nr_tcp_free_tw++;
+}
+
+/**
+ * tcp_timewait_find
+ */
+
+struct tcp_timewait *tcp_timewait_find(ui32_t source_ip,
+                                       ui16_t source_port,
+                                       ui16_t dest_port)
+{
+	struct tcp_timewait *tw;
+
+	tw = tcp_tw_hash[tcp_conn_hashfn(source_ip, source_port, dest_port)];
+
+	for(; tw; tw = tw->hash_next)
+	{
+		if(tw->source_port == dest_port
+		&& tw->dest_ip == source_ip
+		&& tw->dest_port == source_port)
+		{
+			return tw;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * tcp_timewait_receive
+ *
+ *   Handles a segment of a connection in TIME_WAIT: a retransmitted FIN is
+ *   acknowledged again and restarts the wait, a RST is ignored (RFC 1337). A
+ *   SYN past the last sequence number received opens a new connection (RFC
+ *   1122, 4.2.2.13): the record goes, and 0 is returned for the listening
+ *   socket to take the segment.
+ */
+
+bool_t tcp_timewait_receive(struct tcp_timewait *tw,
+                            struct tcp_header *packet,
+                            ui32_t seq_num,
+                            size_t data_size)
+{
+	static struct tcp_socket sock;
+
+	if(packet->flags & TCP_RST)
+	{
+		return 1;
+	}
+
+	if((packet->flags & TCP_SYN)
+	&& !(packet->flags & TCP_ACK)
+	&& mod2pow32_compare(seq_num, tw->rcv_nxt) > 0)
+	{
+		tcp_timewait_free(tw);
+		return 0;
+	}
+
+	/** Do not answer a bare ACK, which may be an answer too. **/
+
+	if(!(packet->flags & (TCP_SYN | TCP_FIN)) && !data_size)
+	{
+		return 1;
+	}
+
+	if(packet->flags & TCP_FIN)
+	{
+		tcp_timewait_unqueue(tw);
+		tw->expires = tics + TCP_SOCK_DELAY;
+		tcp_timewait_queue(tw);
+	}
+
+	/** tcp_send only needs the addresses and the options. **/
+
+	sock.source_ip = tw->source_ip;
+	sock.dest_ip = tw->dest_ip;
+	sock.source_port = tw->source_port;
+	sock.dest_port = tw->dest_port;
+	sock.ts_ok = tw->ts_ok;
+	sock.ts_recent = tw->ts_recent;
+	tcp_send(&sock, tw->snd_nxt, tw->rcv_nxt, 0, 0, TCP_ACK);
+
+	return 1;
+}
+
+/**
+ * tcp_timewait_timeout
+ */
+
+void tcp_timewait_timeout(ui32_t data)
+{
+	while(tcp_tw_head && tcp_tw_head->expires <= tics)
+	{
+		tcp_timewait_free(tcp_tw_head);
+	}
+
+	if(tcp_tw_head)
+	{
+		timer_add(&tcp_tw_timer,
+		          tcp_tw_head->expires,
+		          tcp_timewait_timeout,
+		          0);
+	}
+}
+
+/**
+ * tcp_hash
+ *
+ *   Puts a socket in the chain of the listening socket table for its local
+ *   port, or in the chain of the connection table for its remote address and
+ *   port and its local port.
+ */
+
+void tcp_hash(struct tcp_socket *sock)
+{
+	struct tcp_socket **bucket;
+	struct tcp_timewait *tw;
+
+	if(sock->state == TCP_LISTEN)
+	{
+		bucket = &tcp_listen_hash[sock->source_port
+		                          % TCP_LISTEN_HASH_SIZE];
+	}
+	else
+	{
+		bucket = &tcp_conn_hash[tcp_conn_hashfn(sock->dest_ip,
+		                                        sock->dest_port,
+		                                        sock->source_port)];
+
+		/** The connection replaces an older one in TIME_WAIT. **/
+
+		tw = tcp_timewait_find(sock->dest_ip,
+		                       sock->dest_port,
+		                       sock->source_port);
+
+		if(tw)
+		{
+			tcp_timewait_free(tw);
+		}
+	}
+
+	tcp_unhash(sock);
+	sock->hash_next = *bucket;
+	sock->hash_bucket = bucket;
+	*bucket = sock;
+}
+
+/**
+ * tcp_unhash
+ */
+
+void tcp_unhash(struct tcp_socket *sock)
+{
+	struct tcp_socket **prev;
+
+	if(!sock->hash_bucket)
+	{
+		return;
+	}
+
+	for(prev = sock->hash_bucket; *prev != sock; prev = &(*prev)->hash_next)
+	{
+		if(!*prev)
+		{
+			panic("socket %x not in its hash chain", (ui32_t)sock);
+		}
+	}
+
+	*prev = sock->hash_next;
+	sock->hash_next = 0;
+	sock->hash_bucket = 0;
+}
+
+/**
+ * tcp_port_bind
+ *
+ *   Gives a local port to a socket. The caller checks that the port is free
+ *   (see tcp_port_is_used): the sockets accepted by a listening socket share
+ *   its port.
+ */
+
+void tcp_port_bind(struct tcp_socket *sock, ui16_t port)
+{
+	struct tcp_socket **bucket = &tcp_port_hash[port % TCP_PORT_HASH_SIZE];
+
+	tcp_port_unbind(sock);
+	sock->source_port = port;
+
+	if(!port)
+	{
+		return;
+	}
+
+	sock->port_next = *bucket;
+	sock->port_bound = 1;
+	*bucket = sock;
+	tcp_port_bmp[port / 32] |= 1 << (port % 32);
+}
+
+/**
+ * tcp_port_unbind
+ *
+ *   The port stays marked in the bitmap while other sockets hold it.
+ */
+
+void tcp_port_unbind(struct tcp_socket *sock)
+{
+	struct tcp_socket **prev, *tmp_sock;
+	ui16_t port = sock->source_port;
+
+	if(!sock->port_bound)
+	{
+		return;
+	}
+
+	prev = &tcp_port_hash[port % TCP_PORT_HASH_SIZE];
+
+	for(; *prev != sock; prev = &(*prev)->port_next)
+	{
+		if(!*prev)
+		{
+			panic("socket %x not in its port chain", (ui32_t)sock);
+		}
+	}
+
+	*prev = sock->port_next;
+	sock->port_next = 0;
+	sock->port_bound = 0;
+
+	for(tmp_sock = tcp_port_hash[port % TCP_PORT_HASH_SIZE];
+	    tmp_sock;
+	    tmp_sock = tmp_sock->port_next)
+	{
+		if(tmp_sock->source_port == port)
+		{
+			return;
+		}
+	}
+
+	tcp_port_bmp[port / 32] &= ~(1 << (port % 32));
+}
+
+/**
+ * tcp_port_is_used
+ */
+
+bool_t tcp_port_is_used(ui16_t port)
+{
+	struct tcp_socket *sock;
+
+	if(!(tcp_port_bmp[port / 32] & (1 << (port % 32))))
+	{
+		return 0;
+	}
+
+	for(sock = tcp_port_hash[port % TCP_PORT_HASH_SIZE];
+	    sock;
+	    sock = sock->port_next)
+	{
+		if(sock->source_port == port
+		&& (sock->source_ip || !sock->reuse_addr))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * tcp_port_alloc
+ *
+ *   Returns a free ephemeral port, searched from a random one so that the
+ *   ports of successive connections are hard to guess (RFC 6056), or 0 if
+ *   they are all held.
+ */
+
+ui16_t tcp_port_alloc()
+{
+	static ui32_t seed = 0;
+	count_t range = TCP_EPHEMERAL_MAX - TCP_EPHEMERAL_MIN + 1, i;
+	ui32_t start, port;
+
+	seed = seed * 1103515245 + 12345 + tics;
+	start = (seed >> 16) % range;
+
+	for(i = 0; i < range; i++)
+	{
+		port = TCP_EPHEMERAL_MIN + (start + i) % range;
+
+		/** Skip the ports held 32 at a time. **/
+
+		if(tcp_port_bmp[port / 32] == 0xffffffff)
+		{
+			i += 31 - port % 32;
+		}
+		else if(!(tcp_port_bmp[port / 32] & (1 << (port % 32))))
+		{
+			return port;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * tcp_find_socket
+ *
+ *   Looks for the connection first, then for a socket listening on the port
+ *   (one bound to an address rather than to all of them).
+ */
+
+struct tcp_socket *tcp_find_socket(ui32_t source_ip,
+                                   ui16_t source_port,
+                                   ui16_t dest_port)
+{
+	struct tcp_socket *sock = 0, *tmp_sock;
+
+	tmp_sock = tcp_conn_hash[tcp_conn_hashfn(source_ip,
+	                                         source_port,
+	                                         dest_port)];
+
+	for(; tmp_sock; tmp_sock = tmp_sock->hash_next)
+	{
+		if(tmp_sock->source_port == dest_port
+		&& tmp_sock->dest_ip == source_ip
+		&& tmp_sock->dest_port == source_port
+		&& tmp_sock->state != TCP_LISTEN)
+		{
+			return tmp_sock;
+		}
+	}
+
+	tmp_sock = tcp_listen_hash[dest_port % TCP_LISTEN_HASH_SIZE];
+
+	for(; tmp_sock; tmp_sock = tmp_sock->hash_next)
+	{
+		if(tmp_sock->source_port == dest_port
+		&& tmp_sock->state == TCP_LISTEN
+		&& (!sock || !sock->source_ip))
+		{
+			sock = tmp_sock;
+		}
+	}
+
+	return sock;
+}
+
+/**
+ * tcp_set_socket_state
+ */
+
+void tcp_set_socket_state(struct tcp_socket *sock,
+                          sock_state_t state,
+                          clock_t timeout)
+{
+	if(state != sock->state)
+	{
+		sock->try_cnt = 0;
+	}
+
+	/** A listening socket resets the connections it still holds when it
+	    stops listening. **/
+
+	if(sock->state == TCP_LISTEN && state != TCP_LISTEN)
+	{
+		tcp_listen_close(sock);
+	}
+
+	/** The socket enters the table it is looked for in when it connects
+	    or listens, and is released once it is closed and freed. **/
+
+	if(state != sock->state
+	&& state != TCP_CLOSED
+	&& (sock->state == TCP_CLOSED || state == TCP_LISTEN))
+	{
+		sock->state = state;
+		tcp_hash(sock);
+	}
+	else if(state == TCP_CLOSED
+	     && sock->state != TCP_CLOSED
+	     && !sock->used)
+	{
+		tcp_socket_release(sock);
+	}
+
+	sock->state = state;
+
+	/** A zero timeout makes the timer run on the next tic (e.g. to send
+	    the first SYN or FIN). **/
+
+	if(tcp_timed_state(state))
+	{
+		timer_add(&sock->timer,
+		          tics + timeout,
+		          tcp_socket_timeout,
+		          (ui32_t)sock);
+	}
+	else
+	{
+		timer_cancel(&sock->timer);
+	}
+
+	if(state == TCP_SYN_SENT)
+	{
+		sock->active_open = 1;
+	}
+	else if(state == TCP_ESTABLISHED)
+	{
+		sock->snd_out = sock->snd_max = sock->snd_nxt;
+		sock->cwnd = TCP_INIT_CWND * sock->mss;
+
+		if(sock->parent && !sock->accept_ready)
+		{
+			tcp_child_ready(sock);
+		}
+	}
+
+	wait_wake(&sock->wq);
+}
+
+/**
+ * tcp_child_create
+ *
+ *   Creates the socket of a connection a listening socket takes, from the
+ *   SYN of the remote host. It gets the options, the local port and the
+ *   sizes of the buffers of the listening socket. No user holds it until it
+ *   is accepted: it is released as soon as it is closed.
+ *
+ *   This runs in the network interrupt: the socket comes from the ones
+ *   reserved for the listening sockets (see tcp_socket_reserve), and its
+ *   buffers only get their rings when it is accepted. Until then, its
+ *   receive window is closed.
+ */
+
+struct tcp_socket *tcp_child_create(struct tcp_socket *parent,
+                                    ui32_t source_ip,
+                                    ui32_t dest_ip,
+                                    ui16_t source_port,
+                                    ui32_t irs,
+                                    struct tcp_options *opts)
+{
+	struct tcp_socket *sock = tcp_socket_take();
+
+	if(!sock)
+	{
+		return 0;
+	}
+
+	sock->used = 0;
+	sock->reuse_addr = parent->reuse_addr;
+	sock->nodelay = parent->nodelay;
+	tcp_port_bind(sock, parent->source_port);
+	tcp_sndbuf_resize(sock, parent->tx_fifo.size);
+	tcp_rcvbuf_resize(sock, parent->rx_fifo.size);
+	tcp_apply_options(sock, opts);
+
+	sock->source_ip = dest_ip;
+	sock->dest_ip = source_ip;
+	sock->dest_port = source_port;
+	sock->snd_una = sock->iss;
+	sock->snd_nxt = sock->iss + 1;
+	sock->irs = irs;
+	sock->rcv_nxt = irs + 1;
+	sock->parent = parent;
+	sock->syn_date = tics;
+
+	return sock;
+}
+
+/**
+ * tcp_child_ready
+ *
+ *   Moves a socket whose connection is established from the SYN queue of its
+ *   listening socket to the end of its accept queue.
+ */
+
+void tcp_child_ready(struct tcp_socket *sock)
+{
+	struct tcp_socket *parent = sock->parent;
+
+	tcp_child_unlink(sock);
+
+	sock->parent = parent;
+	sock->accept_ready = 1;
+
+	if(parent->accept_tail)
+	{
+		parent->accept_tail->queue_next = sock;
+	}
+	else
+	{
+		parent->accept_head = sock;
+	}
+
+	parent->accept_tail = sock;
+	parent->accept_cnt++;
+
+	wait_wake(&parent->wq);
+}
+
+/**
+ * tcp_child_pop
+ *
+ *   Takes the first socket of the accept queue, and counts how long its
+ *   connection waited.
+ */
+
+struct tcp_socket *tcp_child_pop(struct tcp_socket *parent)
+{
+	struct tcp_socket *sock = parent->accept_head;
+	clock_t latency;
+	count_t slot;
+
+	if(!sock)
+	{
+		return 0;
+	}
+
+	tcp_child_unlink(sock);
+
+	latency = tics - sock->syn_date;
+
+	for(slot = 0; latency && slot < TCP_HIST_SIZE - 1; slot++, latency >>= 1);
+
+	tcp_accept_latency[slot]++;
+	tcp_nr_accepted++;
+
+	return sock;
+}
+
+/**
+ * tcp_child_unlink
+ *
+ *   Takes a socket out of the queue of its listening socket.
+ */
+
+void tcp_child_unlink(struct tcp_socket *sock)
+{
+	struct tcp_socket *parent = sock->parent, **prev, *last = 0;
+
+	if(!parent)
+	{
+		return;
+	}
+
+	prev = sock->accept_ready ? &parent->accept_head : &parent->syn_queue;
+
+	for(; *prev != sock; prev = &(*prev)->queue_next)
+	{
+		if(!*prev)
+		{
+			panic("socket %x not in its queue", (ui32_t)sock);
+		}
+
+		last = *prev;
+	}
+
+	*prev = sock->queue_next;
+
+	if(!sock->accept_ready)
+	{
+		parent->syn_cnt--;
+	}
+	else
+	{
+		parent->accept_cnt--;
+
+		if(parent->accept_tail == sock)
+		{
+			parent->accept_tail = last;
+		}
+	}
+
+	sock->parent = 0;
+	sock->queue_next = 0;
+	sock->accept_ready = 0;
+}
+
+/**
+ * tcp_listen_close
+ *
+ *   Resets the connections a listening socket has not handed out yet.
+ */
+
+void tcp_listen_close(struct tcp_socket *parent)
+{
+	struct tcp_socket *sock;
+
+	nr_tcp_backlogs -= parent->backlog;
+
+	while((sock = parent->syn_queue) || (sock = parent->accept_head))
+	{
+		tcp_child_unlink(sock);
+		tcp_send(sock, sock->snd_nxt, 0, 0, 0, TCP_RST);
+		tcp_set_socket_state(sock, TCP_CLOSED, 0);
+	}
+}
+
+/**
+ * tcp_listen_syn
+ *
+ *   Takes a SYN arriving to a listening socket: a socket is created for the
+ *   connection if the backlog is not full. Past it, a SYN cookie answers the
+ *   SYN without keeping anything.
+ */
+
+void tcp_listen_syn(struct tcp_socket *parent,
+                    ui32_t source_ip,
+                    ui32_t dest_ip,
+                    ui16_t source_port,
+                    ui32_t seq_num,
+                    struct tcp_options *opts)
+{
+	struct tcp_socket *sock;
+	#ifdef TCP_SYN_COOKIES
+	ui32_t cookie;
+	#endif
+
+	#ifdef DEBUG_TCP
+	printk("request from %x:%x for socket %x (backlog: %x/%x)\n",
+	       source_ip, source_port, (ui32_t)parent,
+	       parent->syn_cnt + parent->accept_cnt, parent->backlog);
+	#endif
+
+	if(parent->syn_cnt + parent->accept_cnt >= parent->backlog)
+	{
+		tcp_nr_listen_overflows++;
+
+		#ifdef TCP_SYN_COOKIES
+		cookie = tcp_cookie_make(source_ip,
+		                         dest_ip,
+		                         source_port,
+		                         parent->source_port,
+		                         seq_num,
+		                         opts->mss);
+
+		if(tcp_send_reply(dest_ip,
+		                  source_ip,
+		                  parent->source_port,
+		                  source_port,
+		                  cookie,
+		                  seq_num + 1,
+		                  TCP_SYN | TCP_ACK) == OK)
+		{
+			tcp_nr_cookies_sent++;
+		}
+		#else
+		tcp_nr_listen_drops++;
+		#endif
+
+		return;
+	}
+
+	sock = tcp_child_create(parent,
+	                        source_ip,
+	                        dest_ip,
+	                        source_port,
+	                        seq_num,
+	                        opts);
+
+	if(!sock)
+	{
+		tcp_nr_listen_drops++;
+		return;
+	}
+
+	sock->queue_next = parent->syn_queue;
+	parent->syn_queue = sock;
+	parent->syn_cnt++;
+
+	/** The SYN-ACK is sent on the next tic. **/
+
+	tcp_set_socket_state(sock, TCP_SYN_RECEIVED, 0);
+}
+
+/**
+ * tcp_listen_ack
+ *
+ *   Takes an ACK arriving to a listening socket: it may complete a handshake
+ *   begun with a SYN cookie, else it is answered with a RST.
+ */
+
+void tcp_listen_ack(struct tcp_socket *parent,
+                    struct tcp_header *packet,
+                    ui32_t source_ip,
+                    ui32_t dest_ip)
+{
+	ui32_t seq_num = ntohl(packet->seq_num);
+	ui32_t ack_num = ntohl(packet->ack_num);
+	ui16_t source_port = ntohs(packet->source_port);
+	#ifdef TCP_SYN_COOKIES
+	struct tcp_options opts;
+	struct tcp_socket *sock;
+
+	if(!(packet->flags & (TCP_SYN | TCP_RST | TCP_FIN)))
+	{
+		opts.mss = tcp_cookie_check(source_ip,
+		                            dest_ip,
+		                            source_port,
+		                            parent->source_port,
+		                            seq_num - 1,
+		                            ack_num - 1);
+	}
+	else
+	{
+		opts.mss = 0;
+	}
+
+	if(opts.mss)
+	{
+		if(parent->syn_cnt + parent->accept_cnt >= parent->backlog)
+		{
+			tcp_nr_listen_drops++;
+			return;
+		}
+
+		/** The options of the SYN are lost but the MSS. **/
+
+		opts.wscale_ok = 0;
+		opts.wscale = 0;
+		opts.ts_ok = 0;
+		opts.ts_val = opts.ts_ecr = 0;
+
+		sock = tcp_child_create(parent,
+		                        source_ip,
+		                        dest_ip,
+		                        source_port,
+		                        seq_num - 1,
+		                        &opts);
+
+		if(!sock)
+		{
+			tcp_nr_listen_drops++;
+			return;
+		}
+
+		sock->iss = ack_num - 1;
+		sock->snd_una = sock->snd_nxt = ack_num;
+		sock->snd_wnd = ntohs(packet->wnd);
+		sock->snd_wl1 = seq_num;
+		sock->snd_wl2 = ack_num;
+		sock->queue_next = parent->syn_queue;
+		parent->syn_queue = sock;
+		parent->syn_cnt++;
+		tcp_nr_cookies_ok++;
+
+		/** Data sent with the ACK is sent again by the remote host. **/
+
+		tcp_set_socket_state(sock, TCP_ESTABLISHED, 0);
+		return;
+	}
+	#endif
+
+	if(!(packet->flags & TCP_RST))
+	{
+		tcp_send_reply(dest_ip,
+		               source_ip,
+		               parent->source_port,
+		               source_port,
+		               ack_num,
+		               0,
+		               TCP_RST);
+	}
+}
+
+/**
+ * tcp_cookie_hash
+ *
+ *   Mixes the addresses, the ports and the sequence number of a SYN with the
+ *   secret and a counter of periods of 64 seconds.
+ */
+
+ui32_t tcp_cookie_hash(ui32_t source_ip,
+                       ui32_t dest_ip,
+                       ui16_t source_port,
+                       ui16_t dest_port,
+                       ui32_t seq_num,
+                       ui32_t count)
+{
+	ui32_t words[5], hash, i;
+
+	if(!tcp_cookie_secret)
+	{
+		tcp_cookie_secret = (ui32_t)hrtimer_now() * 2654435761u ^ tics;
+		tcp_cookie_secret |= 1;
+	}
+
+	words[0] = source_ip;
+	words[1] = dest_ip;
+	words[2] = (source_port << 16) | dest_port;
+	words[3] = seq_num;
+	words[4] = count;
+	hash = tcp_cookie_secret;
+
+	for(i = 0; i < 5; i++)
+	{
+		hash ^= words[i];
+		hash *= 0x01000193;
+		hash ^= hash >> 15;
+		hash += tcp_cookie_secret;
+	}
+
+	return hash;
+}
+
+/**
+ * tcp_cookie_make
+ *
+ *   Returns the initial sequence number of a SYN-ACK sent instead of keeping
+ *   the SYN: 5 bits of counter, 2 bits telling the MSS and 25 bits of hash.
+ */
+
+ui32_t tcp_cookie_make(ui32_t source_ip,
+                       ui32_t dest_ip,
+                       ui16_t source_port,
+                       ui16_t dest_port,
+                       ui32_t seq_num,
+                       ui16_t mss)
+{
+	ui32_t count = tics / (64 * CLK_FREQ), i;
+
+	for(i = 3; i && tcp_cookie_mss[i] > mss; i--);
+
+	return (count << 27)
+	     | (i << 25)
+	     | (tcp_cookie_hash(source_ip,
+	                        dest_ip,
+	                        source_port,
+	                        dest_port,
+	                        seq_num,
+	                        count) & 0x1ffffff);
+}
+
+/**
+ * tcp_cookie_check
+ *
+ *   Returns the MSS a cookie tells, or 0 if it is not valid (forged, or made
+ *   more than two periods ago).
+ */
+
+ui16_t tcp_cookie_check(ui32_t source_ip,
+                        ui32_t dest_ip,
+                        ui16_t source_port,
+                        ui16_t dest_port,
+                        ui32_t seq_num,
+                        ui32_t cookie)
+{
+	ui32_t count = tics / (64 * CLK_FREQ), age;
+
+	age = (count - (cookie >> 27)) & 0x1f;
+
+	if(age > 1)
+	{
+		return 0;
+	}
+
+	count -= age;
+
+	if((cookie ^ tcp_cookie_hash(source_ip,
+	                             dest_ip,
+	                             source_port,
+	                             dest_port,
+	                             seq_num,
+	                             count)) & 0x1ffffff)
+	{
+		return 0;
+	}
+
+	return tcp_cookie_mss[(cookie >> 25) & 3];
+}
+
+/**
+ * tcp_receive
+ */
+
+void tcp_receive(struct tcp_header *packet,
+                 size_t size,
+                 ui32_t source_ip,
+                 ui32_t dest_ip)
+{
+	ui32_t seq_num = ntohl(packet->seq_num);
+	ui32_t ack_num = ntohl(packet->ack_num);
+	ui16_t source_port = ntohs(packet->source_port);
+	ui16_t dest_port = ntohs(packet->dest_port);
+	size_t data_size = size - 4 * packet->header_size;
+	void *data = (void*)packet + 4 * packet->header_size;
+	struct tcp_socket *sock;
+	struct tcp_timewait *tw;
+	struct tcp_options opts;
+	bool_t dup;
+
+	#ifdef DEBUG_TCP
+	printk("\n******************* TCP header dump *******************\n");
+	printk("* source port: %x | dest port: %x\n", source_port, dest_port);
+	printk("* seq num: %x | ack num: %x\n", seq_num, ack_num);
+	printk("* flags: %x | data size: %x\n", packet->flags, data_size);
+	printk("*******************************************************\n\n");
+	#endif
+
+	/** Verify the header size and the checksum. **/
+
+	if(packet->header_size < 5 || 4 * packet->header_size > size)
+	{
+		return;
+	}
+
+	if(tcp_checksum(packet, size, source_ip, dest_ip))
+	{
+		#ifdef DEBUG_TCP
+		printk("wrong tcp checksum\n");
+		#endif
+		return;
+	}
+
+	tcp_parse_options(packet, &opts);
+
+	/** Find which socket the segment is targetted to. **/
+
+	sock = tcp_find_socket(source_ip, source_port, dest_port);
+
+	if(!sock || sock->state == TCP_LISTEN)
+	{
+		tw = tcp_timewait_find(source_ip, source_port, dest_port);
+
+		if(tw && tcp_timewait_receive(tw, packet, seq_num, data_size))
+		{
+			return;
+		}
+	}
+
+	if(!sock)
+	{
+		#ifdef DEBUG_TCP
+		printk("tcp segment dropped: unable to find socket\n");
+		#endif
+		return;
+	}
+
+	/** Packet processing here. **/
+
+	if(sock->state == TCP_CLOSED)
+	{
+		if(packet->flags & TCP_ACK)
+		{
+			tcp_send(sock, ack_num, 0, 0, 0, TCP_RST);
+		}
+		else
+		{
+			tcp_send(sock,
+			         0,
+			         seq_num + data_size,
+			         0,
+			         0,
+			         TCP_RST | TCP_ACK);
+		}
+	}
+	else if(sock->state == TCP_LISTEN)
+	{
+		if(packet->flags & TCP_RST)
+		{
+			/** This is maybe a duplicate of a RST sent to abort
+			    the connection instead of acking our SYN-ACK. **/
+		}
+		else if(packet->flags & TCP_ACK)
+		{
+			tcp_listen_ack(sock, packet, source_ip, dest_ip);
+		}
+		else if(packet->flags & TCP_SYN)
+		{
+			tcp_listen_syn(sock,
+			               source_ip,
+			               dest_ip,
+			               source_port,
+			               seq_num,
+			               &opts);
+		}
+	}
+	else if(sock->state == TCP_SYN_SENT)
+	{
+		if(packet->flags & TCP_ACK)
+		{
+			/** The packet has an acknowledgement number. **/
+
+			if(ack_num == sock->iss + 1)
+			{
+				/** Our SYN is acknowledged. **/
+
+				if(packet->flags & TCP_RST)
+				{
+					tcp_set_socket_state(sock,
+					               TCP_CLOSED,
+					                        0);
+					sock->reset = 1;
+					tcp_buffers_reset(sock);
+				}
+				else if(packet->flags & TCP_SYN)
+				{
+					/** The window of a SYN is not
+					    scaled. **/
+
+					tcp_apply_options(sock, &opts);
+					sock->irs = seq_num;
 					sock->rcv_nxt = seq_num + 1;
-					sock->rcv_wnd = RBUF_SIZE;
 					sock->snd_una = ack_num;
+					sock->snd_wnd = ntohs(packet->wnd);
+					sock->snd_wl1 = seq_num;
+					sock->snd_wl2 = ack_num;
 					tcp_set_socket_state(sock,
 					                     TCP_ESTABLISHED,
 					                     0);
 					tcp_send_ack(sock);
 				}
 			}
-			else
+			else
+			{
+				/** Invalid acknowledgement number. **/
+
+				tcp_send(sock,
+				         ack_num,
+				         0,
+				         0,
+				         0,
+				         TCP_RST);
+			}
+		}
+		else if((packet->flags & TCP_SYN)
+		    && !(packet->flags & TCP_RST))
+		{
+			tcp_apply_options(sock, &opts);
+			sock->irs = seq_num;
+			sock->rcv_nxt = seq_num + 1;
+			tcp_set_socket_state(sock, TCP_SYN_RECEIVED, 0);
+		}
+	}
+	else
+	{
+		/** Check sequence number. **/
+
+		if(seg_inter_win(seq_num,
+		                 seq_num + data_size - 1,
+		                 sock->rcv_nxt,
+		                 sock->rcv_nxt + sock->rcv_wnd - 1))
+		{
+			/** Keep the timestamp to echo, from the segments
+			    that do not start past rcv_nxt (RFC 7323, 4.3).
+			    **/
+
+			if(sock->ts_ok
+			&& opts.ts_ok
+			&& mod2pow32_compare(seq_num, sock->rcv_nxt) <= 0
+			&& mod2pow32_compare(opts.ts_val,
+			                     sock->ts_recent) >= 0)
+			{
+				sock->ts_recent = opts.ts_val;
+			}
+
+			if(packet->flags & TCP_RST)
+			{
+				/** A passive socket is not a listening
+				    one (a listening one created it): it
+				    is closed too. **/
+
+				tcp_set_socket_state(sock, TCP_CLOSED, 0);
+
+				sock->reset = 1;
+				tcp_buffers_reset(sock);
+			}
+			else if(packet->flags & TCP_SYN)
+			{
+				if(packet->flags & TCP_ACK)
+				{
+					tcp_send(sock,
+					         ack_num,
+					         0,
+					         0,
+					         0,
+					         TCP_RST);
+				}
+				else
+				{
+					tcp_send(sock,
+						 0,
+						 seq_num + data_size,
+						 0,
+						 0,
+						 TCP_RST | TCP_ACK);
+				}
+			}
+			else if(packet->flags & TCP_ACK)
 			{
-				/** Invalid acknowledgement number. **/
+				/** An ACK is a duplicate if it acknowledges
+				    nothing new while data is outstanding, and
+				    carries neither data nor a window update
+				    (RFC 5681). **/
+
+				dup = ack_num == sock->snd_una
+				   && sock->snd_max != sock->snd_una
+				   && !data_size
+				   && !(packet->flags & (TCP_SYN | TCP_FIN))
+				   && (ntohs(packet->wnd) << sock->snd_wscale)
+				      == sock->snd_wnd;
+
+				/** Update send window. **/
+
+				if(mod2pow32_compare(seq_num,
+				                     sock->snd_wl1) > 0
+				|| (!mod2pow32_compare(seq_num,
+				                       sock->snd_wl1)
+				 && mod2pow32_compare(ack_num,
+					              sock->snd_wl2) >= 0))
+				{
+					sock->snd_wl1 = seq_num;
+					sock->snd_wl2 = ack_num;
+					sock->snd_wnd = ntohs(packet->wnd)
+					             << sock->snd_wscale;
+				}
+
+				/** Process acknowledgement. **/
+
+				if(sock->state == TCP_ESTABLISHED
+				|| sock->state == TCP_CLOSE_WAIT)
+				{
+					tcp_data_ack(sock,
+					             ack_num,
+					             dup,
+					             &opts);
+				}
+				else if(ack_num == sock->snd_nxt)
+				{
+					if(sock->state == TCP_SYN_RECEIVED)
+					{
+						sock->snd_wnd
+						 = ntohs(packet->wnd)
+						 << sock->snd_wscale;
+						sock->snd_wl1 = seq_num;
+						sock->snd_wl2 = ack_num;
+						tcp_set_socket_state(sock,
+						          TCP_ESTABLISHED,
+						                        0);
+					}
+					else if(sock->state == TCP_FIN_WAIT1)
+					{
+						tcp_set_socket_state(sock,
+						            TCP_FIN_WAIT2,
+						                        0);
+					}
+					else if(sock->state == TCP_CLOSING)
+					{
+						tcp_set_socket_state(sock,
+						            TCP_TIME_WAIT,
+						           TCP_SOCK_DELAY);
+					}
+					else if(sock->state == TCP_LAST_ACK)
+					{
+						tcp_set_socket_state(sock,
+						               TCP_CLOSED,
+						                        0);
+					}
+				}
+
+				/** Process segment data. **/
+
+				if(sock->state == TCP_ESTABLISHED
+				|| sock->state == TCP_FIN_WAIT1
+				|| sock->state == TCP_FIN_WAIT2)
+				{
+					tcp_data_in(sock,
+					            seq_num,
+					            data,
+					            data_size);
+				}
+
+				/** Process FIN. **/
+
+				if(seq_num + data_size == sock->rcv_nxt
+				&& (packet->flags & TCP_FIN))
+				{
+					sock->rcv_nxt++;
+
+					if(sock->state == TCP_ESTABLISHED)
+					{
+						tcp_set_socket_state(sock,
+						           TCP_CLOSE_WAIT,
+						                        0);
+					}
+					else if(sock->state == TCP_FIN_WAIT1)
+					{
+						tcp_set_socket_state(sock,
+						              TCP_CLOSING,
+						          TCP_DEF_TIMEOUT);
+					}
+					else if(sock->state == TCP_FIN_WAIT2)
+					{
+						tcp_set_socket_state(sock,
+						            TCP_TIME_WAIT,
+						           TCP_SOCK_DELAY);
+					}
+
+					tcp_send_ack(sock);
+				}
+
+			}
+		}
+		else
+		{
+			tcp_send_ack(sock);
+		}
+	}
+
+	/** A record replaces the socket if its user has closed it. **/
+
+	if(sock->state == TCP_TIME_WAIT && !sock->used)
+	{
+		tcp_timewait_enter(sock);
+	}
+}
+
+/**
+ * tcp_parse_options
+ *
+ *   Reads the options of a segment this stack knows: MSS, window scale and
+ *   timestamps. A malformed option ends the list.
+ */
+
+void tcp_parse_options(struct tcp_header *packet, struct tcp_options *opts)
+{
+	ui8_t *opt = (ui8_t*)packet + 20;
+	ui8_t *end = (ui8_t*)packet + 4 * packet->header_size;
+	ui32_t len, val;
+
+	opts->mss = TCP_DEF_MSS;
+	opts->wscale_ok = 0;
+	opts->wscale = 0;
+	opts->ts_ok = 0;
+	opts->ts_val = opts->ts_ecr = 0;
+
+	while(opt < end && *opt != TCP_OPT_END)
+	{
+		if(*opt == TCP_OPT_NOP)
+		{
+			opt++;
+			continue;
+		}
+
+		if(opt + 1 >= end || (len = opt[1]) < 2 || opt + len > end)
+		{
+			break;
+		}
+
+		if(opt[0] == TCP_OPT_MSS && len == 4)
+		{
+			val = *(ui16_t*)(opt + 2);
+			opts->mss = ntohs(val);
+		}
+		else if(opt[0] == TCP_OPT_WSCALE && len == 3)
+		{
+			/** RFC 7323, 2.3: the shift is at most 14. **/
+
+			opts->wscale_ok = 1;
+			opts->wscale = min(opt[2], 14);
+		}
+		else if(opt[0] == TCP_OPT_TS && len == 10)
+		{
+			opts->ts_ok = 1;
+			val = *(ui32_t*)(opt + 2);
+			opts->ts_val = ntohl(val);
+			val = *(ui32_t*)(opt + 6);
+			opts->ts_ecr = ntohl(val);
+		}
+
+		opt += len;
+	}
+}
+
+/**
+ * tcp_apply_options
+ *
+ *   Takes the options of the SYN of the remote host: window scaling and
+ *   timestamps are used if both hosts offered them.
+ */
+
+void tcp_apply_options(struct tcp_socket *sock, struct tcp_options *opts)
+{
+	sock->wscale_ok = sock->wscale_ok && opts->wscale_ok;
+	sock->snd_wscale = sock->wscale_ok ? opts->wscale : 0;
+
+	if(!sock->wscale_ok)
+	{
+		sock->rcv_wscale = 0;
+	}
+
+	sock->ts_ok = sock->ts_ok && opts->ts_ok;
+	sock->ts_recent = opts->ts_val;
+
+	/** The timestamps take room in every segment. **/
+
+	sock->mss = (opts->mss < 64) ? 64 : min(opts->mss, TCP_MSS);
+
+	if(sock->ts_ok)
+	{
+		sock->mss -= TCP_OPT_TS_LEN;
+	}
+}
+
+/**
+ * tcp_write_options
+ *
+ *   Writes the options of a segment sent at opt, and returns their size. The
+ *   SYNs carry all the options offered, the other segments the timestamps if
+ *   they are used. RSTs carry none.
+ */
+
+size_t tcp_write_options(struct tcp_socket *sock, ui8_t *opt, ui32_t flags)
+{
+	size_t size = 0;
+	ui32_t val;
+
+	if(flags & TCP_RST)
+	{
+		return 0;
+	}
+
+	if(flags & TCP_SYN)
+	{
+		opt[0] = TCP_OPT_MSS;
+		opt[1] = 4;
+		val = htons(TCP_MSS);
+		*(ui16_t*)(opt + 2) = val;
+		size = 4;
+
+		if(sock->wscale_ok)
+		{
+			opt[size] = TCP_OPT_NOP;
+			opt[size + 1] = TCP_OPT_WSCALE;
+			opt[size + 2] = 3;
+			opt[size + 3] = sock->rcv_wscale;
+			size += 4;
+		}
+	}
+
+	if(sock->ts_ok)
+	{
+		opt[size] = TCP_OPT_NOP;
+		opt[size + 1] = TCP_OPT_NOP;
+		opt[size + 2] = TCP_OPT_TS;
+		opt[size + 3] = 10;
+		val = htonl(tics);
+		*(ui32_t*)(opt + size + 4) = val;
+		val = htonl(sock->ts_recent);
+		*(ui32_t*)(opt + size + 8) = val;
+		size += TCP_OPT_TS_LEN;
+	}
+
+	return size;
+}
+
+/**
+ * tcp_rcv_window
+ *
+ *   Returns the window field of a segment sent. The room left is not
+ *   advertised while it is smaller than a segment or than a quarter of the
+ *   buffer, so that the remote host does not send tiny segments (RFC 1122,
+ *   4.2.3.3). The window of a SYN is not scaled.
+ */
+
+ui16_t tcp_rcv_window(struct tcp_socket *sock, ui32_t flags)
+{
+	ui32_t wnd = sock->rcv_wnd;
+
+	if(wnd < min(sock->rx_fifo.size / 4, TCP_MSS))
+	{
+		wnd = 0;
+	}
+
+	if(!(flags & TCP_SYN))
+	{
+		wnd >>= sock->rcv_wscale;
+	}
+
+	return min(wnd, 0xffff);
+}
+
+/**
+ * tcp_rtt_sample
+ *
+ *   Updates the smoothed round-trip time and its variation with a measure in
+ *   clock tics (RFC 6298, 2.2 and 2.3), then the retransmission timeout.
+ */
+
+void tcp_rtt_sample(struct tcp_socket *sock, clock_t rtt)
+{
+	si32_t err;
+
+	if(!sock->srtt)
+	{
+		sock->srtt = rtt << 3;
+		sock->rttvar = rtt << 1;
+	}
+	else
+	{
+		/** srtt += (rtt - srtt) / 8, rttvar += (|rtt - srtt| - rttvar)
+		    / 4, with the scaled values. **/
+
+		err = (si32_t)(rtt << 3) - (si32_t)sock->srtt;
+		sock->srtt += err >> 3;
+		err = abs(err) >> 1;
+		sock->rttvar += (err - (si32_t)sock->rttvar) >> 2;
+	}
+
+	tcp_rto_update(sock);
+}
+
+/**
+ * tcp_rto_update
+ *
+ *   Sets the retransmission timeout to srtt + 4 * rttvar, without the backoff
+ *   of the timeouts.
+ */
+
+void tcp_rto_update(struct tcp_socket *sock)
+{
+	sock->rto = (sock->srtt >> 3) + (sock->rttvar ? sock->rttvar : 1);
+
+	if(sock->rto < TCP_RTO_MIN)
+	{
+		sock->rto = TCP_RTO_MIN;
+	}
+	else if(sock->rto > TCP_RTO_MAX)
+	{
+		sock->rto = TCP_RTO_MAX;
+	}
+}
+
+/**
+ * tcp_send_window
+ *
+ *   Returns how many bytes may be in flight: the smallest of the congestion
+ *   window and of the window the remote host advertises.
+ */
+
+ui32_t tcp_send_window(struct tcp_socket *sock)
+{
+	return min(sock->cwnd, sock->snd_wnd);
+}
+
+/**
+ * tcp_congestion
+ *
+ *   Halves the slow start threshold on a loss (RFC 5681, equation 4).
+ */
 
-				tcp_send(sock,
-				         ack_num,
-				         0,
-				         0,
-				         0,
-				         TCP_RST);
-			}
+void tcp_congestion(struct tcp_socket *sock)
+{
+	ui32_t flight = sock->snd_max - sock->snd_una;
+
+	sock->ssthresh = (flight / 2 > 2 * sock->mss) ? flight / 2 : 2 * sock->mss;
+}
+
+/**
+ * tcp_output
+ *
+ *   Sends the FIN the user asked for once all the data is acknowledged, and
+ *   (re)transmits the data waiting to be sent, as long as the network card has
+ *   free transmit descriptors. Called whenever one of these may have changed:
+ *   data queued, ACK received, retransmission timer expired, socket closed,
+ *   transmit descriptor freed.
+ */
+
+void tcp_output(struct tcp_socket *sock)
+{
+	ui32_t wnd, off, size;
+
+	/** If all the data was acknowledged and the user requested a close,
+	    update the socket state and send the FIN right away. **/
+
+	if(sock->snd_una == sock->snd_nxt && sock->close_req)
+	{
+		if(sock->state == TCP_ESTABLISHED)
+		{
+			tcp_set_socket_state(sock, TCP_FIN_WAIT1, 0);
+			sock->fss = sock->snd_nxt;
+			sock->snd_nxt++;
+			tcp_socket_timeout((ui32_t)sock);
 		}
-		else if((packet->flags & TCP_SYN)
-		    && !(packet->flags & TCP_RST))
+		else if(sock->state == TCP_CLOSE_WAIT)
 		{
-			sock->irs = seq_num;
-			sock->rcv_nxt = seq_num + 1;
-			sock->rcv_wnd = RBUF_SIZE;
-			tcp_set_socket_state(sock, TCP_SYN_RECEIVED, 0);
+			tcp_set_socket_state(sock, TCP_LAST_ACK, 0);
+			sock->fss = sock->snd_nxt;
+			sock->snd_nxt++;
+			tcp_socket_timeout((ui32_t)sock);
+		}
+		else if(sock->state == TCP_LISTEN)
+		{
+			/** The connections not accepted yet are reset. **/
+
+			tcp_set_socket_state(sock, TCP_CLOSED, 0);
 		}
 	}
-	else
+
+	/** Check whether we can send. **/
+
+	if(sock->state != TCP_ESTABLISHED
+	&& sock->state != TCP_CLOSE_WAIT)
 	{
-		/** Check sequence number. **/
+		return;
+	}
 
-		if(seg_inter_win(seq_num,
-		                 seq_num + data_size - 1,
-		                 sock->rcv_nxt,
-		                 sock->rcv_nxt + sock->rcv_wnd - 1))
+	/** Retransmit the first unacknowledged segment if it was lost. **/
+
+	if(sock->rexmit && sock->snd_una != sock->snd_max)
+	{
+		if(!free_tx_desc)
 		{
-			if(packet->flags & TCP_RST)
-			{
-				if(sock->state == TCP_SYN_RECEIVED
-				&& !sock->active_open)
-				{
-					tcp_set_socket_state(sock,
-					                     TCP_LISTEN,
-					                     0);
-				}
-				else
-				{
-					tcp_set_socket_state(sock,
-					                     TCP_CLOSED,
-					                     0);
-				}
+			tcp_tx_wait(sock);
+			return;
+		}
 
-				sock->reset = 1;
-				tcp_buffers_reset(sock);
-			}
-			else if(packet->flags & TCP_SYN)
+		if(tcp_output_segment(sock,
+		                      sock->snd_una,
+		                      min(sock->snd_max - sock->snd_una,
+		                          sock->mss)) != OK)
+		{
+			return;
+		}
+
+		sock->rexmit = 0;
+	}
+
+	/** Send as many segments as the window allows. With nothing in flight,
+	    at least one byte goes: it probes a closed window. Unless the user
+	    disabled it, a segment of new data smaller than the MSS waits for
+	    the data in flight to be acknowledged, to gather small writes
+	    (Nagle). **/
+
+	wnd = tcp_send_window(sock);
+
+	while(sock->snd_out != sock->snd_nxt && free_tx_desc)
+	{
+		off = sock->snd_out - sock->snd_una;
+		size = min(sock->snd_nxt - sock->snd_out, sock->mss);
+
+		if(off + size > wnd)
+		{
+			if(off)
 			{
-				if(packet->flags & TCP_ACK)
-				{
-					tcp_send(sock,
-					         ack_num,
-					         0,
-					         0,
-					         0,
-					         TCP_RST);
-				}
-				else
-				{
-					tcp_send(sock,
-						 0,
-						 seq_num + data_size,
-						 0,
-						 0,
-						 TCP_RST | TCP_ACK);
-				}
+				break;
 			}
-			else if(packet->flags & TCP_ACK)
-			{
-				/** Process acknowledgement. **/
 
-				if(sock->state == TCP_ESTABLISHED
-				|| sock->state == TCP_CLOSE_WAIT)
-				{
-					tcp_data_ack(sock, ack_num);
-				}
-				else if(ack_num == sock->snd_nxt)
-				{
-					if(sock->state == TCP_SYN_RECEIVED)
-					{
-						tcp_set_socket_state(sock,
-						          TCP_ESTABLISHED,
-						                        0);
-					}
-					else if(sock->state == TCP_FIN_WAIT1)
-					{
-						tcp_set_socket_state(sock,
-						            TCP_FIN_WAIT2,
-						                        0);
-					}
-					else if(sock->state == TCP_CLOSING)
-					{
-						tcp_set_socket_state(sock,
-						            TCP_TIME_WAIT,
-						           TCP_SOCK_DELAY);
-					}
-					else if(sock->state == TCP_LAST_ACK)
-					{
-						tcp_set_socket_state(sock,
-						               TCP_CLOSED,
-						                        0);
-					}
-				}
+			size = wnd ? wnd : 1;
+		}
 
-				/** Process segment data. **/
+		if(size < sock->mss
+		&& sock->snd_out == sock->snd_max
+		&& sock->snd_una != sock->snd_max
+		&& !sock->nodelay
+		&& !sock->close_req)
+		{
+			break;
+		}
 
-				if(sock->state == TCP_ESTABLISHED
-				|| sock->state == TCP_FIN_WAIT1
-				|| sock->state == TCP_FIN_WAIT2)
-				{
-					tcp_data_in(sock,
-					            seq_num,
-					            data,
-					            data_size);
-				}
+		if(tcp_output_segment(sock, sock->snd_out, size) != OK)
+		{
+			break;
+		}
 
-				/** Process FIN. **/
+		sock->snd_out += size;
 
-				if(seq_num + data_size == sock->rcv_nxt
-				&& (packet->flags & TCP_FIN))
-				{
-					sock->rcv_nxt++;
+		if(mod2pow32_compare(sock->snd_out, sock->snd_max) > 0)
+		{
+			sock->snd_max = sock->snd_out;
+		}
+	}
 
-					if(sock->state == TCP_ESTABLISHED)
-					{
-						tcp_set_socket_state(sock,
-						           TCP_CLOSE_WAIT,
-						                        0);
-					}
-					else if(sock->state == TCP_FIN_WAIT1)
-					{
-						tcp_set_socket_state(sock,
-						              TCP_CLOSING,
-						          TCP_DEF_TIMEOUT);
-					}
-					else if(sock->state == TCP_FIN_WAIT2)
-					{
-						tcp_set_socket_state(sock,
-						            TCP_TIME_WAIT,
-						           TCP_SOCK_DELAY);
-					}
+	/** Go on when the network card frees a transmit descriptor. **/
 
-					tcp_send_ack(sock);
-				}
+	if(sock->snd_out != sock->snd_nxt && !free_tx_desc)
+	{
+		tcp_tx_wait(sock);
+	}
+}
 
-				/** Update send window. **/
+/**
+ * tcp_output_segment
+ *
+ *   Sends size bytes of the send buffer, starting at sequence number seq_num.
+ *   New data is timed to measure the round-trip time, unless a segment
+ *   already is. Retransmitted data is not (Karn's algorithm).
+ */
 
-				if(mod2pow32_compare(seq_num,
-				                     sock->snd_wl1) > 0
-				|| (!mod2pow32_compare(seq_num,
-				                       sock->snd_wl1)
-				 && mod2pow32_compare(ack_num,
-					              sock->snd_wl2) > 0))
-				{
-					sock->snd_wl1 = seq_num;
-					sock->snd_wl2 = ack_num;
-					sock->snd_wnd = 0;
-				}
-			}
-		}
-		else
+ret_t tcp_output_segment(struct tcp_socket *sock, ui32_t seq_num, size_t size)
+{
+	ret_t ret;
+
+	ret = tcp_send(sock,
+	               seq_num,
+	               sock->rcv_nxt,
+	               0,
+	               size,
+	               (seq_num + size == sock->snd_nxt)
+	               ? TCP_ACK | TCP_PSH
+	               : TCP_ACK);
+
+	if(ret != OK)
+	{
+		return ret;
+	}
+
+	if(seq_num == sock->snd_max)
+	{
+		if(!sock->rtt_timing)
 		{
-			tcp_send_ack(sock);
+			sock->rtt_timing = 1;
+			sock->rtt_seq = seq_num + size;
+			sock->rtt_date = tics;
 		}
 	}
+	else
+	{
+		sock->rtt_timing = 0;
+	}
+
+	if(!sock->rto_timer.pending)
+	{
+		timer_add(&sock->rto_timer,
+		          tics + sock->rto,
+		          tcp_rto_timeout,
+		          (ui32_t)sock);
+	}
+
+	return OK;
+}
+
+/**
+ * tcp_tx_wait
+ *
+ *   Queues a socket that ran out of transmit descriptors, unless it already
+ *   waits.
+ */
+
+void tcp_tx_wait(struct tcp_socket *sock)
+{
+	if(sock->tx_waiting)
+	{
+		return;
+	}
+
+	sock->tx_waiting = 1;
+	sock->tx_wait_next = 0;
+
+	if(tcp_tx_wait_tail)
+	{
+		tcp_tx_wait_tail->tx_wait_next = sock;
+	}
+	else
+	{
+		tcp_tx_wait_head = sock;
+	}
+
+	tcp_tx_wait_tail = sock;
+}
+
+/**
+ * tcp_tx_unwait
+ */
+
+void tcp_tx_unwait(struct tcp_socket *sock)
+{
+	struct tcp_socket **prev, *last = 0;
+
+	if(!sock->tx_waiting)
+	{
+		return;
+	}
+
+	for(prev = &tcp_tx_wait_head;
+	    *prev != sock;
+	    prev = &(*prev)->tx_wait_next)
+	{
+		last = *prev;
+	}
+
+	*prev = sock->tx_wait_next;
+
+	if(tcp_tx_wait_tail == sock)
+	{
+		tcp_tx_wait_tail = last;
+	}
+
+	sock->tx_waiting = 0;
+	sock->tx_wait_next = 0;
+}
+
+/**
+ * tcp_output_all
+ *
+ *   Gives the transmit descriptors just freed to the sockets that ran out of
+ *   them, in the order they did. A socket that runs out again goes back to
+ *   the end of the list.
+ */
+
+void tcp_output_all()
+{
+	struct tcp_socket *sock;
+
+	while((sock = tcp_tx_wait_head) && free_tx_desc)
+	{
+		tcp_tx_unwait(sock);
+		tcp_output(sock);
+	}
 }
 
 /**
- * tcp_callback
+ * tcp_timed_state
+ *
+ *   Tells whether the socket timer runs in a state: the handshake and closing
+ *   states retransmit their SYN or FIN, and TIME_WAIT ends.
  */
 
-void tcp_callback()
+bool_t tcp_timed_state(sock_state_t state)
 {
-	static si32_t prev_sock_id = NR_TCP_SOCKS - 1;
-	si32_t sock_id;
-	struct tcp_socket *sock;
-	off_t buf_head;
-	struct tcp_buffer *buf;
+	return state == TCP_SYN_SENT
+	    || state == TCP_SYN_RECEIVED
+	    || state == TCP_FIN_WAIT1
+	    || state == TCP_CLOSING
+	    || state == TCP_LAST_ACK
+	    || state == TCP_TIME_WAIT;
+}
 
-	/** Get the first used socket following the one we dealt with in
-	    the previous call to this function. **/
+/**
+ * tcp_socket_timeout
+ */
 
-	sock_id = (prev_sock_id + 1) % NR_TCP_SOCKS;
+void tcp_socket_timeout(ui32_t data)
+{
+	struct tcp_socket *sock = (struct tcp_socket*)data;
 
-	while(sock_id != prev_sock_id)
+	if(sock->state == TCP_SYN_SENT)
 	{
-		if(tcp_sock_tab[sock_id].state != TCP_CLOSED
-		|| tcp_sock_tab[sock_id].used)
+		if(sock->try_cnt > TCP_MAX_TRY_CNT)
 		{
-			break;
+			tcp_set_socket_state(sock, TCP_CLOSED, 0);
+		}
+		else if(tcp_send(sock,
+		                 sock->iss,
+		                 0,
+		                 0,
+		                 0,
+		                 TCP_SYN) == OK)
+		{
+			#ifdef DEBUG_TCP
+			printk("syn timeout\n");
+			#endif
+
+			tcp_set_socket_state(sock,
+			                     TCP_SYN_SENT,
+			                     TCP_DEF_TIMEOUT);
+			sock->try_cnt++;
 		}
-
-		sock_id = (sock_id + 1) % NR_TCP_SOCKS;
-	}
-
-	prev_sock_id = sock_id;
-	sock = &tcp_sock_tab[sock_id];
-
-	if(!sock->used && sock->state == TCP_CLOSED)
-	{
-		return;
 	}
-
-	/** Connection opening and closing stuff. **/
-
-	if(tcp_socket_timeout(sock))
+	else if(sock->state == TCP_SYN_RECEIVED)
 	{
-		if(sock->state == TCP_SYN_SENT)
+		if(sock->iss + 1 != sock->snd_nxt)
 		{
-			if(sock->try_cnt > TCP_MAX_TRY_CNT)
-			{
-				tcp_set_socket_state(sock,
-				               TCP_CLOSED,
-				                        0);
-			}
-			else if(tcp_send(sock,
-			                 sock->iss,
-			                 0,
-			                 0,
-			                 0,
-			                 TCP_SYN) == OK)
-			{
-				#ifdef DEBUG_TCP
-				printk("syn timeout\n");
-				#endif
-
-				tcp_set_socket_state(sock,
-				                     TCP_SYN_SENT,
-				                     TCP_DEF_TIMEOUT);
-				sock->try_cnt++;
-			}
+			panic("corrupt snd info (connection init)");
 		}
-		else if(sock->state == TCP_SYN_RECEIVED)
+		else if(sock->irs + 1 != sock->rcv_nxt)
 		{
-			if(sock->iss + 1 != sock->snd_nxt)
-			{
-				panic("corrupt snd info (connection init)");
-			}
-			else if(sock->irs + 1 != sock->rcv_nxt)
-			{
-				panic("corrupt rcv info (connection init)");
-			}
+			panic("corrupt rcv info (connection init)");
+		}
 
-			if(sock->try_cnt > TCP_MAX_TRY_CNT)
-			{
-				tcp_set_socket_state(sock,
-				               TCP_CLOSED,
-				                        0);
-			}
-			else if(tcp_send(sock,
-			                 sock->iss,
-			                 sock->rcv_nxt,
-			                 0,
-			                 0,
-			                 TCP_SYN | TCP_ACK) == OK)
-			{
-				tcp_set_socket_state(sock,
-				                     TCP_SYN_RECEIVED,
-				                     TCP_DEF_TIMEOUT);
-				sock->try_cnt++;
-			}
+		if(sock->try_cnt > TCP_MAX_TRY_CNT)
+		{
+			tcp_set_socket_state(sock, TCP_CLOSED, 0);
 		}
-		else if(sock->state == TCP_FIN_WAIT1
-		     || sock->state == TCP_CLOSING
-		     || sock->state == TCP_LAST_ACK)
+		else if(tcp_send(sock,
+		                 sock->iss,
+		                 sock->rcv_nxt,
+		                 0,
+		                 0,
+		                 TCP_SYN | TCP_ACK) == OK)
 		{
-			if(sock->try_cnt > TCP_MAX_TRY_CNT)
-			{
-				tcp_set_socket_state(sock,
-				               TCP_CLOSED,
-				                        0);
-			}
-			else if(tcp_send(sock,
-			                 sock->fss,
-			                 sock->rcv_nxt,
-			                 0,
-			                 0,
-			                 TCP_FIN | TCP_ACK) == OK)
-			{
-				tcp_set_socket_state(sock,
-				                     sock->state,
-				                     TCP_DEF_TIMEOUT);
-				sock->try_cnt++;
-			}
+			tcp_set_socket_state(sock,
+			                     TCP_SYN_RECEIVED,
+			                     TCP_DEF_TIMEOUT);
+			sock->try_cnt++;
 		}
 	}
-
-	/** If all the buffers were sent and the user requested a close, update
-	    the socket state. **/
-
-	if(sock->free_buf == TCP_BUF_PER_SOCK && sock->close_req)
+	else if(sock->state == TCP_FIN_WAIT1
+	     || sock->state == TCP_CLOSING
+	     || sock->state == TCP_LAST_ACK)
 	{
-		if(sock->state == TCP_ESTABLISHED)
+		if(sock->try_cnt > TCP_MAX_TRY_CNT)
 		{
-			tcp_set_socket_state(sock, TCP_FIN_WAIT1, 0);
-			sock->fss = sock->snd_nxt;
-			sock->snd_nxt++;
+			tcp_set_socket_state(sock, TCP_CLOSED, 0);
 		}
-		else if(sock->state == TCP_CLOSE_WAIT)
+		else if(tcp_send(sock,
+		                 sock->fss,
+		                 sock->rcv_nxt,
+		                 0,
+		                 0,
+		                 TCP_FIN | TCP_ACK) == OK)
 		{
-			tcp_set_socket_state(sock, TCP_LAST_ACK, 0);
-			sock->fss = sock->snd_nxt;
-			sock->snd_nxt++;
+			tcp_set_socket_state(sock,
+			                     sock->state,
+			                     TCP_DEF_TIMEOUT);
+			sock->try_cnt++;
 		}
 	}
+	else if(sock->state == TCP_TIME_WAIT)
+	{
+		tcp_set_socket_state(sock, TCP_CLOSED, 0);
+	}
 
-	/** Check whether we can send. **/
+	/** The segment could not be sent (no free transmit descriptor): try
+	    again on the next tic. **/
 
-	if(sock->state != TCP_ESTABLISHED
-	&& sock->state != TCP_CLOSE_WAIT)
+	if(!sock->timer.pending && tcp_timed_state(sock->state))
 	{
-		return;
+		timer_add(&sock->timer, tics + 1, tcp_socket_timeout, data);
 	}
+}
 
-	/** (Re)transmit as many packets as possible. **/
+/**
+ * tcp_rto_timeout
+ *
+ *   The retransmission timer expired: the data in flight is considered lost.
+ *   Sending starts again from the first unacknowledged byte in slow start (RFC
+ *   5681), and the timeout doubles (RFC 6298). A closed window is only probed:
+ *   the connection is not penalized for it.
+ */
 
-	buf_head = sock->buf_head;
+void tcp_rto_timeout(ui32_t data)
+{
+	struct tcp_socket *sock = (struct tcp_socket*)data;
 
-	while(buf_head != sock->buf_tail && free_tx_desc)
+	if(sock->snd_una == sock->snd_max
+	|| (sock->state != TCP_ESTABLISHED && sock->state != TCP_CLOSE_WAIT))
 	{
-		buf = &sock->buf_tab[buf_head];
-
-		if((buf->state != TCP_WAITING_ACK
-		    || !tcp_buffer_timeout(sock, buf))
-		&&  buf->state != TCP_WAITING_SEND)
-		{
-			goto next;
-		}
-
-		if(buf->state == TCP_FREE)
-		{
-			panic("unexpected free buffer");
-		}
+		return;
+	}
 
-		if(buf->try_cnt > TCP_MAX_TRY_CNT)
+	if(sock->snd_wnd)
+	{
+		if(++sock->rto_cnt > TCP_MAX_TRY_CNT)
 		{
 			tcp_set_socket_state(sock, TCP_CLOSED, 0);
 			tcp_buffers_reset(sock);
-			break;
-		}
-
-		if(tcp_send(sock,
-		            buf->seq_num,
-		            sock->rcv_nxt,
-		            buf->data,
-		            buf->size,
-		            TCP_ACK) == OK)
-		{
-			tcp_set_buffer_state(sock, buf, TCP_WAITING_ACK);
-			buf->try_cnt++;
-		}
-		else
-		{
-			break;
+			return;
 		}
 
-	next:
-		buf_head = (buf_head + 1) % TCP_BUF_PER_SOCK;
+		tcp_congestion(sock);
+		sock->cwnd = sock->mss;
 	}
-}
-
-/**
- * tcp_socket_timeout
- */
-
-bool_t tcp_socket_timeout(struct tcp_socket *sock)
-{
-	/** WARNING: Don't add -1 to sock->timeout_tics, just in case
-	    sock->timeout_tics = sock->timeout_set_tics. **/
-
-	return !byte_in_win(tics, sock->timeout_set_tics, sock->timeout_tics);
-}
-
-/**
- * tcp_buffer_timeout
- */
 
-bool_t tcp_buffer_timeout(struct tcp_socket *sock, struct tcp_buffer *buf)
-{
-	/** WARNING: Same as above. **/
+	sock->recovery = 0;
+	sock->dup_acks = 0;
+	sock->rexmit = 0;
+	sock->rto = min(2 * sock->rto, TCP_RTO_MAX);
+	sock->snd_out = sock->snd_una;
 
-	return !byte_in_win(tics,
-	                    buf->state_change_date,
-	                    buf->state_change_date + sock->buffer_timeout);
+	tcp_output(sock);
 }
 
 /**
  * tcp_checksum
+ *
+ *   Returns the checksum of the segment, over the pseudo header too, which
+ *   is summed without being written. It is 0 for a received segment whose
+ *   checksum is right.
  */
 
 ui16_t tcp_checksum(struct tcp_header *packet,
@@ -833,21 +2561,36 @@ ui16_t tcp_checksum(struct tcp_header *packet,
                     ui32_t source_ip,
                     ui32_t dest_ip)
 {
-	struct tcp_pseudo_header *pseudo_hdr = (void*)packet - 12;
+	return ip_sum_fold(ip_sum(packet,
+	                          size,
+	                          tcp_pseudo_sum(source_ip, dest_ip, size)));
+}
 
-	pseudo_hdr->source_ip = source_ip;
-	pseudo_hdr->dest_ip = dest_ip;
-	pseudo_hdr->mbz = 0;
-	pseudo_hdr->type = 6;
-	pseudo_hdr->size = htons(size);
+/**
+ * tcp_pseudo_sum
+ *
+ *   Returns the partial sum of the pseudo header.
+ */
+
+ui32_t tcp_pseudo_sum(ui32_t source_ip, ui32_t dest_ip, size_t size)
+{
+	ui32_t sum = 0;
 
-	packet->checksum = 0;
+	sum = ip_sum_add(sum, source_ip, 0);
+	sum = ip_sum_add(sum, dest_ip, 0);
+	sum = ip_sum_add(sum, htons(IP_PROTO_TCP), 0);
 
-	return ip_checksum((ui16_t*)pseudo_hdr, size + 12);
+	return ip_sum_add(sum, htons(size), 0);
 }
 
 /**
  * tcp_send
+ *
+ *   Builds a segment right in the next free transmit buffer of the network
+ *   card, past room for the IP and Ethernet headers, which their layers write
+ *   in front of it. The size bytes of data come from data or, if it is 0,
+ *   from the send FIFO of the socket, at seq_num. They are summed while they
+ *   are copied.
  */
 
 ret_t tcp_send(struct tcp_socket *sock,
@@ -857,10 +2600,17 @@ ret_t tcp_send(struct tcp_socket *sock,
                size_t size,
                ui32_t flags)
 {
-	static ui8_t buf[TCP_BUF_SIZE + 56];
-	struct tcp_header *header = (void*)buf + 36;
+	ui8_t *buf = rtl8139_tx_buf();
+	struct tcp_header *header = (void*)buf + TCP_HEADROOM;
+	size_t opt_size;
+	ui32_t sum = 0;
 
-	if(size > TCP_BUF_SIZE)
+	if(!buf)
+	{
+		return -ENOMEM;
+	}
+
+	if(size > TCP_MSS)
 	{
 		return -EINVAL;
 	}
@@ -871,39 +2621,107 @@ ret_t tcp_send(struct tcp_socket *sock,
 	header->dest_port = htons(sock->dest_port);
 	header->seq_num = htonl(seq_num);
 	header->ack_num = htonl(ack_num);
+	opt_size = tcp_write_options(sock, (void*)header + 20, flags);
 	header->res = 0;
-	header->header_size = 5;
+	header->header_size = 5 + opt_size / 4;
 	header->flags = flags;
-	header->wnd = (sock->rcv_wnd < 0.30 * RBUF_SIZE
-	            ? 0
-	            : htons(sock->rcv_wnd));
+	header->wnd = htons(tcp_rcv_window(sock, flags));
 	header->checksum = 0;
 	header->urg_ptr = 0;
 
-	/** If the packet contains data, copy them. **/
+	if(TCP_HEADROOM + 20 + opt_size + size > RTL8139_TX_BUF_SIZE)
+	{
+		return -EINVAL;
+	}
+
+	/** Copy the data, if any, and sum them on the way. **/
 
 	if(data)
 	{
-		memcpy((void*)header + 20, data, size);
+		sum = ip_copy_sum((void*)header + 20 + opt_size, data, size, 0);
+	}
+	else if(size)
+	{
+		sum = tcp_copy_out(sock,
+		                   seq_num,
+		                   (void*)header + 20 + opt_size,
+		                   size);
 	}
 
-	/** Calculate checksum. **/
+	/** Add the header and the pseudo header: the header size is even, so
+	    that the sum of the data needs no swapping. **/
 
-	header->checksum = tcp_checksum(header,
-	                                size + 20,
-	                                sock->source_ip,
-	                                sock->dest_ip);
+	sum = ip_sum(header, 20 + opt_size, sum);
+	sum = ip_sum_add(sum,
+	                 tcp_pseudo_sum(sock->source_ip,
+	                                sock->dest_ip,
+	                                size + 20 + opt_size),
+	                 0);
+	header->checksum = ip_sum_fold(sum);
 
 	/** Pass the packet to the IP layer. **/
 
 	return ip_send((void*)header,
-                       size + 20,
+                       size + 20 + opt_size,
 	               IP_PROTO_TCP,
                        sock->source_ip,
                        sock->dest_ip,
                        0);
 }
 
+/**
+ * tcp_copy_out
+ *
+ *   Copies the bytes of the send FIFO from seq_num on, and returns their
+ *   partial sum. The sum of the first unacknowledged segment is kept: when it
+ *   is retransmitted, only its header, where the acknowledgment number and the
+ *   window changed, is summed again.
+ */
+
+ui32_t tcp_copy_out(struct tcp_socket *sock,
+                    ui32_t seq_num,
+                    void *buf,
+                    size_t size)
+{
+	size_t off = seq_num - sock->snd_una, done = 0, n;
+	ui32_t sum = 0;
+	void *data;
+
+	if(seq_num == sock->rexmit_sum_seq && size == sock->rexmit_sum_size)
+	{
+		if(fifo_read_at(&sock->tx_fifo, off, buf, size) != size)
+		{
+			panic("sending data out of the send buffer");
+		}
+
+		return sock->rexmit_sum;
+	}
+
+	/** The ring may wrap around: a block starting at an odd offset is
+	    summed in the wrong halves of the words (see ip_sum_add). **/
+
+	while(done < size)
+	{
+		if(!(n = fifo_peek_at(&sock->tx_fifo, off + done, &data)))
+		{
+			panic("sending data out of the send buffer");
+		}
+
+		n = min(size - done, n);
+		sum = ip_sum_add(sum, ip_copy_sum(buf + done, data, n, 0), done);
+		done += n;
+	}
+
+	if(seq_num == sock->snd_una)
+	{
+		sock->rexmit_sum = sum;
+		sock->rexmit_sum_seq = seq_num;
+		sock->rexmit_sum_size = size;
+	}
+
+	return sum;
+}
+
 /**
  * tcp_send_ack
  */
@@ -915,13 +2733,42 @@ ret_t tcp_send_ack(struct tcp_socket *sock)
 	#ifdef DEBUG_TCP
 	if(ret != OK)
 	{
-		printk("socket %x failed sending ack\n", sock - tcp_sock_tab);
+		printk("socket %x failed sending ack\n", (ui32_t)sock);
 	}
 	#endif
 
 	return ret;
 }
 
+/**
+ * tcp_send_reply
+ *
+ *   Sends a segment no socket of the connection exists for (a RST, or the
+ *   SYN-ACK of a SYN cookie, which only carries the MSS option).
+ */
+
+ret_t tcp_send_reply(ui32_t source_ip,
+                     ui32_t dest_ip,
+                     ui16_t source_port,
+                     ui16_t dest_port,
+                     ui32_t seq_num,
+                     ui32_t ack_num,
+                     ui32_t flags)
+{
+	static struct tcp_socket sock;
+
+	sock.source_ip = source_ip;
+	sock.dest_ip = dest_ip;
+	sock.source_port = source_port;
+	sock.dest_port = dest_port;
+	sock.wscale_ok = 0;
+	sock.rcv_wscale = 0;
+	sock.ts_ok = 0;
+	sock.rcv_wnd = 0xffff;
+
+	return tcp_send(&sock, seq_num, ack_num, 0, 0, flags);
+}
+
 /**
  * tcp_data_in
  */
@@ -933,7 +2780,8 @@ void tcp_data_in(struct tcp_socket *sock,
                  void *data,
                  size_t size)
 {
-	size_t read = 0, written = 0;
+	size_t off, written;
+	ui32_t end;
 
 	/** If no data, return. **/
 
@@ -942,56 +2790,143 @@ void tcp_data_in(struct tcp_socket *sock,
 		return;
 	}
 
-	/** Send an ACK. **/
+	/** Escape already received data. **/
 
-	tcp_send_ack(sock);
+	if(mod2pow32_compare(seq_num, sock->rcv_nxt) < 0)
+	{
+		off = sock->rcv_nxt - seq_num;
 
-	/** If a block of data between this one is missing, return. **/
+		if(off >= size)
+		{
+			panic("invalid sequence number or invalid receive window");
+		}
 
-	if(byte_in_win(seq_num,
-	               sock->rcv_nxt,
-	               sock->rcv_nxt + sock->rcv_wnd - 1)
-	&& seq_num != sock->rcv_nxt)
-	{
-		return;
+		data += off;
+		size -= off;
+		seq_num = sock->rcv_nxt;
 	}
 
-	/** Escape already received data. **/
+	/** Copy the data to its place in the received FIFO, up to the receive
+	    window. Data past a hole waits there until the hole is filled. **/
 
-	while(seq_num != sock->rcv_nxt)
+	off = seq_num - sock->rcv_nxt;
+	written = (off < sock->rcv_wnd)
+	        ? fifo_write_at(&sock->rx_fifo,
+	                        off,
+	                        data,
+	                        min(size, sock->rcv_wnd - off))
+	        : 0;
+
+	if(written && off)
+	{
+		tcp_ooo_insert(sock, seq_num, seq_num + written);
+	}
+	else if(written)
 	{
-		seq_num++;
-		data++;
-		read++;
+		end = tcp_ooo_fill(sock, seq_num + written);
+		fifo_commit(&sock->rx_fifo, end - sock->rcv_nxt);
+		sock->rcv_wnd -= end - sock->rcv_nxt;
+		sock->rcv_nxt = end;
+		wait_wake(&sock->wq);
 	}
 
-	if(read >= size)
+	/** Acknowledge at once: past a hole, the duplicate ACK tells the
+	    sender about it, and when it is filled, the sender learns it
+	    quickly (RFC 5681, section 4.2). **/
+
+	tcp_send_ack(sock);
+}
+
+/**
+ * tcp_ooo_insert
+ *
+ *   Records out of order data, merged with the data it touches. If there are
+ *   too many holes, it is forgotten: the sender will retransmit it.
+ */
+
+void tcp_ooo_insert(struct tcp_socket *sock, ui32_t seq_num, ui32_t end)
+{
+	struct tcp_ooo *ooo = sock->ooo_tab;
+	ui32_t base = sock->rcv_nxt;
+	count_t i, j, k;
+
+	/** Skip the data before, then merge the data touched. Sequence numbers
+	    are compared as offsets from rcv_nxt. **/
+
+	for(i = 0; i < sock->ooo_cnt && ooo[i].end - base < seq_num - base; i++);
+
+	for(j = i; j < sock->ooo_cnt && ooo[j].seq_num - base <= end - base; j++)
 	{
-		panic("invalid sequence number or invalid receive window");
+		if(ooo[j].seq_num - base < seq_num - base)
+		{
+			seq_num = ooo[j].seq_num;
+		}
+
+		if(ooo[j].end - base > end - base)
+		{
+			end = ooo[j].end;
+		}
 	}
 
-	/** Write new data to received FIFO. **/
+	/** Make room for one entry at i in place of entries i to j - 1. **/
 
-	while(seq_num != sock->rcv_nxt + sock->rcv_wnd && read < size)
+	if(i == j)
 	{
-		if(fifo_write_byte(&sock->rx_fifo, *(ui8_t*)data, 0) != OK)
+		if(sock->ooo_cnt == TCP_OOO_PER_SOCK)
 		{
-			break;
+			return;
+		}
+
+		for(k = sock->ooo_cnt; k > i; k--)
+		{
+			ooo[k] = ooo[k - 1];
+		}
+
+		sock->ooo_cnt++;
+	}
+	else
+	{
+		for(k = j; k < sock->ooo_cnt; k++)
+		{
+			ooo[k - (j - i - 1)] = ooo[k];
 		}
 
-		seq_num++;
-		data++;
-		read++;
-		written++;
+		sock->ooo_cnt -= j - i - 1;
 	}
 
-	sock->rcv_nxt += written;
-	sock->rcv_wnd -= written;
+	ooo[i].seq_num = seq_num;
+	ooo[i].end = end;
+}
+
+/**
+ * tcp_ooo_fill
+ *
+ *   The data received is contiguous up to end: returns where it really ends,
+ *   with the out of order data it reaches, which is no longer recorded.
+ */
+
+ui32_t tcp_ooo_fill(struct tcp_socket *sock, ui32_t end)
+{
+	struct tcp_ooo *ooo = sock->ooo_tab;
+	ui32_t base = sock->rcv_nxt;
+	count_t i, k;
 
-	/*if(written)
+	for(i = 0; i < sock->ooo_cnt && ooo[i].seq_num - base <= end - base; i++)
 	{
-		tcp_send_ack(sock);
-	}*/
+		if(ooo[i].end - base > end - base)
+		{
+			end = ooo[i].end;
+		}
+	}
+
+	for(k = i; k < sock->ooo_cnt; k++)
+	{
+		ooo[k - i] = ooo[k];
+	}
+
+	sock->ooo_cnt -= i;
+
+	return end;
 }
 
 /**
@@ -1000,78 +2935,197 @@ void tcp_data_in(struct tcp_socket *sock,
 
 // Called when the remote host acknowledges data.
 
-ret_t tcp_data_ack(struct tcp_socket *sock, ui32_t ack_num)
+ret_t tcp_data_ack(struct tcp_socket *sock,
+                   ui32_t ack_num,
+                   bool_t dup,
+                   struct tcp_options *opts)
 {
-	struct tcp_buffer *buf = &sock->buf_tab[sock->buf_head];
-	float rtt = (float)(tics - buf->state_change_date);
+	ui32_t acked;
+
+	if(dup)
+	{
+		sock->dup_acks++;
+
+		if(sock->recovery)
+		{
+			/** Each duplicate ACK means a segment left the
+			    network. **/
 
-	if(sock->snd_una == sock->snd_nxt
+			sock->cwnd += sock->mss;
+		}
+		else if(sock->dup_acks == TCP_DUPACK_THRESH)
+		{
+			/** Fast retransmit of the first unacknowledged
+			    segment, then fast recovery. **/
+
+			tcp_congestion(sock);
+			sock->cwnd = sock->ssthresh
+			           + TCP_DUPACK_THRESH * sock->mss;
+			sock->recovery = 1;
+			sock->recover = sock->snd_max;
+			sock->rexmit = 1;
+		}
+
+		tcp_output(sock);
+
+		return OK;
+	}
+
+	if(sock->snd_una == sock->snd_max
 	|| ack_num == sock->snd_una)
 	{
-		/** Nothing new to acknowledge. **/
+		/** Nothing new to acknowledge, but the window may have
+		    opened. **/
+
+		tcp_output(sock);
 
 		return OK;
 	}
 
-	if(!byte_in_win(ack_num - 1, sock->snd_una, sock->snd_nxt - 1))
+	if(!byte_in_win(ack_num - 1, sock->snd_una, sock->snd_max - 1))
 	{
 		/** At this point, we know that the remote host must have
 		    acknowledged something new. Thus, if ack_num - 1 is not in
-		    the send window, the ACK is considered invalid. **/
+		    the data sent, the ACK is considered invalid. **/
 
 		return tcp_send_ack(sock);
 	}
 
-	/** Free as many buffers as possible. **/
+	/** Measure the round-trip time: with the timestamp echoed, on every
+	    ACK of new data (RFC 7323, 4.1), else if the timed segment is
+	    acknowledged. **/
 
-	while(sock->free_buf < TCP_BUF_PER_SOCK
-	   && buf->state == TCP_WAITING_ACK
-	   && seg_in_win(buf->seq_num,
-	                 buf->seq_num + buf->size - 1,
-	                 sock->snd_una,
-	                 ack_num - 1))
+	if(sock->ts_ok
+	&& opts->ts_ok
+	&& opts->ts_ecr
+	&& tics - opts->ts_ecr < TCP_RTO_MAX)
 	{
-		#ifdef DEBUG_TCP
-		printk("buffer %x acked (seq: %x)\n",
-		       sock->buf_head, buf->seq_num);
-		#endif
-		sock->rtt = (clock_t)(0.875f * (float)sock->rtt
-		                    + 0.125f * rtt);
-		sock->vrtt = (clock_t)(0.25f * abs(rtt - (float)sock->rtt)
-		                     + 0.75f * sock->vrtt);
-		tcp_set_buffer_state(sock, buf, TCP_FREE);
-		sock->buf_head = (sock->buf_head + 1) % TCP_BUF_PER_SOCK;
-		buf = &sock->buf_tab[sock->buf_head];
+		tcp_rtt_sample(sock, tics - opts->ts_ecr);
+	}
+	else if(sock->rtt_timing
+	     && mod2pow32_compare(ack_num, sock->rtt_seq) >= 0)
+	{
+		tcp_rtt_sample(sock, tics - sock->rtt_date);
 	}
 
-	/** Update send state. **/
+	sock->rtt_timing = sock->rtt_timing
+	                && mod2pow32_compare(ack_num, sock->rtt_seq) < 0;
+
+	/** Free the bytes acknowledged and update send state. After a timeout,
+	    the ACK may cover bytes not sent again yet. **/
 
+	acked = ack_num - sock->snd_una;
+	fifo_consume(&sock->tx_fifo, acked);
 	sock->snd_una = ack_num;
+	sock->dup_acks = 0;
+	sock->rto_cnt = 0;
+
+	if(mod2pow32_compare(sock->snd_out, ack_num) < 0)
+	{
+		sock->snd_out = ack_num;
+	}
+
+	/** Leave fast recovery once everything sent before it began is
+	    acknowledged. A partial ACK means the next segment was lost too:
+	    retransmit it at once (RFC 6582). Otherwise, grow the congestion
+	    window: by the bytes acknowledged in slow start, by about a segment
+	    per round trip in congestion avoidance. **/
 
-	/** Update stats. **/
+	if(sock->recovery)
+	{
+		if(mod2pow32_compare(ack_num, sock->recover) >= 0)
+		{
+			sock->recovery = 0;
+			sock->cwnd = sock->ssthresh;
+		}
+		else
+		{
+			sock->rexmit = 1;
+			sock->cwnd = (sock->cwnd > acked)
+			           ? sock->cwnd - acked + sock->mss
+			           : sock->mss;
+		}
+	}
+	else if(sock->cwnd < sock->ssthresh)
+	{
+		sock->cwnd += min(acked, sock->mss);
+	}
+	else
+	{
+		sock->cwnd += (sock->mss * sock->mss > sock->cwnd)
+		            ? sock->mss * sock->mss / sock->cwnd
+		            : 1;
+	}
 
-	sock->buffer_timeout = sock->rtt + 4 * sock->vrtt;
+	/** The retransmission timeout loses its backoff, and the timer restarts
+	    if data is still in flight (RFC 6298, 5.2 and 5.3). **/
 
-	#ifdef DEBUG_TCP
-	printk("new rtt: %x\n", sock->rtt);
+	if(sock->srtt)
+	{
+		tcp_rto_update(sock);
+	}
 
-	if(sock->free_buf < TCP_BUF_PER_SOCK && buf->seq_num != ack_num)
+	if(sock->snd_una == sock->snd_max)
+	{
+		timer_cancel(&sock->rto_timer);
+	}
+	else
 	{
-		panic("seq/ack numbers are unconsistent");
+		timer_add(&sock->rto_timer,
+		          tics + sock->rto,
+		          tcp_rto_timeout,
+		          (ui32_t)sock);
 	}
+
+	#ifdef DEBUG_TCP
+	printk("new srtt: %x, cwnd: %x\n", sock->srtt >> 3, sock->cwnd);
 	#endif
 
+	/** Wake up the writers waiting for room, then send what the window
+	    allows (and the FIN, if a close is pending). **/
+
+	wait_wake(&sock->wq);
+	tcp_output(sock);
+
 	return OK;
 }
 
+/**
+ * tcp_fault_in
+ *
+ *   Makes a user buffer present before it is copied with tcp_lock held (see
+ *   tcp_data_out and tcp_data_push): a fault could sleep on the disk. The
+ *   lock is released while the pages are faulted in. Returns whether it was,
+ *   in which case the socket may have changed.
+ */
+
+bool_t tcp_fault_in(void *buf, size_t size, bool_t write)
+{
+	if(paging_present(buf, size, write))
+	{
+		return 0;
+	}
+
+	spin_unlock(&tcp_lock);
+	sti;
+	paging_fault_in(buf, size, write);
+	cli;
+	spin_lock(&tcp_lock);
+
+	return 1;
+}
+
 /**
  * tcp_data_out
+ *
+ *   Queues as many bytes as the send buffer has room for, and returns their
+ *   number (possibly 0) or an error. A user buffer must be present (see
+ *   tcp_fault_in).
  */
 
-ret_t tcp_data_out(struct tcp_socket *sock, void *data, size_t size)
+ssize_t tcp_data_out(struct tcp_socket *sock, void *data, size_t size)
 {
-	size_t copy_size;
-	struct tcp_buffer *buf = &sock->buf_tab[sock->buf_tail];
+	size_t written;
 
 	if(sock->state != TCP_ESTABLISHED
 	&& sock->state != TCP_CLOSE_WAIT)
@@ -1082,45 +3136,39 @@ ret_t tcp_data_out(struct tcp_socket *sock, void *data, size_t size)
 	{
 		return -EPIPE;
 	}
-	else if(sock->free_buf * TCP_BUF_SIZE < size)
-	{
-		return -ENOBUFS;
-	}
-
-	while(size)
-	{
-		#ifdef DEBUG_TCP
-		printk("allocating buffer %x\n", sock->buf_tail);
-		#endif
-		copy_size = (size > TCP_BUF_SIZE) ? TCP_BUF_SIZE : size;
-		buf = &sock->buf_tab[sock->buf_tail];
-
-		/** tcp_set_buffer_state() should decrease sock->free_buf. **/
 
-		memcpy(buf->data, data, copy_size);
-		tcp_set_buffer_state(sock, buf, TCP_WAITING_SEND);
-		buf->seq_num = sock->snd_nxt;
-		buf->size = copy_size;
-		buf->try_cnt = 0;
+	written = fifo_write(&sock->tx_fifo, data, size, 0);
+	sock->snd_nxt += written;
 
-		sock->snd_nxt += copy_size;
-		data += copy_size;
-		size -= copy_size;
-		sock->buf_tail = (sock->buf_tail + 1) % TCP_BUF_PER_SOCK;
-	}
+	tcp_output(sock);
 
-	return OK;
+	return written;
 }
 
 /**
  * tcp_data_push
+ *
+ *   A user buffer must be present (see tcp_fault_in). When the window was
+ *   held at 0 (see tcp_rcv_window) and the read opens it to a segment or to
+ *   half the buffer, it is advertised at once rather than when the remote
+ *   host probes it (RFC 1122, 4.2.3.3).
  */
 
 size_t tcp_data_push(struct tcp_socket *sock, void *buf, size_t max_size)
 {
 	size_t ret = fifo_read(&sock->rx_fifo, buf, max_size, 0);
+	ui32_t old_wnd = sock->rcv_wnd;
 
 	sock->rcv_wnd += ret;
 
+	if(old_wnd < min(sock->rx_fifo.size / 4, TCP_MSS)
+	&& sock->rcv_wnd >= min(sock->rx_fifo.size / 2, TCP_MSS)
+	&& (sock->state == TCP_ESTABLISHED
+	 || sock->state == TCP_FIN_WAIT1
+	 || sock->state == TCP_FIN_WAIT2))
+	{
+		tcp_send_ack(sock);
+	}
+
 	return ret;	
 }
@@ -3,7 +3,10 @@
 
 #include <config.h>
 #include <fs/fifo.h>
+#include <kernel/lock.h>
+#include <kernel/timer.h>
 #include <kernel/types.h>
+#include <kernel/wait.h>
 
 /** TCP header. **/
 
@@ -19,47 +22,43 @@ struct tcp_header
 	ui16_t wnd;
 	ui16_t checksum;
 	ui16_t urg_ptr;
-	ui32_t opt_padding;
 } __attribute__((packed));
 
-/** Pseudo TCP header. **/
+/** TCP options (kinds, then lengths of the options sent, padded with NOPs).
+    **/
 
-struct tcp_pseudo_header
-{
-	ui32_t source_ip;
-	ui32_t dest_ip;
-	ui8_t mbz;
-	ui8_t type;
-	ui16_t size;
-} __attribute__((packed));
+#define TCP_OPT_END	0
+#define TCP_OPT_NOP	1
+#define TCP_OPT_MSS	2
+#define TCP_OPT_WSCALE	3
+#define TCP_OPT_TS	8
+
+#define TCP_OPT_MAX_LEN	40
+#define TCP_OPT_TS_LEN	12
+
+/** Room left in front of a segment sent for the IP and Ethernet headers. **/
+
+#define TCP_HEADROOM	(14 + 20)
 
-/** TCP connection request (for passive opening). **/
+/** Options of a segment. Those not found take their default value. **/
 
-struct tcp_request
+struct tcp_options
 {
-	ui32_t source_ip;
-	ui32_t dest_ip;
-	ui32_t source_port;
-	ui32_t dest_port;
-	ui32_t irs;
+	ui16_t mss;
+	bool_t wscale_ok;
+	ui8_t wscale;
+	bool_t ts_ok;
+	ui32_t ts_val;
+	ui32_t ts_ecr;
 };
 
-/** TCP buffer. **/
+/** Out of order data: bytes seq_num to end - 1 are in the receive FIFO, past
+    a hole, and not published yet. **/
 
-typedef enum {
-	TCP_FREE = 1, // DEBUG
-	TCP_WAITING_SEND = 2,
-	TCP_WAITING_ACK = 3
-} buf_state_t;
-
-struct tcp_buffer
+struct tcp_ooo
 {
-	buf_state_t state;
-	ui32_t state_change_date;
 	ui32_t seq_num;
-	size_t size;
-	count_t try_cnt;
-	ui8_t data[TCP_BUF_SIZE + 56]; // 56: pseudo-header + TCP + IP + Eth
+	ui32_t end;
 };
 
 /** TCP socket. NOTE: the order matters. Don't change it. **/
@@ -82,12 +81,12 @@ struct tcp_socket
 {
 	bool_t used;
 	bool_t reuse_addr;
+	bool_t nodelay; // no Nagle algorithm (TCP_NODELAY)
 
 	/** State/timeouts. **/
 
 	sock_state_t state;
-	clock_t timeout_set_tics;
-	clock_t timeout_tics;
+	struct timer timer;
 	count_t try_cnt;
 
 	/** Connection info. **/
@@ -108,7 +107,8 @@ struct tcp_socket
 	ui32_t iss;
 	ui32_t fss;
 	ui32_t snd_una;
-	ui32_t snd_nxt;
+	ui32_t snd_nxt; // end of the data queued
+	ui32_t snd_out; // next sequence number to send
 	ui32_t snd_wl1;
 	ui32_t snd_wl2;
 	ui32_t snd_wnd;
@@ -116,23 +116,139 @@ struct tcp_socket
 	ui32_t rcv_nxt;
 	ui32_t rcv_wnd;
 
+	/** Options. Until the SYN of the remote host arrives, wscale_ok and
+	    ts_ok tell whether to offer window scaling and timestamps; then,
+	    whether both hosts use them. mss is the largest amount of data sent
+	    in a segment, options excluded. **/
+
+	ui32_t mss;
+	bool_t wscale_ok;
+	ui8_t snd_wscale; // shift of the windows received
+	ui8_t rcv_wscale; // shift of the windows sent
+	bool_t ts_ok;
+	ui32_t ts_recent; // timestamp to echo
+
 	/** Stats. **/
 
-	clock_t rtt;
-	clock_t vrtt;
-	clock_t buffer_timeout;
+	clock_t srtt; // smoothed round-trip time, scaled by 8 (0: no sample)
+	clock_t rttvar; // its variation, scaled by 4
+	bool_t rtt_timing; // a segment is timed, acknowledged by rtt_seq
+	ui32_t rtt_seq;
+	clock_t rtt_date;
+
+	/** Retransmission. The retransmission timer runs while data is in
+	    flight. On a timeout, sending starts again from snd_una. **/
+
+	struct timer rto_timer;
+	clock_t rto; // retransmission timeout (doubled on timeout)
+	count_t rto_cnt; // timeouts in a row
+	bool_t rexmit; // retransmit the first unacknowledged segment
+
+	/** Partial sum of the rexmit_sum_size bytes at rexmit_sum_seq, the last
+	    segment sent from snd_una (see tcp_copy_out). **/
 
-	/** Buffers. **/
+	ui32_t rexmit_sum;
+	ui32_t rexmit_sum_seq;
+	size_t rexmit_sum_size;
+
+	/** Congestion control (RFC 5681), in bytes. Fast recovery lasts until
+	    recover, the highest sequence number sent when it began, is
+	    acknowledged. **/
+
+	ui32_t snd_max; // highest sequence number sent
+	ui32_t cwnd;
+	ui32_t ssthresh;
+	count_t dup_acks;
+	bool_t recovery;
+	ui32_t recover;
+
+	/** Buffers. The send FIFO holds the bytes from snd_una to snd_nxt,
+	    split into segments when they are sent. The rings come from the page
+	    heap when the socket connects, and go back when it is released. **/
 
 	struct fifo rx_fifo;
-	struct tcp_buffer buf_tab[TCP_BUF_PER_SOCK];
-	off_t buf_head, buf_tail;
-	count_t free_buf;
-	struct tcp_request req_tab[TCP_REQ_PER_SOCK];
-	off_t req_head, req_tail;
-	count_t free_req;
+	struct tcp_ooo ooo_tab[TCP_OOO_PER_SOCK]; // sorted, disjoint
+	count_t ooo_cnt;
+	struct fifo tx_fifo;
+
+	/** Sockets that ran out of transmit descriptors wait in a list until
+	    the network card frees some. **/
+
+	bool_t tx_waiting;
+	struct tcp_socket *tx_wait_next;
+
+	/** Passive opening. A listening socket creates a socket for each SYN
+	    it takes: the new socket waits in the SYN queue of the listening
+	    one during the handshake, then in its accept queue. Together, they
+	    hold at most backlog sockets. **/
+
+	struct tcp_socket *parent; // listening socket (0 once accepted)
+	struct tcp_socket *queue_next;
+	bool_t accept_ready; // in the accept queue
+	clock_t syn_date; // arrival of the SYN
+	struct tcp_socket *syn_queue;
+	struct tcp_socket *accept_head, *accept_tail;
+	count_t syn_cnt, accept_cnt, backlog;
+
+	/** Processes waiting for the socket (data, room, connections or state
+	    changes). **/
+
+	struct wait_queue wq;
+
+	/** Hash tables. A socket is in a chain of the connection (or listening
+	    socket) table from the time it connects (or listens) to its release,
+	    and in a chain of the port table while it holds its local port.
+	    hash_bucket is the head of its chain (0 if none). A free socket is
+	    in the free list, through hash_next. **/
+
+	si32_t id;
+	struct tcp_socket **hash_bucket;
+	struct tcp_socket *hash_next;
+	bool_t port_bound;
+	struct tcp_socket *port_next;
 };
 
+/** TIME_WAIT record: what is left of a connection closed by its user while
+    the segments of the remote host die out (enough to acknowledge them). The
+    records are in a chain of their hash table and in a list sorted by
+    expiry date. **/
+
+struct tcp_timewait
+{
+	ui32_t source_ip;
+	ui32_t dest_ip;
+	ui16_t source_port;
+	ui16_t dest_port;
+	ui32_t snd_nxt;
+	ui32_t rcv_nxt;
+	bool_t ts_ok;
+	ui32_t ts_recent;
+	clock_t expires;
+	struct tcp_timewait *hash_next;
+	struct tcp_timewait *prev, *next;
+};
+
+#define TCP_TW_PER_PAGE		(4096 / sizeof(struct tcp_timewait))
+
+/** The socket table is made of pages of sockets, allocated when all the
+    sockets are used. **/
+
+#define TCP_SOCKS_PER_PAGE	(4096 / sizeof(struct tcp_socket))
+#define NR_TCP_SOCK_PAGES	((NR_TCP_SOCKS + TCP_SOCKS_PER_PAGE - 1) \
+                                 / TCP_SOCKS_PER_PAGE)
+
+#define tcp_sock_get(sock_id)	(&tcp_sock_page_tab[(sock_id) \
+                                                    / TCP_SOCKS_PER_PAGE] \
+                                                   [(sock_id) \
+                                                    % TCP_SOCKS_PER_PAGE])
+
+/** Chain of the connection table for a remote address and port and a local
+    port. **/
+
+#define tcp_conn_hashfn(ip, port, local_port) \
+	(((ip) ^ ((ip) >> 16) ^ (port) ^ ((local_port) << 5)) \
+	 % TCP_CONN_HASH_SIZE)
+
 /** Flags. **/
 
 #define TCP_FIN	0x01
@@ -144,20 +260,86 @@ struct tcp_socket
 #define TCP_ECN	0x40
 #define TCP_CWR	0x80
 
-/** Socket options. **/
+/** Socket options (levels, then options). **/
+
+#define SOL_SOCKET	1
+#define IPPROTO_TCP	6
 
 #define SO_REUSEADDR	2
+#define SO_SNDBUF	7
+#define SO_RCVBUF	8
+#define TCP_NODELAY	1
+
+/** Latency histogram: slot i counts connections accepted 2^(i-1) to 2^i - 1
+    tics after their SYN arrived. **/
+
+#define TCP_HIST_SIZE	8
+
+/** Global variables (pages of the socket table, number of sockets they
+    hold, use and keep free, free sockets and sockets to reap, sum of the
+    backlogs of the listening sockets, TIME_WAIT records, sockets waiting
+    for transmit descriptors, hash tables of the connections, listening
+    sockets and local ports, bitmap of the ports held, secret and MSS table
+    of the SYN cookies, stats, and the lock of the network stack: the
+    network and clock interrupts take it, the socket system calls hold it
+    with interrupts disabled). **/
 
-/** Global variables. **/
 #ifdef _TCP_C_
-struct tcp_socket tcp_sock_tab[NR_TCP_SOCKS] = {
-	[0 ... (NR_TCP_SOCKS - 1)] = {
-		.used = 0,
-		.state = TCP_CLOSED
-	}
-};
+struct tcp_socket *tcp_sock_page_tab[NR_TCP_SOCK_PAGES] = { 0 };
+count_t nr_tcp_socks = 0;
+count_t nr_tcp_used_socks = 0;
+count_t nr_tcp_free_socks = 0;
+struct tcp_socket *tcp_free_socks = 0;
+struct tcp_socket *tcp_reap_socks = 0;
+count_t nr_tcp_backlogs = 0;
+count_t nr_tcp_tw = 0;
+count_t nr_tcp_free_tw = 0;
+struct tcp_timewait *tcp_free_tw = 0;
+struct tcp_timewait *tcp_tw_hash[TCP_CONN_HASH_SIZE] = { 0 };
+struct tcp_timewait *tcp_tw_head = 0, *tcp_tw_tail = 0;
+struct timer tcp_tw_timer = { 0 };
+struct tcp_socket *tcp_tx_wait_head = 0, *tcp_tx_wait_tail = 0;
+struct tcp_socket *tcp_conn_hash[TCP_CONN_HASH_SIZE] = { 0 };
+struct tcp_socket *tcp_listen_hash[TCP_LISTEN_HASH_SIZE] = { 0 };
+struct tcp_socket *tcp_port_hash[TCP_PORT_HASH_SIZE] = { 0 };
+ui32_t tcp_port_bmp[65536 / 32] = { 0 };
+ui32_t tcp_cookie_secret = 0;
+ui16_t tcp_cookie_mss[4] = { 536, 1300, 1440, 1460 };
+count_t tcp_nr_listen_overflows = 0;
+count_t tcp_nr_listen_drops = 0;
+count_t tcp_nr_cookies_sent = 0;
+count_t tcp_nr_cookies_ok = 0;
+count_t tcp_nr_accepted = 0;
+count_t tcp_accept_latency[TCP_HIST_SIZE] = { 0 };
+struct spinlock tcp_lock = SPINLOCK_INIT;
 #else
-extern struct tcp_socket tcp_sock_tab[];
+extern struct tcp_socket *tcp_sock_page_tab[];
+extern count_t nr_tcp_socks;
+extern count_t nr_tcp_used_socks;
+extern count_t nr_tcp_free_socks;
+extern struct tcp_socket *tcp_free_socks;
+extern struct tcp_socket *tcp_reap_socks;
+extern count_t nr_tcp_backlogs;
+extern count_t nr_tcp_tw;
+extern count_t nr_tcp_free_tw;
+extern struct tcp_timewait *tcp_free_tw;
+extern struct tcp_timewait *tcp_tw_hash[];
+extern struct tcp_timewait *tcp_tw_head, *tcp_tw_tail;
+extern struct timer tcp_tw_timer;
+extern struct tcp_socket *tcp_tx_wait_head, *tcp_tx_wait_tail;
+extern struct tcp_socket *tcp_conn_hash[];
+extern struct tcp_socket *tcp_listen_hash[];
+extern struct tcp_socket *tcp_port_hash[];
+extern ui32_t tcp_port_bmp[];
+extern ui32_t tcp_cookie_secret;
+extern ui16_t tcp_cookie_mss[];
+extern count_t tcp_nr_listen_overflows;
+extern count_t tcp_nr_listen_drops;
+extern count_t tcp_nr_cookies_sent;
+extern count_t tcp_nr_cookies_ok;
+extern count_t tcp_nr_accepted;
+extern count_t tcp_accept_latency[TCP_HIST_SIZE];
+extern struct spinlock tcp_lock;
 #endif
 
 /** Functions. **/
@@ -168,10 +350,62 @@ void tcp_socket_init(struct tcp_socket *sock);
 /****************************************************************/
 void tcp_buffers_reset(struct tcp_socket *sock);
 /****************************************************************/
+ret_t tcp_fifo_resize(struct fifo *fifo,
+                      size_t size,
+                      size_t min_size,
+                      size_t max_size);
+/****************************************************************/
+ret_t tcp_sndbuf_resize(struct tcp_socket *sock, size_t size);
+/****************************************************************/
+ret_t tcp_rcvbuf_resize(struct tcp_socket *sock, size_t size);
+/****************************************************************/
+ret_t tcp_buffers_attach(struct tcp_socket *sock);
+/****************************************************************/
+void tcp_buffers_detach(struct tcp_socket *sock);
+/****************************************************************/
+ret_t tcp_socket_grow();
+/****************************************************************/
+void tcp_socket_reserve();
+/****************************************************************/
+struct tcp_socket *tcp_socket_take();
+/****************************************************************/
 si32_t tcp_socket_alloc();
 /****************************************************************/
 void tcp_socket_free(si32_t sock_id);
 /****************************************************************/
+void tcp_socket_release(struct tcp_socket *sock);
+/****************************************************************/
+void tcp_reap();
+/****************************************************************/
+void tcp_timewait_reserve();
+/****************************************************************/
+void tcp_timewait_enter(struct tcp_socket *sock);
+/****************************************************************/
+void tcp_timewait_queue(struct tcp_timewait *tw);
+/****************************************************************/
+void tcp_timewait_unqueue(struct tcp_timewait *tw);
+/****************************************************************/
+void tcp_timewait_free(struct tcp_timewait *tw);
+/****************************************************************/
+struct tcp_timewait *tcp_timewait_find(ui32_t source_ip,
+                                       ui16_t source_port,
+                                       ui16_t dest_port);
+/****************************************************************/
+bool_t tcp_timewait_receive(struct tcp_timewait *tw,
+                            struct tcp_header *packet,
+                            ui32_t seq_num,
+                            size_t data_size);
+/****************************************************************/
+void tcp_timewait_timeout(ui32_t data);
+/****************************************************************/
+void tcp_hash(struct tcp_socket *sock);
+/****************************************************************/
+void tcp_unhash(struct tcp_socket *sock);
+/****************************************************************/
+void tcp_port_bind(struct tcp_socket *sock, ui16_t port);
+/****************************************************************/
+void tcp_port_unbind(struct tcp_socket *sock);
+/****************************************************************/
 bool_t tcp_port_is_used(ui16_t port);
 /****************************************************************/
 ui16_t tcp_port_alloc();
@@ -184,37 +418,98 @@ void tcp_set_socket_state(struct tcp_socket *sock,
                           sock_state_t state,
                           clock_t timeout);
 /****************************************************************/
-void tcp_set_buffer_state(struct tcp_socket *sock,
-                          struct tcp_buffer *buf,
-                          buf_state_t state);
+struct tcp_socket *tcp_child_create(struct tcp_socket *parent,
+                                    ui32_t source_ip,
+                                    ui32_t dest_ip,
+                                    ui16_t source_port,
+                                    ui32_t irs,
+                                    struct tcp_options *opts);
+/****************************************************************/
+void tcp_child_ready(struct tcp_socket *sock);
+/****************************************************************/
+struct tcp_socket *tcp_child_pop(struct tcp_socket *parent);
+/****************************************************************/
+void tcp_child_unlink(struct tcp_socket *sock);
+/****************************************************************/
+void tcp_listen_close(struct tcp_socket *parent);
+/****************************************************************/
+void tcp_listen_syn(struct tcp_socket *parent,
+                    ui32_t source_ip,
+                    ui32_t dest_ip,
+                    ui16_t source_port,
+                    ui32_t seq_num,
+                    struct tcp_options *opts);
+/****************************************************************/
+void tcp_listen_ack(struct tcp_socket *parent,
+                    struct tcp_header *packet,
+                    ui32_t source_ip,
+                    ui32_t dest_ip);
+/****************************************************************/
+ui32_t tcp_cookie_hash(ui32_t source_ip,
+                       ui32_t dest_ip,
+                       ui16_t source_port,
+                       ui16_t dest_port,
+                       ui32_t seq_num,
+                       ui32_t count);
 /****************************************************************/
-ret_t tcp_request_push(struct tcp_socket *sock,
-                       ui32_t source_ip,
+ui32_t tcp_cookie_make(ui32_t source_ip,
                        ui32_t dest_ip,
                        ui16_t source_port,
                        ui16_t dest_port,
-                       ui32_t irs);
+                       ui32_t seq_num,
+                       ui16_t mss);
 /****************************************************************/
-struct tcp_request *tcp_request_pop(struct tcp_socket *sock);
+ui16_t tcp_cookie_check(ui32_t source_ip,
+                        ui32_t dest_ip,
+                        ui16_t source_port,
+                        ui16_t dest_port,
+                        ui32_t seq_num,
+                        ui32_t cookie);
 /****************************************************************/
 void tcp_receive(struct tcp_header *packet,
                  size_t size,
                  ui32_t source_ip,
                  ui32_t dest_ip);
 /****************************************************************/
-void tcp_callback();
+void tcp_parse_options(struct tcp_header *packet, struct tcp_options *opts);
+/****************************************************************/
+void tcp_apply_options(struct tcp_socket *sock, struct tcp_options *opts);
+/****************************************************************/
+size_t tcp_write_options(struct tcp_socket *sock, ui8_t *opt, ui32_t flags);
+/****************************************************************/
+ui16_t tcp_rcv_window(struct tcp_socket *sock, ui32_t flags);
+/****************************************************************/
+void tcp_rtt_sample(struct tcp_socket *sock, clock_t rtt);
+/****************************************************************/
+void tcp_rto_update(struct tcp_socket *sock);
+/****************************************************************/
+ui32_t tcp_send_window(struct tcp_socket *sock);
+/****************************************************************/
+void tcp_congestion(struct tcp_socket *sock);
 /****************************************************************/
-bool_t tcp_socket_timeout(struct tcp_socket *sock);
+void tcp_output(struct tcp_socket *sock);
 /****************************************************************/
-bool_t tcp_buffer_timeout(struct tcp_socket *sock, struct tcp_buffer *buf);
+ret_t tcp_output_segment(struct tcp_socket *sock, ui32_t seq_num, size_t size);
+/****************************************************************/
+void tcp_tx_wait(struct tcp_socket *sock);
+/****************************************************************/
+void tcp_tx_unwait(struct tcp_socket *sock);
+/****************************************************************/
+void tcp_output_all();
+/****************************************************************/
+bool_t tcp_timed_state(sock_state_t state);
+/****************************************************************/
+void tcp_socket_timeout(ui32_t data);
+/****************************************************************/
+void tcp_rto_timeout(ui32_t data);
 /****************************************************************/
-// WARNING: enough space (12 bytes) must be reserved before address "packet" to
-// store TCP pseudo header.
 ui16_t tcp_checksum(struct tcp_header *packet,
                     size_t size,
                     ui32_t source_ip,
                     ui32_t dest_ip);
 /****************************************************************/
+ui32_t tcp_pseudo_sum(ui32_t source_ip, ui32_t dest_ip, size_t size);
+/****************************************************************/
 ret_t tcp_send(struct tcp_socket *sock,
                ui32_t seq_num,
                ui32_t ack_num,
@@ -222,8 +517,21 @@ ret_t tcp_send(struct tcp_socket *sock,
                size_t size,
                ui32_t flags);
 /****************************************************************/
+ui32_t tcp_copy_out(struct tcp_socket *sock,
+                    ui32_t seq_num,
+                    void *buf,
+                    size_t size);
+/****************************************************************/
 ret_t tcp_send_ack(struct tcp_socket *sock);
 /****************************************************************/
+ret_t tcp_send_reply(ui32_t source_ip,
+                     ui32_t dest_ip,
+                     ui16_t source_port,
+                     ui16_t dest_port,
+                     ui32_t seq_num,
+                     ui32_t ack_num,
+                     ui32_t flags);
+/****************************************************************/
 ret_t tcp_send_fin(struct tcp_socket *sock, bool_t again);
 /****************************************************************/
 void tcp_data_in(struct tcp_socket *sock,
@@ -231,9 +539,18 @@ void tcp_data_in(struct tcp_socket *sock,
                  void *data,
                  size_t size);
 /****************************************************************/
-ret_t tcp_data_ack(struct tcp_socket *sock, ui32_t ack_num);
+void tcp_ooo_insert(struct tcp_socket *sock, ui32_t seq_num, ui32_t end);
+/****************************************************************/
+ui32_t tcp_ooo_fill(struct tcp_socket *sock, ui32_t end);
+/****************************************************************/
+ret_t tcp_data_ack(struct tcp_socket *sock,
+                   ui32_t ack_num,
+                   bool_t dup,
+                   struct tcp_options *opts);
+/****************************************************************/
+bool_t tcp_fault_in(void *buf, size_t size, bool_t write);
 /****************************************************************/
-ret_t tcp_data_out(struct tcp_socket *sock, void *data, size_t size);
+ssize_t tcp_data_out(struct tcp_socket *sock, void *data, size_t size);
 /****************************************************************/
 size_t tcp_data_push(struct tcp_socket *sock, void *buf, size_t max_size);
 
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* Context switch benchmark.
+ *
+ * Two processes exchange a byte through a pair of pipes, which costs two
+ * context switches (and two address space changes) per round trip. After
+ * each round trip, the parent touches one byte in each page of a buffer:
+ * comparing with the same walk done without switching gives the cost of the
+ * TLB misses a switch causes. */
+
+#define PAGE_SIZE	4096
+
+static unsigned long long rdtsc(void)
+{
+	unsigned long long t;
+
+	asm volatile("rdtsc" : "=A"(t));
+
+	return t;
+}
+
+static unsigned long long touch(volatile char *buf, int pages)
+{
+	unsigned long long start;
+	int i;
+
+	start = rdtsc();
+
+	for(i = 0; i < pages; i++)
+	{
+		buf[i * PAGE_SIZE]++;
+	}
+
+	return rdtsc() - start;
+}
+
+int main(int argc, char **argv)
+{
+	int rounds = (argc > 1) ? atoi(argv[1]) : 10000;
+	int pages = (argc > 2) ? atoi(argv[2]) : 32;
+	int ping[2], pong[2];
+	unsigned long long start, total, warm = 0, cold = 0;
+	char *buf;
+	char c = 0;
+	pid_t pid;
+	int i;
+
+	if(rounds <= 0 || pages <= 0)
+	{
+		fprintf(stderr, "Usage: ctxbench [ROUNDS [PAGES]]\n");
+		exit(1);
+	}
+
+	buf = malloc(pages * PAGE_SIZE);
+
+	if(!buf || pipe(ping) || pipe(pong))
+	{
+		perror("ctxbench");
+		exit(1);
+	}
+
+	/* Walk the buffer once so that its pages are mapped, then measure
+	   a walk with a warm TLB. */
+
+	touch(buf, pages);
+
+	for(i = 0; i < rounds; i++)
+	{
+		warm += touch(buf, pages);
+	}
+
+	pid = fork();
+
+	if(pid < 0)
+	{
+		perror("fork");
+		exit(1);
+	}
+	else if(pid == 0)
+	{
+		while(read(ping[0], &c, 1) == 1)
+		{
+			write(pong[1], &c, 1);
+		}
+
+		exit(0);
+	}
+
+	/* The pages of the buffer are now copy-on-write: walk it once more
+	   so that the copies are made before measuring. */
+
+	touch(buf, pages);
+
+	start = rdtsc();
+
+	for(i = 0; i < rounds; i++)
+	{
+		write(ping[1], &c, 1);
+		read(pong[0], &c, 1);
+		cold += touch(buf, pages);
+	}
+
+	total = rdtsc() - start - cold;
+
+	close(ping[1]);
+	waitpid(pid, 0, 0);
+
+	printf("round trip (2 switches): %llu cycles\n", total / rounds);
+	printf("walk of %d pages: %llu cycles warm, %llu cycles after a switch\n",
+	       pages, warm / rounds, cold / rounds);
+	printf("cost per page after a switch: %lld cycles\n",
+	       (long long)(cold - warm) / ((long long)rounds * pages));
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,114 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* Pipe throughput benchmark.
+ *
+ * The parent writes a number of megabytes into a pipe, in chunks of a given
+ * size, and a child reads them back until the end of file. Small chunks
+ * measure the cost of a system call and of waking the other end up, large
+ * ones the cost of copying through the pipe buffer. The size of the pipe
+ * buffer may be given too. */
+
+#define MB		(1024 * 1024)
+
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ	1031
+#endif
+
+static unsigned long long rdtsc(void)
+{
+	unsigned long long t;
+
+	asm volatile("rdtsc" : "=A"(t));
+
+	return t;
+}
+
+int main(int argc, char **argv)
+{
+	int megs = (argc > 1) ? atoi(argv[1]) : 64;
+	int chunk = (argc > 2) ? atoi(argv[2]) : 4096;
+	int size = (argc > 3) ? atoi(argv[3]) : 0;
+	unsigned long long start, total, bytes, done = 0;
+	int fd[2];
+	char *buf;
+	pid_t pid;
+	ssize_t n;
+
+	if(megs <= 0 || chunk <= 0)
+	{
+		fprintf(stderr,
+		        "Usage: pipebench [MEGABYTES [CHUNK [PIPE_SIZE]]]\n");
+		exit(1);
+	}
+
+	buf = malloc(chunk);
+
+	if(!buf || pipe(fd))
+	{
+		perror("pipebench");
+		exit(1);
+	}
+
+	if(size > 0 && (size = fcntl(fd[1], F_SETPIPE_SZ, size)) < 0)
+	{
+		perror("fcntl");
+		exit(1);
+	}
+
+	pid = fork();
+
+	if(pid < 0)
+	{
+		perror("fork");
+		exit(1);
+	}
+	else if(pid == 0)
+	{
+		close(fd[1]);
+
+		while(read(fd[0], buf, chunk) > 0);
+
+		exit(0);
+	}
+
+	close(fd[0]);
+
+	bytes = (unsigned long long)megs * MB;
+	start = rdtsc();
+
+	while(done < bytes)
+	{
+		n = write(fd[1], buf, (bytes - done < chunk) ? bytes - done : chunk);
+
+		if(n <= 0)
+		{
+			perror("write");
+			exit(1);
+		}
+
+		done += n;
+	}
+
+	close(fd[1]);
+	waitpid(pid, 0, 0);
+
+	total = rdtsc() - start;
+
+	printf("%d MB in chunks of %d bytes", megs, chunk);
+
+	if(size > 0)
+	{
+		printf(" through %d bytes", size);
+	}
+
+	printf(": %llu cycles\n", total);
+	printf("per byte: %llu.%02llu cycles\n", total / bytes,
+	       (total % bytes) * 100 / bytes);
+	printf("per write: %llu cycles\n", total / ((bytes + chunk - 1) / chunk));
+
+	return EXIT_SUCCESS;
+}